@@ -96,6 +96,9 @@ class KenLM(LanguageModel):
 class InterpolatedLM(LanguageModel):
     injector_section = 'lm'
     injectable_fields = {
+        'slm_profile': ('build profile of the static LM: "serving" builds a quantized trie limited to the '
+                        'vocabulary of the parallel corpora, smaller but slower than the default probing model',
+                        (basestring, ['default', 'serving']), 'default'),
     }
 
     def __init__(self, model):
@@ -105,6 +108,7 @@ class InterpolatedLM(LanguageModel):
         self._create_slm_bin = os.path.join(cli.BIN_DIR, 'create_slm')
 
         self.prune = True
+        self._slm_profile = None  # Injected
 
     def train(self, corpora, lang, working_dir='.', log=None):
         if log is None:
@@ -135,6 +139,15 @@ class InterpolatedLM(LanguageModel):
         if self._order > 2 and self.prune:
             command += ['--prune', '0', '0', '1']
 
+        if self._slm_profile == 'serving':
+            command += ['--profile', 'serving']
+
+            # The decoder can only produce the target words of the parallel corpora
+            if len(bicorpora) > 0:
+                vocabulary_file = os.path.join(static_lm_wdir, 'vocabulary')
+                self._write_vocabulary([corpus.get_file(lang) for corpus in bicorpora], vocabulary_file)
+                command += ['--limit_vocab_file', vocabulary_file]
+
         with open(merged_corpus) as stdin:
             shell.execute(command, stdin=stdin, stdout=log, stderr=log)
 
@@ -152,5 +165,19 @@ class InterpolatedLM(LanguageModel):
         command = [self._create_alm_bin, '-m', adaptive_lm_model, '-i', alm_train_folder, '-b', '50000000']
         shell.execute(command, stdout=log, stderr=log)
 
+    @staticmethod
+    def _write_vocabulary(files, output):
+        vocabulary = set()
+
+        for path in files:
+            with open(path) as stream:
+                for line in stream:
+                    vocabulary.update(line.split())
+
+        with open(output, 'w') as stream:
+            for word in vocabulary:
+                stream.write(word)
+                stream.write('\n')
+
     def get_iniline(self, base_path):
         return 'path={model}'.format(model=self.get_relpath(base_path, self._model))
@@ -0,0 +1,31 @@
+//
+// Writes the binary copy of corpus files, read by the training tools in place of the text.
+//
+
+#include <iostream>
+#include <stdexcept>
+#include <mmt/corpus/SentenceReader.h>
+
+using namespace std;
+using namespace mmt::corpus;
+
+int main(int argc, const char *argv[]) {
+    if (argc < 2 || string(argv[1]) == "-h" || string(argv[1]) == "--help") {
+        cerr << "Usage: " << argv[0] << " FILE..." << endl << endl;
+        cerr << "Writes FILE.bin next to every corpus FILE (a sentence of word ids per line): "
+                "fa_build, create_alm and sapt_build read it in place of the text, as long as "
+                "the text is not modified." << endl;
+        return 1;
+    }
+
+    for (int i = 1; i < argc; ++i) {
+        try {
+            SentenceReader::CreateBinary(argv[i]);
+        } catch (exception &e) {
+            cerr << "ERROR: " << e.what() << endl;
+            return 2;
+        }
+    }
+
+    return 0;
+}
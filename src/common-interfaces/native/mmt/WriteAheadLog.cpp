@@ -0,0 +1,295 @@
+//
+// Append-only, checksummed log of the updates received by an IncrementalModel.
+//
+
+#include "WriteAheadLog.h"
+#include <algorithm>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+using namespace std;
+using namespace mmt;
+
+namespace {
+
+    const char *kSegmentPrefix = "segment.";
+
+    // Every entry is: payload size (uint32), CRC32 of the payload (uint32), payload
+    const size_t kHeaderSize = 2 * sizeof(uint32_t);
+
+    // CRC-32 (IEEE 802.3), table driven
+    class CRC32 {
+    public:
+        CRC32() {
+            for (uint32_t i = 0; i < 256; ++i) {
+                uint32_t crc = i;
+                for (int k = 0; k < 8; ++k)
+                    crc = (crc & 1) ? (0xEDB88320U ^ (crc >> 1)) : (crc >> 1);
+                table[i] = crc;
+            }
+        }
+
+        uint32_t operator()(const char *data, size_t length) const {
+            uint32_t crc = 0xFFFFFFFFU;
+            for (size_t i = 0; i < length; ++i)
+                crc = table[(crc ^ (uint8_t) data[i]) & 0xFF] ^ (crc >> 8);
+            return crc ^ 0xFFFFFFFFU;
+        }
+
+    private:
+        uint32_t table[256];
+    };
+
+    const CRC32 crc32;
+
+    template<typename T>
+    inline void Write(vector<char> &buffer, const T &value) {
+        const char *bytes = reinterpret_cast<const char *>(&value);
+        buffer.insert(buffer.end(), bytes, bytes + sizeof(T));
+    }
+
+    template<typename T>
+    inline void WriteArray(vector<char> &buffer, const vector<T> &values) {
+        Write(buffer, (uint32_t) values.size());
+
+        const char *bytes = reinterpret_cast<const char *>(values.data());
+        buffer.insert(buffer.end(), bytes, bytes + values.size() * sizeof(T));
+    }
+
+    class Reader {
+    public:
+        Reader(const char *data, size_t length) : cursor(data), end(data + length) {}
+
+        template<typename T>
+        bool Read(T *outValue) {
+            if ((size_t) (end - cursor) < sizeof(T))
+                return false;
+
+            memcpy(outValue, cursor, sizeof(T));
+            cursor += sizeof(T);
+            return true;
+        }
+
+        template<typename T>
+        bool ReadArray(vector<T> *outValues) {
+            uint32_t size;
+            if (!Read(&size) || (size_t) (end - cursor) / sizeof(T) < size)
+                return false;
+
+            outValues->resize(size);
+            memcpy((void *) outValues->data(), cursor, size * sizeof(T));
+            cursor += size * sizeof(T);
+            return true;
+        }
+
+        bool Skip(size_t length, const char **outData) {
+            if ((size_t) (end - cursor) < length)
+                return false;
+
+            *outData = cursor;
+            cursor += length;
+            return true;
+        }
+
+        bool AtEnd() const {
+            return cursor == end;
+        }
+
+    private:
+        const char *cursor;
+        const char *end;
+    };
+
+    string ErrorMessage(const string &message, const string &path) {
+        return message + " " + path + ": " + strerror(errno);
+    }
+
+}
+
+WriteAheadLog::WriteAheadLog(const string &path, bool sync) throw(wal_exception) : path(path), sync(sync), fd(-1) {
+    if (mkdir(path.c_str(), 0755) != 0 && errno != EEXIST)
+        throw wal_exception(ErrorMessage("Unable to create log directory", path));
+
+    vector<segment_t> segments = ListSegments();
+    OpenSegment(segments.empty() ? 0 : segments.back() + 1);
+}
+
+WriteAheadLog::~WriteAheadLog() {
+    if (fd >= 0)
+        close(fd);
+}
+
+void WriteAheadLog::Append(const updateid_t &id, const domain_t domain,
+                           const vector<wid_t> &source, const vector<wid_t> &target,
+                           const alignment_t &alignment) throw(wal_exception) {
+    lock_guard<mutex> lock(access);
+
+    buffer.resize(kHeaderSize);
+
+    Write(buffer, id.stream_id);
+    Write(buffer, id.sentence_id);
+    Write(buffer, domain);
+    WriteArray(buffer, source);
+    WriteArray(buffer, target);
+    WriteArray(buffer, alignment);
+
+    uint32_t size = (uint32_t) (buffer.size() - kHeaderSize);
+    uint32_t checksum = crc32(buffer.data() + kHeaderSize, size);
+    memcpy(buffer.data(), &size, sizeof(uint32_t));
+    memcpy(buffer.data() + sizeof(uint32_t), &checksum, sizeof(uint32_t));
+
+    // A single write, so that a crash can only truncate the last entry
+    const char *data = buffer.data();
+    size_t remaining = buffer.size();
+
+    while (remaining > 0) {
+        ssize_t written = write(fd, data, remaining);
+
+        if (written < 0) {
+            if (errno == EINTR)
+                continue;
+            throw wal_exception(ErrorMessage("Unable to write log segment", GetSegmentPath(currentSegment)));
+        }
+
+        data += written;
+        remaining -= written;
+    }
+
+    if (sync && fdatasync(fd) != 0)
+        throw wal_exception(ErrorMessage("Unable to sync log segment", GetSegmentPath(currentSegment)));
+}
+
+WriteAheadLog::segment_t WriteAheadLog::Rotate() throw(wal_exception) {
+    lock_guard<mutex> lock(access);
+
+    segment_t closed = currentSegment;
+    OpenSegment(closed + 1);
+
+    return closed;
+}
+
+void WriteAheadLog::Release(segment_t segment) {
+    vector<segment_t> segments = ListSegments();
+
+    lock_guard<mutex> lock(access);
+
+    for (auto it = segments.begin(); it != segments.end(); ++it) {
+        if (*it <= segment && *it != currentSegment)
+            unlink(GetSegmentPath(*it).c_str());
+    }
+}
+
+size_t WriteAheadLog::Replay(const vector<seqid_t> &streams, const replay_callback_t &callback) const {
+    vector<segment_t> segments = ListSegments();
+
+    segment_t current;
+    {
+        lock_guard<mutex> lock(access);
+        current = currentSegment;
+    }
+
+    vector<seqid_t> latest = streams;
+    size_t count = 0;
+
+    vector<wid_t> source;
+    vector<wid_t> target;
+    alignment_t alignment;
+
+    for (auto segment = segments.begin(); segment != segments.end(); ++segment) {
+        if (*segment >= current)
+            break;
+
+        ifstream input(GetSegmentPath(*segment).c_str(), ios::in | ios::binary);
+        vector<char> data((istreambuf_iterator<char>(input)), istreambuf_iterator<char>());
+
+        Reader reader(data.data(), data.size());
+
+        while (!reader.AtEnd()) {
+            // A truncated or corrupted entry can only be the last one written before a crash
+            uint32_t size, checksum;
+            const char *payload;
+            if (!reader.Read(&size) || !reader.Read(&checksum) || !reader.Skip(size, &payload))
+                break;
+            if (crc32(payload, size) != checksum)
+                break;
+
+            Reader entry(payload, size);
+
+            updateid_t id;
+            domain_t domain;
+            if (!entry.Read(&id.stream_id) || !entry.Read(&id.sentence_id) || !entry.Read(&domain) ||
+                !entry.ReadArray(&source) || !entry.ReadArray(&target) || !entry.ReadArray(&alignment) ||
+                id.stream_id < 0)
+                break;
+
+            if (latest.size() <= (size_t) id.stream_id)
+                latest.resize(id.stream_id + 1, -1);
+
+            if (latest[id.stream_id] >= id.sentence_id)
+                continue;
+
+            latest[id.stream_id] = id.sentence_id;
+
+            callback(id, domain, source, target, alignment);
+            count++;
+        }
+    }
+
+    return count;
+}
+
+vector<WriteAheadLog::segment_t> WriteAheadLog::ListSegments() const {
+    vector<segment_t> segments;
+
+    DIR *dir = opendir(path.c_str());
+    if (dir == NULL)
+        return segments;
+
+    size_t prefixLength = strlen(kSegmentPrefix);
+
+    struct dirent *entry;
+    while ((entry = readdir(dir)) != NULL) {
+        const char *name = entry->d_name;
+
+        if (strncmp(name, kSegmentPrefix, prefixLength) == 0) {
+            char *end;
+            unsigned long long segment = strtoull(name + prefixLength, &end, 10);
+
+            if (end != name + prefixLength && *end == '\0')
+                segments.push_back((segment_t) segment);
+        }
+    }
+
+    closedir(dir);
+
+    sort(segments.begin(), segments.end());
+    return segments;
+}
+
+string WriteAheadLog::GetSegmentPath(segment_t segment) const {
+    return path + "/" + kSegmentPrefix + to_string(segment);
+}
+
+void WriteAheadLog::OpenSegment(segment_t segment) throw(wal_exception) {
+    string segmentPath = GetSegmentPath(segment);
+
+    int segmentFd = open(segmentPath.c_str(), O_WRONLY | O_CREAT | O_APPEND, 0644);
+    if (segmentFd < 0)
+        throw wal_exception(ErrorMessage("Unable to open log segment", segmentPath));
+
+    if (fd >= 0) {
+        if (sync)
+            fdatasync(fd);
+        close(fd);
+    }
+
+    fd = segmentFd;
+    currentSegment = segment;
+}
@@ -0,0 +1,111 @@
+//
+// Append-only, checksummed log of the updates received by an IncrementalModel.
+//
+
+#ifndef MMT_COMMON_INTERFACES_WRITEAHEADLOG_H
+#define MMT_COMMON_INTERFACES_WRITEAHEADLOG_H
+
+#include <cstdint>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <vector>
+#include "IncrementalModel.h"
+
+namespace mmt {
+
+    class wal_exception : public std::exception {
+    public:
+        wal_exception(const std::string &msg) : message(msg) {};
+
+        virtual const char *what() const throw() override {
+            return message.c_str();
+        }
+
+    private:
+        std::string message;
+    };
+
+    /**
+     * A WriteAheadLog records every update before it is acknowledged, so that the updates still
+     * buffered in memory by a model can be recovered after a crash.
+     *
+     * The log is a directory of segments: new entries are always appended to the current segment,
+     * Rotate() closes it and starts a new one, and Release() deletes the closed segments once all
+     * their updates are persistent in the model. Every entry carries a CRC32 checksum: an entry
+     * truncated or corrupted by a crash ends the replay of its segment.
+     *
+     * Segments are written in the native byte order, they are not meant to be moved across machines.
+     * All the methods can be called by multiple threads.
+     */
+    class WriteAheadLog {
+    public:
+        typedef uint64_t segment_t;
+
+        typedef std::function<void(const updateid_t &id, const domain_t domain,
+                                   const std::vector<wid_t> &source, const std::vector<wid_t> &target,
+                                   const alignment_t &alignment)> replay_callback_t;
+
+        /**
+         * Opens the log in the directory "path", creating it if missing. The segments written by
+         * a previous instance are kept, they can be replayed until they are released.
+         *
+         * @param path the log directory.
+         * @param sync if true, every entry is flushed to the device before Append() returns; otherwise
+         *             entries survive a crash of the process, but not of the operating system.
+         */
+        WriteAheadLog(const std::string &path, bool sync = false) throw(wal_exception);
+
+        ~WriteAheadLog();
+
+        /**
+         * Appends an update to the current segment; when this method returns the update is logged.
+         */
+        void Append(const updateid_t &id, const domain_t domain,
+                    const std::vector<wid_t> &source, const std::vector<wid_t> &target,
+                    const alignment_t &alignment) throw(wal_exception);
+
+        /**
+         * Closes the current segment and starts a new one.
+         *
+         * @return the id of the closed segment, that contains all the updates appended so far.
+         */
+        segment_t Rotate() throw(wal_exception);
+
+        /**
+         * Deletes all the closed segments up to "segment" included: their updates must already be
+         * persistent in the model.
+         */
+        void Release(segment_t segment);
+
+        /**
+         * Calls "callback" for every update of the closed segments, in the order they have been
+         * appended. Updates with a sentence id not greater than the latest one of their stream are
+         * skipped, both if they are already in "streams" (the latest ids of the model, indexed by
+         * stream id, -1 if none) and if they appear more than once in the log.
+         *
+         * @return the number of updates passed to "callback".
+         */
+        size_t Replay(const std::vector<seqid_t> &streams, const replay_callback_t &callback) const;
+
+    private:
+        const std::string path;
+        const bool sync;
+
+        mutable std::mutex access;
+        segment_t currentSegment;
+        int fd;
+
+        std::vector<char> buffer;
+
+        std::vector<segment_t> ListSegments() const;
+
+        std::string GetSegmentPath(segment_t segment) const;
+
+        void OpenSegment(segment_t segment) throw(wal_exception);
+    };
+
+}
+
+#endif //MMT_COMMON_INTERFACES_WRITEAHEADLOG_H
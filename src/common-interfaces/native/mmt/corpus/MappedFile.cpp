@@ -0,0 +1,46 @@
+//
+// A read-only memory mapping of a whole file.
+//
+
+#include "MappedFile.h"
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+using namespace mmt::corpus;
+
+MappedFile::MappedFile(const string &path) : mapping(NULL), mapping_size(0) {
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0)
+        throw runtime_error("Unable to open " + path + ": " + strerror(errno));
+
+    struct stat info;
+    if (fstat(fd, &info) != 0) {
+        close(fd);
+        throw runtime_error("Unable to read " + path + ": " + strerror(errno));
+    }
+
+    // mmap() rejects an empty range
+    if (info.st_size == 0) {
+        close(fd);
+        return;
+    }
+
+    mapping_size = (size_t) info.st_size;
+    mapping = mmap(NULL, mapping_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+
+    if (mapping == MAP_FAILED)
+        throw runtime_error("Unable to map " + path + ": " + strerror(errno));
+
+    madvise(mapping, mapping_size, MADV_SEQUENTIAL);
+}
+
+MappedFile::~MappedFile() {
+    if (mapping)
+        munmap(mapping, mapping_size);
+}
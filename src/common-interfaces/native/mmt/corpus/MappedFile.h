@@ -0,0 +1,47 @@
+//
+// A read-only memory mapping of a whole file.
+//
+
+#ifndef MMT_COMMON_INTERFACES_MAPPEDFILE_H
+#define MMT_COMMON_INTERFACES_MAPPEDFILE_H
+
+#include <cstddef>
+#include <string>
+
+using namespace std;
+
+namespace mmt {
+    namespace corpus {
+
+        /**
+         * The file is mapped for a sequential scan: the kernel reads ahead and drops the pages
+         * already read, thus the file does not need to fit in memory. An empty file is valid and
+         * it has no mapping at all.
+         */
+        class MappedFile {
+        public:
+            MappedFile(const string &path);
+
+            ~MappedFile();
+
+            MappedFile(const MappedFile &) = delete;
+
+            MappedFile &operator=(const MappedFile &) = delete;
+
+            inline const char *data() const {
+                return (const char *) mapping;
+            }
+
+            inline size_t size() const {
+                return mapping_size;
+            }
+
+        private:
+            void *mapping;
+            size_t mapping_size;
+        };
+
+    }
+}
+
+#endif //MMT_COMMON_INTERFACES_MAPPEDFILE_H
@@ -0,0 +1,133 @@
+//
+// Sequential reader of the sentences of a corpus file, from the text or from its binary copy.
+//
+
+#include "SentenceReader.h"
+#include <cstdio>
+#include <fstream>
+#include <stdexcept>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+using namespace mmt;
+using namespace mmt::corpus;
+
+namespace {
+
+    const char *kBinaryExtension = ".bin";
+    const char kBinaryMagic[8] = {'M', 'M', 'T', 'S', 'E', 'N', 'T', '\0'};
+    const uint32_t kBinaryVersion = 1;
+    const uint32_t kByteOrderMark = 0x01020304;
+
+    struct binary_header_t {
+        char magic[8];
+        uint32_t version;
+        uint32_t byte_order;
+        uint32_t word_size;
+        uint32_t padding;
+        uint64_t sentences;
+        uint64_t data_size; // in 32 bit words
+        uint64_t text_size;
+        int64_t text_mtime;
+    };
+
+    static_assert(sizeof(wid_t) == sizeof(uint32_t), "The binary corpus stores words as 32 bit integers");
+
+}
+
+bool SentenceReader::HasBinary(const string &path) {
+    struct stat text;
+    if (stat(path.c_str(), &text) != 0)
+        return false;
+
+    int fd = open(GetBinaryPath(path).c_str(), O_RDONLY);
+    if (fd < 0)
+        return false;
+
+    struct stat info;
+    binary_header_t header;
+
+    bool valid = fstat(fd, &info) == 0 &&
+                 pread(fd, &header, sizeof(header), 0) == (ssize_t) sizeof(header) &&
+                 memcmp(header.magic, kBinaryMagic, sizeof(kBinaryMagic)) == 0 &&
+                 header.version == kBinaryVersion &&
+                 header.byte_order == kByteOrderMark &&
+                 header.word_size == sizeof(wid_t) &&
+                 sizeof(header) + header.data_size * sizeof(uint32_t) == (uint64_t) info.st_size &&
+                 header.text_size == (uint64_t) text.st_size &&
+                 header.text_mtime == (int64_t) text.st_mtime;
+
+    close(fd);
+    return valid;
+}
+
+string SentenceReader::GetBinaryPath(const string &path) {
+    return path + kBinaryExtension;
+}
+
+bool SentenceReader::IsBinaryPath(const string &path) {
+    size_t length = strlen(kBinaryExtension);
+    return path.size() > length && path.compare(path.size() - length, length, kBinaryExtension) == 0;
+}
+
+SentenceReader::SentenceReader(const string &path) : SentenceReader(path, HasBinary(path)) {
+}
+
+SentenceReader::SentenceReader(const string &path, bool binary)
+        : binary(binary), file(binary ? GetBinaryPath(path) : path),
+          lines(binary ? NULL : file.data(), binary ? 0 : file.size()),
+          position(NULL), end(NULL) {
+    if (binary) {
+        position = file.data() + sizeof(binary_header_t);
+        end = file.data() + file.size();
+    }
+}
+
+void SentenceReader::CreateBinary(const string &path) {
+    struct stat text;
+    if (stat(path.c_str(), &text) != 0)
+        throw runtime_error("Unable to read " + path);
+
+    binary_header_t header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, kBinaryMagic, sizeof(kBinaryMagic));
+    header.version = kBinaryVersion;
+    header.byte_order = kByteOrderMark;
+    header.word_size = sizeof(wid_t);
+    header.text_size = (uint64_t) text.st_size;
+    header.text_mtime = (int64_t) text.st_mtime;
+
+    // the copy is written aside and renamed at the end: a reader never finds it incomplete
+    string binaryPath = GetBinaryPath(path);
+    string tempPath = binaryPath + ".tmp";
+
+    ofstream out(tempPath, ios::binary | ios::out | ios::trunc);
+    if (!out.is_open())
+        throw runtime_error("Unable to create binary corpus " + tempPath);
+
+    // the header is written again with the final counts at the end
+    out.write((const char *) &header, sizeof(header));
+
+    SentenceReader reader(path, false);
+    vector<wid_t> sentence;
+
+    while (reader.Read(sentence)) {
+        uint32_t length = (uint32_t) sentence.size();
+
+        out.write((const char *) &length, sizeof(length));
+        out.write((const char *) sentence.data(), sentence.size() * sizeof(wid_t));
+
+        header.sentences++;
+        header.data_size += 1 + sentence.size();
+    }
+
+    out.seekp(0);
+    out.write((const char *) &header, sizeof(header));
+    out.close();
+
+    if (!out || rename(tempPath.c_str(), binaryPath.c_str()) != 0) {
+        remove(tempPath.c_str());
+        throw runtime_error("Unable to write binary corpus " + binaryPath);
+    }
+}
@@ -0,0 +1,122 @@
+//
+// Sequential reader of the sentences of a corpus file, from the text or from its binary copy.
+//
+
+#ifndef MMT_COMMON_INTERFACES_SENTENCEREADER_H
+#define MMT_COMMON_INTERFACES_SENTENCEREADER_H
+
+#include <cstddef>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include <mmt/sentence.h>
+#include "MappedFile.h"
+#include "TextParser.h"
+
+using namespace std;
+
+namespace mmt {
+    namespace corpus {
+
+        // A sentence not decoded yet: a line of the text, or the words of the binary copy
+        struct sentence_record_t {
+            const char *begin;
+            const char *end;
+        };
+
+        /**
+         * The text file has a sentence per line, as space separated word ids. It is mapped and
+         * parsed in place, without copying the lines.
+         *
+         * The preprocessing can write once a binary copy of the file with CreateBinary(), at
+         * GetBinaryPath(path): the reader opens it in place of the text, so that the words are
+         * copied instead of parsed. The copy records the size and the modification time of the
+         * text it was written from, and it is ignored if the text has changed since.
+         *
+         * Next() and Decode() split the reading: the records are taken in order by a single
+         * thread, while Decode() can run concurrently.
+         */
+        class SentenceReader {
+        public:
+            SentenceReader(const string &path);
+
+            // Reads the binary copy of "path" if "binary" is true, the text otherwise
+            SentenceReader(const string &path, bool binary);
+
+            SentenceReader(const SentenceReader &) = delete;
+
+            SentenceReader &operator=(const SentenceReader &) = delete;
+
+            inline bool IsBinary() const {
+                return binary;
+            }
+
+            inline bool Next(sentence_record_t &outRecord) {
+                if (binary) {
+                    if (position == end)
+                        return false;
+
+                    uint32_t length;
+                    memcpy(&length, position, sizeof(uint32_t));
+
+                    outRecord.begin = position + sizeof(uint32_t);
+                    if (length > (size_t) (end - outRecord.begin) / sizeof(wid_t))
+                        throw runtime_error("Corrupted binary corpus");
+
+                    outRecord.end = outRecord.begin + length * sizeof(wid_t);
+                    position = outRecord.end;
+
+                    return true;
+                } else {
+                    return lines.Read(&outRecord.begin, &outRecord.end);
+                }
+            }
+
+            inline void Decode(const sentence_record_t &record, vector<wid_t> &outSentence) const {
+                if (binary)
+                    outSentence.assign((const wid_t *) record.begin, (const wid_t *) record.end);
+                else
+                    ParseWords(record.begin, record.end, outSentence);
+            }
+
+            // The words of a record of the binary copy, in place
+            static inline const wid_t *GetWords(const sentence_record_t &record, size_t *outLength) {
+                *outLength = (size_t) (record.end - record.begin) / sizeof(wid_t);
+                return (const wid_t *) record.begin;
+            }
+
+            inline bool Read(vector<wid_t> &outSentence) {
+                sentence_record_t record;
+                if (!Next(record))
+                    return false;
+
+                Decode(record, outSentence);
+                return true;
+            }
+
+            static string GetBinaryPath(const string &path);
+
+            // True if the binary copy of "path" exists and it matches the current text
+            static bool HasBinary(const string &path);
+
+            // True if "path" is the binary copy of another file, not a corpus itself
+            static bool IsBinaryPath(const string &path);
+
+            // Writes the binary copy of the text file "path"
+            static void CreateBinary(const string &path);
+
+        private:
+            bool binary;
+            MappedFile file;
+
+            LineReader lines;
+
+            const char *position;
+            const char *end;
+        };
+
+    }
+}
+
+#endif //MMT_COMMON_INTERFACES_SENTENCEREADER_H
@@ -0,0 +1,163 @@
+//
+// Parsing of the corpus lines: word ids and "i-j" alignment points.
+//
+
+#ifndef MMT_COMMON_INTERFACES_TEXTPARSER_H
+#define MMT_COMMON_INTERFACES_TEXTPARSER_H
+
+#include <cstdint>
+#include <cstring>
+#include <vector>
+#include <mmt/sentence.h>
+
+using namespace std;
+
+namespace mmt {
+    namespace corpus {
+
+        inline bool IsSpace(char c) {
+            return c == ' ' || c == '\t' || c == '\r' || c == '\n' || c == '\v' || c == '\f';
+        }
+
+        /**
+         * Parses the decimal number at "begin", it returns the position after its last digit, or
+         * "begin" if there is no number at all.
+         *
+         * Eight characters are loaded at once in a 64 bit register: the length of the number is
+         * found from the mask of the non digit bytes, and the digits are combined by three
+         * multiplications, pairs, then quads, then the whole word. There is no branch for every
+         * digit, thus no misprediction where a number ends. The last bytes before "end" are
+         * parsed one by one, the parser never reads past "end".
+         */
+        inline const char *ParseNumber(const char *begin, const char *end, uint64_t *outValue) {
+            const char *p = begin;
+            uint64_t value = 0;
+
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+            if (end - p >= 8) {
+                uint64_t chunk;
+                memcpy(&chunk, p, 8);
+
+                // the first character is the lowest byte; a digit byte is 0x30-0x39, that is its
+                // high nibble is 3 before and after adding 6. A byte that is not a digit can carry
+                // into the following ones, but they are past the end of the number anyway
+                uint64_t nondigits = ((chunk & 0xF0F0F0F0F0F0F0F0ULL) ^ 0x3030303030303030ULL) |
+                                     (((chunk + 0x0606060606060606ULL) & 0xF0F0F0F0F0F0F0F0ULL) ^ 0x3030303030303030ULL);
+                size_t digits = nondigits ? (size_t) (__builtin_ctzll(nondigits) >> 3) : 8;
+
+                if (digits == 0) {
+                    *outValue = 0;
+                    return begin;
+                }
+
+                // right-aligns the digits, the bytes shifted in act as leading zeros
+                chunk = (chunk & 0x0F0F0F0F0F0F0F0FULL) << (8 * (8 - digits));
+                chunk = ((chunk * ((10 << 8) + 1)) >> 8) & 0x00FF00FF00FF00FFULL;
+                chunk = ((chunk * ((100 << 16) + 1)) >> 16) & 0x0000FFFF0000FFFFULL;
+                chunk = (chunk * ((10000ULL << 32) + 1)) >> 32;
+
+                value = chunk;
+                p += digits;
+
+                if (digits < 8) {
+                    *outValue = value;
+                    return p;
+                }
+            }
+#endif
+
+            while (p < end && (unsigned char) (*p - '0') < 10) {
+                value = value * 10 + (uint64_t) (*p - '0');
+                ++p;
+            }
+
+            *outValue = value;
+            return p;
+        }
+
+        /**
+         * Parses the space separated word ids of a line into "output". Like the stream extraction
+         * it replaces, the parsing stops at the first token that is not a number.
+         */
+        inline void ParseWords(const char *begin, const char *end, vector<wid_t> &output) {
+            output.clear();
+
+            const char *p = begin;
+            while (true) {
+                while (p < end && IsSpace(*p))
+                    ++p;
+
+                uint64_t word;
+                const char *next = ParseNumber(p, end, &word);
+                if (next == p)
+                    break;
+
+                output.push_back((wid_t) word);
+                p = next;
+
+                if (p < end && !IsSpace(*p))
+                    break;
+            }
+        }
+
+        /**
+         * Parses the space separated "i-j" points of a line into "output"; the parsing stops at
+         * the first malformed point.
+         */
+        inline void ParseAlignment(const char *begin, const char *end, alignment_t &output) {
+            output.clear();
+
+            const char *p = begin;
+            while (true) {
+                while (p < end && IsSpace(*p))
+                    ++p;
+
+                uint64_t i, j;
+                const char *next = ParseNumber(p, end, &i);
+                if (next == p || next == end || *next != '-')
+                    break;
+
+                p = next + 1;
+                next = ParseNumber(p, end, &j);
+                if (next == p)
+                    break;
+
+                output.push_back(pair<length_t, length_t>((length_t) i, (length_t) j));
+                p = next;
+
+                if (p < end && !IsSpace(*p))
+                    break;
+            }
+        }
+
+        /**
+         * Returns the lines of a text in place, without the line terminator: the same lines of
+         * getline(), a final line without terminator included.
+         */
+        class LineReader {
+        public:
+            LineReader(const char *data, size_t size) : position(data), end(data + size) {
+            }
+
+            inline bool Read(const char **outBegin, const char **outEnd) {
+                if (position == end)
+                    return false;
+
+                const char *newline = (const char *) memchr(position, '\n', (size_t) (end - position));
+
+                *outBegin = position;
+                *outEnd = newline ? newline : end;
+
+                position = newline ? newline + 1 : end;
+                return true;
+            }
+
+        private:
+            const char *position;
+            const char *end;
+        };
+
+    }
+}
+
+#endif //MMT_COMMON_INTERFACES_TEXTPARSER_H
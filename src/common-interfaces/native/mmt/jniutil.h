@@ -24,4 +24,11 @@ inline std::string jni_jstrtostr(JNIEnv *jvm, jstring string) {
     return result;
 }
 
+// Raises an exception of class "className" in the JVM, thrown as soon as the native method returns
+inline void jni_throw(JNIEnv *jvm, const char *className, const char *message) {
+    jclass exceptionClass = jvm->FindClass(className);
+    if (exceptionClass != NULL)
+        jvm->ThrowNew(exceptionClass, message);
+}
+
 #endif //MMT_COMMON_INTERFACES_JNIUTIL_H
@@ -276,7 +276,10 @@ public class ClusterNode {
             Decoder decoder = engine.getDecoder();
             ContextAnalyzer contextAnalyzer = engine.getContextAnalyzer();
 
-            if (aligner != null && aligner instanceof DataListener)
+            // the aligner learns from the updates only if it has been opened as adaptive
+            boolean adaptiveAligner = nodeConfig.getEngineConfig().getAlignerConfig().isAdaptive();
+
+            if (aligner != null && aligner instanceof DataListener && adaptiveAligner)
                 dataManager.addDataListener((DataListener) aligner);
             if (decoder != null && decoder instanceof DataListener)
                 dataManager.addDataListener((DataListener) decoder);
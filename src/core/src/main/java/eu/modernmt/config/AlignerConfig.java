@@ -0,0 +1,20 @@
+package eu.modernmt.config;
+
+public class AlignerConfig {
+
+    private boolean adaptive = false;
+
+    public boolean isAdaptive() {
+        return adaptive;
+    }
+
+    public void setAdaptive(boolean adaptive) {
+        this.adaptive = adaptive;
+    }
+
+    @Override
+    public String toString() {
+        return "[Aligner]\n" +
+                "  adaptive = " + adaptive;
+    }
+}
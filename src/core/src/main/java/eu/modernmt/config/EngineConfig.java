@@ -11,6 +11,7 @@ public class EngineConfig {
     private Locale sourceLanguage = null;
     private Locale targetLanguage = null;
     private final DecoderConfig decoderConfig = new DecoderConfig();
+    private final AlignerConfig alignerConfig = new AlignerConfig();
 
     public String getName() {
         return name;
@@ -43,12 +44,17 @@ public class EngineConfig {
         return decoderConfig;
     }
 
+    public AlignerConfig getAlignerConfig() {
+        return alignerConfig;
+    }
+
     @Override
     public String toString() {
         return "[Engine]\n" +
                 "  name = " + name + "\n" +
                 "  source-language = " + sourceLanguage.toLanguageTag() + "\n" +
                 "  target-language = " + targetLanguage.toLanguageTag() + "\n" +
-                "  " + decoderConfig.toString().replace("\n", "\n  ");
+                "  " + decoderConfig.toString().replace("\n", "\n  ") + "\n" +
+                "  " + alignerConfig.toString().replace("\n", "\n  ");
     }
 }
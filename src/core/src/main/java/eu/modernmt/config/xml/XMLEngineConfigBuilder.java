@@ -1,5 +1,6 @@
 package eu.modernmt.config.xml;
 
+import eu.modernmt.config.AlignerConfig;
 import eu.modernmt.config.ConfigException;
 import eu.modernmt.config.DecoderConfig;
 import eu.modernmt.config.EngineConfig;
@@ -11,10 +12,12 @@ import org.w3c.dom.Element;
 class XMLEngineConfigBuilder extends XMLAbstractBuilder {
 
     private final XMLDecoderConfigBuilder decoderConfigBuilder;
+    private final XMLAlignerConfigBuilder alignerConfigBuilder;
 
     public XMLEngineConfigBuilder(Element element) {
         super(element);
         decoderConfigBuilder = new XMLDecoderConfigBuilder(getChild("decoder"));
+        alignerConfigBuilder = new XMLAlignerConfigBuilder(getChild("aligner"));
     }
 
     public EngineConfig build(EngineConfig config) throws ConfigException {
@@ -24,6 +27,7 @@ class XMLEngineConfigBuilder extends XMLAbstractBuilder {
             config.setTargetLanguage(getLocaleAttribute("target-language"));
 
         decoderConfigBuilder.build(config.getDecoderConfig());
+        alignerConfigBuilder.build(config.getAlignerConfig());
 
         return config;
     }
@@ -43,4 +47,18 @@ class XMLEngineConfigBuilder extends XMLAbstractBuilder {
             return config;
         }
     }
+
+    private static class XMLAlignerConfigBuilder extends XMLAbstractBuilder {
+
+        public XMLAlignerConfigBuilder(Element element) {
+            super(element);
+        }
+
+        public AlignerConfig build(AlignerConfig config) throws ConfigException {
+            if (hasAttribute("adaptive"))
+                config.setAdaptive(getBooleanAttribute("adaptive"));
+
+            return config;
+        }
+    }
 }
@@ -83,7 +83,7 @@ public class Engine implements Closeable {
         this.sourcePreprocessor = new Preprocessor(sourceLanguage, targetLanguage, vocabulary);
         this.targetPreprocessor = new Preprocessor(targetLanguage, sourceLanguage, vocabulary);
         this.postprocessor = new Postprocessor(sourceLanguage, targetLanguage, vocabulary);
-        this.aligner = new FastAlign(Paths.join(root, "models", "align"));
+        this.aligner = new FastAlign(Paths.join(root, "models", "align"), config.getAlignerConfig().isAdaptive());
         this.contextAnalyzer = new LuceneAnalyzer(Paths.join(root, "models", "context"), sourceLanguage);
         this.database = new SQLiteDatabase(Paths.join(root, "models", "db", "domains.db"));
 
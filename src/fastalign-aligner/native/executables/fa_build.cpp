@@ -16,6 +16,7 @@
 #include <iostream>
 #include <getopt.h>
 #include <stdlib.h>
+#include <cstdio>
 #include <fastalign/ModelBuilder.h>
 #include <sys/time.h>
 #include <fastalign/FastAligner.h>
@@ -34,6 +35,7 @@ using namespace mmt::fastalign;
 string source_input;
 string target_input;
 string model_path;
+bool external_memory = false;
 
 Options builderOptions(false);
 
@@ -43,6 +45,7 @@ struct option options[] = {
         {"model",      required_argument, NULL, 0},
         {"threads",    optional_argument, NULL, 0},
         {"iterations", optional_argument, NULL, 0},
+        {"external",   no_argument,       NULL, 0},
         {0, 0, 0,                               0}
 };
 
@@ -52,13 +55,14 @@ void help(const char *name) {
          << "  -t: [REQ] Input target corpus\n"
          << "  -m: [REQ] Output model path\n"
          << "  -I: number of iterations in EM training (default = 5)\n"
-         << "  -n: Number of threads. (default = number of CPUs)\n";
+         << "  -n: Number of threads. (default = number of CPUs)\n"
+         << "  -x: Train in external memory, for corpora larger than RAM (reads or writes FILE.bin, see create_bincorpus)\n";
 }
 
 bool InitCommandLine(int argc, char **argv) {
     while (true) {
         int oi;
-        int c = getopt_long(argc, argv, "s:t:m:I:n:", options, &oi);
+        int c = getopt_long(argc, argv, "s:t:m:I:n:x", options, &oi);
         if (c == -1) break;
 
         switch (c) {
@@ -77,6 +81,9 @@ bool InitCommandLine(int argc, char **argv) {
             case 'n':
                 builderOptions.threads = atoi(optarg);
                 break;
+            case 'x':
+                external_memory = true;
+                break;
             default:
                 return false;
         }
@@ -132,6 +139,11 @@ public:
         cerr << "DONE in " << (GetTime() - stepBegin) << "s" << endl;
     }
 
+    virtual void AligningTimes(int iteration, double reading, double expectation, double merging) override {
+        cerr << "\t\treading " << reading << "s, expectation " << expectation << "s, merging " << merging << "s"
+             << endl;
+    }
+
     virtual void IterationEnd(int iteration) override {
         // Nothing to do
     }
@@ -157,28 +169,19 @@ private:
     }
 };
 
-Model *train_forward() {
+Model *train(bool is_reverse, const BinaryCorpus *binaryCorpus) {
     ProcessListener listener;
     Corpus corpus(source_input, target_input);
 
-    builderOptions.is_reverse = false;
+    builderOptions.is_reverse = is_reverse;
 
     ModelBuilder builder(builderOptions);
     builder.setListener(&listener);
 
-    return builder.Build(corpus, model_path + kPathSeparator + FastAligner::kForwardModelFilename);
-}
-
-Model *train_backward() {
-    ProcessListener listener;
-    Corpus corpus(source_input, target_input);
-
-    builderOptions.is_reverse = true;
+    string filename = model_path + kPathSeparator +
+                      (is_reverse ? FastAligner::kBackwardModelFilename : FastAligner::kForwardModelFilename);
 
-    ModelBuilder builder(builderOptions);
-    builder.setListener(&listener);
-
-    return builder.Build(corpus, model_path + kPathSeparator + FastAligner::kBackwardModelFilename);
+    return binaryCorpus ? builder.Build(*binaryCorpus, filename) : builder.Build(corpus, filename);
 }
 
 int main(int argc, char **argv) {
@@ -187,11 +190,23 @@ int main(int argc, char **argv) {
         return 1;
     }
 
+    // both models are trained from the binary copies of the corpus, the ones written by the
+    // preprocessing if they are still up to date
+    BinaryCorpus *binaryCorpus = NULL;
+
+    if (external_memory) {
+        cerr << "Preparing binary corpus... ";
+        binaryCorpus = new BinaryCorpus(Corpus(source_input, target_input));
+        cerr << "DONE" << endl;
+    }
+
     cerr << "== Forward model training ==" << endl;
-    Model *forwardModel = train_forward();
+    Model *forwardModel = train(false, binaryCorpus);
     delete forwardModel;
 
     cerr << "== Backward model training ==" << endl;
-    Model *backwardModel = train_backward();
+    Model *backwardModel = train(true, binaryCorpus);
     delete backwardModel;
+
+    delete binaryCorpus;
 }
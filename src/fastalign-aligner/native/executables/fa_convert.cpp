@@ -0,0 +1,93 @@
+//
+// Converts the models of a FastAligner from the legacy format to the mapped one.
+//
+
+#include <iostream>
+#include <fastalign/FastAligner.h>
+#include <fastalign/Model.h>
+#include <boost/program_options.hpp>
+#include <boost/filesystem.hpp>
+
+using namespace std;
+using namespace mmt;
+using namespace mmt::fastalign;
+
+namespace {
+    const size_t ERROR_IN_COMMAND_LINE = 1;
+    const size_t GENERIC_ERROR = 2;
+    const size_t SUCCESS = 0;
+
+    struct args_t {
+        string model_path;
+    };
+} // namespace
+
+namespace po = boost::program_options;
+namespace fs = boost::filesystem;
+
+bool ParseArgs(int argc, const char *argv[], args_t *args) {
+    po::options_description desc("Convert the FastAligner models in the legacy format to the mapped format");
+    desc.add_options()
+            ("help,h", "print this help message")
+            ("model,m", po::value<string>()->required(), "model path, the models are converted in place");
+
+    po::variables_map vm;
+    try {
+        po::store(po::parse_command_line(argc, argv, desc), vm);
+
+        if (vm.count("help")) {
+            std::cout << desc << std::endl;
+            return false;
+        }
+
+        po::notify(vm);
+
+        args->model_path = vm["model"].as<string>();
+    } catch (po::error &e) {
+        std::cerr << "ERROR: " << e.what() << std::endl << std::endl;
+        std::cerr << desc << std::endl;
+        return false;
+    }
+
+    return true;
+}
+
+// The new model is written next to the old one and renamed over it only when complete
+void Convert(const fs::path &file) {
+    if (Model::IsMapped(file.string())) {
+        cerr << file.string() << " is already in the mapped format" << endl;
+        return;
+    }
+
+    cerr << "Converting " << file.string() << "... ";
+
+    fs::path temp = file;
+    temp += ".tmp";
+
+    Model *model = Model::Open(file.string());
+    model->Store(temp.string());
+    delete model;
+
+    fs::rename(temp, file);
+
+    cerr << "DONE" << endl;
+}
+
+int main(int argc, const char *argv[]) {
+    args_t args;
+
+    if (!ParseArgs(argc, argv, &args))
+        return ERROR_IN_COMMAND_LINE;
+
+    fs::path model_path(args.model_path);
+
+    try {
+        Convert(model_path / FastAligner::kForwardModelFilename);
+        Convert(model_path / FastAligner::kBackwardModelFilename);
+    } catch (exception &e) {
+        cerr << "ERROR: " << e.what() << endl;
+        return GENERIC_ERROR;
+    }
+
+    return SUCCESS;
+}
@@ -0,0 +1,60 @@
+//
+// A parallel corpus read in place from the binary copies of its files.
+//
+
+#include "BinaryCorpus.h"
+#include <limits>
+
+using namespace mmt;
+using namespace mmt::fastalign;
+
+namespace {
+
+    const string &PrepareBinary(const string &path) {
+        if (!corpus::SentenceReader::HasBinary(path))
+            corpus::SentenceReader::CreateBinary(path);
+
+        return path;
+    }
+
+}
+
+BinaryCorpus::BinaryCorpus(const Corpus &corpus) : sourcePath(PrepareBinary(corpus.getSourcePath())),
+                                                   targetPath(PrepareBinary(corpus.getTargetPath())) {
+}
+
+BinaryCorpusReader::BinaryCorpusReader(const BinaryCorpus &corpus) : source(corpus.sourcePath, true),
+                                                                     target(corpus.targetPath, true) {
+}
+
+bool BinaryCorpusReader::Read(sentence_pair_t &outPair) {
+    corpus::sentence_record_t sourceRecord, targetRecord;
+
+    while (source.Next(sourceRecord) && target.Next(targetRecord)) {
+        size_t sourceLength, targetLength;
+        const wid_t *sourceWords = corpus::SentenceReader::GetWords(sourceRecord, &sourceLength);
+        const wid_t *targetWords = corpus::SentenceReader::GetWords(targetRecord, &targetLength);
+
+        if (sourceLength > numeric_limits<length_t>::max() || targetLength > numeric_limits<length_t>::max())
+            continue;
+
+        outPair.source = sourceWords;
+        outPair.target = targetWords;
+        outPair.source_length = (length_t) sourceLength;
+        outPair.target_length = (length_t) targetLength;
+
+        return true;
+    }
+
+    return false;
+}
+
+bool BinaryCorpusReader::Read(vector<sentence_pair_t> &outBatch, size_t limit) {
+    outBatch.clear();
+
+    sentence_pair_t pair;
+    while (outBatch.size() < limit && Read(pair))
+        outBatch.push_back(pair);
+
+    return !outBatch.empty();
+}
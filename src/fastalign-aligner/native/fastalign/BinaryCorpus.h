@@ -0,0 +1,67 @@
+//
+// A parallel corpus read in place from the binary copies of its files.
+//
+
+#ifndef FASTALIGN_BINARYCORPUS_H
+#define FASTALIGN_BINARYCORPUS_H
+
+#include <cstddef>
+#include <string>
+#include <vector>
+#include <mmt/sentence.h>
+#include <mmt/corpus/SentenceReader.h>
+#include "Corpus.h"
+
+using namespace std;
+
+namespace mmt {
+    namespace fastalign {
+
+        // A sentence pair whose words are read in place
+        struct sentence_pair_t {
+            const wid_t *source;
+            const wid_t *target;
+            length_t source_length;
+            length_t target_length;
+        };
+
+        /**
+         * The source and the target are read from their binary copies (see corpus::SentenceReader),
+         * the same files written by the preprocessing: the copies that are missing, or older than
+         * their text, are written when the corpus is opened.
+         *
+         * The copies are mapped and read sequentially, thus the corpus does not need to fit in
+         * memory: the pages already read are simply dropped by the kernel.
+         */
+        class BinaryCorpus {
+            friend class BinaryCorpusReader;
+
+        public:
+            BinaryCorpus(const Corpus &corpus);
+
+        private:
+            const string sourcePath;
+            const string targetPath;
+        };
+
+        /**
+         * The pairs with a sentence longer than length_t are skipped, the models cannot align them.
+         */
+        class BinaryCorpusReader {
+        public:
+            BinaryCorpusReader(const BinaryCorpus &corpus);
+
+            bool Read(sentence_pair_t &outPair);
+
+            // Replaces the content of "outBatch" with at most "limit" pairs
+            bool Read(vector<sentence_pair_t> &outBatch, size_t limit);
+
+        private:
+            corpus::SentenceReader source;
+            corpus::SentenceReader target;
+        };
+
+    }
+}
+
+#endif //FASTALIGN_BINARYCORPUS_H
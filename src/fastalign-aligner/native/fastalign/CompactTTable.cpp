@@ -0,0 +1,110 @@
+//
+// Immutable, compressed-sparse-row translation table for serving.
+//
+
+#include "CompactTTable.h"
+#include <algorithm>
+#include <stdexcept>
+
+using namespace mmt;
+using namespace mmt::fastalign;
+
+CompactTTable::CompactTTable() {
+    offsetsData.push_back(0);
+    UpdateView();
+}
+
+CompactTTable::CompactTTable(const ttable_t &table) {
+    size_t cellCount = 0;
+    for (auto row = table.begin(); row != table.end(); ++row)
+        cellCount += row->size();
+
+    offsetsData.reserve(table.size() + 1);
+    targetsData.reserve(cellCount);
+    valuesData.reserve(cellCount);
+
+    offsetsData.push_back(0);
+    UpdateView();
+
+    vector<cell_t> buffer;
+    for (wid_t source = 0; source < table.size(); ++source) {
+        const unordered_map<wid_t, double> &row = table[source];
+        if (row.empty())
+            continue;
+
+        buffer.clear();
+        for (auto cell = row.begin(); cell != row.end(); ++cell)
+            buffer.push_back(cell_t(cell->first, (float) cell->second));
+
+        AddRow(source, buffer);
+    }
+}
+
+CompactTTable::CompactTTable(const uint64_t *offsets, size_t rows, const wid_t *targets, const float *values)
+        : offsets(offsets), targets(targets), values(values), rows(rows), cells((size_t) offsets[rows]) {
+}
+
+CompactTTable::CompactTTable(CompactTTable &&other) {
+    *this = std::move(other);
+}
+
+CompactTTable &CompactTTable::operator=(CompactTTable &&other) {
+    if (this == &other)
+        return *this;
+
+    bool owned = other.offsets == other.offsetsData.data();
+
+    offsetsData = std::move(other.offsetsData);
+    targetsData = std::move(other.targetsData);
+    valuesData = std::move(other.valuesData);
+
+    if (owned) {
+        UpdateView();
+    } else {
+        offsets = other.offsets;
+        targets = other.targets;
+        values = other.values;
+        rows = other.rows;
+        cells = other.cells;
+    }
+
+    other.offsetsData.assign(1, 0);
+    other.targetsData.clear();
+    other.valuesData.clear();
+    other.UpdateView();
+
+    return *this;
+}
+
+void CompactTTable::AddRow(wid_t source, vector<cell_t> &cellsToAdd) {
+    if (offsets != offsetsData.data())
+        throw logic_error("Unable to add a row to a read-only translation table");
+    if (source + 1 < offsetsData.size())
+        throw invalid_argument("Translation table rows must be added in increasing order of source word");
+
+    // empty rows for the skipped source words
+    offsetsData.resize(source + 1, (uint64_t) targetsData.size());
+
+    sort(cellsToAdd.begin(), cellsToAdd.end());
+
+    for (auto cell = cellsToAdd.begin(); cell != cellsToAdd.end(); ++cell) {
+        targetsData.push_back(cell->first);
+        valuesData.push_back(cell->second);
+    }
+
+    offsetsData.push_back((uint64_t) targetsData.size());
+    UpdateView();
+}
+
+size_t CompactTTable::GetMemoryUsage() const {
+    return offsetsData.capacity() * sizeof(uint64_t) + targetsData.capacity() * sizeof(wid_t) +
+           valuesData.capacity() * sizeof(float);
+}
+
+void CompactTTable::UpdateView() {
+    offsets = offsetsData.data();
+    targets = targetsData.data();
+    values = valuesData.data();
+    rows = offsetsData.size() - 1;
+    cells = targetsData.size();
+}
@@ -0,0 +1,127 @@
+//
+// Immutable, compressed-sparse-row translation table for serving.
+//
+
+#ifndef FASTALIGN_COMPACTTTABLE_H
+#define FASTALIGN_COMPACTTTABLE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <utility>
+#include <vector>
+#include <unordered_map>
+#include <mmt/sentence.h>
+
+using namespace std;
+
+namespace mmt {
+    namespace fastalign {
+
+        typedef vector<unordered_map<wid_t, double>> ttable_t;
+
+        /**
+         * A read-only translation table: the cells of every source word are stored contiguously,
+         * sorted by target word, with single precision probabilities (8 bytes per cell instead of
+         * the ~40 of a hash map node). A lookup is a branch-free binary search in the source row.
+         *
+         * The table either owns its arrays, built with AddRow(), or it is a view over arrays owned
+         * by someone else, i.e. a memory mapped model file.
+         */
+        class CompactTTable {
+        public:
+            typedef pair<wid_t, float> cell_t;
+
+            CompactTTable();
+
+            CompactTTable(const ttable_t &table);
+
+            // A view over "rows + 1" offsets, and as many targets and values as the last offset:
+            // the arrays are not copied and they must outlive the table
+            CompactTTable(const uint64_t *offsets, size_t rows, const wid_t *targets, const float *values);
+
+            CompactTTable(CompactTTable &&other);
+
+            CompactTTable &operator=(CompactTTable &&other);
+
+            CompactTTable(const CompactTTable &) = delete;
+
+            CompactTTable &operator=(const CompactTTable &) = delete;
+
+            // Appends the row of "source", the cells can be in any order and are sorted in place;
+            // the rows skipped from the previous one are left empty. Rows must be added in
+            // increasing order of source word, and only to a table that owns its arrays.
+            void AddRow(wid_t source, vector<cell_t> &cells);
+
+            inline bool empty() const {
+                return cells == 0;
+            }
+
+            // Number of non-empty cells
+            inline size_t size() const {
+                return cells;
+            }
+
+            inline size_t GetRows() const {
+                return rows;
+            }
+
+            inline const uint64_t *GetOffsets() const {
+                return offsets;
+            }
+
+            inline const wid_t *GetTargets() const {
+                return targets;
+            }
+
+            inline const float *GetValues() const {
+                return values;
+            }
+
+            inline bool Find(wid_t source, wid_t target, double *outValue) const {
+                if (source >= rows)
+                    return false;
+
+                const wid_t *cell = Search(targets + offsets[source], (size_t) (offsets[source + 1] - offsets[source]),
+                                           target);
+                if (cell == NULL)
+                    return false;
+
+                *outValue = values[cell - targets];
+                return true;
+            }
+
+            // Branch-free binary search of "target" in the "length" sorted targets of a row
+            static inline const wid_t *Search(const wid_t *base, size_t length, wid_t target) {
+                if (length == 0)
+                    return NULL;
+
+                while (length > 1) {
+                    size_t half = length / 2;
+                    base = (base[half] <= target) ? base + half : base;
+                    length -= half;
+                }
+
+                return *base == target ? base : NULL;
+            }
+
+            // Memory allocated by the table, in bytes; a view allocates nothing
+            size_t GetMemoryUsage() const;
+
+        private:
+            vector<uint64_t> offsetsData;
+            vector<wid_t> targetsData;
+            vector<float> valuesData;
+
+            const uint64_t *offsets;
+            const wid_t *targets;
+            const float *values;
+            size_t rows;
+            size_t cells;
+
+            void UpdateView();
+        };
+
+    }
+}
+
+#endif //FASTALIGN_COMPACTTTABLE_H
@@ -42,23 +42,19 @@ void Corpus::List(const string &path, const string &outPath, const string &sourc
     }
 }
 
-CorpusReader::CorpusReader(const Corpus &corpus) : drained(false), source(corpus.sourcePath.c_str()),
-                                                   target(corpus.targetPath.c_str()) {
+CorpusReader::CorpusReader(const Corpus &corpus) : drained(false), source(corpus.sourcePath),
+                                                   target(corpus.targetPath) {
 }
 
 bool CorpusReader::Read(vector<wid_t> &outSource, vector<wid_t> &outTarget) {
     if (drained)
         return false;
 
-    string sourceLine, targetLine;
-    if (!getline(source, sourceLine) || !getline(target, targetLine)) {
+    if (!source.Read(outSource) || !target.Read(outTarget)) {
         drained = true;
         return false;
     }
 
-    ParseLine(sourceLine, outSource);
-    ParseLine(targetLine, outTarget);
-
     return true;
 }
 
@@ -66,15 +62,16 @@ bool CorpusReader::Read(vector<pair<vector<wid_t>, vector<wid_t>>> &outBuffer, s
     if (drained)
         return false;
 
-    vector<pair<string, string>> batch;
+    // the records point into the files: they are taken in order, then decoded in parallel
+    vector<pair<corpus::sentence_record_t, corpus::sentence_record_t>> batch;
     for (size_t i = 0; i < limit; ++i) {
-        string sourceLine, targetLine;
-        if (!getline(source, sourceLine) || !getline(target, targetLine)) {
+        corpus::sentence_record_t sourceRecord, targetRecord;
+        if (!source.Next(sourceRecord) || !target.Next(targetRecord)) {
             drained = true;
             break;
         }
 
-        batch.push_back(pair<string, string>(sourceLine, targetLine));
+        batch.push_back(make_pair(sourceRecord, targetRecord));
     }
 
     if (batch.empty())
@@ -83,8 +80,8 @@ bool CorpusReader::Read(vector<pair<vector<wid_t>, vector<wid_t>>> &outBuffer, s
     outBuffer.resize(batch.size());
 #pragma omp parallel for schedule(dynamic)
     for (size_t i = 0; i < batch.size(); ++i) {
-        ParseLine(batch[i].first, outBuffer[i].first);
-        ParseLine(batch[i].second, outBuffer[i].second);
+        source.Decode(batch[i].first, outBuffer[i].first);
+        target.Decode(batch[i].second, outBuffer[i].second);
     }
 
     return true;
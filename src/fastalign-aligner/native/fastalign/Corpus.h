@@ -6,9 +6,8 @@
 #define FASTALIGN_CORPUS_H
 
 #include <string>
-#include <fstream>
-#include <sstream>
 #include <mmt/sentence.h>
+#include <mmt/corpus/SentenceReader.h>
 
 using namespace std;
 
@@ -27,6 +26,14 @@ namespace mmt {
             static void
                     List(const string &path, const string &outPath, const string &sourceLang, const string &targetLang, vector<Corpus> &list);
 
+            const string &getSourcePath() const {
+                return sourcePath;
+            }
+
+            const string &getTargetPath() const {
+                return targetPath;
+            }
+
             const string &getOutputPath() const {
                 return outputPath;
             }
@@ -37,6 +44,10 @@ namespace mmt {
             const string outputPath;
         };
 
+        /**
+         * The source and the target are read from their binary copies if there are any (see
+         * corpus::SentenceReader).
+         */
         class CorpusReader {
         public:
             CorpusReader(const Corpus &corpus);
@@ -48,18 +59,8 @@ namespace mmt {
         private:
             bool drained;
 
-            ifstream source;
-            ifstream target;
-
-            static inline void ParseLine(const string &line, vector<wid_t> &output) {
-                output.clear();
-
-                std::stringstream stream(line);
-                wid_t word;
-
-                while (stream >> word)
-                    output.push_back(word);
-            }
+            corpus::SentenceReader source;
+            corpus::SentenceReader target;
         };
 
     }
@@ -0,0 +1,128 @@
+//
+// Expected counts collected online, layered over the translation table of a Model.
+//
+
+#include "DeltaTTable.h"
+#include <algorithm>
+#include <cstdint>
+#include <stdexcept>
+#include <vector>
+
+using namespace mmt;
+using namespace mmt::fastalign;
+
+DeltaTTable::DeltaTTable(double priorStrength) : priorStrength(priorStrength), cells(0) {
+}
+
+void DeltaTTable::Add(wid_t source, wid_t target, double count) {
+    row_t &row = rows[source];
+
+    auto cell = row.cells.find(target);
+    if (cell == row.cells.end()) {
+        row.cells[target] = (float) count;
+        cells++;
+    } else {
+        cell->second += (float) count;
+    }
+
+    row.total += count;
+}
+
+void DeltaTTable::Prune(size_t maxCells) {
+    if (cells <= maxCells)
+        return;
+
+    vector<float> counts;
+    counts.reserve(cells);
+
+    for (auto row = rows.begin(); row != rows.end(); ++row) {
+        for (auto cell = row->second.cells.begin(); cell != row->second.cells.end(); ++cell)
+            counts.push_back(cell->second);
+    }
+
+    // every cell with a count not greater than the threshold is dropped, ties included
+    auto nth = counts.begin() + (cells - maxCells - 1);
+    nth_element(counts.begin(), nth, counts.end());
+    float threshold = *nth;
+
+    for (auto row = rows.begin(); row != rows.end(); /* no increment */) {
+        unordered_map<wid_t, float> &rowCells = row->second.cells;
+        double total = 0;
+
+        for (auto cell = rowCells.begin(); cell != rowCells.end(); /* no increment */) {
+            if (cell->second <= threshold) {
+                cell = rowCells.erase(cell);
+                cells--;
+            } else {
+                total += cell->second;
+                ++cell;
+            }
+        }
+
+        if (rowCells.empty()) {
+            row = rows.erase(row);
+        } else {
+            row->second.total = total;
+            ++row;
+        }
+    }
+}
+
+void DeltaTTable::Write(ostream &out) const {
+    uint64_t rowCount = rows.size();
+    out.write((const char *) &rowCount, sizeof(uint64_t));
+
+    for (auto row = rows.begin(); row != rows.end(); ++row) {
+        uint64_t cellCount = row->second.cells.size();
+
+        out.write((const char *) &row->first, sizeof(wid_t));
+        out.write((const char *) &cellCount, sizeof(uint64_t));
+
+        for (auto cell = row->second.cells.begin(); cell != row->second.cells.end(); ++cell) {
+            out.write((const char *) &cell->first, sizeof(wid_t));
+            out.write((const char *) &cell->second, sizeof(float));
+        }
+    }
+}
+
+void DeltaTTable::Clear() {
+    rows.clear();
+    cells = 0;
+}
+
+void DeltaTTable::Read(istream &in) {
+    Clear();
+
+    uint64_t rowCount = 0;
+    in.read((char *) &rowCount, sizeof(uint64_t));
+
+    for (uint64_t i = 0; i < rowCount && in; ++i) {
+        wid_t source;
+        uint64_t cellCount = 0;
+
+        in.read((char *) &source, sizeof(wid_t));
+
+        in.read((char *) &cellCount, sizeof(uint64_t));
+
+        row_t &row = rows[source];
+
+        for (uint64_t j = 0; j < cellCount && in; ++j) {
+            wid_t target;
+            float count;
+
+            in.read((char *) &target, sizeof(wid_t));
+            in.read((char *) &count, sizeof(float));
+
+            if (in) {
+                row.cells[target] = count;
+                row.total += count;
+                cells++;
+            }
+        }
+    }
+
+    if (!in) {
+        Clear();
+        throw runtime_error("Truncated translation table delta");
+    }
+}
@@ -0,0 +1,79 @@
+//
+// Expected counts collected online, layered over the translation table of a Model.
+//
+
+#ifndef FASTALIGN_DELTATTABLE_H
+#define FASTALIGN_DELTATTABLE_H
+
+#include <cstddef>
+#include <iostream>
+#include <unordered_map>
+#include <mmt/sentence.h>
+
+using namespace std;
+
+namespace mmt {
+    namespace fastalign {
+
+        /**
+         * The expected counts of the sentence pairs received after training. The base translation
+         * table acts as a Dirichlet prior of strength "priorStrength" over every source row, thus
+         * the adapted probability is:
+         *
+         *      p(t | s) = (priorStrength * p_base(t | s) + c(s, t)) / (priorStrength + c(s))
+         *
+         * A source word without counts keeps exactly its base probabilities, and a word seen often
+         * in the new data moves towards its empirical distribution. Since c(s) is the sum of the
+         * cells of the row, the rows stay normalized when cells are dropped by Prune().
+         *
+         * The table is not thread-safe, the owner must synchronize the access.
+         */
+        class DeltaTTable {
+        public:
+            DeltaTTable(double priorStrength);
+
+            inline double GetProbability(wid_t source, wid_t target, double base) const {
+                auto row = rows.find(source);
+                if (row == rows.end())
+                    return base;
+
+                auto cell = row->second.cells.find(target);
+                double count = cell == row->second.cells.end() ? 0. : cell->second;
+
+                return (priorStrength * base + count) / (priorStrength + row->second.total);
+            }
+
+            void Add(wid_t source, wid_t target, double count);
+
+            // Number of cells with a count
+            inline size_t size() const {
+                return cells;
+            }
+
+            // Drops the smallest counts until at most "maxCells" cells are left
+            void Prune(size_t maxCells);
+
+            void Write(ostream &out) const;
+
+            void Clear();
+
+            // Replaces the content of the table with the one written by Write(); if the input is
+            // truncated the table is left empty
+            void Read(istream &in);
+
+        private:
+            struct row_t {
+                double total = 0;
+                unordered_map<wid_t, float> cells;
+            };
+
+            const double priorStrength;
+
+            unordered_map<wid_t, row_t> rows;
+            size_t cells;
+        };
+
+    }
+}
+
+#endif //FASTALIGN_DELTATTABLE_H
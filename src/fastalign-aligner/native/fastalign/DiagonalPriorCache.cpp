@@ -0,0 +1,85 @@
+//
+// Cache of the normalized diagonal alignment priors of a Model.
+//
+
+#include "DiagonalPriorCache.h"
+#include "DiagonalAlignment.h"
+
+using namespace mmt;
+using namespace mmt::fastalign;
+
+const size_t DiagonalPriorCache::kMaxCachedLength;
+const size_t DiagonalPriorCache::kDefaultMaxMemory;
+
+DiagonalPriorCache::DiagonalPriorCache(double tension, double prob_align_null, size_t maxMemory)
+        : prob_align_null(prob_align_null), maxMemory(maxMemory), tension(tension), memory(0) {
+    size_t size = kMaxCachedLength * kMaxCachedLength;
+
+    entries = new atomic<const entry_t *>[size];
+    for (size_t i = 0; i < size; ++i)
+        entries[i].store(NULL, memory_order_relaxed);
+}
+
+DiagonalPriorCache::~DiagonalPriorCache() {
+    Reset(tension);
+    delete[] entries;
+}
+
+void DiagonalPriorCache::Reset(double tension) {
+    this->tension = tension;
+
+    for (size_t i = 0; i < kMaxCachedLength * kMaxCachedLength; ++i) {
+        const entry_t *entry = entries[i].exchange(NULL, memory_order_acq_rel);
+        delete entry;
+    }
+
+    memory = 0;
+}
+
+void DiagonalPriorCache::SetMaxMemory(size_t maxMemory) {
+    this->maxMemory = maxMemory;
+    Reset(tension);
+}
+
+const DiagonalPriorCache::entry_t *DiagonalPriorCache::Create(size_t m, size_t n) {
+    size_t size = 2 * m * n * sizeof(double);
+
+    if (memory.fetch_add(size, memory_order_relaxed) + size > maxMemory) {
+        memory.fetch_sub(size, memory_order_relaxed);
+        return NULL;
+    }
+
+    entry_t *entry = new entry_t();
+    Compute(m, n, tension, prob_align_null, entry);
+
+    // another thread may have created the same entry in the meantime
+    const entry_t *expected = NULL;
+    if (!entries[(m - 1) * kMaxCachedLength + (n - 1)].compare_exchange_strong(expected, entry,
+                                                                                memory_order_acq_rel)) {
+        memory.fetch_sub(size, memory_order_relaxed);
+        delete entry;
+        return expected;
+    }
+
+    return entry;
+}
+
+void DiagonalPriorCache::Compute(size_t m, size_t n, double tension, double prob_align_null, entry_t *outEntry) {
+    outEntry->priors.resize(m * n);
+    outEntry->features.resize(m * n);
+
+    const unsigned trg_size = (unsigned) m;
+    const unsigned src_size = (unsigned) n;
+
+    for (unsigned j = 0; j < trg_size; ++j) {
+        double *priors = &outEntry->priors[j * n];
+        double *features = &outEntry->features[j * n];
+
+        double az = DiagonalAlignment::ComputeZ(j + 1, trg_size, src_size, tension) / (1. - prob_align_null);
+
+        for (unsigned i = 1; i <= src_size; ++i) {
+            priors[i - 1] = DiagonalAlignment::UnnormalizedProb(j + 1, i, trg_size, src_size, tension) / az;
+            features[i - 1] = DiagonalAlignment::Feature(j, i, trg_size, src_size);
+        }
+    }
+}
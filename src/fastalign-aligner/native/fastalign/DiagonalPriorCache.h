@@ -0,0 +1,77 @@
+//
+// Cache of the normalized diagonal alignment priors of a Model.
+//
+
+#ifndef FASTALIGN_DIAGONALPRIORCACHE_H
+#define FASTALIGN_DIAGONALPRIORCACHE_H
+
+#include <atomic>
+#include <cstddef>
+#include <vector>
+
+using namespace std;
+
+namespace mmt {
+    namespace fastalign {
+
+        /**
+         * The diagonal prior of a source position depends only on the target position, the two
+         * sentence lengths and the diagonal tension: this cache keeps, for every pair of lengths
+         * (m = target length, n = source length), the m * n priors already normalized, one row of
+         * n values per target position, together with the m * n diagonal features.
+         *
+         * Entries are computed lazily and can be read and created by multiple threads; Reset() and
+         * SetMaxMemory() must be called when no thread is using the cache. Pairs of lengths beyond
+         * kMaxCachedLength, or beyond the memory budget, are not cached: Get() returns NULL.
+         *
+         * All the pairs of lengths up to kMaxCachedLength take about 1GB, while the lengths of real
+         * sentences are mostly short and close to each other: the default budget holds the most
+         * common pairs, a larger one pays off only when the same corpus is aligned many times.
+         */
+        class DiagonalPriorCache {
+        public:
+            static const size_t kMaxCachedLength = 128;
+            static const size_t kDefaultMaxMemory = 16 * 1024 * 1024;
+
+            struct entry_t {
+                vector<double> priors;
+                vector<double> features;
+            };
+
+            DiagonalPriorCache(double tension, double prob_align_null, size_t maxMemory = kDefaultMaxMemory);
+
+            ~DiagonalPriorCache();
+
+            // Returns the priors of target length "m" and source length "n", or NULL if not cacheable
+            inline const entry_t *Get(size_t m, size_t n) {
+                if (m == 0 || n == 0 || m > kMaxCachedLength || n > kMaxCachedLength)
+                    return NULL;
+
+                const entry_t *entry = entries[(m - 1) * kMaxCachedLength + (n - 1)].load(memory_order_acquire);
+                return entry ? entry : Create(m, n);
+            }
+
+            // Drops all the entries, that will be computed again with the new tension
+            void Reset(double tension);
+
+            // Drops all the entries and changes the memory budget, in bytes
+            void SetMaxMemory(size_t maxMemory);
+
+            // Fills "priors" and "features" of target length "m" and source length "n"
+            static void Compute(size_t m, size_t n, double tension, double prob_align_null, entry_t *outEntry);
+
+        private:
+            const double prob_align_null;
+            size_t maxMemory;
+
+            double tension;
+            atomic<size_t> memory;
+            atomic<const entry_t *> *entries;
+
+            const entry_t *Create(size_t m, size_t n);
+        };
+
+    }
+}
+
+#endif //FASTALIGN_DIAGONALPRIORCACHE_H
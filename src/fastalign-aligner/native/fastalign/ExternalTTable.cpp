@@ -0,0 +1,87 @@
+//
+// Translation table of a model trained in external memory by ModelBuilder.
+//
+
+#include "ExternalTTable.h"
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+using namespace mmt;
+using namespace mmt::fastalign;
+
+const size_t ExternalTTable::kBlockSize;
+
+ExternalTTable::ExternalTTable(vector<uint64_t> &offsets, const string &targetsPath) : targets(NULL), mapping(NULL),
+                                                                                     mapping_size(0) {
+    if (offsets.empty() || offsets[0] != 0)
+        throw invalid_argument("Invalid translation table offsets");
+
+    this->offsets.swap(offsets);
+
+    size_t cells = size();
+
+    int fd = open(targetsPath.c_str(), O_RDONLY);
+    if (fd < 0)
+        throw runtime_error("Unable to open " + targetsPath + ": " + strerror(errno));
+
+    struct stat info;
+    if (fstat(fd, &info) != 0 || (uint64_t) info.st_size != cells * sizeof(wid_t)) {
+        close(fd);
+        throw runtime_error("Invalid translation table targets " + targetsPath);
+    }
+
+    if (cells > 0) {
+        mapping_size = cells * sizeof(wid_t);
+        mapping = mmap(NULL, mapping_size, PROT_READ, MAP_SHARED, fd, 0);
+
+        if (mapping == MAP_FAILED) {
+            close(fd);
+            throw runtime_error("Unable to map " + targetsPath + ": " + strerror(errno));
+        }
+
+        targets = (const wid_t *) mapping;
+    }
+
+    close(fd);
+
+    fence_offsets.reserve(GetRows() + 1);
+    fence_offsets.push_back(0);
+
+    for (size_t source = 0; source < GetRows(); ++source) {
+        for (uint64_t cell = this->offsets[source]; cell < this->offsets[source + 1]; cell += kBlockSize)
+            fences.push_back(targets[cell]);
+        fence_offsets.push_back((uint64_t) fences.size());
+    }
+
+    values.resize(cells, 0.);
+    counts.resize(cells, 0.);
+}
+
+ExternalTTable::~ExternalTTable() {
+    if (mapping)
+        munmap(mapping, mapping_size);
+}
+
+CompactTTable ExternalTTable::ToCompactTTable(double threshold) const {
+    CompactTTable table;
+    vector<CompactTTable::cell_t> row;
+
+    for (size_t source = 0; source < GetRows(); ++source) {
+        row.clear();
+
+        for (uint64_t cell = offsets[source]; cell < offsets[source + 1]; ++cell) {
+            if (values[cell] > threshold)
+                row.push_back(CompactTTable::cell_t(targets[cell], (float) values[cell]));
+        }
+
+        if (!row.empty())
+            table.AddRow((wid_t) source, row);
+    }
+
+    return table;
+}
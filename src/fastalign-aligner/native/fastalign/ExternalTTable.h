@@ -0,0 +1,130 @@
+//
+// Translation table of a model trained in external memory by ModelBuilder.
+//
+
+#ifndef FASTALIGN_EXTERNALTTABLE_H
+#define FASTALIGN_EXTERNALTTABLE_H
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <mmt/sentence.h>
+#include "CompactTTable.h"
+
+using namespace std;
+
+namespace mmt {
+    namespace fastalign {
+
+        /**
+         * A translation table with a fixed set of cells, in compressed sparse rows: the sorted
+         * targets of every row are mapped from a file, while the probabilities and the expected
+         * counts of the cells are kept in memory, about 16 bytes per cell instead of the two hash
+         * map nodes of a ttable_t.
+         *
+         * The probabilities are read by the E-step while the counts are written by the merge, thus
+         * the two steps never touch the same array. ModelBuilder normalizes the counts into the
+         * probabilities.
+         */
+        class ExternalTTable {
+            friend class ModelBuilder;
+
+        public:
+            /**
+             * "offsets" has one entry more than the source words, the last one is the number of
+             * cells; "targetsPath" contains the targets of all the rows, sorted within every row.
+             * The offsets are moved into the table, and the file can be removed as soon as the table
+             * has been created.
+             */
+            ExternalTTable(vector<uint64_t> &offsets, const string &targetsPath);
+
+            ~ExternalTTable();
+
+            ExternalTTable(const ExternalTTable &) = delete;
+
+            ExternalTTable &operator=(const ExternalTTable &) = delete;
+
+            inline size_t GetRows() const {
+                return offsets.size() - 1;
+            }
+
+            // Number of cells
+            inline size_t size() const {
+                return (size_t) offsets.back();
+            }
+
+            inline bool Find(wid_t source, wid_t target, double *outValue) const {
+                size_t cell;
+                if (!Locate(source, target, &cell))
+                    return false;
+
+                *outValue = values[cell];
+                return true;
+            }
+
+            // Adds "count" to the expected count of the cell, if the cell exists
+            inline void AddCount(wid_t source, wid_t target, double count) {
+                size_t cell;
+                if (Locate(source, target, &cell))
+                    counts[cell] += count;
+            }
+
+            // The cells with probability greater than "threshold"
+            CompactTTable ToCompactTTable(double threshold) const;
+
+        private:
+            vector<uint64_t> offsets;
+            const wid_t *targets;
+
+            void *mapping;
+            size_t mapping_size;
+
+            vector<double> values;
+            vector<double> counts;
+
+            // every row is split in blocks of kBlockSize cells, the first target of every block is a
+            // fence: a lookup searches the fences of the row, a small array that stays in cache, and
+            // then a single block
+            static const size_t kBlockSize = 16;
+
+            vector<uint64_t> fence_offsets;
+            vector<wid_t> fences;
+
+            inline bool Locate(wid_t source, wid_t target, size_t *outCell) const {
+                if (source >= GetRows())
+                    return false;
+
+                size_t begin = (size_t) offsets[source];
+                size_t length = (size_t) (offsets[source + 1] - begin);
+
+                if (length > kBlockSize) {
+                    const wid_t *rowFences = fences.data() + fence_offsets[source];
+                    size_t blocks = (size_t) (fence_offsets[source + 1] - fence_offsets[source]);
+
+                    const wid_t *fence = rowFences;
+                    while (blocks > 1) {
+                        size_t half = blocks / 2;
+                        fence = (fence[half] <= target) ? fence + half : fence;
+                        blocks -= half;
+                    }
+
+                    size_t block = (size_t) (fence - rowFences);
+                    begin += block * kBlockSize;
+                    length = min(kBlockSize, length - block * kBlockSize);
+                }
+
+                const wid_t *cell = CompactTTable::Search(targets + begin, length, target);
+                if (cell == NULL)
+                    return false;
+
+                *outCell = (size_t) (cell - targets);
+                return true;
+            }
+        };
+
+    }
+}
+
+#endif //FASTALIGN_EXTERNALTTABLE_H
@@ -4,8 +4,13 @@
 
 #include <symal/SymAlignment.h>
 #include "FastAligner.h"
+#include <algorithm>
+#include <limits>
+#include <numeric>
+#include <stdexcept>
 #include <thread>
 #include "Model.h"
+#include "BinaryCorpus.h"
 #ifdef _OPENMP
 #include <omp.h>
 #endif
@@ -22,16 +27,36 @@ using namespace mmt::fastalign;
 
 const string FastAligner::kForwardModelFilename = "forward.fam";
 const string FastAligner::kBackwardModelFilename = "backward.fam";
+const string FastAligner::kUpdatesFilename = "updates.fad";
 
-FastAligner *FastAligner::Open(const string &path, int threads) {
+FastAligner *FastAligner::Open(const string &path, int threads, bool adaptive, const AdaptationOptions &options) {
     Model *forward = Model::Open(path + kPathSeparator + kForwardModelFilename);
-    Model *backward = Model::Open(path + kPathSeparator + kBackwardModelFilename);
+    Model *backward;
 
-    return new FastAligner(forward, backward, threads);
+    try {
+        backward = Model::Open(path + kPathSeparator + kBackwardModelFilename);
+    } catch (...) {
+        delete forward;
+        throw;
+    }
+
+    FastAligner *aligner = new FastAligner(forward, backward, threads);
+
+    if (adaptive) {
+        try {
+            aligner->updates = new UpdateManager(forward, backward, path + kPathSeparator + kUpdatesFilename,
+                                                 options);
+        } catch (...) {
+            delete aligner;
+            throw;
+        }
+    }
+
+    return aligner;
 }
 
 FastAligner::FastAligner(AlignerModel *forwardModel, AlignerModel *backwardModel, int threads)
-        : forwardModel(forwardModel), backwardModel(backwardModel) {
+        : forwardModel(forwardModel), backwardModel(backwardModel), updates(NULL) {
     this->threads = threads > 0 ? threads : (int) thread::hardware_concurrency();
 
 #ifdef _OPENMP
@@ -41,6 +66,9 @@ FastAligner::FastAligner(AlignerModel *forwardModel, AlignerModel *backwardModel
 }
 
 FastAligner::~FastAligner() {
+    // pending updates are applied and consolidated before the models are released
+    delete updates;
+
     delete forwardModel;
     delete backwardModel;
 }
@@ -51,36 +79,59 @@ FastAligner::GetAlignment(const vector<wid_t> &source, const vector<wid_t> &targ
     alignment_t backward = backwardModel->ComputeAlignment(source, target);
 
     SymAlignment symmetrizer(source.size(), target.size());
+    Symmetrize(symmetrizer, forward, backward, strategy);
 
+    return symmetrizer.ToAlignment();
+}
+
+void FastAligner::Symmetrize(SymAlignment &symal, const alignment_t &forward, const alignment_t &backward,
+                             SymmetrizationStrategy strategy) {
     switch (strategy) {
         case GrowDiagonalFinalAndStrategy:
-            symmetrizer.Grow(forward, backward, true, true);
+            symal.Grow(forward, backward, true, true);
             break;
         case GrowDiagonalStrategy:
-            symmetrizer.Grow(forward, backward, true, false);
+            symal.Grow(forward, backward, true, false);
             break;
         case IntersectionStrategy:
-            symmetrizer.Intersection(forward, backward);
+            symal.Intersection(forward, backward);
             break;
         case UnionStrategy:
-            symmetrizer.Union(forward, backward);
+            symal.Union(forward, backward);
             break;
     }
-
-    return symmetrizer.ToAlignment();
 }
 
 void
 FastAligner::GetAlignments(const vector<pair<vector<wid_t>, vector<wid_t>>> &batch, vector<alignment_t> &outAlignments,
                            SymmetrizationStrategy strategy) {
+    outAlignments.resize(batch.size());
+
+    Model *forward = dynamic_cast<Model *>(forwardModel);
+    Model *backward = dynamic_cast<Model *>(backwardModel);
+
+    if (forward && backward) {
+        vector<sentence_pair_t> pairs(batch.size());
+        for (size_t i = 0; i < batch.size(); ++i) {
+            pairs[i].source = batch[i].first.data();
+            pairs[i].target = batch[i].second.data();
+            pairs[i].source_length = (length_t) batch[i].first.size();
+            pairs[i].target_length = (length_t) batch[i].second.size();
+        }
+
+        Align(forward, backward, pairs, strategy, [&outAlignments](size_t i, alignment_t &alignment) {
+            outAlignments[i].swap(alignment);
+        });
+
+        return;
+    }
+
     vector<alignment_t> forwards;
     vector<alignment_t> backwards;
 
     forwardModel->ComputeAlignments(batch, forwards);
     backwardModel->ComputeAlignments(batch, backwards);
 
-    outAlignments.resize(batch.size());
-
     vector<SymAlignment> symals((size_t) threads);
 
 #pragma omp parallel for schedule(dynamic)
@@ -94,28 +145,120 @@ FastAligner::GetAlignments(const vector<pair<vector<wid_t>, vector<wid_t>>> &bat
 
         symal.Reset(batch[i].first.size(), batch[i].second.size());
 
-        alignment_t &forward = forwards[i];
-        alignment_t &backward = backwards[i];
-
-        switch (strategy) {
-            case GrowDiagonalFinalAndStrategy:
-                symal.Grow(forward, backward, true, true);
-                break;
-            case GrowDiagonalStrategy:
-                symal.Grow(forward, backward, true, false);
-                break;
-            case IntersectionStrategy:
-                symal.Intersection(forward, backward);
-                break;
-            case UnionStrategy:
-                symal.Union(forward, backward);
-                break;
-        }
+        Symmetrize(symal, forwards[i], backwards[i], strategy);
 
         outAlignments[i] = symal.ToAlignment();
     }
 }
 
+void FastAligner::GetAlignments(const uint32_t *input, size_t inputSize, size_t count,
+                                uint32_t *output, size_t outputSize, SymmetrizationStrategy strategy) {
+    Model *forward = dynamic_cast<Model *>(forwardModel);
+    Model *backward = dynamic_cast<Model *>(backwardModel);
+
+    if (!forward || !backward)
+        throw logic_error("Aligning a buffer requires FastAlign models");
+
+    // the pairs read in place and the offset of their slot in the output
+    vector<sentence_pair_t> pairs(count);
+    vector<size_t> slots(count);
+
+    size_t inputOffset = 0;
+    size_t outputOffset = 0;
+
+    for (size_t i = 0; i < count; ++i) {
+        if (inputOffset + 2 > inputSize)
+            throw invalid_argument("Truncated input buffer");
+
+        uint32_t sourceLength = input[inputOffset];
+        uint32_t targetLength = input[inputOffset + 1];
+
+        if (sourceLength > numeric_limits<length_t>::max() || targetLength > numeric_limits<length_t>::max())
+            throw invalid_argument("Sentence too long in input buffer");
+
+        pairs[i].source = input + inputOffset + 2;
+        pairs[i].target = pairs[i].source + sourceLength;
+        pairs[i].source_length = (length_t) sourceLength;
+        pairs[i].target_length = (length_t) targetLength;
+        slots[i] = outputOffset;
+
+        inputOffset += 2 + sourceLength + targetLength;
+        outputOffset += GetAlignmentSlotSize(sourceLength, targetLength);
+
+        if (inputOffset > inputSize)
+            throw invalid_argument("Truncated input buffer");
+    }
+
+    if (outputOffset > outputSize)
+        throw invalid_argument("Output buffer too small");
+
+    Align(forward, backward, pairs, strategy, [output, &slots](size_t i, alignment_t &alignment) {
+        size_t links = alignment.size();
+
+        uint32_t *slot = output + slots[i];
+        slot[0] = (uint32_t) links;
+        for (size_t l = 0; l < links; ++l) {
+            slot[1 + l] = alignment[l].first;
+            slot[1 + links + l] = alignment[l].second;
+        }
+    });
+}
+
+void FastAligner::Align(Model *forward, Model *backward, const vector<sentence_pair_t> &pairs,
+                        SymmetrizationStrategy strategy, const function<void(size_t, alignment_t &)> &output) {
+    // the longest pairs are started first: the last tasks of the batch are short ones, and the
+    // workers finish together even if the lengths are mixed
+    vector<size_t> order(pairs.size());
+    iota(order.begin(), order.end(), 0);
+    stable_sort(order.begin(), order.end(), [&pairs](size_t a, size_t b) {
+        return (size_t) pairs[a].source_length * pairs[a].target_length >
+               (size_t) pairs[b].source_length * pairs[b].target_length;
+    });
+
+    vector<alignment_t> forwardAlignments(pairs.size());
+
+#pragma omp parallel for schedule(dynamic)
+    for (size_t k = 0; k < order.size(); ++k) {
+        const sentence_pair_t &p = pairs[order[k]];
+        forward->ComputeAlignment(p.source, p.source_length, p.target, p.target_length,
+                                  forwardAlignments[order[k]]);
+    }
+
+#ifdef _OPENMP
+    size_t workers = (size_t) omp_get_max_threads();
+#else
+    size_t workers = 1;
+#endif
+
+    vector<SymAlignment> symals(workers);
+    vector<alignment_t> backwardAlignments(workers);
+
+#pragma omp parallel for schedule(dynamic)
+    for (size_t k = 0; k < order.size(); ++k) {
+#ifdef _OPENMP
+        size_t worker = (size_t) omp_get_thread_num();
+#else
+        size_t worker = 0;
+#endif
+        SymAlignment &symal = symals[worker];
+        alignment_t &backwardAlignment = backwardAlignments[worker];
+
+        size_t i = order[k];
+        const sentence_pair_t &p = pairs[i];
+
+        backward->ComputeAlignment(p.source, p.source_length, p.target, p.target_length, backwardAlignment);
+
+        symal.Reset(p.source_length, p.target_length);
+        Symmetrize(symal, forwardAlignments[i], backwardAlignment, strategy);
+
+        // the forward alignment is not needed anymore
+        alignment_t().swap(forwardAlignments[i]);
+
+        alignment_t alignment = symal.ToAlignment();
+        output(i, alignment);
+    }
+}
+
 alignment_t FastAligner::GetForwardAlignment(const vector<wid_t> &source, const vector<wid_t> &target) {
     return forwardModel->ComputeAlignment(source, target);
 }
@@ -142,3 +285,15 @@ float FastAligner::GetBackwardProbability(wid_t source, wid_t target) {
     return (float) backwardModel->GetProbability(target, source);
 }
 
+
+void FastAligner::Add(const updateid_t &id, const domain_t domain, const vector<wid_t> &source,
+                      const vector<wid_t> &target, const alignment_t &alignment) {
+    if (!updates)
+        throw logic_error("The aligner has been opened without adaptation");
+
+    updates->Add(id, source, target);
+}
+
+unordered_map<stream_t, seqid_t> FastAligner::GetLatestUpdatesIdentifier() {
+    return updates ? updates->GetLatestUpdatesIdentifier() : unordered_map<stream_t, seqid_t>();
+}
@@ -6,28 +6,67 @@
 #define FASTALIGN_ALIGNER_H
 
 #include <mmt/aligner/Aligner.h>
+#include <mmt/IncrementalModel.h>
+#include <functional>
 #include <string>
+#include "UpdateManager.h"
 
 namespace mmt {
     namespace fastalign {
 
-        class FastAligner : public Aligner {
+        class SymAlignment;
+
+        class Model;
+
+        struct sentence_pair_t;
+
+        class FastAligner : public Aligner, public IncrementalModel {
         public:
 
             static const string kForwardModelFilename;
             static const string kBackwardModelFilename;
+            static const string kUpdatesFilename;
 
             FastAligner(AlignerModel *forwardModel, AlignerModel *backwardModel, int threads = 0);
 
-            static FastAligner *Open(const string &path, int threads = 0);
+            /**
+             * Opens the models in "path". If "adaptive" is true the aligner also learns from the
+             * sentence pairs passed to Add(), see UpdateManager: the adapted tables are stored in
+             * the same directory, that must be writable.
+             */
+            static FastAligner *Open(const string &path, int threads = 0, bool adaptive = false,
+                                     const AdaptationOptions &options = AdaptationOptions());
 
             virtual alignment_t GetAlignment(const vector<wid_t> &source, const vector<wid_t> &target,
                                              SymmetrizationStrategy strategy) override;
 
+            // With FastAlign models the batch is aligned like a buffer, see below
             virtual void
             GetAlignments(const vector<pair<vector<wid_t>, vector<wid_t>>> &batch, vector<alignment_t> &outAlignments,
                           SymmetrizationStrategy strategy) override;
 
+            /**
+             * Aligns "count" sentence pairs read in place from "input", a buffer of "inputSize" words
+             * where every pair is stored as the source length, the target length, the source words and
+             * the target words. The words are never copied: the whole batch is aligned by the forward
+             * model first, then the backward model aligns every pair and symmetrizes it directly
+             * into "output".
+             *
+             * The output has a slot for every pair, in the input order: the slot of a pair is
+             * GetAlignmentSlotSize() words long and it starts with the number of links n, followed
+             * by the n source positions and the n target positions.
+             *
+             * Throws invalid_argument if the input is malformed or the output is too small.
+             */
+            void GetAlignments(const uint32_t *input, size_t inputSize, size_t count,
+                               uint32_t *output, size_t outputSize, SymmetrizationStrategy strategy);
+
+            // A symmetrized alignment is a subset of the union of the forward alignment, with at most a
+            // link for every target word, and the backward one, with at most a link for every source word
+            static inline size_t GetAlignmentSlotSize(size_t sourceLength, size_t targetLength) {
+                return 1 + 2 * (sourceLength + targetLength);
+            }
+
             virtual alignment_t GetForwardAlignment(const vector<wid_t> &source, const vector<wid_t> &target) override;
 
             virtual void GetForwardAlignments(const vector<pair<vector<wid_t>, vector<wid_t>>> &batch,
@@ -54,13 +93,40 @@ namespace mmt {
                 return GetForwardProbability(kAlignerNullWord, target);
             };
 
+            // The domain and the alignment are ignored: the expected counts of the sentence pair are
+            // computed by the models themselves
+            virtual void Add(const updateid_t &id, const domain_t domain,
+                             const vector<wid_t> &source, const vector<wid_t> &target,
+                             const alignment_t &alignment) override;
+
+            virtual unordered_map<stream_t, seqid_t> GetLatestUpdatesIdentifier() override;
+
             virtual ~FastAligner() override;
 
         private:
             AlignerModel *forwardModel;
             AlignerModel *backwardModel;
+            UpdateManager *updates;
 
             int threads;
+
+            static void Symmetrize(SymAlignment &symal, const alignment_t &forward, const alignment_t &backward,
+                                   SymmetrizationStrategy strategy);
+
+            /**
+             * Aligns "pairs" in two parallel passes: the forward model aligns them all, then every
+             * pair is aligned by the backward model and symmetrized in a single task, with the
+             * backward alignment and the symmetrizer of the worker thread as scratch. "output" is
+             * called from the workers with the final alignment of every pair, it can take it over.
+             *
+             * The forward pass is not fused with the others on purpose. One task per pair running both
+             * models alternates their translation tables in the cache of the worker: on one core it
+             * is about 20% slower on batches of 1000 pairs, and no faster on batches of 64. The cost
+             * of the barrier is keeping the forward alignments of the batch, one link per target word
+             * at most.
+             */
+            static void Align(Model *forward, Model *backward, const vector<sentence_pair_t> &pairs,
+                              SymmetrizationStrategy strategy, const function<void(size_t, alignment_t &)> &output);
         };
 
     }
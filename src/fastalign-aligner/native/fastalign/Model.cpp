@@ -5,16 +5,158 @@
 #include "Model.h"
 #include "DiagonalAlignment.h"
 #include "Corpus.h"
+#include "BinaryCorpus.h"
+#include <cerrno>
+#include <cstring>
+#include <fstream>
+#include <stdexcept>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
 
 using namespace mmt;
 using namespace mmt::fastalign;
 
+namespace {
+
+    const char kMappedMagic[8] = {'F', 'A', 'M', 'C', 'S', 'R', '\n', '\0'};
+    const uint32_t kMappedVersion = 1;
+    const uint32_t kByteOrderMark = 0x01020304;
+    const uint64_t kSectionAlignment = 64;
+
+    struct mapped_header_t {
+        char magic[8];
+        uint32_t version;
+        uint32_t byte_order;
+        uint32_t word_size;
+        uint8_t is_reverse;
+        uint8_t use_null;
+        uint8_t favor_diagonal;
+        uint8_t padding;
+        double prob_align_null;
+        double diagonal_tension;
+        uint64_t rows;
+        uint64_t cells;
+        uint64_t offsets_position;
+        uint64_t targets_position;
+        uint64_t values_position;
+        uint64_t file_size;
+    };
+
+    inline uint64_t Align(uint64_t position) {
+        return (position + kSectionAlignment - 1) / kSectionAlignment * kSectionAlignment;
+    }
+
+    void WriteSection(ofstream &out, uint64_t position, const void *data, size_t size) {
+        static const char zeros[kSectionAlignment] = {0};
+
+        uint64_t current = (uint64_t) out.tellp();
+        out.write(zeros, position - current);
+        out.write((const char *) data, size);
+    }
+
+    bool ReadMagic(int fd) {
+        char magic[sizeof(kMappedMagic)];
+        return pread(fd, magic, sizeof(magic), 0) == (ssize_t) sizeof(magic) &&
+               memcmp(magic, kMappedMagic, sizeof(magic)) == 0;
+    }
+
+}
+
 Model::Model(const bool is_reverse, const bool use_null, const bool favor_diagonal, const double prob_align_null,
              double diagonal_tension) : is_reverse(is_reverse), use_null(use_null), favor_diagonal(favor_diagonal),
-                                        prob_align_null(prob_align_null), diagonal_tension(diagonal_tension) {
+                                        prob_align_null(prob_align_null), diagonal_tension(diagonal_tension),
+                                        prior_cache(diagonal_tension, prob_align_null) {
+}
+
+void Model::SetDiagonalTension(double tension) {
+    diagonal_tension = tension;
+    prior_cache.Reset(tension);
+}
+
+void Model::SetPriorCacheSize(size_t maxMemory) {
+    prior_cache.SetMaxMemory(maxMemory);
+}
+
+Model::~Model() {
+    if (mapping)
+        munmap(mapping, mapping_size);
+
+    delete delta;
+}
+
+bool Model::IsMapped(const string &filename) {
+    int fd = open(filename.c_str(), O_RDONLY);
+    if (fd < 0)
+        throw runtime_error("Unable to open model file " + filename + ": " + strerror(errno));
+
+    bool mapped = ReadMagic(fd);
+    close(fd);
+
+    return mapped;
 }
 
 Model *Model::Open(const string &filename) {
+    return IsMapped(filename) ? OpenMapped(filename) : OpenLegacy(filename);
+}
+
+Model *Model::OpenMapped(const string &filename) {
+    int fd = open(filename.c_str(), O_RDONLY);
+    if (fd < 0)
+        throw runtime_error("Unable to open model file " + filename + ": " + strerror(errno));
+
+    struct stat info;
+    mapped_header_t header;
+
+    if (fstat(fd, &info) != 0 || pread(fd, &header, sizeof(header), 0) != (ssize_t) sizeof(header)) {
+        close(fd);
+        throw runtime_error("Unable to read model file " + filename);
+    }
+
+    if (header.version != kMappedVersion || header.byte_order != kByteOrderMark || header.word_size != sizeof(wid_t)) {
+        close(fd);
+        throw runtime_error("Incompatible model file " + filename + ", it was written by a different build");
+    }
+
+    if (header.file_size != (uint64_t) info.st_size ||
+        header.offsets_position % sizeof(uint64_t) != 0 ||
+        header.offsets_position + (header.rows + 1) * sizeof(uint64_t) > header.targets_position ||
+        header.targets_position + header.cells * sizeof(wid_t) > header.values_position ||
+        header.values_position + header.cells * sizeof(float) > header.file_size) {
+        close(fd);
+        throw runtime_error("Corrupted model file " + filename);
+    }
+
+    void *mapping = mmap(NULL, (size_t) header.file_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+
+    if (mapping == MAP_FAILED)
+        throw runtime_error("Unable to map model file " + filename + ": " + strerror(errno));
+
+    const char *data = (const char *) mapping;
+    const uint64_t *offsets = (const uint64_t *) (data + header.offsets_position);
+
+    if (offsets[0] != 0 || offsets[header.rows] != header.cells) {
+        munmap(mapping, (size_t) header.file_size);
+        throw runtime_error("Corrupted model file " + filename);
+    }
+
+    Model *model = new Model(header.is_reverse != 0, header.use_null != 0, header.favor_diagonal != 0,
+                             header.prob_align_null, header.diagonal_tension);
+    model->mapping = mapping;
+    model->mapping_size = (size_t) header.file_size;
+    model->compact_table = CompactTTable(offsets, (size_t) header.rows,
+                                         (const wid_t *) (data + header.targets_position),
+                                         (const float *) (data + header.values_position));
+
+    return model;
+}
+
+Model *Model::OpenLegacy(const string &filename) {
     bool is_reverse;
     bool use_null;
     bool favor_diagonal;
@@ -35,7 +177,8 @@ Model *Model::Open(const string &filename) {
     size_t ttable_size;
     in.read((char *) &ttable_size, sizeof(size_t));
 
-    model->translation_table.resize(ttable_size);
+    // rows are stored in increasing order of source word, they are loaded directly in the compact table
+    vector<CompactTTable::cell_t> row;
 
     while (true) {
         wid_t sourceWord;
@@ -47,8 +190,7 @@ Model *Model::Open(const string &filename) {
         size_t row_size;
         in.read((char *) &row_size, sizeof(size_t));
 
-        unordered_map<wid_t, double> &row = model->translation_table[sourceWord];
-        row.reserve(row_size);
+        row.resize(row_size);
 
         for (size_t i = 0; i < row_size; ++i) {
             wid_t targetWord;
@@ -57,44 +199,122 @@ Model *Model::Open(const string &filename) {
             in.read((char *) &targetWord, sizeof(wid_t));
             in.read((char *) &value, sizeof(double));
 
-            row[targetWord] = value;
+            row[i] = CompactTTable::cell_t(targetWord, (float) value);
         }
+
+        model->compact_table.AddRow(sourceWord, row);
     }
 
     return model;
 }
 
+void Model::Compact() {
+    compact_table = CompactTTable(translation_table);
+    ttable_t().swap(translation_table);
+}
+
 void Model::Store(const string &filename) {
-    ofstream out(filename, ios::binary | ios::out);
+    CompactTTable trainedTable;
+    if (!translation_table.empty())
+        trainedTable = CompactTTable(translation_table);
+
+    const CompactTTable &table = translation_table.empty() ? compact_table : trainedTable;
+
+    mapped_header_t header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, kMappedMagic, sizeof(kMappedMagic));
+    header.version = kMappedVersion;
+    header.byte_order = kByteOrderMark;
+    header.word_size = sizeof(wid_t);
+    header.is_reverse = (uint8_t) is_reverse;
+    header.use_null = (uint8_t) use_null;
+    header.favor_diagonal = (uint8_t) favor_diagonal;
+    header.prob_align_null = prob_align_null;
+    header.diagonal_tension = diagonal_tension;
+    header.rows = table.GetRows();
+    header.cells = table.size();
+    header.offsets_position = Align(sizeof(header));
+    header.targets_position = Align(header.offsets_position + (header.rows + 1) * sizeof(uint64_t));
+    header.values_position = Align(header.targets_position + header.cells * sizeof(wid_t));
+    header.file_size = header.values_position + header.cells * sizeof(float);
+
+    ofstream out(filename, ios::binary | ios::out | ios::trunc);
+
+    out.write((const char *) &header, sizeof(header));
+    WriteSection(out, header.offsets_position, table.GetOffsets(), (header.rows + 1) * sizeof(uint64_t));
+    WriteSection(out, header.targets_position, table.GetTargets(), header.cells * sizeof(wid_t));
+    WriteSection(out, header.values_position, table.GetValues(), header.cells * sizeof(float));
+
+    out.close();
+
+    if (!out)
+        throw runtime_error("Unable to write model file " + filename);
+}
 
-    out.write((const char *) &is_reverse, sizeof(bool));
-    out.write((const char *) &use_null, sizeof(bool));
-    out.write((const char *) &favor_diagonal, sizeof(bool));
+void Model::EnableAdaptation(double priorStrength) {
+    if (delta)
+        throw logic_error("Adaptation is already enabled");
 
-    out.write((const char *) &prob_align_null, sizeof(double));
-    out.write((const char *) &diagonal_tension, sizeof(double));
+    delta = new DeltaTTable(priorStrength);
+}
 
-    size_t ttable_size = translation_table.size();
-    out.write((const char *) &ttable_size, sizeof(size_t));
+void Model::Adapt(const vector<pair<vector<wid_t>, vector<wid_t>>> &batch) {
+    if (!delta)
+        throw logic_error("Adaptation is not enabled");
 
-    for (wid_t sourceWord = 0; sourceWord < translation_table.size(); ++sourceWord) {
-        unordered_map<wid_t, double> &row = translation_table[sourceWord];
-        size_t row_size = row.size();
+    // a single partition: the batches are small and they are applied by one thread
+    count_buffer_t counts(1);
 
-        if (row_size == 0)
-            continue;
+    // the E-step only reads the delta table, alignments can be computed in the meantime
+    {
+        boost::shared_lock<boost::shared_mutex> lock(delta_access);
+        for (auto pair = batch.begin(); pair != batch.end(); ++pair)
+            ComputeAlignment(pair->first, pair->second, &counts, NULL);
+    }
 
-        out.write((const char *) &sourceWord, sizeof(wid_t));
-        out.write((const char *) &row_size, sizeof(size_t));
+    boost::unique_lock<boost::shared_mutex> lock(delta_access);
+    for (auto count = counts[0].begin(); count != counts[0].end(); ++count)
+        delta->Add(count->source, count->target, count->value);
+}
 
-        for (auto it = row.begin(); it != row.end(); ++it) {
-            wid_t targetWord = it->first;
-            double value = it->second;
+size_t Model::GetAdaptationSize() {
+    if (!delta)
+        return 0;
 
-            out.write((const char *) &targetWord, sizeof(wid_t));
-            out.write((const char *) &value, sizeof(double));
-        }
-    }
+    boost::shared_lock<boost::shared_mutex> lock(delta_access);
+    return delta->size();
+}
+
+void Model::PruneAdaptation(size_t maxCells) {
+    if (!delta)
+        throw logic_error("Adaptation is not enabled");
+
+    boost::unique_lock<boost::shared_mutex> lock(delta_access);
+    delta->Prune(maxCells);
+}
+
+void Model::StoreAdaptation(ostream &out) {
+    if (!delta)
+        throw logic_error("Adaptation is not enabled");
+
+    boost::shared_lock<boost::shared_mutex> lock(delta_access);
+    delta->Write(out);
+}
+
+void Model::LoadAdaptation(istream &in) {
+    if (!delta)
+        throw logic_error("Adaptation is not enabled");
+
+    boost::unique_lock<boost::shared_mutex> lock(delta_access);
+    delta->Read(in);
+}
+
+void Model::ClearAdaptation() {
+    if (!delta)
+        throw logic_error("Adaptation is not enabled");
+
+    boost::unique_lock<boost::shared_mutex> lock(delta_access);
+    delta->Clear();
 }
 
 void Model::Prune(double threshold) {
@@ -112,83 +332,180 @@ void Model::Prune(double threshold) {
     }
 }
 
-double Model::ComputeAlignments(const vector<pair<vector<wid_t>, vector<wid_t>>> &batch, ttable_t *outTable,
+double Model::ComputeAlignments(const vector<pair<vector<wid_t>, vector<wid_t>>> &batch, bool countAlignments,
                                 vector<alignment_t> *outAlignments) {
     double emp_feat = 0.0;
 
     if (outAlignments)
         outAlignments->resize(batch.size());
 
+    if (countAlignments)
+        PrepareCountBuffers();
+
 #pragma omp parallel for schedule(dynamic) reduction(+:emp_feat)
     for (size_t i = 0; i < batch.size(); ++i) {
+        count_buffer_t *counts = NULL;
+        if (countAlignments) {
+#ifdef _OPENMP
+            counts = &count_buffers[omp_get_thread_num()];
+#else
+            counts = &count_buffers[0];
+#endif
+        }
+
         const pair<vector<wid_t>, vector<wid_t>> &p = batch[i];
-        emp_feat += ComputeAlignment(p.first, p.second, outTable, outAlignments ? &outAlignments->at(i) : NULL);
+        emp_feat += ComputeAlignment(p.first, p.second, counts, outAlignments ? &outAlignments->at(i) : NULL);
     }
 
     return emp_feat;
 }
 
-double Model::ComputeAlignment(const vector<wid_t> &source, const vector<wid_t> &target, ttable_t *outTable,
-                               alignment_t *outAlignment) {
+double Model::ComputeAlignments(const vector<sentence_pair_t> &batch) {
     double emp_feat = 0.0;
 
-    const vector<wid_t> src = is_reverse ? target : source;
-    const vector<wid_t> trg = is_reverse ? source : target;
+    PrepareCountBuffers();
 
-    vector<double> probs(src.size() + 1);
+#pragma omp parallel for schedule(dynamic) reduction(+:emp_feat)
+    for (size_t i = 0; i < batch.size(); ++i) {
+#ifdef _OPENMP
+        count_buffer_t *counts = &count_buffers[omp_get_thread_num()];
+#else
+        count_buffer_t *counts = &count_buffers[0];
+#endif
+
+        const sentence_pair_t &p = batch[i];
+        emp_feat += ComputeAlignment(p.source, p.source_length, p.target, p.target_length, counts, NULL);
+    }
 
-    length_t src_size = (length_t) src.size();
-    length_t trg_size = (length_t) trg.size();
+    return emp_feat;
+}
 
-    for (length_t j = 0; j < trg_size; ++j) {
-        const wid_t &f_j = trg[j];
-        double sum = 0;
-        double prob_a_i = 1.0 / (src_size +
-                                 // uniform (model 1), Diagonal Alignment (distortion model)
-                                 // ****** DIFFERENT FROM LEXICAL TRANSLATION PROBABILITY *****
-                                 (use_null ? 1 : 0));
-        if (use_null) {
-            if (favor_diagonal)
-                prob_a_i = prob_align_null;
-            probs[0] = GetProbability(kAlignerNullWord, f_j) * prob_a_i;
-            sum += probs[0];
+void Model::PrepareCountBuffers() {
+#ifdef _OPENMP
+    size_t threads = (size_t) omp_get_max_threads();
+#else
+    size_t threads = 1;
+#endif
+    // a few partitions per thread, so that the merge is balanced even if some rows are much
+    // larger than others (i.e. the NULL word)
+    size_t partitions = 1;
+    while (partitions < 4 * threads)
+        partitions *= 2;
+
+    count_buffers.resize(threads);
+    for (auto buffer = count_buffers.begin(); buffer != count_buffers.end(); ++buffer)
+        buffer->resize(partitions);
+}
+
+void Model::MergeCounts(ttable_t &table) {
+    size_t partitions = count_buffers.empty() ? 0 : count_buffers[0].size();
+
+#pragma omp parallel for schedule(dynamic)
+    for (size_t partition = 0; partition < partitions; ++partition) {
+        for (auto buffer = count_buffers.begin(); buffer != count_buffers.end(); ++buffer) {
+            vector<count_t> &counts = (*buffer)[partition];
+            for (auto count = counts.begin(); count != counts.end(); ++count)
+                table[count->source][count->target] += count->value;
+
+            counts.clear();
         }
+    }
+}
 
-        double az = 0;
-        if (favor_diagonal)
-            az = DiagonalAlignment::ComputeZ(j + 1, trg_size, src_size, diagonal_tension) /
-                 (1. - prob_align_null);
+void Model::MergeCounts(ExternalTTable &table) {
+    size_t partitions = count_buffers.empty() ? 0 : count_buffers[0].size();
 
-        for (length_t i = 1; i <= src_size; ++i) {
-            if (favor_diagonal) {
-                prob_a_i = DiagonalAlignment::UnnormalizedProb(j + 1, i, trg_size, src_size, diagonal_tension) /
-                           az;
-            }
-            probs[i] = GetProbability(src[i - 1], f_j) * prob_a_i;
-            sum += probs[i];
+#pragma omp parallel for schedule(dynamic)
+    for (size_t partition = 0; partition < partitions; ++partition) {
+        for (auto buffer = count_buffers.begin(); buffer != count_buffers.end(); ++buffer) {
+            vector<count_t> &counts = (*buffer)[partition];
+            for (auto count = counts.begin(); count != counts.end(); ++count)
+                table.AddCount(count->source, count->target, count->value);
+
+            counts.clear();
         }
+    }
+}
 
+double Model::ComputeAlignment(const wid_t *source, length_t sourceLength, const wid_t *target,
+                               length_t targetLength, count_buffer_t *outCounts, alignment_t *outAlignment) {
+    double emp_feat = 0.0;
 
-        if (use_null) {
-            double count = probs[0] / sum;
+    const wid_t *src = is_reverse ? target : source;
+    const wid_t *trg = is_reverse ? source : target;
 
-            if (outTable) {
-#pragma omp atomic
-                (*outTable)[kAlignerNullWord][f_j] += count;
-            }
+    length_t src_size = is_reverse ? targetLength : sourceLength;
+    length_t trg_size = is_reverse ? sourceLength : targetLength;
+
+    // probs[0] is the NULL word, the source words follow: the loops on the source words below work
+    // on contiguous arrays, so that the compiler can vectorize them
+    vector<double> probs(src_size + 1);
+
+    const double uniform_prob = 1.0 / (src_size +
+                                       // uniform (model 1), Diagonal Alignment (distortion model)
+                                       // ****** DIFFERENT FROM LEXICAL TRANSLATION PROBABILITY *****
+                                       (use_null ? 1 : 0));
+
+    // normalized priors and features of every (target, source) position, cached for the common lengths
+    const DiagonalPriorCache::entry_t *diagonal = NULL;
+    DiagonalPriorCache::entry_t uncached;
+
+    if (favor_diagonal) {
+        diagonal = prior_cache.Get(trg_size, src_size);
+
+        if (diagonal == NULL) {
+            DiagonalPriorCache::Compute(trg_size, src_size, diagonal_tension, prob_align_null, &uncached);
+            diagonal = &uncached;
+        }
+    }
+
+    for (length_t j = 0; j < trg_size; ++j) {
+        const wid_t &f_j = trg[j];
+        double *src_probs = probs.data() + 1;
+
+        if (use_null)
+            probs[0] = GetAdaptedProbability(kAlignerNullWord, f_j) * (favor_diagonal ? prob_align_null : uniform_prob);
+
+        for (length_t i = 0; i < src_size; ++i)
+            src_probs[i] = GetAdaptedProbability(src[i], f_j);
+
+        if (favor_diagonal) {
+            const double *priors = diagonal->priors.data() + j * src_size;
+            for (length_t i = 0; i < src_size; ++i)
+                src_probs[i] *= priors[i];
+        } else {
+            for (length_t i = 0; i < src_size; ++i)
+                src_probs[i] *= uniform_prob;
         }
 
-        for (length_t i = 1; i <= src_size; ++i) {
-            const double p = probs[i] / sum;
+        double sum = use_null ? probs[0] : 0;
+        for (length_t i = 0; i < src_size; ++i)
+            sum += src_probs[i];
+
+        if (outCounts) {
+            count_buffer_t &counts = *outCounts;
+            const size_t mask = counts.size() - 1;
 
-            if (outTable) {
-#pragma omp atomic
-                (*outTable)[src[i - 1]][f_j] += p;
+            if (use_null) {
+                count_t count = {kAlignerNullWord, f_j, probs[0] / sum};
+                counts[kAlignerNullWord & mask].push_back(count);
             }
 
-            emp_feat += DiagonalAlignment::Feature(j, i, trg_size, src_size) * p;
-        }
+            for (length_t i = 0; i < src_size; ++i) {
+                count_t count = {src[i], f_j, src_probs[i] / sum};
+                counts[src[i] & mask].push_back(count);
+            }
 
+            // the feature is needed only to optimize the diagonal tension
+            if (favor_diagonal) {
+                const double *features = diagonal->features.data() + j * src_size;
+                for (length_t i = 0; i < src_size; ++i)
+                    emp_feat += features[i] * (src_probs[i] / sum);
+            } else {
+                for (length_t i = 0; i < src_size; ++i)
+                    emp_feat += DiagonalAlignment::Feature(j, i + 1, trg_size, src_size) * (src_probs[i] / sum);
+            }
+        }
 
         if (outAlignment) {
             double max_p = -1;
@@ -10,7 +10,12 @@
 #include <string>
 #include <vector>
 #include <unordered_map>
+#include <boost/thread/shared_mutex.hpp>
 #include <mmt/aligner/AlignerModel.h>
+#include "CompactTTable.h"
+#include "DeltaTTable.h"
+#include "ExternalTTable.h"
+#include "DiagonalPriorCache.h"
 
 using namespace std;
 
@@ -18,29 +23,137 @@ namespace mmt {
     namespace fastalign {
 
         const double kNullProbability = 1e-9;
+        const double kPruneThreshold = 1e-20;
 
-        typedef vector<unordered_map<wid_t, double>> ttable_t;
+        struct sentence_pair_t;
 
         class Model : public AlignerModel {
             friend class ModelBuilder;
 
         public:
 
+            /**
+             * Opens a model file in either format: a mapped model (see Store()) is used in place,
+             * without parsing or copying, while a model in the legacy format is parsed into a
+             * CompactTTable.
+             */
             static Model *Open(const string &filename);
 
+            // Returns true if the file is a model in the mapped format
+            static bool IsMapped(const string &filename);
+
+            // Memory budget of the cache of the diagonal priors, in bytes (see DiagonalPriorCache);
+            // must not be called while alignments are being computed
+            void SetPriorCacheSize(size_t maxMemory);
+
+            virtual ~Model() override;
+
             virtual inline alignment_t
             ComputeAlignment(const vector<wid_t> &source, const vector<wid_t> &target) override {
                 alignment_t alignment;
-                ComputeAlignment(source, target, NULL, &alignment);
+
+                if (delta) {
+                    boost::shared_lock<boost::shared_mutex> lock(delta_access);
+                    ComputeAlignment(source, target, NULL, &alignment);
+                } else {
+                    ComputeAlignment(source, target, NULL, &alignment);
+                }
+
                 return alignment;
             }
 
+            // Same as ComputeAlignment(), on words read in place; "outAlignment" is overwritten
+            inline void ComputeAlignment(const wid_t *source, length_t sourceLength,
+                                         const wid_t *target, length_t targetLength, alignment_t &outAlignment) {
+                outAlignment.clear();
+
+                if (delta) {
+                    boost::shared_lock<boost::shared_mutex> lock(delta_access);
+                    ComputeAlignment(source, sourceLength, target, targetLength, NULL, &outAlignment);
+                } else {
+                    ComputeAlignment(source, sourceLength, target, targetLength, NULL, &outAlignment);
+                }
+            }
+
             virtual inline void ComputeAlignments(const vector<pair<vector<wid_t>, vector<wid_t>>> &batch,
                                                   vector<alignment_t> &outAlignments) override {
-                ComputeAlignments(batch, NULL, &outAlignments);
+                if (delta) {
+                    boost::shared_lock<boost::shared_mutex> lock(delta_access);
+                    ComputeAlignments(batch, false, &outAlignments);
+                } else {
+                    ComputeAlignments(batch, false, &outAlignments);
+                }
             }
 
             inline double GetProbability(wid_t source, wid_t target) override {
+                if (delta) {
+                    boost::shared_lock<boost::shared_mutex> lock(delta_access);
+                    return delta->GetProbability(source, target, GetBaseProbability(source, target));
+                }
+
+                return GetBaseProbability(source, target);
+            }
+
+            void Prune(double threshold = kPruneThreshold);
+
+            // Moves the translation table into a CompactTTable: lookups are faster and the memory
+            // is several times smaller, but the model cannot be trained anymore.
+            // Models loaded with Open() are already compact.
+            void Compact();
+
+            /**
+             * Writes the model in the mapped format: a fixed header followed by the offsets, the
+             * targets and the probabilities of the compact table, every section aligned to 64 bytes.
+             * Open() maps the file read-only and shared, thus loading takes constant time and the
+             * pages are shared by all the processes using the same model.
+             *
+             * The file is written in the native byte order and word size: it is not portable, but
+             * Open() rejects files written by an incompatible build.
+             */
+            void Store(const string &filename);
+
+            /**
+             * Enables the online adaptation of the model: the expected counts of the sentence pairs
+             * passed to Adapt() are collected in a DeltaTTable layered over the translation table,
+             * see DeltaTTable for the adapted probabilities. Must be called before the model is
+             * shared with other threads; the following methods can be called by any thread.
+             */
+            void EnableAdaptation(double priorStrength);
+
+            // One step of online EM: the expected counts of "batch" under the current adapted
+            // model are added to the delta table
+            void Adapt(const vector<pair<vector<wid_t>, vector<wid_t>>> &batch);
+
+            size_t GetAdaptationSize();
+
+            void PruneAdaptation(size_t maxCells);
+
+            void StoreAdaptation(ostream &out);
+
+            void LoadAdaptation(istream &in);
+
+            // Drops all the counts of the delta table
+            void ClearAdaptation();
+
+        private:
+            ttable_t translation_table;
+            CompactTTable compact_table;
+            const ExternalTTable *external_table = NULL; // owned by the ModelBuilder training the model
+
+            DeltaTTable *delta = NULL;
+            boost::shared_mutex delta_access;
+
+            inline double GetBaseProbability(wid_t source, wid_t target) {
+                if (!compact_table.empty()) {
+                    double value;
+                    return compact_table.Find(source, target, &value) ? value : kNullProbability;
+                }
+
+                if (external_table) {
+                    double value;
+                    return external_table->Find(source, target, &value) ? value : kNullProbability;
+                }
+
                 if (translation_table.empty())
                     return kNullProbability;
                 if (source >= translation_table.size())
@@ -51,10 +164,27 @@ namespace mmt {
                 return ptr == row.end() ? kNullProbability : ptr->second;
             }
 
-            void Prune(double threshold = 1e-20);
+            // The caller must hold "delta_access" if the adaptation is enabled
+            inline double GetAdaptedProbability(wid_t source, wid_t target) {
+                double probability = GetBaseProbability(source, target);
+                return delta ? delta->GetProbability(source, target, probability) : probability;
+            }
 
-        private:
-            ttable_t translation_table;
+            void *mapping = NULL;
+            size_t mapping_size = 0;
+
+            // Expected counts of a batch, collected by every thread without synchronization: the
+            // counts of a thread are split in a power of two partitions of source words, that are
+            // merged in parallel
+            struct count_t {
+                wid_t source;
+                wid_t target;
+                double value;
+            };
+
+            typedef vector<vector<count_t>> count_buffer_t;
+
+            vector<count_buffer_t> count_buffers;
 
             const bool is_reverse;
             const bool use_null;
@@ -62,17 +192,42 @@ namespace mmt {
             const double prob_align_null;
 
             double diagonal_tension;
+            DiagonalPriorCache prior_cache;
 
             Model(const bool is_reverse, const bool use_null, const bool favor_diagonal, const double prob_align_null,
                   double diagonal_tension);
 
-            double ComputeAlignment(const vector<wid_t> &source, const vector<wid_t> &target, ttable_t *outTable,
-                                    alignment_t *outAlignment);
+            double ComputeAlignment(const wid_t *source, length_t sourceLength, const wid_t *target,
+                                    length_t targetLength, count_buffer_t *outCounts, alignment_t *outAlignment);
+
+            inline double ComputeAlignment(const vector<wid_t> &source, const vector<wid_t> &target,
+                                           count_buffer_t *outCounts, alignment_t *outAlignment) {
+                return ComputeAlignment(source.data(), (length_t) source.size(), target.data(),
+                                        (length_t) target.size(), outCounts, outAlignment);
+            }
 
-            double ComputeAlignments(const vector<pair<vector<wid_t>, vector<wid_t>>> &batch, ttable_t *outTable,
+            // If "countAlignments" is true, the expected counts of the batch are collected and
+            // the returned value is the diagonal feature; MergeCounts() must be called afterwards
+            double ComputeAlignments(const vector<pair<vector<wid_t>, vector<wid_t>>> &batch, bool countAlignments,
                                      vector<alignment_t> *outAlignments);
 
-            void Store(const string &filename);
+            // Collects the expected counts of a batch read in place, see ComputeAlignments() above
+            double ComputeAlignments(const vector<sentence_pair_t> &batch);
+
+            void PrepareCountBuffers();
+
+            // Adds the counts collected by ComputeAlignments() to "table", that must already contain
+            // all the cells, and clears them
+            void MergeCounts(ttable_t &table);
+
+            void MergeCounts(ExternalTTable &table);
+
+            // Must not be called while alignments are being computed
+            void SetDiagonalTension(double tension);
+
+            static Model *OpenMapped(const string &filename);
+
+            static Model *OpenLegacy(const string &filename);
         };
 
     }
@@ -2,8 +2,17 @@
 // Created by Davide  Caroselli on 23/08/16.
 //
 
+#include <algorithm>
+#include <cassert>
+#include <chrono>
+#include <cstdio>
+#include <fstream>
 #include <iostream>
+#include <limits>
+#include <memory>
+#include <queue>
 #include <sstream>
+#include <stdexcept>
 #include <thread>
 #ifdef _OPENMP
 #include <omp.h>
@@ -14,12 +23,173 @@
 using namespace mmt;
 using namespace mmt::fastalign;
 
+static inline double SecondsSince(const chrono::steady_clock::time_point &begin) {
+    return chrono::duration<double>(chrono::steady_clock::now() - begin).count();
+}
+
 struct LengthPairHash {
     size_t operator()(const pair<length_t, length_t> &x) const {
         return (size_t) ((x.first << 16) | ((x.second) & 0xffff));
     }
 };
 
+namespace {
+
+    // A cell of the translation table as a sortable key: source word first, then target word
+    inline uint64_t CellKey(wid_t source, wid_t target) {
+        return (((uint64_t) source) << 32) | (uint64_t) target;
+    }
+
+    // Sorts the keys in parallel, a chunk per thread, and removes the duplicates
+    void SortCells(vector<uint64_t> &cells) {
+#ifdef _OPENMP
+        size_t chunks = (size_t) omp_get_max_threads();
+#else
+        size_t chunks = 1;
+#endif
+        size_t size = cells.size();
+        size_t chunk = max((size_t) 1, (size + chunks - 1) / chunks);
+
+#pragma omp parallel for
+        for (size_t i = 0; i < chunks; ++i) {
+            size_t begin = min(i * chunk, size);
+            size_t end = min(begin + chunk, size);
+            sort(cells.begin() + begin, cells.begin() + end);
+        }
+
+        for (size_t width = chunk; width < size; width *= 2) {
+            size_t merges = (size + 2 * width - 1) / (2 * width);
+
+#pragma omp parallel for
+            for (size_t i = 0; i < merges; ++i) {
+                size_t begin = i * 2 * width;
+                size_t middle = min(begin + width, size);
+                size_t end = min(begin + 2 * width, size);
+                inplace_merge(cells.begin() + begin, cells.begin() + middle, cells.begin() + end);
+            }
+        }
+
+        cells.erase(unique(cells.begin(), cells.end()), cells.end());
+    }
+
+    // A sorted run of keys, either in memory or in a file, read sequentially
+    class CellRun {
+    public:
+        CellRun(const vector<uint64_t> &cells) : data(cells.data()), size(cells.size()), position(0) {
+        }
+
+        CellRun(const string &path) : input(new ifstream(path, ios::binary | ios::in)), position(0) {
+            if (!input->is_open())
+                throw runtime_error("Unable to open " + path);
+
+            Fill();
+        }
+
+        inline bool empty() const {
+            return position >= size;
+        }
+
+        inline uint64_t front() const {
+            return data[position];
+        }
+
+        inline void pop() {
+            if (++position == size && input)
+                Fill();
+        }
+
+    private:
+        static const size_t kReadBufferSize = 1 << 16;
+
+        unique_ptr<ifstream> input;
+        vector<uint64_t> buffer;
+
+        const uint64_t *data;
+        size_t size;
+        size_t position;
+
+        void Fill() {
+            buffer.resize(kReadBufferSize);
+            input->read((char *) buffer.data(), kReadBufferSize * sizeof(uint64_t));
+            buffer.resize((size_t) input->gcount() / sizeof(uint64_t));
+
+            data = buffer.data();
+            size = buffer.size();
+            position = 0;
+        }
+    };
+
+    void WriteRun(const vector<uint64_t> &cells, const string &path) {
+        ofstream out(path, ios::binary | ios::out | ios::trunc);
+        out.write((const char *) cells.data(), cells.size() * sizeof(uint64_t));
+        out.close();
+
+        if (!out)
+            throw runtime_error("Unable to write " + path);
+    }
+
+    /*
+     * Merges the sorted runs, dropping the duplicates: the targets of the cells are written to
+     * "targetsPath", in order of source word then target word, and "outOffsets" receives the
+     * position of the first cell of every source word, followed by the number of cells.
+     */
+    void MergeRuns(vector<CellRun *> &runs, const string &targetsPath, vector<uint64_t> &outOffsets) {
+        typedef pair<uint64_t, size_t> head_t;
+        priority_queue<head_t, vector<head_t>, greater<head_t>> heads;
+
+        for (size_t i = 0; i < runs.size(); ++i) {
+            if (!runs[i]->empty())
+                heads.push(head_t(runs[i]->front(), i));
+        }
+
+        ofstream out(targetsPath, ios::binary | ios::out | ios::trunc);
+
+        vector<wid_t> targets;
+        targets.reserve(1 << 20);
+
+        uint64_t cells = 0;
+        uint64_t last = 0;
+
+        outOffsets.clear();
+
+        while (!heads.empty()) {
+            head_t head = heads.top();
+            heads.pop();
+
+            CellRun *run = runs[head.second];
+            run->pop();
+            if (!run->empty())
+                heads.push(head_t(run->front(), head.second));
+
+            uint64_t key = head.first;
+            if (cells > 0 && key == last)
+                continue;
+            last = key;
+
+            size_t source = (size_t) (key >> 32);
+            while (outOffsets.size() <= source)
+                outOffsets.push_back(cells);
+
+            targets.push_back((wid_t) key);
+            cells++;
+
+            if (targets.size() == targets.capacity()) {
+                out.write((const char *) targets.data(), targets.size() * sizeof(wid_t));
+                targets.clear();
+            }
+        }
+
+        out.write((const char *) targets.data(), targets.size() * sizeof(wid_t));
+        out.close();
+
+        if (!out)
+            throw runtime_error("Unable to write " + targetsPath);
+
+        outOffsets.push_back(cells);
+    }
+
+}
+
 ModelBuilder::ModelBuilder(Options options) : mean_srclen_multiplier(options.mean_srclen_multiplier),
                                               is_reverse(options.is_reverse),
                                               iterations(options.iterations),
@@ -30,12 +200,16 @@ ModelBuilder::ModelBuilder(Options options) : mean_srclen_multiplier(options.mea
                                               alpha(options.alpha),
                                               use_null(options.use_null),
                                               buffer_size(options.buffer_size),
+                                              sort_buffer_size(max(options.sort_buffer_size,
+                                                                   (size_t) numeric_limits<length_t>::max() + 1)),
                                               threads((options.threads == 0) ? (int) thread::hardware_concurrency()
-                                                                             : options.threads) {
+                                                                             : options.threads),
+                                              listener(NULL) {
     if (variational_bayes && alpha <= 0.0)
         throw invalid_argument("Parameter 'alpha' must be greather than 0");
 
     model = new Model(is_reverse, use_null, favor_diagonal, prob_align_null, options.initial_diagonal_tension);
+    model->SetPriorCacheSize(options.prior_cache_size);
 }
 
 void ModelBuilder::setListener(ModelBuilder::Listener *listener) {
@@ -109,6 +283,97 @@ void ModelBuilder::InitialPass(const Corpus &corpus, double *n_target_tokens, tt
     AllocateTTableSpace(ttable, buffer, maxSourceWord);
 }
 
+ExternalTTable *ModelBuilder::InitialPass(const BinaryCorpus &corpus, const string &temp_prefix,
+                                          double *n_target_tokens,
+                                          vector<pair<pair<length_t, length_t>, size_t>> *size_counts) {
+    static_assert(sizeof(wid_t) <= sizeof(uint32_t), "Cells are sorted as pairs of 32 bit words");
+
+    BinaryCorpusReader reader(corpus);
+
+    unordered_map<pair<length_t, length_t>, size_t, LengthPairHash> size_counts_;
+
+    vector<uint64_t> buffer;
+    buffer.reserve(sort_buffer_size);
+    const size_t capacity = buffer.capacity();
+
+    vector<string> runPaths;
+    sentence_pair_t pair;
+
+    // sorts the buffer to make room for "cells" more; word pairs repeat a lot, thus a run is
+    // written only if the unique pairs fill half the buffer or if there is still no room
+    auto flush = [&](size_t cells) {
+        SortCells(buffer);
+
+        if (buffer.size() >= sort_buffer_size / 2 || buffer.size() + cells > sort_buffer_size) {
+            runPaths.push_back(temp_prefix + ".run" + to_string(runPaths.size()));
+            WriteRun(buffer, runPaths.back());
+            buffer.clear();
+        }
+    };
+
+    while (reader.Read(pair)) {
+        const wid_t *src = is_reverse ? pair.target : pair.source;
+        const wid_t *trg = is_reverse ? pair.source : pair.target;
+        length_t src_size = is_reverse ? pair.target_length : pair.source_length;
+        length_t trg_size = is_reverse ? pair.source_length : pair.target_length;
+
+        *n_target_tokens += trg_size;
+
+        // the buffer is flushed before it would grow past its capacity, a pair longer than the
+        // whole buffer is split at its target words (the buffer always fits a target word)
+        size_t row = (size_t) src_size + (use_null ? 1 : 0);
+        size_t cells = row * trg_size;
+
+        if (buffer.size() + cells > sort_buffer_size)
+            flush(min(cells, sort_buffer_size));
+
+        for (length_t j = 0; j < trg_size; ++j) {
+            if (buffer.size() + row > sort_buffer_size)
+                flush(row);
+
+            if (use_null)
+                buffer.push_back(CellKey(kAlignerNullWord, trg[j]));
+
+            for (length_t i = 0; i < src_size; ++i)
+                buffer.push_back(CellKey(src[i], trg[j]));
+        }
+
+        assert(buffer.capacity() == capacity);
+
+        ++size_counts_[make_pair(trg_size, src_size)];
+    }
+
+    for (auto p = size_counts_.begin(); p != size_counts_.end(); ++p) {
+        size_counts->push_back(*p);
+    }
+
+    SortCells(buffer);
+
+    vector<CellRun *> runs;
+    runs.push_back(new CellRun(buffer));
+    for (auto path = runPaths.begin(); path != runPaths.end(); ++path)
+        runs.push_back(new CellRun(*path));
+
+    string targetsPath = temp_prefix + ".targets";
+    vector<uint64_t> offsets;
+
+    MergeRuns(runs, targetsPath, offsets);
+
+    for (auto run = runs.begin(); run != runs.end(); ++run)
+        delete *run;
+    for (auto path = runPaths.begin(); path != runPaths.end(); ++path)
+        remove(path->c_str());
+
+    vector<uint64_t>().swap(buffer);
+
+    ExternalTTable *table = new ExternalTTable(offsets, targetsPath);
+
+    // the targets stay mapped until the table is destroyed
+    remove(targetsPath.c_str());
+
+    return table;
+}
+
 void ModelBuilder::SwapTTables(ttable_t &source, ttable_t &destination) {
     if (destination.empty()) {
         destination.resize(source.size());
@@ -153,33 +418,35 @@ Model *ModelBuilder::Build(const Corpus &corpus, const string &model_filename) {
         CorpusReader reader(corpus);
         vector<pair<vector<wid_t>, vector<wid_t>>> batch;
 
+        double reading = 0, expectation = 0, merging = 0;
+
         if (listener) listener->Begin(kBuilderStepAligning, iter + 1);
-        while (reader.Read(batch, buffer_size)) {
-            emp_feat += model->ComputeAlignments(batch, &stagingArea, NULL);
+        while (true) {
+            auto begin = chrono::steady_clock::now();
+            bool more = reader.Read(batch, buffer_size);
+            reading += SecondsSince(begin);
+
+            if (!more)
+                break;
+
+            begin = chrono::steady_clock::now();
+            emp_feat += model->ComputeAlignments(batch, true, NULL);
+            expectation += SecondsSince(begin);
+
+            begin = chrono::steady_clock::now();
+            model->MergeCounts(stagingArea);
+            merging += SecondsSince(begin);
+
             batch.clear();
         }
         if (listener) listener->End(kBuilderStepAligning, iter + 1);
+        if (listener) listener->AligningTimes(iter + 1, reading, expectation, merging);
 
         emp_feat /= n_target_tokens;
 
         if (favor_diagonal && optimize_tension) {
             if (listener) listener->Begin(kBuilderStepOptimizingDiagonalTension, iter + 1);
-
-            for (int ii = 0; ii < 8; ++ii) {
-                double mod_feat = 0;
-#pragma omp parallel for reduction(+:mod_feat)
-                for (size_t i = 0; i < size_counts.size(); ++i) {
-                    const pair<length_t, length_t> &p = size_counts[i].first;
-                    for (length_t j = 1; j <= p.first; ++j)
-                        mod_feat += size_counts[i].second *
-                                    DiagonalAlignment::ComputeDLogZ(j, p.first, p.second, model->diagonal_tension);
-                }
-                mod_feat /= n_target_tokens;
-                model->diagonal_tension += (emp_feat - mod_feat) * 20.0;
-                if (model->diagonal_tension <= 0.1) model->diagonal_tension = 0.1;
-                if (model->diagonal_tension > 14) model->diagonal_tension = 14;
-            }
-
+            OptimizeDiagonalTension(emp_feat, n_target_tokens, size_counts);
             if (listener) listener->End(kBuilderStepOptimizingDiagonalTension, iter + 1);
         }
 
@@ -205,6 +472,107 @@ Model *ModelBuilder::Build(const Corpus &corpus, const string &model_filename) {
     return model;
 }
 
+Model *ModelBuilder::Build(const BinaryCorpus &corpus, const string &model_filename) {
+#ifdef _OPENMP
+    omp_set_dynamic(0);
+    omp_set_num_threads(threads);
+#endif
+
+    if (listener) listener->Begin();
+
+    vector<pair<pair<length_t, length_t>, size_t>> size_counts;
+    double n_target_tokens = 0;
+
+    if (listener) listener->Begin(kBuilderStepSetup, 0);
+    unique_ptr<ExternalTTable> table(InitialPass(corpus, model_filename + ".tmp", &n_target_tokens, &size_counts));
+    if (listener) listener->End(kBuilderStepSetup, 0);
+
+    vector<sentence_pair_t> batch;
+
+    for (int iter = 0; iter < iterations; ++iter) {
+        if (listener) listener->IterationBegin(iter + 1);
+
+        double emp_feat = 0.0;
+
+        BinaryCorpusReader reader(corpus);
+
+        double reading = 0, expectation = 0, merging = 0;
+
+        if (listener) listener->Begin(kBuilderStepAligning, iter + 1);
+        while (true) {
+            auto begin = chrono::steady_clock::now();
+            bool more = reader.Read(batch, buffer_size);
+            reading += SecondsSince(begin);
+
+            if (!more)
+                break;
+
+            begin = chrono::steady_clock::now();
+            emp_feat += model->ComputeAlignments(batch);
+            expectation += SecondsSince(begin);
+
+            begin = chrono::steady_clock::now();
+            model->MergeCounts(*table);
+            merging += SecondsSince(begin);
+        }
+        if (listener) listener->End(kBuilderStepAligning, iter + 1);
+        if (listener) listener->AligningTimes(iter + 1, reading, expectation, merging);
+
+        emp_feat /= n_target_tokens;
+
+        if (favor_diagonal && optimize_tension) {
+            if (listener) listener->Begin(kBuilderStepOptimizingDiagonalTension, iter + 1);
+            OptimizeDiagonalTension(emp_feat, n_target_tokens, size_counts);
+            if (listener) listener->End(kBuilderStepOptimizingDiagonalTension, iter + 1);
+        }
+
+        // as in Build(const Corpus &), the first iteration runs with no translation table at all
+        if (listener) listener->Begin(kBuilderStepNormalizing, iter + 1);
+        NormalizeTTable(*table, variational_bayes ? alpha : 0);
+        model->external_table = table.get();
+        if (listener) listener->End(kBuilderStepNormalizing, iter + 1);
+
+        if (listener) listener->IterationEnd(iter + 1);
+    }
+
+    if (listener) listener->Begin(kBuilderStepPruning, 0);
+    model->compact_table = table->ToCompactTTable(kPruneThreshold);
+    model->external_table = NULL;
+    table.reset();
+    if (listener) listener->End(kBuilderStepPruning, 0);
+
+    if (listener) listener->Begin(kBuilderStepStoringModel, 0);
+    model->Store(model_filename);
+    if (listener) listener->End(kBuilderStepStoringModel, 0);
+
+    if (listener) listener->End();
+
+    return model;
+}
+
+void ModelBuilder::OptimizeDiagonalTension(double emp_feat, double n_target_tokens,
+                                           const vector<pair<pair<length_t, length_t>, size_t>> &size_counts) {
+    double tension = model->diagonal_tension;
+
+    for (int ii = 0; ii < 8; ++ii) {
+        double mod_feat = 0;
+#pragma omp parallel for reduction(+:mod_feat)
+        for (size_t i = 0; i < size_counts.size(); ++i) {
+            const pair<length_t, length_t> &p = size_counts[i].first;
+            for (length_t j = 1; j <= p.first; ++j)
+                mod_feat += size_counts[i].second *
+                            DiagonalAlignment::ComputeDLogZ(j, p.first, p.second, tension);
+        }
+        mod_feat /= n_target_tokens;
+        tension += (emp_feat - mod_feat) * 20.0;
+        if (tension <= 0.1) tension = 0.1;
+        if (tension > 14) tension = 14;
+    }
+
+    // the cached diagonal priors are refreshed for the new tension
+    model->SetDiagonalTension(tension);
+}
+
 inline double digamma(double x) {
     double result = 0, xx, xx2, xx4;
     for (; x < 7; ++x)
@@ -236,3 +604,28 @@ void ModelBuilder::NormalizeTTable(ttable_t &table, double alpha) {
             cell->second = alpha > 0 ? exp(digamma(cell->second + alpha) - row_norm) : cell->second / row_norm;
     }
 }
+
+void ModelBuilder::NormalizeTTable(ExternalTTable &table, double alpha) {
+    const vector<uint64_t> &offsets = table.offsets;
+
+#pragma omp parallel for schedule(dynamic)
+    for (size_t i = 0; i < table.GetRows(); ++i) {
+        uint64_t begin = offsets[i];
+        uint64_t end = offsets[i + 1];
+        double row_norm = 0;
+
+        for (uint64_t cell = begin; cell < end; ++cell)
+            row_norm += table.counts[cell] + alpha;
+
+        if (row_norm == 0) row_norm = 1;
+
+        if (alpha > 0)
+            row_norm = digamma(row_norm);
+
+        for (uint64_t cell = begin; cell < end; ++cell) {
+            double count = table.counts[cell];
+            table.values[cell] = alpha > 0 ? exp(digamma(count + alpha) - row_norm) : count / row_norm;
+            table.counts[cell] = 0;
+        }
+    }
+}
@@ -9,6 +9,7 @@
 #include <string>
 #include "Model.h"
 #include "Corpus.h"
+#include "BinaryCorpus.h"
 
 using namespace std;
 
@@ -28,6 +29,8 @@ namespace mmt {
             bool use_null = true;
             int threads = 0; // Default is number of CPUs
             size_t buffer_size = 10000;
+            size_t sort_buffer_size = 100000000; // Word pairs (8 bytes each) sorted in memory when training from a BinaryCorpus, at least 65536
+            size_t prior_cache_size = 128 * 1024 * 1024; // Bytes of diagonal priors cached while training, see DiagonalPriorCache
 
             Options(bool is_reverse = false) : is_reverse(is_reverse) {};
         };
@@ -54,6 +57,10 @@ namespace mmt {
 
                 virtual void End(const BuilderStep step, int iteration) = 0;
 
+                // Time spent, in seconds, in the phases of the kBuilderStepAligning step: reading the
+                // corpus, computing the expected counts and merging them into the translation table
+                virtual void AligningTimes(int iteration, double reading, double expectation, double merging) {};
+
                 virtual void IterationEnd(int iteration) = 0;
 
                 virtual void End() = 0;
@@ -65,6 +72,16 @@ namespace mmt {
 
             Model *Build(const Corpus &corpus, const string &model_filename);
 
+            /**
+             * Trains the model in external memory: the word pairs of the corpus are sorted in runs
+             * of "sort_buffer_size" pairs written next to the model file, then merged into the cells
+             * of an ExternalTTable, and every EM iteration reads the corpus in place. Besides the
+             * sort buffer, the memory used is about 16 bytes per cell of the translation table,
+             * independently from the size of the corpus. The result is the model of
+             * Build(const Corpus &), up to the rounding of the sums of the expected counts.
+             */
+            Model *Build(const BinaryCorpus &corpus, const string &model_filename);
+
         private:
             const double mean_srclen_multiplier;
             const bool is_reverse;
@@ -76,6 +93,7 @@ namespace mmt {
             const double alpha;
             const bool use_null;
             const size_t buffer_size;
+            const size_t sort_buffer_size;
             const int threads;
 
             Listener *listener;
@@ -92,7 +110,15 @@ namespace mmt {
             void InitialPass(const Corpus &corpus, double *n_target_tokens, ttable_t &ttable,
                              vector<pair<pair<length_t, length_t>, size_t>> *size_counts);
 
+            ExternalTTable *InitialPass(const BinaryCorpus &corpus, const string &temp_prefix, double *n_target_tokens,
+                                        vector<pair<pair<length_t, length_t>, size_t>> *size_counts);
+
+            void OptimizeDiagonalTension(double emp_feat, double n_target_tokens,
+                                         const vector<pair<pair<length_t, length_t>, size_t>> &size_counts);
+
             void NormalizeTTable(ttable_t &table, double alpha = 0);
+
+            void NormalizeTTable(ExternalTTable &table, double alpha = 0);
         };
 
     }
@@ -0,0 +1,244 @@
+//
+// Online adaptation of the models of a FastAligner to the updates stream.
+//
+
+#include "UpdateManager.h"
+#include <cerrno>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <limits>
+#include <stdexcept>
+
+using namespace mmt;
+using namespace mmt::fastalign;
+
+namespace {
+
+    const char kStateMagic[8] = {'F', 'A', 'D', 'E', 'L', 'T', 'A', '\n'};
+    const uint32_t kStateVersion = 1;
+
+    void UpdateStreams(vector<seqid_t> &streams, const updateid_t &id) {
+        if ((size_t) id.stream_id >= streams.size())
+            streams.resize(((size_t) id.stream_id) + 1, -1);
+
+        if (id.sentence_id > streams[id.stream_id])
+            streams[id.stream_id] = id.sentence_id;
+    }
+
+}
+
+UpdateManager::UpdateManager(Model *forwardModel, Model *backwardModel, const string &statePath,
+                             const AdaptationOptions &options) :
+        forwardModel(forwardModel), backwardModel(backwardModel), statePath(statePath), options(options),
+        logger("fastalign.UpdateManager"), stop(false) {
+    forwardModel->EnableAdaptation(options.prior_strength);
+    backwardModel->EnableAdaptation(options.prior_strength);
+
+    // the updates are received again from the start of the streams, the static models are enough
+    // to begin with
+    try {
+        LoadState();
+    } catch (exception &e) {
+        LogError(logger) << "Discarding the aligner updates: " << e.what();
+
+        appliedStreams.clear();
+        forwardModel->ClearAdaptation();
+        backwardModel->ClearAdaptation();
+    }
+
+    receivedStreams = appliedStreams;
+
+    foregroundBatch = new batch_t();
+    backgroundBatch = new batch_t();
+
+    backgroundThread = new boost::thread(boost::bind(&UpdateManager::BackgroundThreadRun, this));
+}
+
+UpdateManager::~UpdateManager() {
+    {
+        lock_guard<mutex> lock(batchAccess);
+        stop = true;
+    }
+    batchFull.notify_one();
+
+    backgroundThread->join();
+
+    delete backgroundThread;
+    delete foregroundBatch;
+    delete backgroundBatch;
+}
+
+void UpdateManager::Add(const updateid_t &id, const vector<wid_t> &source, const vector<wid_t> &target) {
+    if (id.stream_id < 0)
+        throw invalid_argument("Invalid stream id " + to_string(id.stream_id));
+
+    if ((size_t) id.stream_id < receivedStreams.size() && id.sentence_id <= receivedStreams[id.stream_id])
+        return;
+
+    UpdateStreams(receivedStreams, id);
+
+    unique_lock<mutex> lock(batchAccess);
+
+    // an empty pair teaches nothing, but its id is applied with the batch all the same, otherwise
+    // it would be received again after a restart
+    if (source.empty() || target.empty()) {
+        UpdateStreams(foregroundBatch->streams, id);
+        return;
+    }
+
+    while (foregroundBatch->pairs.size() >= options.buffer_size) {
+        batchFull.notify_one();
+        batchSwapped.wait(lock);
+    }
+
+    foregroundBatch->pairs.push_back(pair<vector<wid_t>, vector<wid_t>>(source, target));
+    UpdateStreams(foregroundBatch->streams, id);
+
+    if (foregroundBatch->pairs.size() >= options.buffer_size)
+        batchFull.notify_one();
+}
+
+unordered_map<stream_t, seqid_t> UpdateManager::GetLatestUpdatesIdentifier() {
+    unordered_map<stream_t, seqid_t> result;
+
+    lock_guard<mutex> lock(streamsAccess);
+    for (size_t i = 0; i < appliedStreams.size(); ++i) {
+        if (appliedStreams[i] >= 0)
+            result[(stream_t) i] = appliedStreams[i];
+    }
+
+    return result;
+}
+
+void UpdateManager::BackgroundThreadRun() {
+    auto timeout = std::chrono::milliseconds((int64_t) (options.max_delay * 1000.));
+    auto interval = std::chrono::milliseconds((int64_t) (options.consolidation_interval * 1000.));
+
+    auto lastConsolidation = std::chrono::steady_clock::now();
+    bool consolidated = true;
+
+    // the updates still pending when the manager is destroyed are applied and consolidated
+    bool running = true;
+    while (running) {
+        {
+            unique_lock<mutex> lock(batchAccess);
+            batchFull.wait_for(lock, timeout, [this] {
+                return stop || foregroundBatch->pairs.size() >= options.buffer_size;
+            });
+
+            running = !stop;
+
+            batch_t *tmp = backgroundBatch;
+            backgroundBatch = foregroundBatch;
+            foregroundBatch = tmp;
+        }
+        batchSwapped.notify_all();
+
+        if (!backgroundBatch->streams.empty()) {
+            Apply(*backgroundBatch);
+            consolidated = false;
+        }
+
+        backgroundBatch->pairs.clear();
+        backgroundBatch->streams.clear();
+
+        if (!consolidated && (!running || std::chrono::steady_clock::now() - lastConsolidation >= interval)) {
+            try {
+                Consolidate();
+                consolidated = true;
+            } catch (exception &e) {
+                // the state on disk is still the previous one, consolidation is attempted again later
+                LogError(logger) << "Unable to consolidate the aligner updates: " << e.what();
+            }
+
+            lastConsolidation = std::chrono::steady_clock::now();
+        }
+    }
+}
+
+void UpdateManager::Apply(const batch_t &batch) {
+    if (!batch.pairs.empty()) {
+        forwardModel->Adapt(batch.pairs);
+        backwardModel->Adapt(batch.pairs);
+    }
+
+    // a delta table can exceed its budget by one batch, then it is pruned to half of the budget,
+    // so that the pruning does not run again at every batch
+    size_t target = options.max_cells / 2;
+
+    if (forwardModel->GetAdaptationSize() > options.max_cells)
+        forwardModel->PruneAdaptation(target);
+    if (backwardModel->GetAdaptationSize() > options.max_cells)
+        backwardModel->PruneAdaptation(target);
+
+    lock_guard<mutex> lock(streamsAccess);
+    for (size_t i = 0; i < batch.streams.size(); ++i) {
+        if (batch.streams[i] >= 0)
+            UpdateStreams(appliedStreams, updateid_t((stream_t) i, batch.streams[i]));
+    }
+}
+
+void UpdateManager::Consolidate() {
+    vector<seqid_t> streams;
+    {
+        lock_guard<mutex> lock(streamsAccess);
+        streams = appliedStreams;
+    }
+
+    string tempPath = statePath + ".tmp";
+    ofstream out(tempPath, ios::binary | ios::out | ios::trunc);
+
+    uint32_t version = kStateVersion;
+    uint32_t wordSize = sizeof(wid_t);
+    uint64_t streamCount = streams.size();
+
+    out.write(kStateMagic, sizeof(kStateMagic));
+    out.write((const char *) &version, sizeof(uint32_t));
+    out.write((const char *) &wordSize, sizeof(uint32_t));
+    out.write((const char *) &streamCount, sizeof(uint64_t));
+    out.write((const char *) streams.data(), streamCount * sizeof(seqid_t));
+
+    // only the background thread modifies the delta tables: they match the ids above
+    forwardModel->StoreAdaptation(out);
+    backwardModel->StoreAdaptation(out);
+
+    out.close();
+
+    if (!out)
+        throw runtime_error("Unable to write " + tempPath);
+
+    if (rename(tempPath.c_str(), statePath.c_str()) != 0)
+        throw runtime_error("Unable to rename " + tempPath + ": " + strerror(errno));
+}
+
+void UpdateManager::LoadState() {
+    ifstream in(statePath, ios::binary | ios::in);
+    if (!in.is_open())
+        return;
+
+    char magic[sizeof(kStateMagic)];
+    uint32_t version = 0;
+    uint32_t wordSize = 0;
+    uint64_t streamCount = 0;
+
+    // a stream id is a stream_t, at most one entry for every non-negative value
+    const uint64_t maxStreamCount = (uint64_t) numeric_limits<stream_t>::max() + 1;
+
+    in.read(magic, sizeof(magic));
+    in.read((char *) &version, sizeof(uint32_t));
+    in.read((char *) &wordSize, sizeof(uint32_t));
+    in.read((char *) &streamCount, sizeof(uint64_t));
+
+    if (!in || memcmp(magic, kStateMagic, sizeof(magic)) != 0 || version != kStateVersion ||
+        wordSize != sizeof(wid_t) || streamCount > maxStreamCount)
+        throw runtime_error("Invalid aligner updates file " + statePath);
+
+    appliedStreams.resize((size_t) streamCount);
+    in.read((char *) appliedStreams.data(), streamCount * sizeof(seqid_t));
+
+    forwardModel->LoadAdaptation(in);
+    backwardModel->LoadAdaptation(in);
+}
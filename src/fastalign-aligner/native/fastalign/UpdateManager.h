@@ -0,0 +1,95 @@
+//
+// Online adaptation of the models of a FastAligner to the updates stream.
+//
+
+#ifndef FASTALIGN_UPDATEMANAGER_H
+#define FASTALIGN_UPDATEMANAGER_H
+
+#include <cstddef>
+#include <mutex>
+#include <condition_variable>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include <boost/thread.hpp>
+#include <mmt/IncrementalModel.h>
+#include <mmt/logging/Logger.h>
+#include "Model.h"
+
+using namespace std;
+
+namespace mmt {
+    namespace fastalign {
+
+        struct AdaptationOptions {
+            double prior_strength = 5.0; // Strength of the base translation table, see DeltaTTable
+            size_t max_cells = 2000000; // Maximum number of cells of every delta table
+            size_t buffer_size = 1000; // Maximum number of pending sentence pairs
+            double max_delay = 1.0; // Seconds before a pending sentence pair is applied
+            double consolidation_interval = 60.; // Seconds between two snapshots of the delta tables
+        };
+
+        /**
+         * Collects the sentence pairs of the updates stream and applies them in background, one batch
+         * at a time, as a step of online EM on both the forward and the backward model.
+         *
+         * A delta table that grows beyond its budget is pruned to half of it: the counts of word pairs
+         * unknown to the base model start very small and grow with EM, thus the pruning must leave
+         * them room. Periodically the delta tables are consolidated: they are written to "statePath"
+         * together with the ids of the updates they contain. The file is replaced atomically, so the
+         * ids returned after a restart always match the counts that have been restored; the updates
+         * received after the last consolidation are simply received again.
+         */
+        class UpdateManager {
+        public:
+            UpdateManager(Model *forwardModel, Model *backwardModel, const string &statePath,
+                          const AdaptationOptions &options = AdaptationOptions());
+
+            ~UpdateManager();
+
+            // Must be called by one thread at a time
+            void Add(const updateid_t &id, const vector<wid_t> &source, const vector<wid_t> &target);
+
+            unordered_map<stream_t, seqid_t> GetLatestUpdatesIdentifier();
+
+        private:
+            struct batch_t {
+                vector<pair<vector<wid_t>, vector<wid_t>>> pairs;
+                vector<seqid_t> streams;
+            };
+
+            Model *forwardModel;
+            Model *backwardModel;
+            const string statePath;
+            const AdaptationOptions options;
+            const logging::Logger logger;
+
+            // latest ids received by Add(), and latest ids applied to the models
+            vector<seqid_t> receivedStreams;
+            vector<seqid_t> appliedStreams;
+            mutex streamsAccess;
+
+            // the foreground batch collects the new updates while the background one is applied
+            batch_t *foregroundBatch;
+            batch_t *backgroundBatch;
+
+            mutex batchAccess;
+            condition_variable batchFull;
+            condition_variable batchSwapped;
+
+            boost::thread *backgroundThread;
+            bool stop;
+
+            void BackgroundThreadRun();
+
+            void Apply(const batch_t &batch);
+
+            void Consolidate();
+
+            void LoadState();
+        };
+
+    }
+}
+
+#endif //FASTALIGN_UPDATEMANAGER_H
@@ -5,6 +5,7 @@
 #include "javah/eu_modernmt_aligner_fastalign_FastAlign.h"
 #include "fastalign/FastAligner.h"
 #include <mmt/jniutil.h>
+#include <stdexcept>
 #ifdef _OPENMP
 #include <omp.h>
 #endif
@@ -24,91 +25,126 @@ inline void ParseSentence(JNIEnv *jvm, jintArray jarray, vector<wid_t> &outSente
     jvm->ReleaseIntArrayElements(jarray, array, 0);
 }
 
-inline jintArray AlignmentToArray(JNIEnv *jvm, alignment_t align) {
-    jsize hsize = (jsize) align.size();
-    jsize size = (jsize) (hsize * 2);
-
-    jint *buffer = new jint[size];
-    for (jsize i = 0; i < hsize; i++) {
-        pair<length_t, length_t> &pair = align[i];
-        buffer[i] = pair.first;
-        buffer[i + hsize] = pair.second;
-    }
-
-    jintArray jarray = jvm->NewIntArray(size);
-    jvm->SetIntArrayRegion(jarray, 0, size, buffer);
-    delete[] buffer;
-
-    return jarray;
-}
-
 
 /*
  * Class:     eu_modernmt_aligner_fastalign_FastAlign
  * Method:    instantiate
- * Signature: (Ljava/lang/String;I)J
+ * Signature: (Ljava/lang/String;IZ)J
  */
 JNIEXPORT jlong JNICALL
-Java_eu_modernmt_aligner_fastalign_FastAlign_instantiate(JNIEnv *jvm, jobject jself, jstring jmodel, jint threads) {
+Java_eu_modernmt_aligner_fastalign_FastAlign_instantiate(JNIEnv *jvm, jobject jself, jstring jmodel, jint threads,
+                                                         jboolean jadaptive) {
 #ifdef _OPENMP
     omp_set_dynamic(0);
     omp_set_num_threads(threads);
 #endif
 
     string modelPath = jni_jstrtostr(jvm, jmodel);
-    return (jlong) FastAligner::Open(modelPath);
+
+    try {
+        return (jlong) FastAligner::Open(modelPath, 0, jadaptive == JNI_TRUE);
+    } catch (exception &e) {
+        jni_throw(jvm, "java/io/IOException", e.what());
+        return 0;
+    }
 }
 
 
 /*
  * Class:     eu_modernmt_aligner_fastalign_FastAlign
- * Method:    align
- * Signature: ([I[II)[I
+ * Method:    alignBatch
+ * Signature: (Ljava/nio/ByteBuffer;ILjava/nio/ByteBuffer;I)V
  */
-JNIEXPORT jintArray JNICALL
-Java_eu_modernmt_aligner_fastalign_FastAlign_align___3I_3II(JNIEnv *jvm, jobject jself, jintArray jsource,
-                                                            jintArray jtarget, jint jstrategy) {
+JNIEXPORT void JNICALL
+Java_eu_modernmt_aligner_fastalign_FastAlign_alignBatch(JNIEnv *jvm, jobject jself, jobject jinput, jint jsize,
+                                                        jobject joutput, jint jstrategy) {
     FastAligner *aligner = jni_gethandle<FastAligner>(jvm, jself);
 
-    vector<wid_t> source, target;
-    ParseSentence(jvm, jsource, source);
-    ParseSentence(jvm, jtarget, target);
+    // the buffers are direct and in native order: the sentences are read and the alignments are
+    // written in place, without copies
+    uint32_t *input = (uint32_t *) jvm->GetDirectBufferAddress(jinput);
+    uint32_t *output = (uint32_t *) jvm->GetDirectBufferAddress(joutput);
 
-    alignment_t align = aligner->GetAlignment(source, target, (SymmetrizationStrategy) jstrategy);
+    if (input == NULL || output == NULL) {
+        jni_throw(jvm, "java/lang/IllegalArgumentException", "Buffers must be direct");
+        return;
+    }
+
+    size_t inputSize = (size_t) jvm->GetDirectBufferCapacity(jinput) / sizeof(uint32_t);
+    size_t outputSize = (size_t) jvm->GetDirectBufferCapacity(joutput) / sizeof(uint32_t);
 
-    return AlignmentToArray(jvm, align);
+    try {
+        aligner->GetAlignments(input, inputSize, (size_t) jsize, output, outputSize,
+                               (SymmetrizationStrategy) jstrategy);
+    } catch (invalid_argument &e) {
+        jni_throw(jvm, "java/lang/IllegalArgumentException", e.what());
+    } catch (exception &e) {
+        jni_throw(jvm, "eu/modernmt/aligner/AlignerException", e.what());
+    }
 }
 
 /*
  * Class:     eu_modernmt_aligner_fastalign_FastAlign
- * Method:    align
- * Signature: ([[I[[I[[II)V
+ * Method:    updateReceived
+ * Signature: (IJI[I[I)V
  */
 JNIEXPORT void JNICALL
-Java_eu_modernmt_aligner_fastalign_FastAlign_align___3_3I_3_3I_3_3II(JNIEnv *jvm, jobject jself, jobjectArray jsources,
-                                                                     jobjectArray jtargets, jobjectArray joutput,
-                                                                     jint jstrategy) {
+Java_eu_modernmt_aligner_fastalign_FastAlign_updateReceived(JNIEnv *jvm, jobject jself, jint jstreamId,
+                                                            jlong jsentenceId, jint jdomain, jintArray jsource,
+                                                            jintArray jtarget) {
     FastAligner *aligner = jni_gethandle<FastAligner>(jvm, jself);
-    jsize length = jvm->GetArrayLength(jsources);
 
-    vector<pair<vector<wid_t>, vector<wid_t>>> batch;
-    batch.reserve((size_t) length);
+    updateid_t id((stream_t) jstreamId, (seqid_t) jsentenceId);
+    domain_t domain = (domain_t) jdomain;
+
+    vector<wid_t> source, target;
+    ParseSentence(jvm, jsource, source);
+    ParseSentence(jvm, jtarget, target);
 
-    for (jsize i = 0; i < length; i++) {
-        vector<wid_t> source, target;
-        ParseSentence(jvm, (jintArray) jvm->GetObjectArrayElement(jsources, i), source);
-        ParseSentence(jvm, (jintArray) jvm->GetObjectArrayElement(jtargets, i), target);
+    try {
+        aligner->Add(id, domain, source, target, alignment_t());
+    } catch (exception &e) {
+        jni_throw(jvm, "java/lang/RuntimeException", e.what());
+    }
+}
 
-        batch.push_back(pair<vector<wid_t>, vector<wid_t>>(source, target));
+/*
+ * Class:     eu_modernmt_aligner_fastalign_FastAlign
+ * Method:    getLatestUpdatesIdentifier
+ * Signature: ()[J
+ */
+JNIEXPORT jlongArray JNICALL
+Java_eu_modernmt_aligner_fastalign_FastAlign_getLatestUpdatesIdentifier(JNIEnv *jvm, jobject jself) {
+    FastAligner *aligner = jni_gethandle<FastAligner>(jvm, jself);
+
+    unordered_map<stream_t, seqid_t> ids;
+
+    try {
+        ids = aligner->GetLatestUpdatesIdentifier();
+    } catch (exception &e) {
+        jni_throw(jvm, "java/lang/RuntimeException", e.what());
+        return NULL;
     }
 
-    vector<alignment_t> alignments;
-    aligner->GetAlignments(batch, alignments, (SymmetrizationStrategy) jstrategy);
+    vector<jlong> jidsArray;
+    for (auto id = ids.begin(); id != ids.end(); ++id) {
+        if (id->first < 0)
+            continue;
+
+        size_t stream = (size_t) id->first;
+
+        if (stream >= jidsArray.size())
+            jidsArray.resize(stream + 1, -1);
 
-    for (jsize i = 0; i < ((jsize) alignments.size()); i++) {
-        jintArray alignment = AlignmentToArray(jvm, alignments[i]);
-        jvm->SetObjectArrayElement(joutput, i, alignment);
+        jidsArray[stream] = (jlong) id->second;
     }
+
+    jsize size = (jsize) jidsArray.size();
+
+    jlongArray jarray = jvm->NewLongArray(size);
+    jvm->SetLongArrayRegion(jarray, 0, size, jidsArray.data());
+
+    return jarray;
 }
 
 /*
@@ -3,18 +3,12 @@
 //
 
 #include "SymAlignment.h"
-#include <stdlib.h>
-#include <cstring>
 
 using namespace std;
 using namespace mmt;
 using namespace fastalign;
 
-#define IsInIntersection(a) (((a) & 0x03) == 0x03)
-#define IsInUnion(a) (((a) & 0x03) > 0)
-#define HasBeenAdded(a) (((a) & 0x04) == 0x04)
-#define IsInForward(a) (((a) & 0x01) > 0)
-#define IsInBackward(a) (((a) & 0x02) > 0)
+const size_t SymAlignment::kWordBits;
 
 static const int kGrowDiagonalNeighbors[8][2] = {
         // Grow
@@ -33,67 +27,96 @@ static const int kGrowDiagonalNeighbors[8][2] = {
 void SymAlignment::Reset(size_t _source_length, size_t _target_length) {
     source_length = _source_length;
     target_length = _target_length;
+    row_words = (source_length + kWordBits - 1) / kWordBits;
 
-    size_t m_size_ = source_length * target_length;
-    if (m_size_ > m_size) {
-        m_size = m_size_;
-        m = (uint8_t *) realloc(m, m_size);
-    }
-
-    if (source_length > src_coverage_size) {
-        src_coverage_size = source_length;
-        src_coverage = (uint8_t *) realloc(src_coverage, src_coverage_size);
-    }
-
-    if (target_length > trg_coverage_size) {
-        trg_coverage_size = target_length;
-        trg_coverage = (uint8_t *) realloc(trg_coverage, trg_coverage_size);
-    }
+    // assign() keeps the capacity: a reused instance does not allocate for shorter sentences
+    size_t size = row_words * target_length;
+    forward_points.assign(size, 0);
+    backward_points.assign(size, 0);
+    points.assign(size, 0);
 
-    memset(m, 0, m_size);
-    memset(src_coverage, 0, src_coverage_size);
-    memset(trg_coverage, 0, trg_coverage_size);
+    src_coverage.assign(source_length, 0);
+    trg_coverage.assign(target_length, 0);
 }
 
 void SymAlignment::Union(const alignment_t &forward, const alignment_t &backward) {
     Merge(forward, backward);
+
+    for (size_t i = 0; i < points.size(); ++i)
+        points[i] = forward_points[i] | backward_points[i];
 }
 
 void SymAlignment::Intersection(const alignment_t &forward, const alignment_t &backward) {
     Merge(forward, backward);
 
-    for (size_t i = 0; i < (source_length * target_length); ++i) {
-        m[i] = (uint8_t) (IsInIntersection(m[i]) ? 1 : 0);
+    for (size_t i = 0; i < points.size(); ++i)
+        points[i] = forward_points[i] & backward_points[i];
+}
+
+bool SymAlignment::HasCandidates(size_t t) const {
+    // a point can be added only if it is in the union and it is not already in the alignment
+    // (every point of the alignment covers both its words): the row is skipped if no such point
+    // is in the 3x3 neighborhood of one of its points
+    const word_t *row = points.data() + t * row_words;
+
+    for (size_t w = 0; w < row_words; ++w) {
+        word_t neighborhood = row[w] | (row[w] << 1) | (row[w] >> 1);
+        if (w > 0)
+            neighborhood |= row[w - 1] >> (kWordBits - 1);
+        if (w + 1 < row_words)
+            neighborhood |= row[w + 1] << (kWordBits - 1);
+
+        if (neighborhood == 0)
+            continue;
+
+        word_t candidates = 0;
+        for (size_t nt = (t > 0 ? t - 1 : t); nt <= t + 1 && nt < target_length; ++nt) {
+            size_t i = nt * row_words + w;
+            candidates |= (forward_points[i] | backward_points[i]) & ~points[i];
+        }
+
+        if (neighborhood & candidates)
+            return true;
     }
+
+    return false;
 }
 
 void SymAlignment::Grow(const alignment_t &forward, const alignment_t &backward, bool diagonal, bool final) {
-    Merge(forward, backward);
+    Intersection(forward, backward);
+
+    for (size_t t = 0; t < target_length; ++t) {
+        for (size_t s = Next(points, t, 0); s < source_length; s = Next(points, t, s + 1)) {
+            src_coverage[s] = 1;
+            trg_coverage[t] = 1;
+        }
+    }
 
     size_t neighbors_size = diagonal ? 8 : 4;
 
+    // the points are visited in the order of the cell by cell scan (target, then source), and a
+    // point added after the current one in that order is visited in the same pass: the coverage,
+    // thus the result, is exactly the one of the scan
     bool added = true;
     while (added) {
         added = false;
 
         for (size_t t = 0; t < target_length; ++t) {
-            for (size_t s = 0; s < source_length; ++s) {
-                uint8_t point = m[idx(s, t)];
-
-                if (IsInIntersection(point) || HasBeenAdded(point)) {
-                    for (size_t ni = 0; ni < neighbors_size; ++ni) {
-                        size_t ns = s + kGrowDiagonalNeighbors[ni][0];
-                        size_t nt = t + kGrowDiagonalNeighbors[ni][1];
-
-                        if (ns >= source_length || nt >= target_length)
-                            continue; // point is outside matrix
-
-                        if (!(src_coverage[ns] && trg_coverage[nt]) && IsInUnion(m[idx(ns, nt)])) {
-                            m[idx(ns, nt)] |= 0x04;
-                            src_coverage[ns] = 1;
-                            trg_coverage[nt] = 1;
-                            added = true;
-                        }
+            if (!HasCandidates(t))
+                continue;
+
+            for (size_t s = Next(points, t, 0); s < source_length; s = Next(points, t, s + 1)) {
+                for (size_t ni = 0; ni < neighbors_size; ++ni) {
+                    size_t ns = s + kGrowDiagonalNeighbors[ni][0];
+                    size_t nt = t + kGrowDiagonalNeighbors[ni][1];
+
+                    if (ns >= source_length || nt >= target_length)
+                        continue; // point is outside matrix
+
+                    if (!(src_coverage[ns] && trg_coverage[nt]) &&
+                        (Test(forward_points, ns, nt) || Test(backward_points, ns, nt))) {
+                        Add(ns, nt);
+                        added = true;
                     }
                 }
             }
@@ -101,41 +124,43 @@ void SymAlignment::Grow(const alignment_t &forward, const alignment_t &backward,
     }
 
     if (final) {
-        // Forward Final-And
-        for (size_t t = 0; t < target_length; ++t) {
-            for (size_t s = 0; s < source_length; ++s) {
-                if (IsInForward(m[idx(s, t)]) && !(src_coverage[s] || trg_coverage[t])) {
-                    m[idx(s, t)] |= 0x04;
-                    src_coverage[s] = 1;
-                    trg_coverage[t] = 1;
-                }
-            }
-        }
+        FinalAnd(forward_points);
+        FinalAnd(backward_points);
+    }
+}
 
-        // Forward Final-And
-        for (size_t t = 0; t < target_length; ++t) {
-            for (size_t s = 0; s < source_length; ++s) {
-                if (IsInBackward(m[idx(s, t)]) && !(src_coverage[s] || trg_coverage[t])) {
-                    m[idx(s, t)] |= 0x04;
-                    src_coverage[s] = 1;
-                    trg_coverage[t] = 1;
-                }
+void SymAlignment::FinalAnd(const vector<word_t> &matrix) {
+    for (size_t t = 0; t < target_length; ++t) {
+        if (trg_coverage[t])
+            continue;
+
+        for (size_t s = Next(matrix, t, 0); s < source_length; s = Next(matrix, t, s + 1)) {
+            if (!src_coverage[s]) {
+                Add(s, t);
+                break; // the target word is now covered
             }
         }
     }
-
-    for (size_t i = 0; i < (source_length * target_length); ++i)
-        m[i] = (uint8_t) (IsInIntersection(m[i]) || HasBeenAdded(m[i]) ? 1 : 0);
 }
 
 alignment_t SymAlignment::ToAlignment() {
-    alignment_t alignment;
+    // the rows are target positions: the points are counted for every source position, then
+    // scattered so that they are sorted by source position, then target position
+    src_offsets.assign(source_length + 1, 0);
 
-    for (size_t s = 0; s < source_length; ++s) {
-        for (size_t t = 0; t < target_length; ++t) {
-            if (m[idx(s, t)] > 0)
-                alignment.push_back(pair<size_t, size_t>(s, t));
-        }
+    for (size_t t = 0; t < target_length; ++t) {
+        for (size_t s = Next(points, t, 0); s < source_length; s = Next(points, t, s + 1))
+            src_offsets[s + 1]++;
+    }
+
+    for (size_t s = 0; s < source_length; ++s)
+        src_offsets[s + 1] += src_offsets[s];
+
+    alignment_t alignment(src_offsets[source_length]);
+
+    for (size_t t = 0; t < target_length; ++t) {
+        for (size_t s = Next(points, t, 0); s < source_length; s = Next(points, t, s + 1))
+            alignment[src_offsets[s]++] = pair<length_t, length_t>((length_t) s, (length_t) t);
     }
 
     return alignment;
@@ -6,11 +6,20 @@
 #define FASTALIGN_SYMMETRIZER_H
 
 #include <stddef.h>
+#include <stdint.h>
+#include <vector>
 #include <mmt/sentence.h>
 
 namespace mmt {
     namespace fastalign {
 
+        /**
+         * The alignments are stored as bit matrices with a row for every target position: the bit s
+         * of a row is the source position s, and a row takes (source_length + 63) / 64 words.
+         * Union and intersection are computed a word at a time; Grow visits only the points of the
+         * symmetrized alignment, in the same order of the original cell by cell implementation,
+         * and skips the rows that have no candidate point around them.
+         */
         class SymAlignment {
         public:
 
@@ -20,12 +29,6 @@ namespace mmt {
                 Reset(source_length, target_length);
             }
 
-            ~SymAlignment() {
-                delete[] m;
-                delete[] src_coverage;
-                delete[] trg_coverage;
-            }
-
             void Reset(size_t source_length, size_t target_length);
 
             void Union(const alignment_t &forward, const alignment_t &backward);
@@ -38,38 +41,66 @@ namespace mmt {
             alignment_t ToAlignment();
 
         private:
+            typedef uint64_t word_t;
+
+            static const size_t kWordBits = 64;
+
             size_t source_length = 0;
             size_t target_length = 0;
+            size_t row_words = 0;
 
-            uint8_t *m = NULL;
-            uint8_t *src_coverage = NULL;
-            uint8_t *trg_coverage = NULL;
+            std::vector<word_t> forward_points;
+            std::vector<word_t> backward_points;
+            std::vector<word_t> points; // the symmetrized alignment
 
-            size_t m_size = 0;
-            size_t src_coverage_size = 0;
-            size_t trg_coverage_size = 0;
+            std::vector<uint8_t> src_coverage;
+            std::vector<uint8_t> trg_coverage;
 
-            inline size_t idx(size_t s, size_t t) {
-                return s * target_length + t;
+            std::vector<size_t> src_offsets; // used by ToAlignment()
+
+            inline void Set(std::vector<word_t> &matrix, size_t s, size_t t) {
+                matrix[t * row_words + s / kWordBits] |= ((word_t) 1) << (s % kWordBits);
             }
 
-            inline void Merge(const alignment_t &forward, const alignment_t &backward) {
-                for (auto it = forward.begin(); it != forward.end(); ++it)
-                    m[idx(it->first, it->second)] |= 0x01;
+            inline bool Test(const std::vector<word_t> &matrix, size_t s, size_t t) const {
+                return ((matrix[t * row_words + s / kWordBits] >> (s % kWordBits)) & 1) != 0;
+            }
 
-                for (auto it = backward.begin(); it != backward.end(); ++it) {
-                    size_t i = idx(it->first, it->second);
+            // First source position not lower than "s" set in the row "t" of "matrix", or source_length
+            inline size_t Next(const std::vector<word_t> &matrix, size_t t, size_t s) const {
+                if (s >= source_length)
+                    return source_length;
 
-                    m[i] |= 0x02;
+                const word_t *row = matrix.data() + t * row_words;
+                size_t w = s / kWordBits;
+                word_t word = row[w] & (~((word_t) 0) << (s % kWordBits));
 
-                    if ((m[i] & 0x03) == 0x03) {
-                        src_coverage[it->first] = 1;
-                        trg_coverage[it->second] = 1;
-                    }
+                while (word == 0) {
+                    if (++w == row_words)
+                        return source_length;
+                    word = row[w];
                 }
 
+                return w * kWordBits + (size_t) __builtin_ctzll(word);
             }
 
+            inline void Add(size_t s, size_t t) {
+                Set(points, s, t);
+                src_coverage[s] = 1;
+                trg_coverage[t] = 1;
+            }
+
+            inline void Merge(const alignment_t &forward, const alignment_t &backward) {
+                for (auto it = forward.begin(); it != forward.end(); ++it)
+                    Set(forward_points, it->first, it->second);
+
+                for (auto it = backward.begin(); it != backward.end(); ++it)
+                    Set(backward_points, it->first, it->second);
+            }
+
+            bool HasCandidates(size_t t) const;
+
+            void FinalAnd(const std::vector<word_t> &matrix);
 
         };
 
@@ -0,0 +1,180 @@
+#include <iostream>
+#include <chrono>
+#include <random>
+
+#include <mmt/sentence.h>
+#include <symal/SymAlignment.h>
+#include <boost/program_options.hpp>
+#include <test/util/LegacySymAlignment.h>
+
+using namespace std;
+using namespace mmt;
+using namespace mmt::fastalign;
+using namespace mmt::fastalign::test;
+
+namespace {
+    const size_t ERROR_IN_COMMAND_LINE = 1;
+    const size_t TEST_FAILED = 3;
+    const size_t SUCCESS = 0;
+
+    struct args_t {
+        size_t iterations = 100000;
+        size_t max_length = 150;
+        unsigned int seed = 1;
+    };
+} // namespace
+
+namespace po = boost::program_options;
+
+bool ParseArgs(int argc, const char *argv[], args_t *args) {
+    po::options_description desc("Compare SymAlignment with the byte-matrix implementation on random alignments");
+    desc.add_options()
+            ("help,h", "print this help message")
+            ("iterations,n", po::value<size_t>(), "number of sentence pairs (default = 100000)")
+            ("max-length,l", po::value<size_t>(), "maximum sentence length (default = 150)")
+            ("seed,s", po::value<unsigned int>(), "random seed (default = 1)");
+
+    po::variables_map vm;
+    try {
+        po::store(po::parse_command_line(argc, argv, desc), vm);
+
+        if (vm.count("help")) {
+            std::cout << desc << std::endl;
+            return false;
+        }
+
+        po::notify(vm);
+
+        if (vm.count("iterations"))
+            args->iterations = vm["iterations"].as<size_t>();
+        if (vm.count("max-length"))
+            args->max_length = vm["max-length"].as<size_t>();
+        if (vm.count("seed"))
+            args->seed = vm["seed"].as<unsigned int>();
+    } catch (po::error &e) {
+        std::cerr << "ERROR: " << e.what() << std::endl << std::endl;
+        std::cerr << desc << std::endl;
+        return false;
+    }
+
+    return true;
+}
+
+// ------ Random alignments
+
+/*
+ * Every word of the "from" side is aligned to at most one word of the other side, like the
+ * directional alignments of fast_align: mostly close to the diagonal, sometimes anywhere,
+ * sometimes to NULL (i.e. not aligned at all).
+ */
+void Generate(mt19937 &random, size_t fromLength, size_t toLength, bool fromSource, alignment_t &outAlignment) {
+    uniform_real_distribution<double> uniform(0., 1.);
+    normal_distribution<double> noise(0., 1.5);
+    uniform_int_distribution<size_t> anywhere(0, toLength - 1);
+
+    outAlignment.clear();
+
+    for (size_t i = 0; i < fromLength; ++i) {
+        double p = uniform(random);
+        if (p < 0.1)
+            continue;
+
+        size_t j;
+        if (p < 0.2) {
+            j = anywhere(random);
+        } else {
+            double diagonal = ((double) i + .5) * toLength / fromLength + noise(random);
+            j = (size_t) max(0., min((double) toLength - 1, diagonal));
+        }
+
+        if (fromSource)
+            outAlignment.push_back(pair<length_t, length_t>((length_t) i, (length_t) j));
+        else
+            outAlignment.push_back(pair<length_t, length_t>((length_t) j, (length_t) i));
+    }
+}
+
+// ------ Testing
+
+template<class Symmetrizer>
+alignment_t Symmetrize(Symmetrizer &symal, size_t sourceLength, size_t targetLength, const alignment_t &forward,
+                       const alignment_t &backward, int strategy) {
+    symal.Reset(sourceLength, targetLength);
+
+    switch (strategy) {
+        case 0:
+            symal.Grow(forward, backward, true, true);
+            break;
+        case 1:
+            symal.Grow(forward, backward, true, false);
+            break;
+        case 2:
+            symal.Grow(forward, backward, false, false);
+            break;
+        case 3:
+            symal.Intersection(forward, backward);
+            break;
+        default:
+            symal.Union(forward, backward);
+            break;
+    }
+
+    return symal.ToAlignment();
+}
+
+const char *kStrategyNames[] = {"grow-diag-final-and", "grow-diag", "grow", "intersection", "union"};
+
+bool RunTest(const args_t &args, int strategy) {
+    mt19937 random(args.seed);
+    uniform_int_distribution<size_t> length(1, args.max_length);
+
+    SymAlignment symal;
+    LegacySymAlignment legacy;
+
+    alignment_t forward, backward;
+    double time = 0, legacyTime = 0;
+
+    for (size_t i = 0; i < args.iterations; ++i) {
+        size_t sourceLength = length(random);
+        size_t targetLength = length(random);
+
+        // the forward model aligns every target word, the backward model every source word
+        Generate(random, targetLength, sourceLength, false, forward);
+        Generate(random, sourceLength, targetLength, true, backward);
+
+        auto begin = chrono::steady_clock::now();
+        alignment_t result = Symmetrize(symal, sourceLength, targetLength, forward, backward, strategy);
+        auto middle = chrono::steady_clock::now();
+        alignment_t expected = Symmetrize(legacy, sourceLength, targetLength, forward, backward, strategy);
+        auto end = chrono::steady_clock::now();
+
+        time += chrono::duration<double>(middle - begin).count();
+        legacyTime += chrono::duration<double>(end - middle).count();
+
+        if (result != expected) {
+            cout << "FAILED (pair " << i << ", " << sourceLength << "x" << targetLength << ": expected "
+                 << expected.size() << " points but found " << result.size() << ")" << endl;
+            return false;
+        }
+    }
+
+    cout << "SUCCESS (" << time << "s, byte matrix " << legacyTime << "s)" << endl;
+    return true;
+}
+
+// --------------
+
+int main(int argc, const char *argv[]) {
+    args_t args;
+
+    if (!ParseArgs(argc, argv, &args))
+        return ERROR_IN_COMMAND_LINE;
+
+    for (int strategy = 0; strategy < 5; ++strategy) {
+        cout << "Testing " << kStrategyNames[strategy] << ": " << flush;
+        if (!RunTest(args, strategy))
+            exit(TEST_FAILED);
+    }
+
+    return SUCCESS;
+}
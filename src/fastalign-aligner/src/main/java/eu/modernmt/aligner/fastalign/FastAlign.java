@@ -2,6 +2,8 @@ package eu.modernmt.aligner.fastalign;
 
 import eu.modernmt.aligner.Aligner;
 import eu.modernmt.aligner.AlignerException;
+import eu.modernmt.data.DataListener;
+import eu.modernmt.data.TranslationUnit;
 import eu.modernmt.model.Alignment;
 import eu.modernmt.model.Sentence;
 import eu.modernmt.model.Word;
@@ -10,16 +12,26 @@ import org.apache.logging.log4j.Logger;
 
 import java.io.File;
 import java.io.IOException;
+import java.nio.ByteBuffer;
+import java.nio.ByteOrder;
+import java.nio.IntBuffer;
+import java.util.HashMap;
 import java.util.Iterator;
 import java.util.List;
+import java.util.Map;
 
 /**
  * Created by lucamastrostefano on 15/03/16.
  */
-public class FastAlign implements Aligner {
+public class FastAlign implements Aligner, DataListener {
 
     private static final Logger logger = LogManager.getLogger(FastAlign.class);
 
+    // Direct buffers are expensive to allocate and are freed only by the GC: every thread keeps
+    // the largest ones it used, one for the input and one for the output of alignBatch()
+    private static final ThreadLocal<ByteBuffer> inputBuffers = new ThreadLocal<>();
+    private static final ThreadLocal<ByteBuffer> outputBuffers = new ThreadLocal<>();
+
     static {
         try {
             System.loadLibrary("fastalign");
@@ -34,13 +46,21 @@ public class FastAlign implements Aligner {
     private long nativeHandle;
 
     public FastAlign(File model) throws IOException {
+        this(model, false);
+    }
+
+    /**
+     * If "adaptive" is true the aligner also learns from the translation units received as a
+     * DataListener, otherwise it must not be registered to the data stream.
+     */
+    public FastAlign(File model, boolean adaptive) throws IOException {
         if (!model.isDirectory())
             throw new IOException("Invalid model path: " + model);
 
-        this.nativeHandle = instantiate(model.getAbsolutePath(), Runtime.getRuntime().availableProcessors());
+        this.nativeHandle = instantiate(model.getAbsolutePath(), Runtime.getRuntime().availableProcessors(), adaptive);
     }
 
-    private native long instantiate(String modelDirectory, int threads);
+    private native long instantiate(String modelDirectory, int threads, boolean adaptive) throws IOException;
 
     @Override
     public void setDefaultSymmetrizationStrategy(SymmetrizationStrategy strategy) {
@@ -59,10 +79,11 @@ public class FastAlign implements Aligner {
 
     @Override
     public Alignment getAlignment(Sentence source, Sentence target, SymmetrizationStrategy strategy) throws AlignerException {
-        return parse(align(getIds(source), getIds(target), toInt(strategy)));
-    }
+        Word[][] sourcesWords = new Word[][]{source.getWords()};
+        Word[][] targetsWords = new Word[][]{target.getWords()};
 
-    private native int[] align(int[] source, int[] target, int strategy);
+        return align(sourcesWords, targetsWords, strategy)[0];
+    }
 
     @Override
     public Alignment[] getAlignments(List<Sentence> sources, List<Sentence> targets) throws AlignerException {
@@ -71,36 +92,129 @@ public class FastAlign implements Aligner {
 
     @Override
     public Alignment[] getAlignments(List<Sentence> sources, List<Sentence> targets, SymmetrizationStrategy strategy) throws AlignerException {
-        int[][] sourcesIds = new int[sources.size()][];
-        int[][] targetsIds = new int[targets.size()][];
+        int size = Math.min(sources.size(), targets.size());
+
+        Word[][] sourcesWords = new Word[size][];
+        Word[][] targetsWords = new Word[size][];
 
         Iterator<Sentence> sourceIterator = sources.iterator();
         Iterator<Sentence> targetIterator = targets.iterator();
 
-        int i = 0;
-        while (sourceIterator.hasNext() && targetIterator.hasNext()) {
-            sourcesIds[i] = getIds(sourceIterator.next());
-            targetsIds[i] = getIds(targetIterator.next());
-            i++;
+        for (int i = 0; i < size; i++) {
+            sourcesWords[i] = sourceIterator.next().getWords();
+            targetsWords[i] = targetIterator.next().getWords();
+        }
+
+        return align(sourcesWords, targetsWords, strategy);
+    }
+
+    private Alignment[] align(Word[][] sourcesWords, Word[][] targetsWords, SymmetrizationStrategy strategy) throws AlignerException {
+        int size = sourcesWords.length;
+        int inputLength = 0;
+        int outputLength = 0;
+
+        for (int i = 0; i < size; i++) {
+            inputLength += 2 + sourcesWords[i].length + targetsWords[i].length;
+            outputLength += getAlignmentSlotSize(sourcesWords[i].length, targetsWords[i].length);
+        }
+
+        // Every pair is written as: source length, target length, source ids, target ids
+        ByteBuffer input = getBuffer(inputBuffers, inputLength);
+        IntBuffer inputInts = input.asIntBuffer();
+
+        for (int i = 0; i < size; i++) {
+            inputInts.put(sourcesWords[i].length);
+            inputInts.put(targetsWords[i].length);
+
+            for (Word word : sourcesWords[i])
+                inputInts.put(word.getId());
+            for (Word word : targetsWords[i])
+                inputInts.put(word.getId());
+        }
+
+        ByteBuffer output = getBuffer(outputBuffers, outputLength);
+
+        try {
+            alignBatch(input, size, output, toInt(strategy));
+        } catch (IllegalArgumentException e) {
+            throw new AlignerException(e.getMessage());
         }
 
-        int[][] result = new int[sourcesIds.length][];
-        align(sourcesIds, targetsIds, result, toInt(strategy));
+        // The buffer is reused by the next call: the alignments are read from it exactly once, into
+        // the arrays they keep
+        IntBuffer outputInts = output.asIntBuffer();
+        Alignment[] alignments = new Alignment[size];
+
+        int offset = 0;
+        for (int i = 0; i < size; i++) {
+            int links = outputInts.get(offset);
+
+            int[] source = new int[links];
+            int[] target = new int[links];
 
-        Alignment[] alignments = new Alignment[result.length];
+            outputInts.position(offset + 1);
+            outputInts.get(source);
+            outputInts.get(target);
 
-        for (int j = 0; j < result.length; j++)
-            alignments[j] = parse(result[j]);
+            alignments[i] = new Alignment(source, target);
+            offset += getAlignmentSlotSize(sourcesWords[i].length, targetsWords[i].length);
+        }
 
         return alignments;
     }
 
+    // Returns the buffer of this thread, grown if smaller than "ints" integers
+    private static ByteBuffer getBuffer(ThreadLocal<ByteBuffer> buffers, int ints) {
+        ByteBuffer buffer = buffers.get();
+
+        if (buffer == null || buffer.capacity() < ints * 4) {
+            int capacity = Math.max(ints * 4, buffer == null ? 0 : buffer.capacity() * 2);
+            buffer = ByteBuffer.allocateDirect(capacity).order(ByteOrder.nativeOrder());
+            buffers.set(buffer);
+        }
+
+        buffer.clear();
+        return buffer;
+    }
+
+    // Same as FastAligner::GetAlignmentSlotSize()
+    private static int getAlignmentSlotSize(int sourceLength, int targetLength) {
+        return 1 + 2 * (sourceLength + targetLength);
+    }
+
     @Override
     public long getNativeHandle() {
         return nativeHandle;
     }
 
-    private native void align(int[][] sources, int[][] targets, int[][] result, int strategy);
+    private native void alignBatch(ByteBuffer input, int size, ByteBuffer output, int strategy) throws AlignerException;
+
+    // Updates
+
+    @Override
+    public void onDataReceived(TranslationUnit unit) throws Exception {
+        int[] sourceSentence = getIds(unit.sourceSentence);
+        int[] targetSentence = getIds(unit.targetSentence);
+
+        updateReceived(unit.channel, unit.channelPosition, unit.domain, sourceSentence, targetSentence);
+    }
+
+    private native void updateReceived(int streamId, long sentenceId, int domainId, int[] sourceSentence, int[] targetSentence);
+
+    @Override
+    public Map<Short, Long> getLatestChannelPositions() {
+        long[] ids = getLatestUpdatesIdentifier();
+
+        HashMap<Short, Long> map = new HashMap<>(ids.length);
+        for (short i = 0; i < ids.length; i++) {
+            if (ids[i] >= 0)
+                map.put(i, ids[i]);
+        }
+
+        return map;
+    }
+
+    private native long[] getLatestUpdatesIdentifier();
 
     private static int toInt(SymmetrizationStrategy strategy) {
         switch (strategy) {
@@ -141,19 +255,4 @@ public class FastAlign implements Aligner {
         return ids;
     }
 
-    private static Alignment parse(int[] encoded) throws AlignerException {
-        if (encoded.length % 2 == 1)
-            throw new AlignerException("Invalid native result length: " + encoded.length);
-
-        int size = encoded.length / 2;
-
-        int[] source = new int[size];
-        int[] target = new int[size];
-
-        System.arraycopy(encoded, 0, source, 0, size);
-        System.arraycopy(encoded, size, target, 0, size);
-
-        return new Alignment(source, target);
-    }
-
 }
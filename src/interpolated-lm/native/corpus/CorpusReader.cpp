@@ -3,7 +3,6 @@
 //
 
 #include "CorpusReader.h"
-#include <fstream>
 
 using namespace mmt::ilm;
 
@@ -11,8 +10,7 @@ struct noop {
     void operator()(...) const {}
 };
 
-CorpusReader::CorpusReader(const string &corpus) : drained(false) {
-    input.reset(new ifstream(corpus.c_str()));
+CorpusReader::CorpusReader(const string &corpus) : drained(false), reader(new corpus::SentenceReader(corpus)) {
 }
 
 CorpusReader::CorpusReader(istream *stream) : drained(false) {
@@ -23,6 +21,15 @@ bool CorpusReader::Read(vector<wid_t> &outSentence) {
     if (drained)
         return false;
 
+    if (reader) {
+        if (!reader->Read(outSentence)) {
+            drained = true;
+            return false;
+        }
+
+        return true;
+    }
+
     string line;
     if (!getline(*input, line)) {
         drained = true;
@@ -8,7 +8,7 @@
 #include <istream>
 #include <lm/LM.h>
 #include <memory>
-#include <sstream>
+#include <mmt/corpus/SentenceReader.h>
 
 using namespace std;
 
@@ -17,6 +17,7 @@ namespace mmt {
 
         class CorpusReader {
         public:
+            // Reads the file, or its binary copy if there is one (see corpus::SentenceReader)
             CorpusReader(const string &corpus);
 
             CorpusReader(istream *stream);
@@ -24,18 +25,13 @@ namespace mmt {
             bool Read(vector <wid_t> &outSentence);
 
             static inline void ParseLine(const string &line, vector <wid_t> &output) {
-                output.clear();
-
-                std::stringstream stream(line);
-                wid_t word;
-
-                while (stream >> word)
-                    output.push_back(word);
+                corpus::ParseWords(line.data(), line.data() + line.size(), output);
             }
 
         private:
             bool drained;
             shared_ptr <istream> input;
+            unique_ptr <corpus::SentenceReader> reader;
         };
 
     }
@@ -0,0 +1,252 @@
+//
+// Offline construction of an NGramStorage, based on external sorting.
+//
+
+#include "BulkLoader.h"
+#include <algorithm>
+#include <cstring>
+#include <unordered_map>
+#include <util/stream/chain.hh>
+#include <util/stream/sort.hh>
+#include <util/stream/stream.hh>
+
+using namespace std;
+using namespace mmt;
+using namespace mmt::ilm;
+
+namespace {
+
+    struct ngram_record_t {
+        dbkey_t key;
+        dbkey_t predecessor;
+        domain_t domain;
+        counts_t counts;
+        uint8_t order;
+    };
+
+    // Records are sorted in the same order of the storage, so that the final counts can be ingested as they are
+    class RecordOrder {
+    public:
+        RecordOrder(const NGramStorage &storage) : storage(&storage) {}
+
+        bool operator()(const void *first, const void *second) const {
+            const ngram_record_t *a = static_cast<const ngram_record_t *>(first);
+            const ngram_record_t *b = static_cast<const ngram_record_t *>(second);
+
+            return storage->KeyLess(a->domain, a->key, b->domain, b->key);
+        }
+
+    private:
+        const NGramStorage *storage;
+    };
+
+    // Sums the counts of the records of the same n-gram and domain; the sorter applies it only
+    // while merging blocks, see RecordReader
+    class RecordCombine {
+    public:
+        bool operator()(void *into, const void *option, const RecordOrder &compare) const {
+            ngram_record_t *a = static_cast<ngram_record_t *>(into);
+            const ngram_record_t *b = static_cast<const ngram_record_t *>(option);
+
+            if (a->domain != b->domain || a->key != b->key)
+                return false;
+
+            a->counts.count += b->counts.count;
+            a->counts.successors += b->counts.successors;
+            return true;
+        }
+    };
+
+    typedef util::stream::Sort<RecordOrder, RecordCombine> sorter_t;
+
+    // Reads the output of a sorter, a record for every n-gram and domain: the sorter combines the
+    // records only when it merges blocks, while a sort that fits a single block leaves the equal
+    // records adjacent, thus they are folded here in any case
+    class RecordReader {
+    public:
+        RecordReader(util::stream::Stream &stream, const RecordOrder &order) : stream(stream), order(order) {}
+
+        bool Read(ngram_record_t &outRecord) {
+            if (!stream)
+                return false;
+
+            memcpy(&outRecord, stream.Get(), sizeof(ngram_record_t));
+
+            for (++stream; stream; ++stream) {
+                if (!combine(&outRecord, stream.Get(), order))
+                    break;
+            }
+
+            return true;
+        }
+
+    private:
+        util::stream::Stream &stream;
+        const RecordOrder &order;
+        RecordCombine combine;
+    };
+
+    static const size_t kMinBlockEntries = 1024;
+
+    // Every chain gets a quarter of the memory, sorters merge with half of it
+    util::stream::ChainConfig MakeChainConfig(size_t memory) {
+        size_t size = max(memory / 4, 2 * kMinBlockEntries * sizeof(ngram_record_t));
+        return util::stream::ChainConfig(sizeof(ngram_record_t), 2, size);
+    }
+
+    util::stream::SortConfig MakeSortConfig(const string &tempPath, size_t memory) {
+        util::stream::SortConfig config;
+        config.temp_prefix = tempPath + "/sort_";
+        config.buffer_size = max(memory / 32, kMinBlockEntries * sizeof(ngram_record_t));
+        config.total_memory = max(memory / 2, 4 * config.buffer_size);
+
+        return config;
+    }
+
+}
+
+struct BulkLoader::pipeline_t {
+    util::stream::Chain chain;
+    util::stream::Stream stream;
+    sorter_t sorter;
+
+    pipeline_t(const NGramStorage &storage, const string &tempPath, size_t memory)
+            : chain(MakeChainConfig(memory)), stream(chain.Add()),
+              sorter(chain, MakeSortConfig(tempPath, memory), RecordOrder(storage)) {
+    }
+
+    // Must be called before destruction: the sorter is in use until the chain ends
+    void Close() {
+        stream.Poison();
+        chain.Wait(true);
+    }
+};
+
+BulkLoader::BulkLoader(NGramStorage &storage, const string &tempPath, size_t memory)
+        : storage(storage), tempPath(tempPath), memory(memory) {
+    pipeline = new pipeline_t(storage, tempPath, memory);
+}
+
+BulkLoader::~BulkLoader() {
+    if (pipeline) {
+        pipeline->Close();
+        delete pipeline;
+    }
+}
+
+void BulkLoader::Add(NGramBatch &batch) {
+    lock_guard<mutex> lock(access);
+
+    util::stream::Stream &stream = pipeline->stream;
+    unordered_map<domain_t, ngram_table_t> &ngrams = batch.GetNGrams();
+
+    for (auto entry = ngrams.begin(); entry != ngrams.end(); ++entry) {
+        ngram_table_t &table = entry->second;
+
+        for (size_t o = 0; o < table.size(); ++o) {
+            for (auto it = table[o].begin(); it != table[o].end(); ++it) {
+                ngram_record_t *record = static_cast<ngram_record_t *>(stream.Get());
+                record->key = it->first;
+                record->predecessor = it->second.predecessor;
+                record->domain = entry->first;
+                record->counts = counts_t(it->second.counts.count, 0);
+                record->order = (uint8_t) (o + 1);
+
+                ++stream;
+            }
+        }
+    }
+}
+
+void BulkLoader::Load() throw(storage_exception) {
+    {
+        lock_guard<mutex> lock(access);
+        pipeline->Close();
+    }
+
+    RecordOrder order(storage);
+
+    // Pass 1: the n-gram counts are read in order, and every n-gram adds one successor to its
+    // predecessor, together with the word counts of every domain
+    // ------------------------
+
+    util::stream::Chain counts(MakeChainConfig(memory));
+    pipeline->sorter.Output(counts);
+    util::stream::Stream input(counts.Add());
+    counts >> util::stream::kRecycle;
+
+    util::stream::Chain merged(MakeChainConfig(memory));
+    util::stream::Stream output(merged.Add());
+    sorter_t mergedSorter(merged, MakeSortConfig(tempPath, memory), order);
+
+    unordered_map<domain_t, counts_t> wordCounts;
+
+    RecordReader ngrams(input, order);
+    ngram_record_t record;
+
+    while (ngrams.Read(record)) {
+        if (record.order == 1) {
+            counts_t &domainWordCounts = wordCounts[record.domain];
+            domainWordCounts.count += record.counts.count;
+            domainWordCounts.successors++;
+        } else {
+            ngram_record_t *successor = static_cast<ngram_record_t *>(output.Get());
+            successor->key = record.predecessor;
+            successor->predecessor = 0;
+            successor->domain = record.domain;
+            successor->counts = counts_t(0, 1);
+            successor->order = (uint8_t) (record.order - 1);
+            ++output;
+        }
+
+        memcpy(output.Get(), &record, sizeof(ngram_record_t));
+        ++output;
+    }
+
+    for (auto entry = wordCounts.begin(); entry != wordCounts.end(); ++entry) {
+        ngram_record_t *record = static_cast<ngram_record_t *>(output.Get());
+        record->key = kWordCountsKey;
+        record->predecessor = 0;
+        record->domain = entry->first;
+        record->counts = entry->second;
+        record->order = 0;
+        ++output;
+    }
+
+    output.Poison();
+    counts.Wait(true);
+    merged.Wait(true);
+
+    delete pipeline;
+    pipeline = NULL;
+
+    // Pass 2: the counts of the same n-gram are summed by the reader, thus they are final
+    // ------------------------
+
+    util::stream::Chain sorted(MakeChainConfig(memory));
+    mergedSorter.Output(sorted);
+    util::stream::Stream result(sorted.Add());
+    sorted >> util::stream::kRecycle;
+
+    RecordReader finalCounts(result, order);
+
+    try {
+        storage.IngestSorted([&](domain_t *outDomain, dbkey_t *outKey, counts_t *outCounts) {
+            ngram_record_t record;
+            if (!finalCounts.Read(record))
+                return false;
+
+            *outDomain = record.domain;
+            *outKey = record.key;
+            *outCounts = record.counts;
+
+            return true;
+        }, tempPath);
+    } catch (...) {
+        // The chain must be drained before being destroyed
+        for (; result; ++result);
+        throw;
+    }
+
+    sorted.Wait(true);
+}
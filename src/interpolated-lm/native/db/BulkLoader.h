@@ -0,0 +1,52 @@
+//
+// Offline construction of an NGramStorage, based on external sorting.
+//
+
+#ifndef ILM_BULKLOADER_H
+#define ILM_BULKLOADER_H
+
+#include <string>
+#include <mutex>
+#include "NGramStorage.h"
+#include "NGramBatch.h"
+
+using namespace std;
+
+namespace mmt {
+    namespace ilm {
+
+        // Builds a new storage without reading it back: the n-grams of all the batches are counted
+        // with an external sort, then successors and word counts are computed exactly from the sorted
+        // n-grams, and the final counts are ingested by the storage as table files (IngestSorted()).
+        // Unlike PutBatch(), this requires no reads for novelty detection and leaves no merge operands
+        // to compact, but the storage must be empty and the counts are visible only after Load().
+        class BulkLoader {
+        public:
+
+            // At most about "memory" bytes are used for sorting, the rest is spilled to
+            // temporary files in "tempPath", that must exist
+            BulkLoader(NGramStorage &storage, const string &tempPath, size_t memory);
+
+            ~BulkLoader();
+
+            // Adds the n-grams of the batch to the counts; it can be called by multiple threads
+            void Add(NGramBatch &batch);
+
+            // Computes the final counts and loads them into the storage; no more batches can be added
+            void Load() throw(storage_exception);
+
+        private:
+            struct pipeline_t;
+
+            NGramStorage &storage;
+            const string tempPath;
+            const size_t memory;
+
+            mutex access;
+            pipeline_t *pipeline;
+        };
+
+    }
+}
+
+#endif //ILM_BULKLOADER_H
@@ -0,0 +1,162 @@
+//
+// Approximate membership set of the n-gram keys stored in the database.
+//
+
+#include "NGramFilter.h"
+#include <cstdlib>
+#include <cstring>
+#include <new>
+
+using namespace std;
+using namespace mmt::ilm;
+
+static const size_t kCacheLineSize = 64;
+static const size_t kBlockWords = kCacheLineSize / sizeof(uint64_t);
+static const size_t kGrowthFactor = 2;
+
+// The first slice has a false positive rate of about 0.5%, every following slice adds a hash and
+// 1.5 bits per key, halving the rate: the sum of all of them is less than 1%
+static const size_t kBitsPerKey = 13;
+static const size_t kHashesCount = 8;
+
+// A 64 bit word holds 7 bit positions of 9 bits, the following ones are mixed from the previous word
+static const size_t kBitsPerHash = 9;
+static const size_t kHashesPerWord = 64 / kBitsPerHash;
+static const uint64_t kGoldenRatio = 0x9E3779B97F4A7C15ULL;
+
+// MurmurHash3 finalizer: unigram keys are plain word ids and must be mixed
+static inline uint64_t Mix(uint64_t key) {
+    key ^= key >> 33;
+    key *= 0xFF51AFD7ED558CCDULL;
+    key ^= key >> 33;
+    key *= 0xC4CEB9FE1A85EC53ULL;
+    key ^= key >> 33;
+    return key;
+}
+
+// Maps the high bits of the hash to [0, count) with a multiplication instead of a division
+static inline size_t GetBlock(uint64_t hash, size_t count) {
+    return (size_t) (((hash >> 32) * (uint64_t) count) >> 32);
+}
+
+// Returns the position of the i-th bit of a key within its block, the hashes are taken in order
+static inline size_t NextBit(uint64_t &bits, size_t i) {
+    if (i > 0 && i % kHashesPerWord == 0)
+        bits = Mix(bits ^ kGoldenRatio);
+
+    return (size_t) ((bits >> ((i % kHashesPerWord) * kBitsPerHash)) & ((1ULL << kBitsPerHash) - 1));
+}
+
+NGramFilter::NGramFilter(size_t initialCapacity) : slices(new slices_t()) {
+    AddSlice(initialCapacity > 0 ? initialCapacity : kDefaultCapacity);
+}
+
+NGramFilter::~NGramFilter() {
+    const slices_t *list = slices.load();
+
+    for (auto slice = list->begin(); slice != list->end(); ++slice) {
+        free((*slice)->blocks);
+        delete *slice;
+    }
+
+    delete list;
+    for (auto retired = retiredSlices.begin(); retired != retiredSlices.end(); ++retired)
+        delete *retired;
+}
+
+void NGramFilter::AddSlice(size_t capacity) {
+    const slices_t *list = slices.load(memory_order_relaxed);
+    size_t index = list->size();
+
+    slice_t *slice = new slice_t;
+    slice->capacity = capacity;
+    slice->size = 0;
+    slice->hashesCount = (uint8_t) (kHashesCount + index);
+
+    // bits per key, doubled to keep the half bits
+    size_t keyBits2 = 2 * kBitsPerKey + 3 * index;
+
+    slice->blocksCount = (capacity * keyBits2 + kCacheLineSize * 8 * 2 - 1) / (kCacheLineSize * 8 * 2);
+    size_t words = slice->blocksCount * kBlockWords;
+
+    void *ptr = NULL;
+    if (posix_memalign(&ptr, kCacheLineSize, words * sizeof(uint64_t)) != 0) {
+        delete slice;
+        throw bad_alloc();
+    }
+
+    slice->blocks = (atomic<uint64_t> *) ptr;
+    for (size_t i = 0; i < words; ++i)
+        new(slice->blocks + i) atomic<uint64_t>(0);
+
+    slices_t *grown = new slices_t(*list);
+    grown->push_back(slice);
+
+    slices.store(grown, memory_order_release);
+    retiredSlices.push_back(list);
+}
+
+void NGramFilter::Add(const dbkey_t key) {
+    uint64_t hash = Mix(key);
+    uint64_t bits = Mix(hash ^ kGoldenRatio);
+
+    lock_guard<mutex> lock(access);
+
+    slice_t *slice = slices.load(memory_order_relaxed)->back();
+    if (slice->size >= slice->capacity) {
+        AddSlice(slice->capacity * kGrowthFactor);
+        slice = slices.load(memory_order_relaxed)->back();
+    }
+
+    atomic<uint64_t> *block = slice->blocks + GetBlock(hash, slice->blocksCount) * kBlockWords;
+
+    // writers are serialized, readers only need every word to be read whole
+    for (size_t i = 0; i < slice->hashesCount; ++i) {
+        size_t bit = NextBit(bits, i);
+        atomic<uint64_t> &word = block[bit >> 6];
+
+        word.store(word.load(memory_order_relaxed) | (1ULL << (bit & 63)), memory_order_relaxed);
+    }
+
+    slice->size++;
+}
+
+bool NGramFilter::MayContain(const dbkey_t key) const {
+    uint64_t hash = Mix(key);
+    uint64_t seed = Mix(hash ^ kGoldenRatio);
+
+    const slices_t *list = slices.load(memory_order_acquire);
+
+    // The most recent slices are the largest ones
+    for (auto it = list->rbegin(); it != list->rend(); ++it) {
+        const slice_t *slice = *it;
+        const atomic<uint64_t> *block = slice->blocks + GetBlock(hash, slice->blocksCount) * kBlockWords;
+
+        uint64_t bits = seed;
+        bool found = true;
+
+        for (size_t i = 0; i < slice->hashesCount; ++i) {
+            size_t bit = NextBit(bits, i);
+
+            if ((block[bit >> 6].load(memory_order_relaxed) & (1ULL << (bit & 63))) == 0) {
+                found = false;
+                break;
+            }
+        }
+
+        if (found)
+            return true;
+    }
+
+    return false;
+}
+
+size_t NGramFilter::GetMemoryUsage() const {
+    const slices_t *list = slices.load(memory_order_acquire);
+
+    size_t size = sizeof(NGramFilter);
+    for (auto slice = list->begin(); slice != list->end(); ++slice)
+        size += (*slice)->blocksCount * kCacheLineSize;
+
+    return size;
+}
@@ -0,0 +1,70 @@
+//
+// Approximate membership set of the n-gram keys stored in the database.
+//
+
+#ifndef ILM_NGRAMFILTER_H
+#define ILM_NGRAMFILTER_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+#include <mutex>
+#include "dbkey.h"
+
+using namespace std;
+
+namespace mmt {
+    namespace ilm {
+
+        // Blocked bloom filter of the n-gram keys of a domain: MayContain() never returns false for
+        // a key that has been added, while it returns true for a missing key with a probability of
+        // less than 1%. All the bits of a key are set in the same 64-byte block, thus a lookup touches
+        // a single cache line per slice.
+        // The filter grows by appending a new slice with twice the capacity of the last one every
+        // time it is full; every new slice halves the false positive rate of the previous one, so
+        // that their sum stays bounded however many slices are added (a scalable bloom filter).
+        // The new slices take more bits per key, thus a filter of a known size should be created
+        // with its capacity.
+        // It can be safely shared by multiple threads: Add() calls are serialized, while MayContain()
+        // reads the slices without locking.
+        class NGramFilter {
+        public:
+
+            static const size_t kDefaultCapacity = 1024;
+
+            NGramFilter(size_t initialCapacity = kDefaultCapacity);
+
+            ~NGramFilter();
+
+            void Add(const dbkey_t key);
+
+            bool MayContain(const dbkey_t key) const;
+
+            // Memory allocated by the filter, in bytes
+            size_t GetMemoryUsage() const;
+
+        private:
+            struct slice_t {
+                atomic<uint64_t> *blocks;
+                size_t blocksCount;
+                uint8_t hashesCount;
+                size_t capacity;
+                size_t size;
+            };
+
+            typedef vector<slice_t *> slices_t;
+
+            // Slices lists are immutable once published, the ones replaced by AddSlice() are
+            // released with the filter
+            atomic<const slices_t *> slices;
+            vector<const slices_t *> retiredSlices;
+            mutex access;
+
+            void AddSlice(size_t capacity);
+        };
+
+    }
+}
+
+#endif //ILM_NGRAMFILTER_H
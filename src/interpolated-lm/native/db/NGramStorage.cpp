@@ -7,7 +7,13 @@
 #include <rocksdb/table.h>
 #include <rocksdb/slice_transform.h>
 #include <rocksdb/merge_operator.h>
+#include <rocksdb/sst_file_writer.h>
+#include <rocksdb/filter_policy.h>
+#include <rocksdb/cache.h>
 #include <thread>
+#include <cstring>
+#include <fstream>
+#include <boost/filesystem.hpp>
 
 const string kPathSeparator =
 #ifdef _WIN32
@@ -16,9 +22,10 @@ const string kPathSeparator =
         "/";
 #endif
 
-#define WordCountsKey (0)
 #define StreamsKey SerializeKey(0, 0)
 
+namespace fs = boost::filesystem;
+
 using namespace std;
 using namespace rocksdb;
 using namespace mmt;
@@ -26,6 +33,29 @@ using namespace mmt::ilm;
 
 static_assert(sizeof(seqid_t) == 8, "Current version only supports 64-bit seqid_t");
 
+static const uint64_t kUnknownWordCounts = UINT64_MAX;
+static const size_t kWordCountsTableInitialSize = 1024;
+static const size_t kFiltersTableInitialSize = 1024;
+static const size_t kIngestFileSize = 64 * 1024 * 1024;
+
+// Block-based tables (kBlockTable)
+static const size_t kBlockSize = 4 * 1024;
+static const int kBloomBitsPerKey = 10;
+static const size_t kBlockCacheSize = 256 * 1024 * 1024;
+
+// In order of preference: a build of RocksDB links only the libraries it has found, and it
+// refuses to open a database with a compression it does not have
+static const CompressionType kBlockCompressions[] = {kLZ4Compression, kSnappyCompression, kNoCompression};
+static const size_t kBlockCompressionsSize = sizeof(kBlockCompressions) / sizeof(CompressionType);
+
+static inline uint64_t PackWordCounts(const counts_t &counts) {
+    return (((uint64_t) counts.count) << 32) | counts.successors;
+}
+
+static inline counts_t UnpackWordCounts(uint64_t value) {
+    return counts_t((count_t) (value >> 32), (count_t) (value & 0xFFFFFFFFULL));
+}
+
 static inline string SerializeStreams(const vector<seqid_t> &streams) {
     size_t size = streams.size();
     size_t bytes_size = size * sizeof(seqid_t);
@@ -110,6 +140,46 @@ static inline string SerializeKey(domain_t domain, dbkey_t key) {
     return string(bytes, 12);
 }
 
+static inline string SerializeNGramKey(dbkey_t key) {
+    const char bytes[8] = {
+            (char) (key & 0xFF),
+            (char) ((key >> 8) & 0xFF),
+            (char) ((key >> 16) & 0xFF),
+            (char) ((key >> 24) & 0xFF),
+            (char) ((key >> 32) & 0xFF),
+            (char) ((key >> 40) & 0xFF),
+            (char) ((key >> 48) & 0xFF),
+            (char) ((key >> 56) & 0xFF)
+    };
+
+    return string(bytes, 8);
+}
+
+static inline dbkey_t DeserializeNGramKey(const char *data) {
+    return (data[0] & 0xFFULL) +
+           ((data[1] & 0xFFULL) << 8) +
+           ((data[2] & 0xFFULL) << 16) +
+           ((data[3] & 0xFFULL) << 24) +
+           ((data[4] & 0xFFULL) << 32) +
+           ((data[5] & 0xFFULL) << 40) +
+           ((data[6] & 0xFFULL) << 48) +
+           ((data[7] & 0xFFULL) << 56);
+}
+
+static inline uint32_t DeserializeUInt32(const char *data) {
+    return (data[0] & 0xFFU) +
+           ((data[1] & 0xFFU) << 8) +
+           ((data[2] & 0xFFU) << 16) +
+           ((data[3] & 0xFFU) << 24);
+}
+
+static inline void SerializeUInt32(uint32_t value, char *data) {
+    data[0] = (char) (value & 0xFF);
+    data[1] = (char) ((value >> 8) & 0xFF);
+    data[2] = (char) ((value >> 16) & 0xFF);
+    data[3] = (char) ((value >> 24) & 0xFF);
+}
+
 static inline bool Deserialize(const char *data, size_t size, counts_t *output) {
     if (size != 8)
         return false;
@@ -127,43 +197,409 @@ static inline bool Deserialize(const char *data, size_t size, counts_t *output)
     return true;
 }
 
+// Varint encoding: integers are written 7 bits per byte, least significant first,
+// the high bit of every byte but the last is set
+static inline void AppendVarint(string &output, uint64_t value) {
+    while (value >= 0x80) {
+        output.push_back((char) ((value & 0x7F) | 0x80));
+        value >>= 7;
+    }
+
+    output.push_back((char) value);
+}
+
+static inline bool ReadVarint(const char *&data, const char *end, uint64_t *output) {
+    uint64_t value = 0;
+
+    for (unsigned int shift = 0; shift < 64 && data < end; shift += 7) {
+        uint64_t byte = (uint8_t) *(data++);
+        value |= (byte & 0x7F) << shift;
+
+        if ((byte & 0x80) == 0) {
+            *output = value;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+// By far the most common counts: n-grams seen once, never followed by a longer one
+static inline bool IsSingleton(const counts_t &counts) {
+    return counts.count == 1 && counts.successors == 0;
+}
+
+// Domain layout values: with kVarintEncoding a singleton is an empty value, any other
+// counts are the two varints (count, successors)
+static inline string EncodeCounts(value_encoding_t encoding, const counts_t &counts) {
+    if (encoding == kFixedEncoding)
+        return SerializeCounts(counts);
+
+    string output;
+    if (!IsSingleton(counts)) {
+        AppendVarint(output, counts.count);
+        AppendVarint(output, counts.successors);
+    }
+
+    return output;
+}
+
+static inline bool DecodeCounts(value_encoding_t encoding, const char *data, size_t size, counts_t *output) {
+    if (encoding == kFixedEncoding)
+        return Deserialize(data, size, output);
+
+    if (size == 0) {
+        *output = counts_t(1, 0);
+        return true;
+    }
+
+    const char *end = data + size;
+    uint64_t count, successors;
+
+    if (!ReadVarint(data, end, &count) || !ReadVarint(data, end, &successors) || data != end)
+        return false;
+
+    *output = counts_t((count_t) count, (count_t) successors);
+    return true;
+}
+
+// Inverted layout: the value of an n-gram is a list of entries (domain, count, successors), sorted by domain.
+// With kFixedEncoding every entry is 12 bytes long; with kVarintEncoding an entry starts with the varint
+// (domain delta << 1 | singleton flag) and, if it is not a singleton, the two varints (count, successors)
+static const size_t kDomainEntrySize = sizeof(domain_t) + 2 * sizeof(count_t);
+
+static inline void SerializeDomainEntry(domain_t domain, const counts_t &counts, char *data) {
+    SerializeUInt32(domain, data);
+    SerializeUInt32(counts.count, data + 4);
+    SerializeUInt32(counts.successors, data + 8);
+}
+
+static inline domain_t DeserializeDomain(const char *entry) {
+    return DeserializeUInt32(entry);
+}
+
+static inline counts_t DeserializeDomainCounts(const char *entry) {
+    return counts_t(DeserializeUInt32(entry + 4), DeserializeUInt32(entry + 8));
+}
+
+class DomainEntryReader {
+public:
+    DomainEntryReader(value_encoding_t encoding, const char *data, size_t size)
+            : encoding(encoding), data(data), lastDomain(0) {
+        end = data + (encoding == kFixedEncoding ? (size / kDomainEntrySize) * kDomainEntrySize : size);
+    }
+
+    bool Next(domain_t *outDomain, counts_t *outCounts) {
+        if (data >= end)
+            return false;
+
+        if (encoding == kFixedEncoding) {
+            *outDomain = DeserializeDomain(data);
+            *outCounts = DeserializeDomainCounts(data);
+            data += kDomainEntrySize;
+
+            return true;
+        }
+
+        uint64_t header;
+        if (!ReadVarint(data, end, &header))
+            return false;
+
+        if (header & 1) {
+            *outCounts = counts_t(1, 0);
+        } else {
+            uint64_t count, successors;
+            if (!ReadVarint(data, end, &count) || !ReadVarint(data, end, &successors))
+                return false;
+
+            *outCounts = counts_t((count_t) count, (count_t) successors);
+        }
+
+        lastDomain += (domain_t) (header >> 1);
+        *outDomain = lastDomain;
+
+        return true;
+    }
+
+private:
+    const value_encoding_t encoding;
+    const char *data;
+    const char *end;
+    domain_t lastDomain;
+};
+
+class DomainEntryWriter {
+public:
+    DomainEntryWriter(value_encoding_t encoding, string &output)
+            : encoding(encoding), output(output), lastDomain(0) {}
+
+    // Entries must be appended in domain order
+    void Append(domain_t domain, const counts_t &counts) {
+        if (encoding == kFixedEncoding) {
+            char bytes[kDomainEntrySize];
+            SerializeDomainEntry(domain, counts, bytes);
+            output.append(bytes, kDomainEntrySize);
+        } else {
+            bool singleton = IsSingleton(counts);
+            AppendVarint(output, (((uint64_t) (domain - lastDomain)) << 1) | (singleton ? 1 : 0));
+
+            if (!singleton) {
+                AppendVarint(output, counts.count);
+                AppendVarint(output, counts.successors);
+            }
+
+            lastDomain = domain;
+        }
+    }
+
+private:
+    const value_encoding_t encoding;
+    string &output;
+    domain_t lastDomain;
+};
+
+static inline string EncodeDomainEntry(value_encoding_t encoding, domain_t domain, const counts_t &counts) {
+    string output;
+    DomainEntryWriter(encoding, output).Append(domain, counts);
+    return output;
+}
+
+static inline bool FindDomainEntry(value_encoding_t encoding, const char *data, size_t size, domain_t domain,
+                                   counts_t *output) {
+    if (encoding == kFixedEncoding) {
+        size_t low = 0;
+        size_t high = size / kDomainEntrySize;
+
+        while (low < high) {
+            size_t mid = (low + high) / 2;
+            domain_t current = DeserializeDomain(data + mid * kDomainEntrySize);
+
+            if (current < domain) {
+                low = mid + 1;
+            } else if (current > domain) {
+                high = mid;
+            } else {
+                *output = DeserializeDomainCounts(data + mid * kDomainEntrySize);
+                return true;
+            }
+        }
+
+        return false;
+    }
+
+    // Variable-length entries can only be scanned, but most n-grams have very few domains
+    DomainEntryReader reader(encoding, data, size);
+    domain_t current;
+    counts_t counts;
+
+    while (reader.Next(&current, &counts)) {
+        if (current == domain) {
+            *output = counts;
+            return true;
+        } else if (current > domain) {
+            break;
+        }
+    }
+
+    return false;
+}
+
 class CountsAddOperator : public AssociativeMergeOperator {
 public:
+    CountsAddOperator(value_encoding_t encoding) : encoding(encoding) {}
+
     virtual bool Merge(const Slice &key, const Slice *existing_value, const Slice &value, std::string *new_value,
                        Logger *logger) const override {
 
         counts_t existing;
         if (existing_value)
-            Deserialize(existing_value->data_, existing_value->size_, &existing);
+            DecodeCounts(encoding, existing_value->data_, existing_value->size_, &existing);
 
         counts_t update;
-        Deserialize(value.data_, value.size_, &update);
+        DecodeCounts(encoding, value.data_, value.size_, &update);
 
         existing.count += update.count;
         existing.successors += update.successors;
 
-        *new_value = SerializeCounts(existing);
+        *new_value = EncodeCounts(encoding, existing);
         return true;
     }
 
     virtual const char *Name() const override {
         return "CountsAddOperator";
     }
+
+private:
+    const value_encoding_t encoding;
+};
+
+class DomainCountsMergeOperator : public AssociativeMergeOperator {
+public:
+    DomainCountsMergeOperator(value_encoding_t encoding) : encoding(encoding) {}
+
+    virtual bool Merge(const Slice &key, const Slice *existing_value, const Slice &value, std::string *new_value,
+                       Logger *logger) const override {
+        if (existing_value == nullptr || existing_value->size_ == 0) {
+            new_value->assign(value.data_, value.size_);
+            return true;
+        }
+
+        // Both the lists are sorted by domain: merge them, summing the counts of the same domain
+        DomainEntryReader a(encoding, existing_value->data_, existing_value->size_);
+        DomainEntryReader b(encoding, value.data_, value.size_);
+
+        string merged;
+        merged.reserve(existing_value->size_ + value.size_);
+        DomainEntryWriter writer(encoding, merged);
+
+        domain_t aDomain, bDomain;
+        counts_t aCounts, bCounts;
+        bool hasA = a.Next(&aDomain, &aCounts);
+        bool hasB = b.Next(&bDomain, &bCounts);
+
+        while (hasA || hasB) {
+            if (hasA && (!hasB || aDomain < bDomain)) {
+                writer.Append(aDomain, aCounts);
+                hasA = a.Next(&aDomain, &aCounts);
+            } else if (!hasA || bDomain < aDomain) {
+                writer.Append(bDomain, bCounts);
+                hasB = b.Next(&bDomain, &bCounts);
+            } else {
+                aCounts.count += bCounts.count;
+                aCounts.successors += bCounts.successors;
+
+                writer.Append(aDomain, aCounts);
+                hasA = a.Next(&aDomain, &aCounts);
+                hasB = b.Next(&bDomain, &bCounts);
+            }
+        }
+
+        new_value->swap(merged);
+        return true;
+    }
+
+    virtual const char *Name() const override {
+        return "DomainCountsMergeOperator";
+    }
+
+private:
+    const value_encoding_t encoding;
 };
 
-NGramStorage::NGramStorage(string basepath, uint8_t order, bool prepareForBulkLoad) throw(storage_exception) : order(
-        order) {
-    rocksdb::Options options;
+// The format file has one "property=value" line for every field of storage_format_t
+static inline bool WriteFormat(const string &path, const storage_format_t &format) {
+    ofstream output(path.c_str());
+    output << "encoding=" << (format.encoding == kVarintEncoding ? "varint" : "fixed") << endl;
+    output << "table=" << (format.table == kBlockTable ? "block" : "plain") << endl;
+
+    return (bool) output;
+}
+
+static inline bool ReadFormat(const string &path, storage_format_t *outFormat) {
+    *outFormat = storage_format_t();
+
+    if (!fs::exists(path))
+        return true;
+
+    ifstream input(path.c_str());
+    string line;
+
+    while (getline(input, line)) {
+        if (line.empty())
+            continue;
+
+        if (line == "encoding=fixed")
+            outFormat->encoding = kFixedEncoding;
+        else if (line == "encoding=varint")
+            outFormat->encoding = kVarintEncoding;
+        else if (line == "table=plain")
+            outFormat->table = kPlainTable;
+        else if (line == "table=block")
+            outFormat->table = kBlockTable;
+        else
+            return false;
+    }
+
+    return true;
+}
+
+NGramStorage::wordcounts_table_t::wordcounts_table_t(size_t size) : size(size) {
+    entries = new atomic<uint64_t>[size];
+    for (size_t i = 0; i < size; ++i)
+        entries[i].store(kUnknownWordCounts, memory_order_relaxed);
+}
+
+NGramStorage::wordcounts_table_t::~wordcounts_table_t() {
+    delete[] entries;
+}
+
+NGramStorage::filters_table_t::filters_table_t(size_t size) : size(size) {
+    entries = new atomic<NGramFilter *>[size];
+    for (size_t i = 0; i < size; ++i)
+        entries[i].store(NULL, memory_order_relaxed);
+}
+
+NGramStorage::filters_table_t::~filters_table_t() {
+    delete[] entries;
+}
+
+NGramStorage::NGramStorage(string basepath, uint8_t order, bool prepareForBulkLoad,
+                           storage_layout_t layout, bool noveltyFilters,
+                           const storage_format_t &defaultFormat) throw(storage_exception) :
+        order(order), layout(layout), useFilters(noveltyFilters), filtersReady(false), stopFiltersLoader(false),
+        filtersLoader(NULL), filtersTable(new filters_table_t(kFiltersTableInitialSize)),
+        wordCountsTable(new wordcounts_table_t(kWordCountsTableInitialSize)) {
+    string path = GetDataPath(basepath, layout);
+    string formatPath = GetFormatPath(basepath, layout);
+
+    if (fs::is_directory(path)) {
+        if (!ReadFormat(formatPath, &format))
+            throw storage_exception("Invalid storage format file: " + formatPath);
+    } else {
+        format = defaultFormat;
+
+        boost::system::error_code error;
+        fs::create_directories(basepath, error);
+
+        if (!WriteFormat(formatPath, format))
+            throw storage_exception("Unable to write storage format file: " + formatPath);
+    }
+
     options.create_if_missing = true;
-    options.merge_operator.reset(new CountsAddOperator);
 
-    PlainTableOptions plainTableOptions;
-    plainTableOptions.user_key_len = sizeof(domain_t) + sizeof(dbkey_t);
+    size_t keyLength;
+
+    if (layout == kInvertedLayout) {
+        options.merge_operator.reset(new DomainCountsMergeOperator(format.encoding));
+        keyLength = sizeof(dbkey_t);
+    } else {
+        options.merge_operator.reset(new CountsAddOperator(format.encoding));
+        keyLength = sizeof(domain_t) + sizeof(dbkey_t);
+    }
 
     options.prefix_extractor.reset(NewNoopTransform());
-    options.table_factory.reset(NewPlainTableFactory(plainTableOptions));
+
+    if (format.table == kBlockTable) {
+        // Lookups are point reads of keys that are often missing: a full (not per block)
+        // bloom filter on the whole key rejects most of them without reading any block
+        BlockBasedTableOptions blockTableOptions;
+        blockTableOptions.block_size = kBlockSize;
+        blockTableOptions.filter_policy.reset(NewBloomFilterPolicy(kBloomBitsPerKey, false));
+        blockTableOptions.whole_key_filtering = true;
+        blockTableOptions.cache_index_and_filter_blocks = false;
+        blockTableOptions.block_cache = NewLRUCache(kBlockCacheSize);
+
+        options.table_factory.reset(NewBlockBasedTableFactory(blockTableOptions));
+        options.compression = kBlockCompressions[0];
+    } else {
+        PlainTableOptions plainTableOptions;
+        plainTableOptions.user_key_len = (uint32_t) keyLength;
+
+        options.table_factory.reset(NewPlainTableFactory(plainTableOptions));
+        options.allow_mmap_reads = true;
+    }
+
     options.memtable_factory.reset(NewHashLinkListRepFactory());
-    options.allow_mmap_reads = true;
 
     options.max_open_files = -1;
     options.compaction_style = kCompactionStyleLevel;
@@ -186,47 +622,237 @@ NGramStorage::NGramStorage(string basepath, uint8_t order, bool prepareForBulkLo
         options.max_bytes_for_level_base = 512 * 1024 * 1024;
     }
 
-    string path = basepath + kPathSeparator + "_data";
-
     Status status = DB::Open(options, path, &db);
+
+    for (size_t i = 1; format.table == kBlockTable && status.IsInvalidArgument() && i < kBlockCompressionsSize; ++i) {
+        options.compression = kBlockCompressions[i];
+        status = DB::Open(options, path, &db);
+    }
+
     if (!status.ok())
         throw storage_exception(status.ToString());
 
     // Read streams
     string raw_streams;
-    db->Get(ReadOptions(), StreamsKey, &raw_streams);
+    db->Get(ReadOptions(), GetStreamsKey(), &raw_streams);
     DeserializeStreams(raw_streams.data(), raw_streams.size(), streams);
+
+    if (useFilters)
+        filtersLoader = new thread(&NGramStorage::LoadFilters, this);
 }
 
 NGramStorage::~NGramStorage() {
+    if (filtersLoader) {
+        stopFiltersLoader = true;
+        filtersLoader->join();
+        delete filtersLoader;
+    }
+
+    filters_table_t *filters = filtersTable.load();
+    for (size_t i = 0; i < filters->size; ++i)
+        delete filters->entries[i].load();
+
+    delete filters;
+    for (auto table = retiredFilters.begin(); table != retiredFilters.end(); ++table)
+        delete *table;
+
     delete db;
+
+    delete wordCountsTable.load();
+    for (auto table = retiredWordCounts.begin(); table != retiredWordCounts.end(); ++table)
+        delete *table;
 }
 
-counts_t NGramStorage::GetCounts(const domain_t domain, const dbkey_t key) const {
-    ReadOptions options = ReadOptions(false, true);
+string NGramStorage::GetFormatPath(const string &path, storage_layout_t layout) {
+    return GetDataPath(path, layout) + ".format";
+}
+
+string NGramStorage::GetDataPath(const string &path, storage_layout_t layout) {
+    return path + kPathSeparator + (layout == kInvertedLayout ? "_ngrams" : "_data");
+}
+
+storage_layout_t NGramStorage::DetectLayout(const string &path, storage_layout_t defaultLayout) {
+    if (fs::is_directory(GetDataPath(path, kInvertedLayout)))
+        return kInvertedLayout;
+    if (fs::is_directory(GetDataPath(path, kDomainLayout)))
+        return kDomainLayout;
+
+    return defaultLayout;
+}
+
+inline string NGramStorage::GetStreamsKey() const {
+    return layout == kInvertedLayout ? SerializeNGramKey(kStreamsKey) : StreamsKey;
+}
 
+inline Status NGramStorage::Read(const ReadOptions &options, const domain_t domain, const dbkey_t key,
+                                 counts_t *outCounts) const {
     string value;
-    Status status = db->Get(options, Slice(SerializeKey(domain, key)), &value);
 
-    if (!status.ok()) {
-        if (status.IsNotFound())
-            return counts_t();
+    if (layout == kInvertedLayout) {
+        Status status = db->Get(options, Slice(SerializeNGramKey(key)), &value);
+        if (!status.ok())
+            return status;
+
+        return FindDomainEntry(format.encoding, value.data(), value.size(), domain, outCounts) ?
+               status : Status::NotFound();
+    } else {
+        Status status = db->Get(options, Slice(SerializeKey(domain, key)), &value);
+        if (status.ok() && !DecodeCounts(format.encoding, value.data(), value.size(), outCounts))
+            *outCounts = counts_t();
+
+        return status;
+    }
+}
+
+void NGramStorage::Read(const ReadOptions &options, const domain_t domain, const vector<dbkey_t> &keys,
+                        vector<Status> &outStatuses) const {
+    vector<string> serializedKeys;
+    serializedKeys.reserve(keys.size());
+
+    for (auto key = keys.begin(); key != keys.end(); ++key)
+        serializedKeys.push_back(layout == kInvertedLayout ? SerializeNGramKey(*key) : SerializeKey(domain, *key));
+
+    vector<Slice> slices(serializedKeys.begin(), serializedKeys.end());
+    vector<string> values;
+
+    outStatuses = db->MultiGet(options, slices, &values);
+
+    if (layout == kInvertedLayout) {
+        counts_t counts;
 
-        return counts_t();
+        for (size_t i = 0; i < keys.size(); ++i) {
+            if (outStatuses[i].ok() &&
+                !FindDomainEntry(format.encoding, values[i].data(), values[i].size(), domain, &counts))
+                outStatuses[i] = Status::NotFound();
+        }
     }
+}
 
+inline void NGramStorage::Write(WriteBatch &writeBatch, const domain_t domain, const dbkey_t key,
+                                const counts_t &counts) const {
+    if (layout == kInvertedLayout)
+        writeBatch.Merge(Slice(SerializeNGramKey(key)), Slice(EncodeDomainEntry(format.encoding, domain, counts)));
+    else
+        writeBatch.Merge(Slice(SerializeKey(domain, key)), Slice(EncodeCounts(format.encoding, counts)));
+}
+
+counts_t NGramStorage::GetCounts(const domain_t domain, const dbkey_t key) const {
     counts_t output;
-    return Deserialize(value.data(), value.size(), &output) ? output : counts_t();
+    Status status = Read(ReadOptions(false, true), domain, key, &output);
+
+    return status.ok() ? output : counts_t();
+}
+
+bool NGramStorage::MayContain(const domain_t domain, const dbkey_t key) const {
+    if (!useFilters || !filtersReady.load(memory_order_acquire))
+        return true;
+
+    filters_table_t *table = filtersTable.load(memory_order_acquire);
+    const NGramFilter *filter = domain < table->size ? table->entries[domain].load(memory_order_acquire) : NULL;
+
+    // Once loaded, there is a filter for every domain with at least one n-gram
+    return filter != NULL && filter->MayContain(key);
+}
+
+void NGramStorage::GetCounts(const vector<domain_t> &domains, const vector<dbkey_t> &keys,
+                            vector<counts_t> &outCounts) const {
+    size_t size = keys.size() * domains.size();
+
+    if (layout == kInvertedLayout) {
+        // A single read per n-gram returns its counts in all the domains
+        vector<string> serializedKeys;
+        serializedKeys.reserve(keys.size());
+
+        for (auto key = keys.begin(); key != keys.end(); ++key)
+            serializedKeys.push_back(SerializeNGramKey(*key));
+
+        vector<Slice> slices(serializedKeys.begin(), serializedKeys.end());
+        vector<string> values;
+
+        vector<Status> statuses = db->MultiGet(ReadOptions(false, true), slices, &values);
+
+        outCounts.resize(size);
+        for (size_t i = 0; i < keys.size(); ++i) {
+            const string &value = values[i];
+
+            for (size_t j = 0; j < domains.size(); ++j) {
+                counts_t &counts = outCounts[i * domains.size() + j];
+
+                if (!statuses[i].ok() ||
+                    !FindDomainEntry(format.encoding, value.data(), value.size(), domains[j], &counts))
+                    counts = counts_t();
+            }
+        }
+
+        return;
+    }
+
+    vector<string> serializedKeys;
+    serializedKeys.reserve(size);
+
+    for (auto key = keys.begin(); key != keys.end(); ++key) {
+        for (auto domain = domains.begin(); domain != domains.end(); ++domain)
+            serializedKeys.push_back(SerializeKey(*domain, *key));
+    }
+
+    vector<Slice> slices(serializedKeys.begin(), serializedKeys.end());
+    vector<string> values;
+
+    vector<Status> statuses = db->MultiGet(ReadOptions(false, true), slices, &values);
+
+    outCounts.resize(size);
+    for (size_t i = 0; i < size; ++i) {
+        if (!statuses[i].ok() || !DecodeCounts(format.encoding, values[i].data(), values[i].size(), &outCounts[i]))
+            outCounts[i] = counts_t();
+    }
 }
 
 void NGramStorage::GetWordCounts(const domain_t domain, count_t *outUniqueWordCount, count_t *outWordCount) const {
-    counts_t counts = GetCounts(domain, WordCountsKey);
+    wordcounts_table_t *table = wordCountsTable.load(memory_order_acquire);
+    uint64_t value = domain < table->size ? table->entries[domain].load(memory_order_relaxed) : kUnknownWordCounts;
+
+    if (value == kUnknownWordCounts)
+        value = LoadWordCounts(domain);
+
+    counts_t counts = UnpackWordCounts(value);
     if (outWordCount)
         *outWordCount = counts.count;
     if (outUniqueWordCount)
         *outUniqueWordCount = counts.successors;
 }
 
+uint64_t NGramStorage::LoadWordCounts(const domain_t domain) const {
+    lock_guard<mutex> lock(wordCountsAccess);
+
+    atomic<uint64_t> &entry = GetWordCountsTable(domain)->entries[domain];
+    uint64_t value = entry.load(memory_order_relaxed);
+
+    if (value == kUnknownWordCounts) {
+        value = PackWordCounts(GetCounts(domain, kWordCountsKey));
+        entry.store(value, memory_order_relaxed);
+    }
+
+    return value;
+}
+
+NGramStorage::wordcounts_table_t *NGramStorage::GetWordCountsTable(const domain_t domain) const {
+    // Must be called holding "wordCountsAccess"
+    wordcounts_table_t *table = wordCountsTable.load(memory_order_relaxed);
+
+    if (domain >= table->size) {
+        wordcounts_table_t *grown = new wordcounts_table_t(max((size_t) domain + 1, table->size * 2));
+        for (size_t i = 0; i < table->size; ++i)
+            grown->entries[i].store(table->entries[i].load(memory_order_relaxed), memory_order_relaxed);
+
+        // Readers may still hold a reference to the old table: it is released on destruction only
+        wordCountsTable.store(grown, memory_order_release);
+        retiredWordCounts.push_back(table);
+        table = grown;
+    }
+
+    return table;
+}
+
 size_t NGramStorage::GetEstimateSize() const {
     uint64_t size;
     db->GetAggregatedIntProperty(Slice("rocksdb.estimate-num-keys"), &size);
@@ -237,23 +863,51 @@ void NGramStorage::PutBatch(NGramBatch &batch) throw(storage_exception) {
     WriteBatch writeBatch;
 
     unordered_map<domain_t, ngram_table_t> &ngrams = batch.GetNGrams();
+    vector<pair<domain_t, counts_t>> wordCountsUpdates;
+    wordCountsUpdates.reserve(ngrams.size());
 
     for (auto it = ngrams.begin(); it != ngrams.end(); ++it) {
-        PrepareBatch(it->first, it->second, writeBatch);
+        counts_t domainWordCounts;
+        if (PrepareBatch(it->first, it->second, writeBatch, &domainWordCounts))
+            wordCountsUpdates.push_back(make_pair(it->first, domainWordCounts));
     }
 
     // Store streams status
-    writeBatch.Put(Slice(StreamsKey), Slice(SerializeStreams(batch.GetStreams())));
+    writeBatch.Put(Slice(GetStreamsKey()), Slice(SerializeStreams(batch.GetStreams())));
 
-    Status status = db->Write(WriteOptions(), &writeBatch);
-    if (!status.ok())
-        throw storage_exception(status.ToString());
+    {
+        // Word counts table must be updated together with the commit, otherwise
+        // a concurrent LoadWordCounts() could overwrite it with a stale value
+        lock_guard<mutex> lock(wordCountsAccess);
+
+        Status status = db->Write(WriteOptions(), &writeBatch);
+        if (!status.ok())
+            throw storage_exception(status.ToString());
+
+        for (auto update = wordCountsUpdates.begin(); update != wordCountsUpdates.end(); ++update) {
+            atomic<uint64_t> &entry = GetWordCountsTable(update->first)->entries[update->first];
+            uint64_t value = entry.load(memory_order_relaxed);
+
+            if (value == kUnknownWordCounts) {
+                value = PackWordCounts(GetCounts(update->first, kWordCountsKey));
+            } else {
+                counts_t counts = UnpackWordCounts(value);
+                counts.count += update->second.count;
+                counts.successors += update->second.successors;
+
+                value = PackWordCounts(counts);
+            }
+
+            entry.store(value, memory_order_relaxed);
+        }
+    }
 
     // Reset streams
     streams = batch.GetStreams();
 }
 
-bool NGramStorage::PrepareBatch(domain_t domain, ngram_table_t &table, rocksdb::WriteBatch &writeBatch) {
+bool NGramStorage::PrepareBatch(domain_t domain, ngram_table_t &table, rocksdb::WriteBatch &writeBatch,
+                                counts_t *outWordCounts) {
     // Compute counts (successors and word counts)
     // ------------------------
 
@@ -263,15 +917,26 @@ bool NGramStorage::PrepareBatch(domain_t domain, ngram_table_t &table, rocksdb::
     // database). This can save lots of read requests for well known n-grams
 
     ReadOptions read_ops = ReadOptions(false, true);
-    Status status;
+
+    // The filter is complete only once it has been loaded: before, all the n-grams are read from the database
+    NGramFilter *filter = useFilters ? GetFilter(domain) : NULL;
+    bool isFilterReady = filter && filtersReady.load(memory_order_acquire);
 
     // We also store the word count and the count of unique words
     count_t uniqueWordCount = 0;
     count_t wordCount = 0;
 
+    vector<dbkey_t> candidates;
+    vector<ngram_t *> candidateNGrams;
+    vector<Status> statuses;
+
     for (size_t o = order; o > 0; --o) {
         unordered_map<dbkey_t, ngram_t> &entry = table[o - 1];
 
+        // N-grams rejected by the filter are new for sure, the others are read all at once
+        candidates.clear();
+        candidateNGrams.clear();
+
         for (auto it = entry.begin(); it != entry.end(); ++it) {
             dbkey_t key = it->first;
             ngram_t &ngram = it->second;
@@ -279,32 +944,50 @@ bool NGramStorage::PrepareBatch(domain_t domain, ngram_table_t &table, rocksdb::
             if (o == 1)
                 wordCount += ngram.counts.count;
 
-            if (!ngram.is_in_db_for_sure) {
-                string value;
-                status = db->Get(read_ops, Slice(SerializeKey(domain, key)), &value);
+            if (ngram.is_in_db_for_sure)
+                continue;
+
+            if (isFilterReady && !filter->MayContain(key)) {
+                if (o == 1) // it is a word
+                    uniqueWordCount++;
+                else // increment predecessor's successors
+                    table[o - 2][ngram.predecessor].counts.successors++;
+            } else {
+                candidates.push_back(key);
+                candidateNGrams.push_back(&ngram);
+            }
+        }
+
+        if (candidates.empty())
+            continue;
 
-                if (!status.ok()) {
-                    if (!status.IsNotFound())
-                        return false;
+        Read(read_ops, domain, candidates, statuses);
 
-                    if (o == 1) { // it is a word
-                        uniqueWordCount++;
-                    } else {
-                        // NGram NOT found in db
-                        // increment predecessor's successors
-                        table[o - 2][ngram.predecessor].counts.successors++;
-                    }
+        for (size_t i = 0; i < candidates.size(); ++i) {
+            const Status &status = statuses[i];
+            ngram_t &ngram = *candidateNGrams[i];
+
+            if (!status.ok()) {
+                if (!status.IsNotFound())
+                    return false;
+
+                if (o == 1) { // it is a word
+                    uniqueWordCount++;
                 } else {
-                    // If the n-gram is a word, it has no predecessors
-                    if (o > 1) {
-                        // NGram found in db
-                        // set "is_in_db_for_sure" to true for the whole predecessors subtree
-                        dbkey_t cursor = ngram.predecessor;
-                        for (size_t i = o - 2; i > 0; --i) {
-                            ngram_t &predecessor = table[i][cursor];
-                            predecessor.is_in_db_for_sure = true;
-                            cursor = predecessor.predecessor;
-                        }
+                    // NGram NOT found in db
+                    // increment predecessor's successors
+                    table[o - 2][ngram.predecessor].counts.successors++;
+                }
+            } else {
+                // If the n-gram is a word, it has no predecessors
+                if (o > 1) {
+                    // NGram found in db
+                    // set "is_in_db_for_sure" to true for the whole predecessors subtree
+                    dbkey_t cursor = ngram.predecessor;
+                    for (size_t j = o - 2; j > 0; --j) {
+                        ngram_t &predecessor = table[j][cursor];
+                        predecessor.is_in_db_for_sure = true;
+                        cursor = predecessor.predecessor;
                     }
                 }
             }
@@ -322,13 +1005,18 @@ bool NGramStorage::PrepareBatch(domain_t domain, ngram_table_t &table, rocksdb::
             dbkey_t key = it->first;
             ngram_t &ngram = it->second;
 
-            writeBatch.Merge(Slice(SerializeKey(domain, key)), Slice(SerializeCounts(ngram.counts)));
+            Write(writeBatch, domain, key, ngram.counts);
+
+            if (filter)
+                filter->Add(key);
         }
     }
 
     // Store word counts
     counts_t wordCounts(wordCount, uniqueWordCount);
-    writeBatch.Merge(Slice(SerializeKey(domain, WordCountsKey)), Slice(SerializeCounts(wordCounts)));
+    Write(writeBatch, domain, kWordCountsKey, wordCounts);
+
+    *outWordCounts = wordCounts;
 
     return true;
 }
@@ -340,3 +1028,234 @@ void NGramStorage::ForceCompaction() {
 const vector<seqid_t> &NGramStorage::GetStreamsStatus() const {
     return streams;
 }
+
+Status NGramStorage::Scan(const function<bool(domain_t, dbkey_t, const counts_t &)> &callback) const {
+    const string streamsKey = GetStreamsKey();
+
+    Iterator *it = db->NewIterator(ReadOptions(false, false));
+
+    for (it->SeekToFirst(); it->Valid(); it->Next()) {
+        Slice key = it->key();
+        Slice value = it->value();
+
+        if (key.size_ == streamsKey.size() && memcmp(key.data_, streamsKey.data(), key.size_) == 0)
+            continue;
+
+        bool proceed = true;
+
+        if (layout == kInvertedLayout) {
+            if (key.size_ != sizeof(dbkey_t))
+                continue;
+
+            dbkey_t ngramKey = DeserializeNGramKey(key.data_);
+            DomainEntryReader reader(format.encoding, value.data_, value.size_);
+
+            domain_t domain;
+            counts_t counts;
+            while (proceed && reader.Next(&domain, &counts))
+                proceed = callback(domain, ngramKey, counts);
+        } else {
+            counts_t counts;
+            if (key.size_ != sizeof(domain_t) + sizeof(dbkey_t) ||
+                !DecodeCounts(format.encoding, value.data_, value.size_, &counts))
+                continue;
+
+            proceed = callback(DeserializeUInt32(key.data_), DeserializeNGramKey(key.data_ + 4), counts);
+        }
+
+        if (!proceed)
+            break;
+    }
+
+    Status status = it->status();
+    delete it;
+
+    return status;
+}
+
+void NGramStorage::CopyTo(NGramStorage &target, size_t batchSize) const throw(storage_exception) {
+    WriteBatch writeBatch;
+    size_t writeBatchSize = 0;
+    Status writeStatus;
+
+    Status status = Scan([&](domain_t domain, dbkey_t key, const counts_t &counts) {
+        target.Write(writeBatch, domain, key, counts);
+
+        if (target.useFilters)
+            target.GetFilter(domain)->Add(key);
+
+        if (++writeBatchSize >= batchSize) {
+            writeStatus = target.db->Write(WriteOptions(), &writeBatch);
+
+            writeBatch.Clear();
+            writeBatchSize = 0;
+        }
+
+        return writeStatus.ok();
+    });
+
+    if (!writeStatus.ok())
+        throw storage_exception(writeStatus.ToString());
+    if (!status.ok())
+        throw storage_exception(status.ToString());
+
+    writeBatch.Put(Slice(target.GetStreamsKey()), Slice(SerializeStreams(streams)));
+
+    status = target.db->Write(WriteOptions(), &writeBatch);
+    if (!status.ok())
+        throw storage_exception(status.ToString());
+
+    target.streams = streams;
+}
+
+void NGramStorage::IngestSorted(const function<bool(domain_t *, dbkey_t *, counts_t *)> &next,
+                                const string &tempPath) throw(storage_exception) {
+    SstFileWriter writer(EnvOptions(), options);
+    vector<string> files;
+
+    domain_t domain;
+    dbkey_t key;
+    counts_t counts;
+    bool hasNext = next(&domain, &key, &counts);
+
+    while (hasNext) {
+        string file = tempPath + kPathSeparator + "ingest_" + to_string(files.size()) + ".sst";
+        files.push_back(file);
+
+        Status status = writer.Open(file);
+        if (!status.ok())
+            throw storage_exception(status.ToString());
+
+        // A file ends on a record boundary, so that the files do not overlap
+        size_t fileSize = 0;
+        while (hasNext && fileSize < kIngestFileSize) {
+            string serializedKey;
+            string value;
+
+            if (layout == kInvertedLayout) {
+                const dbkey_t current = key;
+
+                serializedKey = SerializeNGramKey(current);
+                DomainEntryWriter entries(format.encoding, value);
+                do {
+                    entries.Append(domain, counts);
+                    if (useFilters && key != kWordCountsKey)
+                        GetFilter(domain)->Add(key);
+
+                    hasNext = next(&domain, &key, &counts);
+                } while (hasNext && key == current);
+            } else {
+                serializedKey = SerializeKey(domain, key);
+                value = EncodeCounts(format.encoding, counts);
+                if (useFilters && key != kWordCountsKey)
+                    GetFilter(domain)->Add(key);
+
+                hasNext = next(&domain, &key, &counts);
+            }
+
+            status = writer.Add(Slice(serializedKey), Slice(value));
+            if (!status.ok())
+                throw storage_exception(status.ToString());
+
+            fileSize += serializedKey.size() + value.size();
+        }
+
+        status = writer.Finish();
+        if (!status.ok())
+            throw storage_exception(status.ToString());
+    }
+
+    if (!files.empty()) {
+        IngestExternalFileOptions ingestOptions;
+        ingestOptions.move_files = true;
+
+        Status status = db->IngestExternalFile(files, ingestOptions);
+        if (!status.ok())
+            throw storage_exception(status.ToString());
+    }
+
+    for (auto file = files.begin(); file != files.end(); ++file) {
+        boost::system::error_code error;
+        fs::remove(*file, error);
+    }
+
+    Status status = db->Put(WriteOptions(), Slice(GetStreamsKey()), Slice(SerializeStreams(streams)));
+    if (!status.ok())
+        throw storage_exception(status.ToString());
+
+    // Word counts have changed under the table: they are read again from the database
+    lock_guard<mutex> lock(wordCountsAccess);
+
+    wordcounts_table_t *table = wordCountsTable.load(memory_order_relaxed);
+    for (size_t i = 0; i < table->size; ++i)
+        table->entries[i].store(kUnknownWordCounts, memory_order_relaxed);
+}
+
+NGramFilter *NGramStorage::GetFilter(const domain_t domain, size_t capacity) {
+    lock_guard<mutex> lock(filtersAccess);
+
+    filters_table_t *table = filtersTable.load(memory_order_relaxed);
+
+    if (domain >= table->size) {
+        filters_table_t *grown = new filters_table_t(max((size_t) domain + 1, table->size * 2));
+        for (size_t i = 0; i < table->size; ++i)
+            grown->entries[i].store(table->entries[i].load(memory_order_relaxed), memory_order_relaxed);
+
+        // Readers may still hold a reference to the old table: it is released on destruction only
+        filtersTable.store(grown, memory_order_release);
+        retiredFilters.push_back(table);
+        table = grown;
+    }
+
+    NGramFilter *filter = table->entries[domain].load(memory_order_relaxed);
+    if (filter == NULL) {
+        filter = new NGramFilter(capacity);
+        table->entries[domain].store(filter, memory_order_release);
+    }
+
+    return filter;
+}
+
+void NGramStorage::LoadFilters() {
+    // The keys are counted first, so that the filter of every domain is created with a single
+    // slice for all of them (a filter created meanwhile by PrepareBatch() just grows)
+    unordered_map<domain_t, size_t> sizes;
+    domain_t lastDomain = 0;
+    size_t *size = NULL;
+
+    Status status = Scan([&](domain_t domain, dbkey_t key, const counts_t &counts) {
+        if (size == NULL || domain != lastDomain) {
+            size = &sizes[domain];
+            lastDomain = domain;
+        }
+
+        if (key != kWordCountsKey)
+            (*size)++;
+
+        return !stopFiltersLoader.load(memory_order_relaxed);
+    });
+
+    if (!status.ok() || stopFiltersLoader)
+        return;
+
+    for (auto entry = sizes.begin(); entry != sizes.end(); ++entry)
+        GetFilter(entry->first, entry->second);
+
+    // Keys written while scanning are added to the filters by PrepareBatch()
+    NGramFilter *filter = NULL;
+
+    status = Scan([&](domain_t domain, dbkey_t key, const counts_t &counts) {
+        if (filter == NULL || domain != lastDomain) {
+            filter = GetFilter(domain);
+            lastDomain = domain;
+        }
+
+        if (key != kWordCountsKey)
+            filter->Add(key);
+
+        return !stopFiltersLoader.load(memory_order_relaxed);
+    });
+
+    if (status.ok() && !stopFiltersLoader)
+        filtersReady.store(true, memory_order_release);
+}
@@ -7,12 +7,18 @@
 
 #include <string>
 #include <vector>
+#include <atomic>
+#include <mutex>
+#include <thread>
+#include <functional>
+#include <unordered_map>
 #include <rocksdb/db.h>
 #include <lm/LM.h>
 #include <mmt/IncrementalModel.h>
 #include "dbkey.h"
 #include "counts.h"
 #include "NGramBatch.h"
+#include "NGramFilter.h"
 
 using namespace std;
 
@@ -31,15 +37,71 @@ namespace mmt {
             string message;
         };
 
+        // On-disk layout of the n-gram counts
+        enum storage_layout_t {
+            // one record for every domain and n-gram, keyed by domain and n-gram key
+            kDomainLayout = 0,
+
+            // one record for every n-gram, keyed by n-gram key only: its value is the list
+            // of the counts of the n-gram in every domain, sorted by domain
+            kInvertedLayout = 1
+        };
+
+        // Encoding of the counts in the database
+        enum value_encoding_t {
+            // every count and successors count takes 4 bytes
+            kFixedEncoding = 0,
+
+            // counts are variable-length integers, and the n-grams seen once with no
+            // successors (the vast majority) take no value bytes at all
+            kVarintEncoding = 1
+        };
+
+        // Format of the database table files
+        enum table_format_t {
+            // uncompressed, memory-mapped tables with a hash index: the fastest lookups
+            kPlainTable = 0,
+
+            // compressed blocks with bloom filters, read through a block cache: the smallest footprint
+            kBlockTable = 1
+        };
+
+        struct storage_format_t {
+            value_encoding_t encoding;
+            table_format_t table;
+
+            storage_format_t(value_encoding_t encoding = kFixedEncoding, table_format_t table = kPlainTable)
+                    : encoding(encoding), table(table) {};
+        };
+
         class NGramStorage {
         public:
 
-            NGramStorage(string path, uint8_t order, bool prepareForBulkLoad = false) throw(storage_exception);
+            // If "noveltyFilters" is true, the n-gram keys of every domain are also kept in memory in
+            // approximate form (see NGramFilter), so that PutBatch() skips the database reads for the
+            // n-grams that are new for sure. The filters are loaded in background, by scanning the
+            // whole database: until then all the n-grams are read from the database.
+            // A new storage is created with "format", while an existing one keeps the format it has
+            // been created with (see GetFormatPath()).
+            NGramStorage(string path, uint8_t order, bool prepareForBulkLoad = false,
+                         storage_layout_t layout = kDomainLayout, bool noveltyFilters = true,
+                         const storage_format_t &format = storage_format_t()) throw(storage_exception);
 
             ~NGramStorage();
 
             counts_t GetCounts(const domain_t domain, const dbkey_t key) const;
 
+            // Returns false only if "key" is not in "domain" for sure, without reading the database;
+            // it always returns true if the novelty filters are disabled or not loaded yet
+            bool MayContain(const domain_t domain, const dbkey_t key) const;
+
+            // Retrieves the counts of all the given keys, for all the given domains, with a single
+            // batch read; the counts of keys[i] in domains[j] are stored in outCounts[i * domains.size() + j]
+            void GetCounts(const vector<domain_t> &domains, const vector<dbkey_t> &keys,
+                           vector<counts_t> &outCounts) const;
+
+            // Word counts are served from memory: they are read from the database the first time
+            // a domain is requested and then kept up to date by PutBatch()
             void GetWordCounts(const domain_t domain, count_t *outUniqueWordCount, count_t *outWordCount) const;
 
             size_t GetEstimateSize() const;
@@ -54,12 +116,119 @@ namespace mmt {
 
             const vector<seqid_t> &GetStreamsStatus() const;
 
+            inline storage_layout_t GetLayout() const {
+                return layout;
+            }
+
+            inline const storage_format_t &GetFormat() const {
+                return format;
+            }
+
+            // Copies all the counts and the streams status of this storage into "target",
+            // converting them to the target layout
+            void CopyTo(NGramStorage &target, size_t batchSize = 100000) const throw(storage_exception);
+
+            // Bulk loads the counts returned by "next" (until it returns false), that must be sorted
+            // with KeyLess() and must not be in the storage yet: they are written to table files
+            // in "tempPath" that are then ingested by the database, bypassing memtables and merges
+            void IngestSorted(const function<bool(domain_t *, dbkey_t *, counts_t *)> &next,
+                              const string &tempPath) throw(storage_exception);
+
+            // Returns true if the record of "a" in "aDomain" precedes the one of "b" in "bDomain" in the
+            // database, that sorts keys by their little-endian serialization, byte by byte
+            inline bool KeyLess(const domain_t aDomain, const dbkey_t a, const domain_t bDomain, const dbkey_t b) const {
+                if (layout == kInvertedLayout) {
+                    if (a != b)
+                        return __builtin_bswap64(a) < __builtin_bswap64(b);
+
+                    return aDomain < bDomain;
+                } else {
+                    if (aDomain != bDomain)
+                        return __builtin_bswap32(aDomain) < __builtin_bswap32(bDomain);
+
+                    return __builtin_bswap64(a) < __builtin_bswap64(b);
+                }
+            }
+
+            // Returns the layout of the storage at "path", or "defaultLayout" if it does not exist yet
+            static storage_layout_t DetectLayout(const string &path, storage_layout_t defaultLayout);
+
+            // Returns the path of the database that holds the storage at "path" with the given layout
+            static string GetDataPath(const string &path, storage_layout_t layout);
+
+            // Returns the path of the file that records the format of the storage at "path" with the given
+            // layout; storages created before formats were introduced have none and use the default format
+            static string GetFormatPath(const string &path, storage_layout_t layout);
+
         private:
+            // Dense table of the per-domain word counts, indexed by domain; every entry packs
+            // the word count and the unique word count in a single word, so that it can be
+            // read and updated atomically
+            struct wordcounts_table_t {
+                const size_t size;
+                atomic<uint64_t> *entries;
+
+                wordcounts_table_t(size_t size);
+
+                ~wordcounts_table_t();
+            };
+
+            // Dense table of the novelty filters, indexed by domain: it is only replaced by a larger
+            // one, thus MayContain() reads it without locking
+            struct filters_table_t {
+                const size_t size;
+                atomic<NGramFilter *> *entries;
+
+                filters_table_t(size_t size);
+
+                ~filters_table_t();
+            };
+
             const uint8_t order;
+            const storage_layout_t layout;
+            storage_format_t format;
             vector<seqid_t> streams;
+            rocksdb::Options options;
             rocksdb::DB *db;
 
-            inline bool PrepareBatch(domain_t domain, ngram_table_t &table, rocksdb::WriteBatch &writeBatch);
+            const bool useFilters;
+            atomic<bool> filtersReady;
+            atomic<bool> stopFiltersLoader;
+            thread *filtersLoader;
+            atomic<filters_table_t *> filtersTable;
+            vector<filters_table_t *> retiredFilters;
+            mutex filtersAccess;
+
+            mutable atomic<wordcounts_table_t *> wordCountsTable;
+            mutable vector<wordcounts_table_t *> retiredWordCounts;
+            mutable mutex wordCountsAccess;
+
+            inline string GetStreamsKey() const;
+
+            inline rocksdb::Status Read(const rocksdb::ReadOptions &options, const domain_t domain, const dbkey_t key,
+                                        counts_t *outCounts) const;
+
+            // Reads all the given keys of a domain with a single batch read; the status of a missing key is NotFound
+            void Read(const rocksdb::ReadOptions &options, const domain_t domain, const vector<dbkey_t> &keys,
+                      vector<rocksdb::Status> &outStatuses) const;
+
+            inline void Write(rocksdb::WriteBatch &writeBatch, const domain_t domain, const dbkey_t key,
+                              const counts_t &counts) const;
+
+            inline bool PrepareBatch(domain_t domain, ngram_table_t &table, rocksdb::WriteBatch &writeBatch,
+                                     counts_t *outWordCounts);
+
+            // Calls "callback" for every n-gram count stored in the database (except the streams status),
+            // until it returns false
+            rocksdb::Status Scan(const function<bool(domain_t, dbkey_t, const counts_t &)> &callback) const;
+
+            NGramFilter *GetFilter(const domain_t domain, size_t capacity = NGramFilter::kDefaultCapacity);
+
+            void LoadFilters();
+
+            uint64_t LoadWordCounts(const domain_t domain) const;
+
+            wordcounts_table_t *GetWordCountsTable(const domain_t domain) const;
         };
 
     }
@@ -13,6 +13,13 @@ namespace mmt {
 
         typedef uint64_t dbkey_t;
 
+        // key "0" is reserved for the per-domain word counts
+        const dbkey_t kWordCountsKey = 0;
+
+        // key "UINT64_MAX" is reserved for the streams status of the domain-inverted storage:
+        // word keys are 32 bit, while a longer n-gram hits it as rarely as any other hash collision
+        const dbkey_t kStreamsKey = UINT64_MAX;
+
         inline dbkey_t make_key(const wid_t word) {
             return (dbkey_t) word;
         }
@@ -23,15 +30,19 @@ namespace mmt {
             return key == 0 ? 1 : key; // key "0" is reserved
         }
 
-        inline dbkey_t make_key(const vector<wid_t> &words, const size_t offset, const size_t size) {
-            dbkey_t key = make_key(words[offset]);
+        inline dbkey_t make_key(const wid_t *words, const size_t size) {
+            dbkey_t key = make_key(words[0]);
 
             for (size_t i = 1; i < size; ++i)
-                key = make_key(key, words[offset + i]);
+                key = make_key(key, words[i]);
 
             return key;
         }
 
+        inline dbkey_t make_key(const vector<wid_t> &words, const size_t offset, const size_t size) {
+            return make_key(words.data() + offset, size);
+        }
+
         inline dbkey_t make_key(const vector<wid_t> &words, const size_t order) {
             const size_t offset = (size_t) std::max(0, (int) (words.size() - order));
             return make_key(words, offset, order);
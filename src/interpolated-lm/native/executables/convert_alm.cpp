@@ -0,0 +1,258 @@
+//
+// Converts an adaptive language model to a different storage layout or format.
+//
+
+#include <cstddef>
+#include <boost/program_options.hpp>
+#include <boost/filesystem.hpp>
+#include <fstream>
+#include <iostream>
+#include <db/NGramStorage.h>
+
+using namespace std;
+using namespace mmt;
+using namespace mmt::ilm;
+
+namespace {
+    const size_t ERROR_IN_COMMAND_LINE = 1;
+    const size_t GENERIC_ERROR = 2;
+    const size_t SUCCESS = 0;
+
+    struct args_t {
+        string model_path;
+        uint8_t order = 5;
+
+        // Unset properties are kept as they are in the model
+        bool has_layout = false;
+        storage_layout_t layout = kInvertedLayout;
+        bool has_encoding = false;
+        value_encoding_t encoding = kFixedEncoding;
+        bool has_table = false;
+        table_format_t table = kPlainTable;
+
+        size_t buffer_size = 100000;
+    };
+} // namespace
+
+namespace po = boost::program_options;
+namespace fs = boost::filesystem;
+
+/*
+ * The new storage is built in <model>/_convert; once it is complete, the layouts of the swap are
+ * written to <model>/_convert/complete. The current storage is then moved to <model>/_replaced,
+ * the new one is moved in its place, and only at last the two directories are removed.
+ *
+ * Every step can be repeated after a crash: a storage still in _convert has not replaced the
+ * current one yet, thus CompleteSwap() can always be run again on a complete conversion.
+ */
+string GetConvertPath(const string &modelPath) {
+    return (fs::path(modelPath) / "_convert").string();
+}
+
+string GetReplacedPath(const string &modelPath) {
+    return (fs::path(modelPath) / "_replaced").string();
+}
+
+string GetCompletePath(const string &modelPath) {
+    return (fs::path(GetConvertPath(modelPath)) / "complete").string();
+}
+
+void Replace(const string &current, const string &target, const string &replacement, const string &aside) {
+    if (!fs::exists(replacement))
+        return;
+
+    if (fs::exists(current))
+        fs::rename(current, aside);
+    fs::rename(replacement, target);
+}
+
+void CompleteSwap(const string &modelPath, storage_layout_t sourceLayout, storage_layout_t targetLayout) {
+    string convertPath = GetConvertPath(modelPath);
+    string replacedPath = GetReplacedPath(modelPath);
+
+    fs::create_directories(replacedPath);
+
+    Replace(NGramStorage::GetDataPath(modelPath, sourceLayout),
+              NGramStorage::GetDataPath(modelPath, targetLayout),
+              NGramStorage::GetDataPath(convertPath, targetLayout),
+              NGramStorage::GetDataPath(replacedPath, sourceLayout));
+    Replace(NGramStorage::GetFormatPath(modelPath, sourceLayout),
+              NGramStorage::GetFormatPath(modelPath, targetLayout),
+              NGramStorage::GetFormatPath(convertPath, targetLayout),
+              NGramStorage::GetFormatPath(replacedPath, sourceLayout));
+
+    fs::remove_all(convertPath);
+    fs::remove_all(replacedPath);
+}
+
+// Completes the swap of a conversion that was interrupted after the new storage was complete,
+// otherwise it drops the partial storage: the current one has not been touched yet
+void RecoverConversion(const string &modelPath) {
+    string convertPath = GetConvertPath(modelPath);
+
+    if (fs::exists(convertPath)) {
+        ifstream complete(GetCompletePath(modelPath));
+        int sourceLayout, targetLayout;
+
+        if (complete >> sourceLayout >> targetLayout) {
+            cerr << "WARNING: completing the previous conversion of " << modelPath << endl;
+            CompleteSwap(modelPath, (storage_layout_t) sourceLayout, (storage_layout_t) targetLayout);
+        } else {
+            cerr << "WARNING: removing the incomplete conversion in " << convertPath << endl;
+            fs::remove_all(convertPath);
+        }
+    }
+
+    // the new storage is already in place, this is just the old copy
+    fs::remove_all(GetReplacedPath(modelPath));
+}
+
+bool ParseArgs(int argc, const char *argv[], args_t *args) {
+    po::options_description desc("Convert an adaptive language model to a different storage layout or format");
+    desc.add_options()
+            ("help,h", "print this help message")
+            ("model,m", po::value<string>()->required(), "adaptive language model path")
+            ("order,o", po::value<uint8_t>(), "the language model order (default is 5)")
+            ("layout,l", po::value<string>(), "the target layout, either 'inverted' or 'domain'")
+            ("encoding,e", po::value<string>(), "the target counts encoding, either 'fixed' or 'varint'")
+            ("table,t", po::value<string>(), "the target table format, either 'plain' or 'block'")
+            ("buffer,b", po::value<size_t>(), "number of n-grams written with a single batch");
+
+    po::variables_map vm;
+    try {
+        po::store(po::parse_command_line(argc, argv, desc), vm);
+
+        if (vm.count("help")) {
+            std::cout << desc << std::endl;
+            return false;
+        }
+
+        po::notify(vm);
+
+        args->model_path = vm["model"].as<string>();
+
+        if (vm.count("order"))
+            args->order = vm["order"].as<uint8_t>();
+
+        if (vm.count("buffer"))
+            args->buffer_size = vm["buffer"].as<size_t>();
+
+        if (vm.count("layout")) {
+            string layout = vm["layout"].as<string>();
+
+            if (layout == "inverted")
+                args->layout = kInvertedLayout;
+            else if (layout == "domain")
+                args->layout = kDomainLayout;
+            else
+                throw po::error("invalid layout: " + layout);
+
+            args->has_layout = true;
+        }
+
+        if (vm.count("encoding")) {
+            string encoding = vm["encoding"].as<string>();
+
+            if (encoding == "varint")
+                args->encoding = kVarintEncoding;
+            else if (encoding == "fixed")
+                args->encoding = kFixedEncoding;
+            else
+                throw po::error("invalid encoding: " + encoding);
+
+            args->has_encoding = true;
+        }
+
+        if (vm.count("table")) {
+            string table = vm["table"].as<string>();
+
+            if (table == "block")
+                args->table = kBlockTable;
+            else if (table == "plain")
+                args->table = kPlainTable;
+            else
+                throw po::error("invalid table format: " + table);
+
+            args->has_table = true;
+        }
+
+        if (!args->has_layout && !args->has_encoding && !args->has_table)
+            throw po::error("at least one of layout, encoding and table must be specified");
+    } catch (po::error &e) {
+        std::cerr << "ERROR: " << e.what() << std::endl << std::endl;
+        std::cerr << desc << std::endl;
+        return false;
+    }
+
+    return true;
+}
+
+int main(int argc, const char *argv[]) {
+    args_t args;
+
+    if (!ParseArgs(argc, argv, &args))
+        return ERROR_IN_COMMAND_LINE;
+
+    try {
+        RecoverConversion(args.model_path);
+    } catch (fs::filesystem_error &e) {
+        cerr << "ERROR: unable to recover the previous conversion: " << e.what() << endl;
+        return GENERIC_ERROR;
+    }
+
+    storage_layout_t sourceLayout = NGramStorage::DetectLayout(args.model_path, kDomainLayout);
+
+    if (!fs::is_directory(NGramStorage::GetDataPath(args.model_path, sourceLayout))) {
+        cerr << "ERROR: no model to convert in " << args.model_path << endl;
+        return GENERIC_ERROR;
+    }
+
+    string tempPath = GetConvertPath(args.model_path);
+    storage_layout_t targetLayout = args.has_layout ? args.layout : sourceLayout;
+
+    {
+        NGramStorage source(args.model_path, args.order, false, sourceLayout, false);
+
+        storage_format_t targetFormat = source.GetFormat();
+        if (args.has_encoding)
+            targetFormat.encoding = args.encoding;
+        if (args.has_table)
+            targetFormat.table = args.table;
+
+        if (targetLayout == sourceLayout && targetFormat.encoding == source.GetFormat().encoding &&
+            targetFormat.table == source.GetFormat().table) {
+            cout << "Model already has the requested layout and format" << endl;
+            return SUCCESS;
+        }
+
+        fs::create_directories(tempPath);
+
+        NGramStorage target(tempPath, args.order, true, targetLayout, false, targetFormat);
+
+        source.CopyTo(target, args.buffer_size);
+        target.ForceCompaction();
+    }
+
+    // the marker is written only once the new storage has been closed
+    {
+        string completePath = GetCompletePath(args.model_path);
+        ofstream complete(completePath);
+        complete << (int) sourceLayout << ' ' << (int) targetLayout << endl;
+        complete.close();
+
+        if (!complete) {
+            cerr << "ERROR: unable to write " << completePath << endl;
+            return GENERIC_ERROR;
+        }
+    }
+
+    try {
+        CompleteSwap(args.model_path, sourceLayout, targetLayout);
+    } catch (fs::filesystem_error &e) {
+        cerr << "ERROR: unable to replace the model, run the conversion again to complete it: " << e.what() << endl;
+        return GENERIC_ERROR;
+    }
+
+    cout << "Model converted" << endl;
+    return SUCCESS;
+}
@@ -7,6 +7,9 @@
 #include <boost/filesystem.hpp>
 #include <iostream>
 #include <db/NGramStorage.h>
+#include <db/BulkLoader.h>
+#include <util/usage.hh>
+#include <util/exception.hh>
 #include <sys/time.h>
 #include <corpus/CorpusReader.h>
 #ifdef _OPENMP
@@ -29,6 +32,13 @@ namespace {
         uint8_t order = 5;
 
         size_t buffer_size = 100000;
+        bool inverted = false;
+        bool compact = false;
+        bool compressed = false;
+
+        bool offline = false;
+        string temp_path;
+        size_t memory = 2ULL * 1024 * 1024 * 1024;
     };
 } // namespace
 
@@ -42,7 +52,13 @@ bool ParseArgs(int argc, const char *argv[], args_t *args) {
             ("model,m", po::value<string>()->required(), "output model path")
             ("input,i", po::value<string>()->required(), "input folder with input corpora")
             ("order,o", po::value<uint8_t>(), "the language model order (default is 5)")
-            ("buffer,b", po::value<size_t>(), "size of the buffer expressed in number of n-grams");
+            ("buffer,b", po::value<size_t>(), "size of the buffer expressed in number of n-grams")
+            ("inverted", "store the counts of all the domains of an n-gram in a single record")
+            ("compact", "store the counts as variable-length integers")
+            ("compressed", "store the counts in compressed block-based tables with bloom filters")
+            ("offline", "count the n-grams with an external sort and ingest the final counts at once (new models only)")
+            ("memory,M", po::value<string>(), "memory used for sorting in offline mode, e.g. 4G or 50% (default is 2G)")
+            ("temp,T", po::value<string>(), "directory for temporary files in offline mode (default is inside the model)");
 
     po::variables_map vm;
     try {
@@ -63,6 +79,24 @@ bool ParseArgs(int argc, const char *argv[], args_t *args) {
 
         if (vm.count("order"))
             args->order = vm["order"].as<uint8_t>();
+
+        args->inverted = vm.count("inverted") > 0;
+        args->compact = vm.count("compact") > 0;
+        args->compressed = vm.count("compressed") > 0;
+        args->offline = vm.count("offline") > 0;
+
+        if (vm.count("temp"))
+            args->temp_path = vm["temp"].as<string>();
+        else
+            args->temp_path = (fs::path(args->model_path) / "_tmp").string();
+
+        if (vm.count("memory")) {
+            try {
+                args->memory = (size_t) util::ParseSize(vm["memory"].as<string>());
+            } catch (util::Exception &e) {
+                throw po::error("invalid memory size: " + vm["memory"].as<string>());
+            }
+        }
     } catch (po::error &e) {
         std::cerr << "ERROR: " << e.what() << std::endl << std::endl;
         std::cerr << desc << std::endl;
@@ -76,7 +110,8 @@ void ListCorpora(const string &root, vector<string> &outCorpora) {
     fs::recursive_directory_iterator endit;
 
     for (fs::recursive_directory_iterator it(root); it != endit; ++it) {
-        if (fs::is_regular_file(*it))
+        // the binary copies are read by CorpusReader in place of their corpus
+        if (fs::is_regular_file(*it) && !corpus::SentenceReader::IsBinaryPath(it->path().string()))
             outCorpora.push_back(fs::absolute(it->path()).string());
     }
 }
@@ -92,7 +127,7 @@ double GetTime() {
     return (double) time.tv_sec + ((double) time.tv_usec / 1000000.);
 }
 
-void LoadCorpus(const string &corpus, NGramStorage &storage, uint8_t order, size_t buffer_size) {
+void LoadCorpus(const string &corpus, const function<void(NGramBatch &)> &consumer, uint8_t order, size_t buffer_size) {
     domain_t domain = (domain_t) stoi(fs::path(corpus).stem().string());
 
     CorpusReader reader(corpus);
@@ -101,7 +136,7 @@ void LoadCorpus(const string &corpus, NGramStorage &storage, uint8_t order, size
     vector<wid_t> sentence;
     while(reader.Read(sentence)) {
         if (!batch.Add(domain, sentence)) {
-            storage.PutBatch(batch);
+            consumer(batch);
 
             ++batches;
             batch.Clear();
@@ -110,7 +145,7 @@ void LoadCorpus(const string &corpus, NGramStorage &storage, uint8_t order, size
     }
 
     if (batch.GetSize() > 0) {
-        storage.PutBatch(batch);
+        consumer(batch);
         batch.Clear();
     }
     cerr << "loading domain:" << domain << " requires " << batches << " batches" << endl;
@@ -140,15 +175,56 @@ int main(int argc, const char *argv[]) {
     vector<string> corpora;
     ListCorpora(args.input_path, corpora);
 
-    NGramStorage storage(args.model_path, args.order, true);
+    storage_layout_t layout = NGramStorage::DetectLayout(args.model_path,
+                                                         args.inverted ? kInvertedLayout : kDomainLayout);
+
+    if (args.offline && fs::exists(NGramStorage::GetDataPath(args.model_path, layout))) {
+        cerr << "ERROR: offline mode requires a new model, but " << args.model_path << " already exists" << endl;
+        return GENERIC_ERROR;
+    }
+
+    storage_format_t format(args.compact ? kVarintEncoding : kFixedEncoding,
+                            args.compressed ? kBlockTable : kPlainTable);
+
+    // Novelty filters only serve PutBatch()
+    NGramStorage storage(args.model_path, args.order, true, layout, !args.offline, format);
+
+    if (args.offline) {
+        bool removeTemp = !fs::exists(args.temp_path);
+        fs::create_directories(args.temp_path);
+
+        {
+            BulkLoader loader(storage, args.temp_path, args.memory);
 
 #pragma omp parallel for schedule(dynamic)
-    for (size_t i = 0; i < corpora.size(); ++i) {
-        string &corpus = corpora[i];
-        double begin = GetTime();
-        LoadCorpus(corpus, storage, args.order, args.buffer_size);
-        double elapsed = GetTime() - begin;
-        cout << "Corpus " << corpus << " DONE in " << elapsed << "s" << endl;
+            for (size_t i = 0; i < corpora.size(); ++i) {
+                string &corpus = corpora[i];
+                double begin = GetTime();
+                LoadCorpus(corpus, [&loader](NGramBatch &batch) {
+                    loader.Add(batch);
+                }, args.order, args.buffer_size);
+                double elapsed = GetTime() - begin;
+                cout << "Corpus " << corpus << " counted in " << elapsed << "s" << endl;
+            }
+
+            double begin = GetTime();
+            loader.Load();
+            cout << "Counts loaded in " << (GetTime() - begin) << "s" << endl;
+        }
+
+        if (removeTemp)
+            fs::remove_all(args.temp_path);
+    } else {
+#pragma omp parallel for schedule(dynamic)
+        for (size_t i = 0; i < corpora.size(); ++i) {
+            string &corpus = corpora[i];
+            double begin = GetTime();
+            LoadCorpus(corpus, [&storage](NGramBatch &batch) {
+                storage.PutBatch(batch);
+            }, args.order, args.buffer_size);
+            double elapsed = GetTime() - begin;
+            cout << "Corpus " << corpus << " DONE in " << elapsed << "s" << endl;
+        }
     }
 
     storage.ForceCompaction();
@@ -157,6 +157,7 @@ namespace lm {
                 if (val > 25) {
                     util::ParseNumberException e(from);
                     e << " bit counts are limited to 25.";
+                    throw e;
                 }
                 return val;
             }
@@ -201,7 +202,7 @@ int main(int argc, char *argv[]) {
         po::options_description options("Language model building options");
         lm::builder::PipelineConfig pipeline;
 
-        std::string text, model, model_type;
+        std::string text, model, model_type, profile;
         std::string temporary_directory;
         std::vector<std::string> pruning;
         std::vector<std::string> discount_fallback;
@@ -241,6 +242,8 @@ int main(int argc, char *argv[]) {
                  "Size of IO operations for sort (determines arity)")
                 ("block_count", po::value<std::size_t>(&pipeline.block_count)->default_value(2),
                  "Block count (per order)")
+                ("threads", po::value<std::size_t>(&pipeline.count_threads)->default_value(1),
+                 "Number of threads counting the text in step 1. Compressed input and pipes are decompressed by a single thread")
                 ("vocab_estimate", po::value<lm::WordIndex>(&pipeline.vocab_estimate)->default_value(1000000),
                  "Assume this vocabulary size for purposes of calculating memory in step 1 (corpus count) and pre-sizing the hash table")
                 ("vocab_pad", po::value<uint64_t>(&pipeline.vocab_size_for_unk)->default_value(0),
@@ -250,6 +253,8 @@ int main(int argc, char *argv[]) {
                 ("text", po::value<std::string>(&text), "Read text from a file instead of stdin")
                 ("model", po::value<std::string>(&model), "File with the estimated model")
                 ("type", po::value<std::string>(&model_type), "Model type (probing, trie, ...) probing by default.")
+                ("profile", po::value<std::string>(&profile)->default_value("default"),
+                 "Build profile: default (as specified by the other options) or serving (trie quantized with -q 8, with pointers compressed with -a, and singleton n-grams pruned from order 3 with --prune 0 0 1).  Explicit --type, -q, -b, -a and --prune options take precedence over the profile.  Combine it with --limit_vocab_file to keep only the n-grams the decoder can produce.")
                 ("renumber", po::bool_switch(&pipeline.renumber_vocabulary),
                  "Rrenumber the vocabulary identifiers so that they are monotone with the hash of each string.  This is consistent with the ordering used by the trie data structure.")
                 ("collapse_values", po::bool_switch(&pipeline.output_q),
@@ -271,9 +276,9 @@ int main(int argc, char *argv[]) {
                  "\"order1.arpa order2 order3 order4\" adds lower-order rest costs from these  model files.  order1.arpa must be an ARPA file.  All others may be ARPA or the same data structure as being built.  All files must have the same vocabulary.  For probing, the unigrams must be in the same order. type is either probing or trie.  Default is probing. probing uses a probing hash table.  It is the fastest but uses the most memory.")
                 ("p", po::value<float>(&config.probing_multiplier),
                  "sets the space multiplier and must be >1.0.  The default is 1.5. trie is a straightforward trie with bit-level packing.  It uses the least memory and is still faster than SRI or IRST.  Building the trie format uses an on-disk sort to save memory.")
-                ("q", po::value<uint8_t>(&config.prob_bits), "turns quantization on and sets the number of bits (e.g. -q 8).")
-                ("b", po::value<uint8_t>(&config.backoff_bits), "sets backoff quantization bits.  Requires -q and defaults to that value.")
-                ("a", po::value<uint8_t>(&config.pointer_bhiksha_bits),
+                ("q", po::value<std::string>(), "turns quantization on and sets the number of bits (e.g. -q 8).")
+                ("b", po::value<std::string>(), "sets backoff quantization bits.  Requires -q and defaults to that value.")
+                ("a", po::value<std::string>(),
                  "compresses pointers using an array of offsets.  The parameter is the maximum number of bits encoded by the array.  Memory is minimized subject to the maximum, so pick 255 to minimize memory.");
 
 
@@ -341,6 +346,24 @@ int main(int argc, char *argv[]) {
             pipeline.discount.bad_action = lm::THROW_UP;
         }
 
+        bool serving = false;
+        if (profile == "serving") {
+            serving = true;
+        } else if (profile != "default") {
+            std::cerr << "Unknown build profile: " << profile << std::endl;
+            return 1;
+        }
+
+        if (serving && pruning.empty() && pipeline.order > 2) {
+            pruning.push_back("0");
+            pruning.push_back("0");
+            pruning.push_back("1");
+        }
+
+        if (!vm.count("type")) {
+            model_type = serving ? "trie" : "probing";
+        }
+
         // parse pruning thresholds.  These depend on order, so it is not done as a notifier.
         pipeline.prune_thresholds = ParsePruning(pruning, pipeline.order);
 
@@ -369,16 +392,22 @@ int main(int argc, char *argv[]) {
         config.building_memory = util::ParseSize(default_mem);
 
         if (vm.count("q")) {
-            config.prob_bits = vm["q"].as<uint8_t>();
+            config.prob_bits = ParseBitCount(vm["q"].as<std::string>().c_str());
             if (!set_backoff_bits) config.backoff_bits = config.prob_bits;
             quantize = true;
+        } else if (serving && model_type == "trie") {
+            config.prob_bits = 8;
+            config.backoff_bits = 8;
+            quantize = true;
         }
         if (vm.count("b")) {
-            config.prob_bits = vm["b"].as<uint8_t>();
+            config.backoff_bits = ParseBitCount(vm["b"].as<std::string>().c_str());
             set_backoff_bits = true;
         }
         if (vm.count("a")) {
-            config.pointer_bhiksha_bits = vm["a"].as<uint8_t>();
+            config.pointer_bhiksha_bits = ParseBitCount(vm["a"].as<std::string>().c_str());
+            bhiksha = true;
+        } else if (serving && model_type == "trie") {
             bhiksha = true;
         }
         if (vm.count("u")) {
@@ -408,11 +437,6 @@ int main(int argc, char *argv[]) {
             ParseFileList(rest_string.c_str(), config.rest_lower_files);
             config.rest_function = Config::REST_LOWER;
         }
-
-        model_type = "probing";
-        if (vm.count("type")) {
-            model_type = vm["type"].as<std::string>();
-        }
         //it is mandatory to specify an output file
         if (vm.count("model")) {
             config.write_mmap = vm["model"].as<std::string>().c_str();
@@ -474,7 +498,6 @@ int main(int argc, char *argv[]) {
                 } else {
                     if (bhiksha) {
                         ArrayTrieModel(temporary_arpa.c_str(), config);
-                        ArrayTrieModel(temporary_arpa.c_str(), config);
                     } else {
                         TrieModel(temporary_arpa.c_str(), config);
                     }
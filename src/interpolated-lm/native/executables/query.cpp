@@ -5,7 +5,14 @@
 #include <boost/program_options.hpp>
 #include <boost/filesystem.hpp>
 #include <lm/InterpolatedLM.h>
+#include <lm/StaticLM.h>
+#include <chrono>
+#include <cmath>
+#include <fstream>
+#include <iomanip>
 #include <iostream>
+#include <sstream>
+#include <unistd.h>
 #include <corpus/CorpusReader.h>
 
 using namespace std;
@@ -23,6 +30,7 @@ namespace {
         context_t context_map;
         string model_path;
         uint8_t order = 5;
+        vector<string> benchmark_models;
     };
 } // namespace
 
@@ -49,7 +57,8 @@ bool ParseContextMap(const string &str, context_t &context) {
     return true;
 }
 
-#define PrintUsage(name) {cerr << "USAGE: " << name << " [-h] [--alm-only|--slm-only] [-o ARG] [-c ARG] MODEL_PATH" << endl << endl;}
+#define PrintUsage(name) {cerr << "USAGE: " << name << " [-h] [--alm-only|--slm-only] [-o ARG] [-c ARG] MODEL_PATH" << endl \
+                                << "       " << name << " --benchmark SLM_FILE [SLM_FILE ...]" << endl << endl;}
 
 bool ParseArgs(int argc, const char *argv[], args_t *args) {
     string appName = fs::basename(argv[0]);
@@ -57,11 +66,14 @@ bool ParseArgs(int argc, const char *argv[], args_t *args) {
     po::options_description options("Option arguments");
     options.add_options()
             ("help,h", "print this help message")
-            ("model", po::value<string>()->required(), "InterpolatedLM model path")
+            ("model", po::value<string>(), "InterpolatedLM model path")
             ("context,c", po::value<string>(), "context map in the format <id>:<w>[,<id>:<w>]")
             ("alm-only", "use AdaptiveLM only")
             ("slm-only", "use StaticLM only")
-            ("order,o", po::value<uint8_t>(), "the language model order (default is 5)");
+            ("order,o", po::value<uint8_t>(), "the language model order (default is 5)")
+            ("benchmark", po::value<vector<string>>()->multitoken(),
+             "compare static LM binary files (i.e. probing and trie builds of background.slm): every model "
+             "is loaded in turn and scores the input document, then load time, latency and memory are printed");
 
     po::positional_options_description pOptions;
     pOptions.add("model", 1);
@@ -82,6 +94,14 @@ bool ParseArgs(int argc, const char *argv[], args_t *args) {
 
         po::notify(vm);
 
+        if (vm.count("benchmark")) {
+            args->benchmark_models = vm["benchmark"].as<vector<string>>();
+            return true;
+        }
+
+        if (!vm.count("model"))
+            throw po::error("the option '--model' is required but missing");
+
         args->model_path = vm["model"].as<string>();
 
         if (vm.count("context")) {
@@ -106,12 +126,108 @@ bool ParseArgs(int argc, const char *argv[], args_t *args) {
     return true;
 }
 
+size_t GetResidentMemory() {
+    ifstream statm("/proc/self/statm");
+
+    size_t size = 0, resident = 0;
+    statm >> size >> resident;
+
+    return resident * (size_t) sysconf(_SC_PAGESIZE);
+}
+
+const char *GetModelTypeName(lm::ngram::ModelType type) {
+    switch (type) {
+        case lm::ngram::PROBING:
+            return "probing";
+        case lm::ngram::REST_PROBING:
+            return "rest-probing";
+        case lm::ngram::TRIE:
+            return "trie";
+        case lm::ngram::QUANT_TRIE:
+            return "quant-trie";
+        case lm::ngram::ARRAY_TRIE:
+            return "array-trie";
+        case lm::ngram::QUANT_ARRAY_TRIE:
+            return "quant-array-trie";
+        default:
+            return "unknown";
+    }
+}
+
+// The document is scored twice by every model: the first pass maps the pages the document needs,
+// only the second one is timed. Memory is the resident set growth with respect to before loading.
+int Benchmark(const vector<string> &models) {
+    vector<vector<wid_t>> document;
+
+    CorpusReader reader(&cin);
+    vector<wid_t> line;
+    size_t word_count = 0;
+
+    while (reader.Read(line)) {
+        line.push_back(kVocabularyEndSymbol);
+        word_count += line.size();
+        document.push_back(line);
+    }
+
+    if (word_count == 0) {
+        cerr << "ERROR: empty input document" << endl;
+        return GENERIC_ERROR;
+    }
+
+    vector<wid_t> sentenceBegin(1, kVocabularyStartSymbol);
+
+    cout << left << setw(20) << "Type" << right << setw(12) << "Load (s)" << setw(12) << "RSS (MB)"
+         << setw(12) << "ns/word" << setw(14) << "Perplexity" << "  Model" << endl;
+
+    for (auto model = models.begin(); model != models.end(); ++model) {
+        size_t baseMemory = GetResidentMemory();
+
+        auto begin = chrono::steady_clock::now();
+        StaticLM slm(*model);
+        double loadTime = chrono::duration<double>(chrono::steady_clock::now() - begin).count();
+
+        HistoryState startState;
+        slm.MakeHistoryState(sentenceBegin, &startState);
+
+        double corpusProbability = 0.;
+        double elapsed = 0.;
+
+        for (int pass = 0; pass < 2; ++pass) {
+            corpusProbability = 0.;
+            begin = chrono::steady_clock::now();
+
+            for (auto sentence = document.begin(); sentence != document.end(); ++sentence) {
+                HistoryState historyState = startState;
+                corpusProbability += slm.ComputePhraseProbability(sentence->data(), sentence->size(),
+                                                                  historyState, NULL, &historyState);
+            }
+
+            elapsed = chrono::duration<double>(chrono::steady_clock::now() - begin).count();
+        }
+
+        size_t finalMemory = GetResidentMemory();
+        size_t memory = finalMemory > baseMemory ? finalMemory - baseMemory : 0;
+
+        cout << left << setw(20) << GetModelTypeName(slm.GetModelType()) << right << fixed
+             << setw(12) << setprecision(3) << loadTime
+             << setw(12) << setprecision(1) << (memory / (1024. * 1024.))
+             << setw(12) << setprecision(1) << (elapsed * 1e9 / word_count)
+             << setw(14) << setprecision(3) << exp(-(corpusProbability / word_count))
+             << "  " << *model << endl;
+    }
+
+    return SUCCESS;
+}
+
 int main(int argc, const char *argv[]) {
     args_t args;
 
     if (!ParseArgs(argc, argv, &args))
         return ERROR_IN_COMMAND_LINE;
 
+    if (!args.benchmark_models.empty())
+        return Benchmark(args.benchmark_models);
+
     Options options;
 
     options.order = args.order;
@@ -135,20 +251,17 @@ int main(int argc, const char *argv[]) {
     while (reader.Read(line)) {
         line.push_back(kVocabularyEndSymbol);
 
-        HistoryKey *historyKey = lm.MakeHistoryKey(sentenceBegin);
+        HistoryState historyState;
+        lm.MakeHistoryState(sentenceBegin, &historyState);
+
         float sentenceProbability = 0.0;
 
         for (auto word = line.begin(); word != line.end(); ++word) {
-            HistoryKey *outKey;
-
-            float wordProbability = lm.ComputeProbability(*word, historyKey, &args.context_map, &outKey);
-
-            delete historyKey;
-            historyKey = outKey;
+            float wordProbability = lm.ComputeProbability(*word, historyState, &args.context_map, &historyState);
 
             cout << *word
                   << (lm.IsOOV(&args.context_map, *word) ? "[OOV] " : "") << " "
-                 << "Length: " << historyKey->length() << " "
+                 << "Length: " << historyState.length() << " "
                  << wordProbability << "\t";
 
             sentenceProbability += wordProbability;
@@ -157,7 +270,6 @@ int main(int argc, const char *argv[]) {
 
         corpusProbability += sentenceProbability;
 
-        delete historyKey;
         cout << endl;
     }
 
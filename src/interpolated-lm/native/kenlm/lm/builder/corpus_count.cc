@@ -9,11 +9,18 @@
 #include "util/file.hh"
 #include "util/file_piece.hh"
 #include "util/murmur_hash.hh"
+#include "util/mmap.hh"
 #include "util/probing_hash_table.hh"
+#include "util/read_compressed.hh"
 #include "util/scoped.hh"
 #include "util/stream/chain.hh"
 #include "util/tokenize_piece.hh"
 
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/thread.hpp>
+
+#include <cstring>
+#include <exception>
 #include <functional>
 
 #include <stdint.h>
@@ -64,16 +71,17 @@ const float kProbingMultiplier = 1.5;
 
 typedef util::ProbingHashTable<DedupeEntry, DedupeHash, DedupeEquals> Dedupe;
 
-class Writer {
+// Blocks is either a util::stream::Link or a SharedLink.
+template <class Blocks> class Writer {
   public:
-    Writer(std::size_t order, const util::stream::ChainPosition &position, void *dedupe_mem, std::size_t dedupe_mem_size)
-      : block_(position), gram_(block_->Get(), order),
+    Writer(std::size_t order, Blocks &blocks, std::size_t block_size, void *dedupe_mem, std::size_t dedupe_mem_size)
+      : block_(blocks), gram_(block_->Get(), order),
         dedupe_invalid_(order, std::numeric_limits<WordIndex>::max()),
         dedupe_(dedupe_mem, dedupe_mem_size, &dedupe_invalid_[0], DedupeHash(order), DedupeEquals(order)),
         buffer_(new WordIndex[order - 1]),
-        block_size_(position.GetChain().BlockSize()) {
+        block_size_(block_size) {
       dedupe_.Clear();
-      assert(Dedupe::Size(position.GetChain().BlockSize() / position.GetChain().EntrySize(), kProbingMultiplier) == dedupe_mem_size);
+      assert(Dedupe::Size(block_size / NGram<BuildingPayload>::TotalSize(order), kProbingMultiplier) == dedupe_mem_size);
       if (order == 1) {
         // Add special words.  AdjustCounts is responsible if order != 1.
         AddUnigramWord(kUNK);
@@ -133,7 +141,7 @@ class Writer {
       }
     }
 
-    util::stream::Link block_;
+    Blocks &block_;
 
     NGram<BuildingPayload> gram_;
 
@@ -148,6 +156,117 @@ class Writer {
     const std::size_t block_size_;
 };
 
+// Blocks of a sharded counting worker: n-grams are deduplicated in a private block, which
+// is copied to the shared chain once full.
+class SharedLink {
+  public:
+    SharedLink(util::stream::Link &out, boost::mutex &out_mutex, std::size_t block_size)
+      : memory_(util::MallocOrThrow(block_size)), current_(memory_.get(), block_size),
+        out_(out), out_mutex_(out_mutex), block_size_(block_size) {}
+
+    util::stream::Block *operator->() { return &current_; }
+
+    SharedLink &operator++() {
+      if (current_.ValidSize()) {
+        boost::mutex::scoped_lock lock(out_mutex_);
+        memcpy(out_->Get(), current_.Get(), current_.ValidSize());
+        out_->SetValidSize(current_.ValidSize());
+        ++out_;
+      }
+      current_ = util::stream::Block(memory_.get(), block_size_);
+      return *this;
+    }
+
+    // The shared chain is poisoned once all the workers are done.
+    void Poison() {}
+
+  private:
+    util::scoped_malloc memory_;
+    util::stream::Block current_;
+
+    util::stream::Link &out_;
+    boost::mutex &out_mutex_;
+    const std::size_t block_size_;
+};
+
+// Splits the text in chunks of whole lines for the sharded counting workers.
+class ChunkSource {
+  public:
+    explicit ChunkSource(int fd) : fd_(fd), mapped_(false), cursor_(0), eof_(false) {
+      uint64_t size = util::SizeFile(fd);
+      if (size != util::kBadSize && size >= util::ReadCompressed::kMagicSize) {
+        util::MapRead(util::LAZY, fd, 0, util::CheckOverflow(size), mapping_);
+        mapped_ = !util::ReadCompressed::DetectCompressedMagic(mapping_.get());
+        if (mapped_) return;
+        mapping_.reset();
+        util::SeekOrThrow(fd, 0);
+      }
+      reader_.Reset(fd_.release());
+    }
+
+    // Returns false at the end of the text.  Streamed chunks are stored in buffer, which is private
+    // to the caller; mapped ones point to the mapping.
+    bool Next(std::string &buffer, StringPiece &out) {
+      boost::mutex::scoped_lock lock(mutex_);
+      return mapped_ ? NextMapped(out) : NextStreamed(buffer, out);
+    }
+
+  private:
+    static const std::size_t kChunkSize = 1 << 22;
+
+    bool NextMapped(StringPiece &out) {
+      const char *base = static_cast<const char*>(mapping_.get());
+      std::size_t size = mapping_.size();
+      if (cursor_ >= size) return false;
+
+      std::size_t end = std::min(cursor_ + kChunkSize, size);
+      const void *newline = memchr(base + end - 1, '\n', size - end + 1);
+      end = newline ? static_cast<const char*>(newline) - base + 1 : size;
+
+      out = StringPiece(base + cursor_, end - cursor_);
+      cursor_ = end;
+      return true;
+    }
+
+    bool NextStreamed(std::string &buffer, StringPiece &out) {
+      buffer.swap(carry_);
+      carry_.clear();
+
+      while (!eof_) {
+        std::size_t old = buffer.size();
+        buffer.resize(old + kChunkSize);
+        std::size_t got = reader_.Read(&buffer[old], kChunkSize);
+        buffer.resize(old + got);
+        if (!got) {
+          eof_ = true;
+        } else if (buffer.size() >= kChunkSize && memchr(&buffer[old], '\n', got)) {
+          break;
+        }
+      }
+
+      if (!eof_) {
+        std::size_t newline = buffer.rfind('\n');
+        carry_.assign(buffer, newline + 1, std::string::npos);
+        buffer.resize(newline + 1);
+      }
+
+      if (buffer.empty()) return false;
+      out = StringPiece(buffer.data(), buffer.size());
+      return true;
+    }
+
+    boost::mutex mutex_;
+
+    util::scoped_fd fd_;
+    bool mapped_;
+    util::scoped_memory mapping_;
+    std::size_t cursor_;
+
+    util::ReadCompressed reader_;
+    std::string carry_;
+    bool eof_;
+};
+
 } // namespace
 
 float CorpusCount::DedupeMultiplier(std::size_t order) {
@@ -159,13 +278,23 @@ std::size_t CorpusCount::VocabUsage(std::size_t vocab_estimate) {
 }
 
 CorpusCount::CorpusCount(util::FilePiece &from, int vocab_write, bool dynamic_vocab, uint64_t &token_count, WordIndex &type_count, std::vector<bool> &prune_words, const std::string& prune_vocab_filename, std::size_t entries_per_block, WarningAction disallowed_symbol)
-  : from_(from), vocab_write_(vocab_write), dynamic_vocab_(dynamic_vocab), token_count_(token_count), type_count_(type_count),
+  : from_(&from), text_fd_(-1), threads_(1), vocab_write_(vocab_write), dynamic_vocab_(dynamic_vocab), token_count_(token_count), type_count_(type_count),
     prune_words_(prune_words), prune_vocab_filename_(prune_vocab_filename),
+    entries_per_block_(entries_per_block),
     dedupe_mem_size_(Dedupe::Size(entries_per_block, kProbingMultiplier)),
     dedupe_mem_(util::MallocOrThrow(dedupe_mem_size_)),
     disallowed_symbol_action_(disallowed_symbol) {
 }
 
+CorpusCount::CorpusCount(int text_fd, std::size_t threads, int vocab_write, uint64_t &token_count, WordIndex &type_count, std::vector<bool> &prune_words, const std::string& prune_vocab_filename, std::size_t entries_per_block, WarningAction disallowed_symbol)
+  : from_(NULL), text_fd_(text_fd), threads_(threads), vocab_write_(vocab_write), dynamic_vocab_(true), token_count_(token_count), type_count_(type_count),
+    prune_words_(prune_words), prune_vocab_filename_(prune_vocab_filename),
+    entries_per_block_(entries_per_block),
+    dedupe_mem_size_(Dedupe::Size(entries_per_block, kProbingMultiplier)),
+    disallowed_symbol_action_(disallowed_symbol) {
+  UTIL_THROW_IF(threads == 0, util::Exception, "At least one counting thread is required");
+}
+
 namespace {
 void ComplainDisallowed(StringPiece word, WarningAction &action) {
   switch (action) {
@@ -220,10 +349,116 @@ class VocabGiven {
 
     WordIndex bos_, eos_;
 };
+
+// Vocabulary shared by the sharded counting workers.  Every worker keeps the ids it has already
+// seen in its own cache, so that the lock is taken only for the first occurrence of a word.
+class SharedVocab {
+  public:
+    typedef util::AutoProbing<ngram::ProbingVocabularyEntry, util::IdentityHash> Cache;
+
+    SharedVocab(WordIndex initial_size, int vocab_write, WarningAction &disallowed_symbol_action)
+      : vocab_(initial_size, vocab_write), disallowed_symbol_action_(disallowed_symbol_action) {}
+
+    WordIndex FindOrInsert(const StringPiece &word, Cache &cache) {
+      // Same key of GrowableVocab, thus the same words collide
+      uint64_t key = util::MurmurHashNative(word.data(), word.size());
+      Cache::ConstIterator it;
+      if (cache.Find(key, it)) return it->value;
+
+      WordIndex index;
+      {
+        boost::mutex::scoped_lock lock(mutex_);
+        index = vocab_.FindOrInsert(word);
+      }
+      cache.Insert(ngram::ProbingVocabularyEntry::Make(key, index));
+      return index;
+    }
+
+    bool IsSpecial(WordIndex word) const { return vocab_.IsSpecial(word); }
+
+    void ComplainDisallowed(const StringPiece &word) {
+      boost::mutex::scoped_lock lock(mutex_);
+      lm::builder::ComplainDisallowed(word, disallowed_symbol_action_);
+    }
+
+    // Only once all the workers are done.
+    const ngram::GrowableVocab<ngram::WriteUniqueWords> &Get() const { return vocab_; }
+
+  private:
+    boost::mutex mutex_;
+    ngram::GrowableVocab<ngram::WriteUniqueWords> vocab_;
+    WarningAction &disallowed_symbol_action_;
+};
+
+struct ShardedWorker {
+  ChunkSource *source;
+  SharedVocab *vocab;
+  util::stream::Link *out;
+  boost::mutex *out_mutex;
+  std::size_t order, block_size, dedupe_mem_size;
+  WordIndex end_sentence;
+
+  uint64_t token_count;
+  std::exception_ptr error;
+
+  void operator()() {
+    try {
+      Count();
+    } catch (...) {
+      error = std::current_exception();
+    }
+  }
+
+  void Count() {
+    util::scoped_malloc dedupe_mem(util::MallocOrThrow(dedupe_mem_size));
+    SharedLink blocks(*out, *out_mutex, block_size);
+    Writer<SharedLink> writer(order, blocks, block_size, dedupe_mem.get(), dedupe_mem_size);
+    SharedVocab::Cache cache;
+
+    bool delimiters[256];
+    util::BoolCharacter::Build("\0\t\n\r ", delimiters);
+
+    std::string buffer;
+    StringPiece chunk;
+    uint64_t count = 0;
+
+    // Chunks always start at the beginning of a line.  As with FilePiece, a sentence ends
+    // (with </s>) only at a newline.
+    while (source->Next(buffer, chunk)) {
+      writer.StartSentence();
+      const char *it = chunk.data();
+      const char *end = chunk.data() + chunk.size();
+      while (it != end) {
+        if (*it == '\n') {
+          writer.Append(end_sentence);
+          writer.StartSentence();
+          ++it;
+        } else if (delimiters[static_cast<unsigned char>(*it)]) {
+          ++it;
+        } else {
+          const char *word_begin = it;
+          while (it != end && !delimiters[static_cast<unsigned char>(*it)]) ++it;
+          StringPiece w(word_begin, it - word_begin);
+          WordIndex word = vocab->FindOrInsert(w, cache);
+          if (UTIL_UNLIKELY(vocab->IsSpecial(word))) {
+            vocab->ComplainDisallowed(w);
+            continue;
+          }
+          writer.Append(word);
+          ++count;
+        }
+      }
+    }
+
+    token_count = count;
+  }
+};
 } // namespace
 
 void CorpusCount::Run(const util::stream::ChainPosition &position) {
-  if (dynamic_vocab_) {
+  if (!from_) {
+    RunSharded(position);
+  } else if (dynamic_vocab_) {
     ngram::GrowableVocab<ngram::WriteUniqueWords> vocab(type_count_, vocab_write_);
     RunWithVocab(position, vocab);
   } else {
@@ -236,28 +471,79 @@ template <class Vocab> void CorpusCount::RunWithVocab(const util::stream::ChainP
   token_count_ = 0;
   type_count_ = 0;
   const WordIndex end_sentence = vocab.FindOrInsert("</s>");
-  Writer writer(NGram<BuildingPayload>::OrderFromSize(position.GetChain().EntrySize()), position, dedupe_mem_.get(), dedupe_mem_size_);
-  uint64_t count = 0;
-  bool delimiters[256];
-  util::BoolCharacter::Build("\0\t\n\r ", delimiters);
-  StringPiece w;
-  while(true) {
-    writer.StartSentence();
-    while (from_.ReadWordSameLine(w, delimiters)) {
-      WordIndex word = vocab.FindOrInsert(w);
-      if (UTIL_UNLIKELY(vocab.IsSpecial(word))) {
-        ComplainDisallowed(w, disallowed_symbol_action_);
-        continue;
+  util::stream::Link link(position);
+  {
+    Writer<util::stream::Link> writer(NGram<BuildingPayload>::OrderFromSize(position.GetChain().EntrySize()), link, position.GetChain().BlockSize(), dedupe_mem_.get(), dedupe_mem_size_);
+    uint64_t count = 0;
+    bool delimiters[256];
+    util::BoolCharacter::Build("\0\t\n\r ", delimiters);
+    StringPiece w;
+    while(true) {
+      writer.StartSentence();
+      while (from_->ReadWordSameLine(w, delimiters)) {
+        WordIndex word = vocab.FindOrInsert(w);
+        if (UTIL_UNLIKELY(vocab.IsSpecial(word))) {
+          ComplainDisallowed(w, disallowed_symbol_action_);
+          continue;
+        }
+        writer.Append(word);
+        ++count;
       }
-      writer.Append(word);
-      ++count;
+      if (!from_->ReadLineOrEOF(w)) break;
+      writer.Append(end_sentence);
     }
-    if (!from_.ReadLineOrEOF(w)) break;
-    writer.Append(end_sentence);
+    token_count_ = count;
   }
-  token_count_ = count;
   type_count_ = vocab.Size();
 
+  PruneVocab(vocab);
+}
+
+void CorpusCount::RunSharded(const util::stream::ChainPosition &position) {
+  SharedVocab vocab(type_count_, vocab_write_, disallowed_symbol_action_);
+  token_count_ = 0;
+  type_count_ = 0;
+
+  ChunkSource source(text_fd_);
+  util::stream::Link link(position);
+  boost::mutex link_mutex;
+
+  std::vector<ShardedWorker> workers(threads_);
+  for (std::size_t i = 0; i < threads_; ++i) {
+    ShardedWorker &worker = workers[i];
+    worker.source = &source;
+    worker.vocab = &vocab;
+    worker.out = &link;
+    worker.out_mutex = &link_mutex;
+    worker.order = NGram<BuildingPayload>::OrderFromSize(position.GetChain().EntrySize());
+    worker.block_size = position.GetChain().BlockSize();
+    worker.dedupe_mem_size = dedupe_mem_size_;
+    worker.end_sentence = kEOS;
+    worker.token_count = 0;
+  }
+
+  boost::thread_group group;
+  for (std::size_t i = 0; i < threads_; ++i)
+    group.create_thread(boost::ref(workers[i]));
+  group.join_all();
+
+  // The link is poisoned even if a worker failed, otherwise the downstream threads wait forever.
+  link.Poison();
+
+  for (std::size_t i = 0; i < threads_; ++i) {
+    if (workers[i].error) std::rethrow_exception(workers[i].error);
+    token_count_ += workers[i].token_count;
+  }
+
+  type_count_ = vocab.Get().Size();
+
+  PruneVocab(vocab.Get());
+}
+
+template <class Vocab> void CorpusCount::PruneVocab(const Vocab &vocab) {
+  bool delimiters[256];
+  util::BoolCharacter::Build("\0\t\n\r ", delimiters);
+
   // Create list of unigrams that are supposed to be pruned
   if (!prune_vocab_filename_.empty()) {
     try {
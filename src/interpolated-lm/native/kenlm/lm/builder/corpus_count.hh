@@ -32,12 +32,25 @@ class CorpusCount {
     // type_count aka vocabulary size.  Initialize to an estimate.  It is set to the exact value.
     CorpusCount(util::FilePiece &from, int vocab_write, bool dynamic_vocab, uint64_t &token_count, WordIndex &type_count, std::vector<bool> &prune_words, const std::string& prune_vocab_filename, std::size_t entries_per_block, WarningAction disallowed_symbol);
 
+    // Sharded counting: "threads" workers read the text in chunks of whole lines, each one
+    // deduplicating its own blocks, and share the (dynamic) vocabulary.  A plain file is
+    // split in byte ranges of its memory mapping, anything else (pipes, compressed files)
+    // is read through util::ReadCompressed.  Vocabulary ids depend on thread scheduling.
+    // Memory usage is threads * (1 + DedupeMultipler(order)) * block_size + total_chain_size + vocab.
+    CorpusCount(int text_fd, std::size_t threads, int vocab_write, uint64_t &token_count, WordIndex &type_count, std::vector<bool> &prune_words, const std::string& prune_vocab_filename, std::size_t entries_per_block, WarningAction disallowed_symbol);
+
     void Run(const util::stream::ChainPosition &position);
 
   private:
     template <class Vocab> void RunWithVocab(const util::stream::ChainPosition &position, Vocab &vocab);
 
-    util::FilePiece &from_;
+    void RunSharded(const util::stream::ChainPosition &position);
+
+    template <class Vocab> void PruneVocab(const Vocab &vocab);
+
+    util::FilePiece *from_;
+    int text_fd_;
+    std::size_t threads_;
     int vocab_write_;
     bool dynamic_vocab_;
     uint64_t &token_count_;
@@ -45,6 +58,7 @@ class CorpusCount {
     std::vector<bool>& prune_words_;
     const std::string& prune_vocab_filename_;
 
+    std::size_t entries_per_block_;
     std::size_t dedupe_mem_size_;
     util::scoped_malloc dedupe_mem_;
 
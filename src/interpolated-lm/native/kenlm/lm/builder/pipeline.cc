@@ -15,6 +15,8 @@
 
 #include "util/exception.hh"
 #include "util/file.hh"
+#include "util/file_piece.hh"
+#include "util/scoped.hh"
 #include "util/stream/io.hh"
 
 #include <algorithm>
@@ -213,22 +215,33 @@ util::stream::Sort<SuffixOrder, CombineCounts> *CountText(int text_file /* input
   const PipelineConfig &config = master.Config();
   std::cerr << "=== 1/" << master.Steps() << " Counting and sorting n-grams ===" << std::endl;
 
+  const std::size_t threads = std::max<std::size_t>(config.count_threads, 1);
   const std::size_t vocab_usage = CorpusCount::VocabUsage(config.vocab_estimate);
   UTIL_THROW_IF(config.TotalMemory() < vocab_usage, util::Exception, "Vocab hash size estimate " << vocab_usage << " exceeds total memory " << config.TotalMemory());
+  // Every sharded worker has its own dedupe table and a private block.
+  const float per_block_overhead = threads == 1 ? CorpusCount::DedupeMultiplier(config.order) :
+    static_cast<float>(threads) * (1.0f + CorpusCount::DedupeMultiplier(config.order));
   std::size_t memory_for_chain =
     // This much memory to work with after vocab hash table.
     static_cast<float>(config.TotalMemory() - vocab_usage) /
     // Solve for block size including the dedupe multiplier for one block.
-    (static_cast<float>(config.block_count) + CorpusCount::DedupeMultiplier(config.order)) *
+    (static_cast<float>(config.block_count) + per_block_overhead) *
     // Chain likes memory expressed in terms of total memory.
     static_cast<float>(config.block_count);
   util::stream::Chain chain(util::stream::ChainConfig(NGram<BuildingPayload>::TotalSize(config.order), config.block_count, memory_for_chain));
 
   type_count = config.vocab_estimate;
-  util::FilePiece text(text_file, NULL, &std::cerr);
-  text_file_name = text.FileName();
-  CorpusCount counter(text, vocab_file, true, token_count, type_count, prune_words, config.prune_vocab_file, chain.BlockSize() / chain.EntrySize(), config.disallowed_symbol_action);
-  chain >> boost::ref(counter);
+  util::scoped_ptr<util::FilePiece> text;
+  util::scoped_ptr<CorpusCount> counter;
+  if (threads == 1) {
+    text.reset(new util::FilePiece(text_file, NULL, &std::cerr));
+    text_file_name = text->FileName();
+    counter.reset(new CorpusCount(*text, vocab_file, true, token_count, type_count, prune_words, config.prune_vocab_file, chain.BlockSize() / chain.EntrySize(), config.disallowed_symbol_action));
+  } else {
+    text_file_name = util::NameFromFD(text_file);
+    counter.reset(new CorpusCount(text_file, threads, vocab_file, token_count, type_count, prune_words, config.prune_vocab_file, chain.BlockSize() / chain.EntrySize(), config.disallowed_symbol_action));
+  }
+  chain >> boost::ref(*counter);
 
   util::scoped_ptr<util::stream::Sort<SuffixOrder, CombineCounts> > sorter(new util::stream::Sort<SuffixOrder, CombineCounts>(chain, config.sort, SuffixOrder(config.order), CombineCounts()));
   chain.Wait(true);
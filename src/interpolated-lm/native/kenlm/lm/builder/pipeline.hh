@@ -32,6 +32,10 @@ struct PipelineConfig {
   // Number of blocks to use.  This will be overridden to 1 if everything fits.
   std::size_t block_count;
 
+  // Number of threads reading and counting the text.  With more than one, the
+  // vocabulary ids depend on thread scheduling (the model does not).
+  std::size_t count_threads;
+
   // n-gram count thresholds for pruning. 0 values means no pruning for
   // corresponding n-gram order
   std::vector<uint64_t> prune_thresholds; //mjd
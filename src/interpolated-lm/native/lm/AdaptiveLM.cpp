@@ -4,7 +4,9 @@
 
 #include "AdaptiveLM.h"
 #include <cmath>
+#include <cstring>
 #include <iostream>
+#include <stdexcept>
 
 using namespace std;
 using namespace mmt;
@@ -12,6 +14,7 @@ using namespace mmt::ilm;
 
 static const float kUnigramEpsilon = 1.f;
 static const size_t kDictionaryUpperBound = 10000000;
+static const size_t kStackPhraseLength = 32;
 
 namespace mmt {
     namespace ilm {
@@ -60,8 +63,56 @@ namespace mmt {
     }
 }
 
-AdaptiveLM::AdaptiveLM(const string &modelPath, uint8_t order, size_t updateBufferSize, double updateMaxDelay) :
-        order(order), storage(modelPath, order), updateManager(&storage, updateBufferSize, updateMaxDelay) {
+// The keys of the n-gram levels are kept on the stack, thus the order is bounded by kMaxOrder
+static uint8_t CheckOrder(uint8_t order) {
+    if (order == 0 || order > kMaxOrder)
+        throw invalid_argument("Invalid order " + to_string(order) + ", it must be between 1 and " +
+                               to_string(kMaxOrder));
+
+    return order;
+}
+
+// Same as AdaptiveLMHistoryKey(history, word, length); "outHistoryState" may alias "historyState"
+static inline void AppendToHistoryState(const HistoryState &historyState, const wid_t word, size_t length,
+                                        HistoryState *outHistoryState) {
+    const size_t historyLength = historyState.alm_length;
+
+    if (length > 0) {
+        size_t words_length = std::min(length, historyLength + 1);
+        size_t offset = historyLength - words_length + 1;
+
+        memmove(outHistoryState->alm_words, historyState.alm_words + offset, (words_length - 1) * sizeof(wid_t));
+        outHistoryState->alm_words[words_length - 1] = word;
+        outHistoryState->alm_length = (uint8_t) words_length;
+    } else {
+        outHistoryState->alm_length = 0;
+    }
+}
+
+static inline void CopyHistoryState(const HistoryState &historyState, HistoryState *outHistoryState) {
+    std::copy(historyState.alm_words, historyState.alm_words + historyState.alm_length, outHistoryState->alm_words);
+    outHistoryState->alm_length = historyState.alm_length;
+}
+
+// Fills the keys of the levels [0, levels) of "word" preceded by the words of "history" ending at "end"
+static inline void MakeLevelKeys(const wid_t *history, const size_t end, const wid_t word, const size_t levels,
+                                 dbkey_t *historyKeys, dbkey_t *ngramKeys) {
+    historyKeys[0] = 0;
+    ngramKeys[0] = make_key(word);
+    for (size_t i = 1; i < levels; ++i) {
+        historyKeys[i] = make_key(history + end - i, i);
+        ngramKeys[i] = make_key(historyKeys[i], word);
+    }
+}
+
+AdaptiveLM::AdaptiveLM(const string &modelPath, uint8_t order, size_t updateBufferSize, double updateMaxDelay,
+                       bool batchLookups, storage_layout_t defaultLayout, bool noveltyFilters,
+                       const storage_format_t &defaultFormat, bool updateLog) :
+        order(CheckOrder(order)), batchLookups(batchLookups),
+        storage(modelPath, this->order, false, NGramStorage::DetectLayout(modelPath, defaultLayout), noveltyFilters,
+                defaultFormat),
+        updateManager(&storage, updateBufferSize, updateMaxDelay,
+                      updateLog ? modelPath + "/updates.wal" : "") {
 }
 
 float AdaptiveLM::ComputeProbability(const wid_t word, const HistoryKey *historyKey, const context_t *context,
@@ -76,7 +127,7 @@ float AdaptiveLM::ComputeProbability(const wid_t word, const HistoryKey *history
     const AdaptiveLMHistoryKey *inKey = (AdaptiveLMHistoryKey *) historyKey;
     assert(inKey != NULL);
 
-    cachevalue_t result = ComputeProbability(context, inKey->words, word, 0, inKey->words.size(), cache);
+    cachevalue_t result = ComputeProbability(context, inKey->words.data(), inKey->words.size(), word, cache);
 
     if (outHistoryKey)
         *outHistoryKey = new AdaptiveLMHistoryKey(inKey->words, word, word == kVocabularyEndSymbol ? 0 : result.length);
@@ -84,7 +135,153 @@ float AdaptiveLM::ComputeProbability(const wid_t word, const HistoryKey *history
     return result.probability > 0. ? log(result.probability) : kNaturalLogZeroProbability;
 }
 
-cachevalue_t AdaptiveLM::ComputeProbability(const context_t *context, const vector<wid_t> &history, const wid_t word,
+float AdaptiveLM::ComputeProbability(const wid_t word, const HistoryState &historyState, const context_t *context,
+                                     HistoryState *outHistoryState, AdaptiveLMCache *cache) const {
+    if (context == nullptr || context->empty()) {
+        if (outHistoryState)
+            outHistoryState->alm_length = 0;
+
+        return kNaturalLogZeroProbability;
+    }
+
+    cachevalue_t result = ComputeProbability(context, historyState.alm_words, historyState.alm_length, word, cache);
+
+    if (outHistoryState)
+        AppendToHistoryState(historyState, word, word == kVocabularyEndSymbol ? 0 : result.length, outHistoryState);
+
+    return result.probability > 0. ? log(result.probability) : kNaturalLogZeroProbability;
+}
+
+float AdaptiveLM::ComputePhraseProbability(const wid_t *phrase, size_t length, const HistoryState &historyState,
+                                           const context_t *context, HistoryState *outHistoryState,
+                                           float *outProbabilities, AdaptiveLMCache *cache) const {
+    if (context == nullptr || context->empty() || !batchLookups || length < 2) {
+        HistoryState state = historyState;
+        double result = 0.;
+
+        for (size_t i = 0; i < length; ++i) {
+            float probability = ComputeProbability(phrase[i], state, context, &state, cache);
+
+            if (outProbabilities)
+                outProbabilities[i] = probability;
+            result += probability;
+        }
+
+        if (outHistoryState)
+            CopyHistoryState(state, outHistoryState);
+
+        return (float) result;
+    }
+
+    // The history followed by the phrase: the history of every word is a suffix of the words preceding it
+    const size_t historyLength = historyState.alm_length;
+
+    wid_t window[kMaxOrder + kStackPhraseLength];
+    vector<wid_t> heapWindow;
+    wid_t *words = window;
+
+    if (historyLength + length > kMaxOrder + kStackPhraseLength) {
+        heapWindow.resize(historyLength + length);
+        words = heapWindow.data();
+    }
+
+    std::copy(historyState.alm_words, historyState.alm_words + historyLength, words);
+    std::copy(phrase, phrase + length, words + historyLength);
+
+    // The actual history of a word is known only once the previous word has been scored, but it is
+    // never longer than the available one: the counts of every word are read for the longest history
+    // (skipping the levels already in cache), then all the keys of the phrase are read at once.
+    vector<dbkey_t> ngramKeys(length * (kMaxOrder + 1));
+    vector<cachevalue_t> cachedResults(length);
+    vector<size_t> cachedLevels(length);
+    vector<size_t> keyOffsets(length);
+
+    vector<dbkey_t> keys;
+    keys.reserve(length * (2 * order + 1));
+
+    size_t historyStart = 0;
+
+    for (size_t p = 0; p < length; ++p) {
+        const size_t end = historyLength + p;
+        const size_t levels = min(end - historyStart, (size_t) order) + 1;
+
+        dbkey_t historyKeys[kMaxOrder + 1];
+        dbkey_t *wordNgramKeys = &ngramKeys[p * (kMaxOrder + 1)];
+        MakeLevelKeys(words, end, phrase[p], levels, historyKeys, wordNgramKeys);
+
+        // the probability of level "first - 1" is in cache
+        size_t first = 0;
+        for (size_t i = levels; i-- > 0;) {
+            if (cache && cache->IsCacheable(i + 1) && cache->Get(wordNgramKeys[i], &cachedResults[p])) {
+                first = i + 1;
+                break;
+            }
+        }
+
+        cachedLevels[p] = first;
+        keyOffsets[p] = keys.size();
+
+        if (first == 0)
+            keys.push_back(wordNgramKeys[0]);
+
+        for (size_t i = max(first, (size_t) 1); i < levels; ++i) {
+            keys.push_back(historyKeys[i]);
+            keys.push_back(wordNgramKeys[i]);
+        }
+
+        if (phrase[p] == kVocabularyEndSymbol)
+            historyStart = end + 1;
+    }
+
+    vector<domain_t> domains;
+    domains.reserve(context->size());
+    for (context_t::const_iterator it = context->begin(); it != context->end(); ++it)
+        domains.push_back(it->domain);
+
+    vector<counts_t> counts;
+    storage.GetCounts(domains, keys, counts);
+
+    // Score the words in sequence with their actual history
+    const size_t contextSize = context->size();
+
+    HistoryState state = historyState;
+    double result = 0.;
+
+    for (size_t p = 0; p < length; ++p) {
+        const wid_t word = phrase[p];
+        const size_t levels = state.alm_length + 1;
+        const size_t cachedLevel = cachedLevels[p];
+
+        cachevalue_t wordResult;
+
+        if (cachedLevel == levels) {
+            wordResult = cachedResults[p];
+        } else if (cachedLevel < levels) {
+            // the lower levels are the same of the longest history, thus the counts read for it can be used
+            wordResult = InterpolateProbability(context, &ngramKeys[p * (kMaxOrder + 1)],
+                                                counts.data() + keyOffsets[p] * contextSize,
+                                                cachedLevel, levels, cachedResults[p], cache);
+        } else {
+            // the history has been cut below the level found in cache: its counts have not been read
+            wordResult = BatchComputeProbability(context, state.alm_words, word, 0, state.alm_length, cache);
+        }
+
+        float probability = wordResult.probability > 0. ? log(wordResult.probability) : kNaturalLogZeroProbability;
+
+        if (outProbabilities)
+            outProbabilities[p] = probability;
+        result += probability;
+
+        AppendToHistoryState(state, word, word == kVocabularyEndSymbol ? 0 : wordResult.length, &state);
+    }
+
+    if (outHistoryState)
+        CopyHistoryState(state, outHistoryState);
+
+    return (float) result;
+}
+
+cachevalue_t AdaptiveLM::ComputeProbability(const context_t *context, const wid_t *history, const wid_t word,
                                             const size_t start, const size_t end, AdaptiveLMCache *cache) const {
     dbkey_t historyKey;
     dbkey_t ngramKey;
@@ -93,7 +290,7 @@ cachevalue_t AdaptiveLM::ComputeProbability(const context_t *context, const vect
         historyKey = 0;
         ngramKey = make_key(word);
     } else {
-        historyKey = make_key(history, start, end - start);
+        historyKey = make_key(history + start, end - start);
         ngramKey = make_key(historyKey, word);
     }
 
@@ -147,6 +344,116 @@ cachevalue_t AdaptiveLM::ComputeProbability(const context_t *context, const vect
     return result;
 }
 
+cachevalue_t AdaptiveLM::BatchComputeProbability(const context_t *context, const wid_t *history,
+                                                 const wid_t word, const size_t start, const size_t end,
+                                                 AdaptiveLMCache *cache) const {
+    // Level "i" is the n-gram made of the i most recent words of the history followed by "word"
+    const size_t levels = end - start + 1;
+
+    assert(levels <= kMaxOrder + 1);
+
+    dbkey_t historyKeys[kMaxOrder + 1];
+    dbkey_t ngramKeys[kMaxOrder + 1];
+    MakeLevelKeys(history, end, word, levels, historyKeys, ngramKeys);
+
+    // Look for the longest n-gram already in cache: its lower orders are not needed anymore
+    cachevalue_t result;
+    size_t first = 0;
+
+    for (size_t i = levels; i-- > 0;) {
+        if (cache && cache->IsCacheable(i + 1) && cache->Get(ngramKeys[i], &result)) {
+            if (i == levels - 1)
+                return result;
+
+            first = i + 1;
+            break;
+        }
+    }
+
+    // Collect all the keys and read them at once
+    vector<dbkey_t> keys;
+    keys.reserve(2 * levels);
+
+    if (first == 0)
+        keys.push_back(ngramKeys[0]);
+
+    for (size_t i = max(first, (size_t) 1); i < levels; ++i) {
+        keys.push_back(historyKeys[i]);
+        keys.push_back(ngramKeys[i]);
+    }
+
+    vector<domain_t> domains;
+    domains.reserve(context->size());
+    for (context_t::const_iterator it = context->begin(); it != context->end(); ++it)
+        domains.push_back(it->domain);
+
+    vector<counts_t> counts;
+    storage.GetCounts(domains, keys, counts);
+
+    return InterpolateProbability(context, ngramKeys, counts.data(), first, levels, result, cache);
+}
+
+cachevalue_t AdaptiveLM::InterpolateProbability(const context_t *context, const dbkey_t *ngramKeys,
+                                                const counts_t *counts, const size_t first, const size_t levels,
+                                                cachevalue_t result, AdaptiveLMCache *cache) const {
+    // Interpolate from the lowest order up to the highest
+    const size_t contextSize = context->size();
+    const counts_t *cursor = counts;
+    size_t level = first;
+
+    if (level == 0) {
+        result = ComputeUnigramProbability(context, cursor);
+        cursor += contextSize;
+
+        if (cache && cache->IsCacheable(1))
+            cache->Put(ngramKeys[0], result);
+
+        level = 1;
+    }
+
+    for (size_t i = level; i < levels; ++i) {
+        const counts_t *historyCounts = cursor;
+        const counts_t *ngramCounts = cursor + contextSize;
+        cursor += 2 * contextSize;
+
+        float interpolatedFstar = 0.f;
+        float interpolatedLambda = 0.f;
+        uint8_t maxLength = 0;
+
+        for (size_t d = 0; d < contextSize; ++d) {
+            const counts_t &domainHistoryCounts = historyCounts[d];
+
+            float fstar = 0.f;
+            float lambda = 1.f;
+            uint8_t length = 0;
+
+            if (domainHistoryCounts.count > 0) {
+                count_t domainNgramCount = ngramCounts[d].count;
+
+                if (domainNgramCount > 0) {
+                    fstar = (float) domainNgramCount / (domainHistoryCounts.count + domainHistoryCounts.successors);
+                    length = (uint8_t) min(i + 1, (size_t) (order - 1));
+                }
+
+                lambda = (float) domainHistoryCounts.successors /
+                         (domainHistoryCounts.count + domainHistoryCounts.successors);
+            }
+
+            interpolatedFstar += context->at(d).score * fstar;
+            interpolatedLambda += context->at(d).score * lambda;
+            maxLength = max(maxLength, length);
+        }
+
+        result.probability = interpolatedFstar + interpolatedLambda * result.probability;
+        result.length = max(maxLength, result.length);
+
+        if (cache && cache->IsCacheable(i + 1))
+            cache->Put(ngramKeys[i], result);
+    }
+
+    return result;
+}
+
 // Policy for OOV:
 //  OOV is considered as a word class, containing an estimated amount of virtual entries, each with frequency 1
 //  OOV "symbol" is not actually inserted in the DB
@@ -173,23 +480,38 @@ cachevalue_t AdaptiveLM::ComputeUnigramProbability(const context_t *context, dbk
         count_t uniqueWordCount;
         storage.GetWordCounts(it->domain, &uniqueWordCount, &wordCount);
 
-        count_t oovFrequency = OOVClassFrequency(uniqueWordCount);
-        count_t den = (count_t) (wordCount + oovFrequency + kUnigramEpsilon * uniqueWordCount);
-
         count_t unigramCount = storage.GetCounts(it->domain, wordKey).count;
 
-        float probability;
+        if (unigramCount > 0)
+            isOOV = false;
+
+        interpolatedProbability += it->score * UnigramProbability(wordCount, uniqueWordCount, unigramCount);
+    }
+
+    cachevalue_t result;
+    result.probability = interpolatedProbability;
+    result.length = (uint8_t) (isOOV ? 0 : 1);
+
+    return result;
+}
+
+cachevalue_t AdaptiveLM::ComputeUnigramProbability(const context_t *context, const counts_t *unigramCounts) const {
+    bool isOOV = true;
+    float interpolatedProbability = 0.f;
+
+    for (size_t d = 0; d < context->size(); ++d) {
+        const cscore_t &entry = context->at(d);
+
+        count_t wordCount; // This value includes also the occurrencies of the kVocabularyStartSymbol
+        count_t uniqueWordCount;
+        storage.GetWordCounts(entry.domain, &uniqueWordCount, &wordCount);
+
+        count_t unigramCount = unigramCounts[d].count;
 
-        if (unigramCount > 0) {
+        if (unigramCount > 0)
             isOOV = false;
-            probability = (unigramCount + kUnigramEpsilon) / den;
-        } else {
-            // OOV
-            probability = (oovFrequency + kUnigramEpsilon) / den; //compute the probability of the whole OOV class
-            probability /= OOVClassSize(uniqueWordCount);  // compute the probability of one single OOV
-        }
 
-        interpolatedProbability += it->score * probability;
+        interpolatedProbability += entry.score * UnigramProbability(wordCount, uniqueWordCount, unigramCount);
     }
 
     cachevalue_t result;
@@ -199,6 +521,23 @@ cachevalue_t AdaptiveLM::ComputeUnigramProbability(const context_t *context, dbk
     return result;
 }
 
+inline float AdaptiveLM::UnigramProbability(count_t wordCount, count_t uniqueWordCount, count_t unigramCount) const {
+    count_t oovFrequency = OOVClassFrequency(uniqueWordCount);
+    count_t den = (count_t) (wordCount + oovFrequency + kUnigramEpsilon * uniqueWordCount);
+
+    float probability;
+
+    if (unigramCount > 0) {
+        probability = (unigramCount + kUnigramEpsilon) / den;
+    } else {
+        // OOV
+        probability = (oovFrequency + kUnigramEpsilon) / den; //compute the probability of the whole OOV class
+        probability /= OOVClassSize(uniqueWordCount);  // compute the probability of one single OOV
+    }
+
+    return probability;
+}
+
 HistoryKey *AdaptiveLM::MakeEmptyHistoryKey() const {
     return new AdaptiveLMHistoryKey();
 }
@@ -207,6 +546,17 @@ HistoryKey *AdaptiveLM::MakeHistoryKey(const vector<wid_t> &phrase) const {
     return new AdaptiveLMHistoryKey(phrase, order);
 }
 
+void AdaptiveLM::MakeEmptyHistoryState(HistoryState *outHistoryState) const {
+    outHistoryState->alm_length = 0;
+}
+
+void AdaptiveLM::MakeHistoryState(const vector<wid_t> &phrase, HistoryState *outHistoryState) const {
+    size_t length = std::min((size_t) order, phrase.size());
+
+    std::copy(phrase.end() - length, phrase.end(), outHistoryState->alm_words);
+    outHistoryState->alm_length = (uint8_t) length;
+}
+
 
 inline count_t AdaptiveLM::OOVClassFrequency(const count_t dictionarySize) const {
     return dictionarySize;
@@ -232,6 +582,33 @@ bool AdaptiveLM::IsOOV(const context_t *context, const wid_t word) const {
     return true;
 }
 
+bool AdaptiveLM::GetOOVProbabilityBound(const context_t *context, const wid_t word, float *outBound) const {
+    dbkey_t key = make_key(word);
+
+    float bound = 0.f;
+    float totalScore = 0.f;
+
+    for (context_t::const_iterator it = context->begin(); it != context->end(); ++it) {
+        if (storage.MayContain(it->domain, key))
+            return false;
+
+        count_t wordCount;
+        count_t uniqueWordCount;
+        storage.GetWordCounts(it->domain, &uniqueWordCount, &wordCount);
+
+        bound += it->score * UnigramProbability(wordCount, uniqueWordCount, 0);
+        totalScore += it->score;
+    }
+
+    // No n-gram ending with "word" exists, thus every higher order only scales the unigram
+    // probability by the interpolated lambda, that is at most the sum of the scores
+    if (totalScore > 1.f)
+        bound *= pow(totalScore, order - 1);
+
+    *outBound = bound;
+    return true;
+}
+
 void AdaptiveLM::Add(const updateid_t &id, domain_t domain, const vector<wid_t> &source, const vector<wid_t> &target,
                      const alignment_t &alignment) {
     updateManager.Add(id, domain, target);
@@ -284,3 +661,10 @@ void AdaptiveLM::NormalizeContext(context_t *context) {
     //todo: check if the following insert is correct
     context->insert(context->begin(), ret.begin(), ret.end());
 }
+
+void AdaptiveLM::GetContextVersion(const context_t *context, vector<count_t> &outVersion) const {
+    outVersion.resize(context->size());
+
+    for (size_t i = 0; i < context->size(); ++i)
+        storage.GetWordCounts(context->at(i).domain, NULL, &outVersion[i]);
+}
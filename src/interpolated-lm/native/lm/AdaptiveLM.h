@@ -22,7 +22,10 @@ namespace mmt {
         class AdaptiveLM : public LM, public IncrementalModel {
         public:
 
-            AdaptiveLM(const string &modelPath, uint8_t order, size_t updateBufferSize, double updateMaxDelay);
+            AdaptiveLM(const string &modelPath, uint8_t order, size_t updateBufferSize, double updateMaxDelay,
+                       bool batchLookups = true, storage_layout_t defaultLayout = kDomainLayout,
+                       bool noveltyFilters = true, const storage_format_t &defaultFormat = storage_format_t(),
+                       bool updateLog = true);
 
             /* LM */
 
@@ -40,8 +43,40 @@ namespace mmt {
 
             virtual HistoryKey *MakeEmptyHistoryKey() const override;
 
+            inline virtual float ComputeProbability(const wid_t word, const HistoryState &historyState,
+                                                    const context_t *context,
+                                                    HistoryState *outHistoryState) const override {
+                return ComputeProbability(word, historyState, context, outHistoryState, NULL);
+            }
+
+            float ComputeProbability(const wid_t word, const HistoryState &historyState,
+                                     const context_t *context, HistoryState *outHistoryState,
+                                     AdaptiveLMCache *cache) const;
+
+            virtual void MakeHistoryState(const vector <wid_t> &phrase, HistoryState *outHistoryState) const override;
+
+            inline virtual float ComputePhraseProbability(const wid_t *phrase, size_t length,
+                                                          const HistoryState &historyState,
+                                                          const context_t *context, HistoryState *outHistoryState,
+                                                          float *outProbabilities = NULL) const override {
+                return ComputePhraseProbability(phrase, length, historyState, context, outHistoryState,
+                                                outProbabilities, NULL);
+            }
+
+            float ComputePhraseProbability(const wid_t *phrase, size_t length, const HistoryState &historyState,
+                                           const context_t *context, HistoryState *outHistoryState,
+                                           float *outProbabilities, AdaptiveLMCache *cache) const;
+
+            virtual void MakeEmptyHistoryState(HistoryState *outHistoryState) const override;
+
             virtual bool IsOOV(const context_t *context, const wid_t word) const override;
 
+            // If "word" is missing for sure from all the domains of the context (see NGramStorage::MayContain()),
+            // returns true and sets "outBound" to an upper bound of its probability (not in log space) in any
+            // history; the bound only needs in-memory data. In that case the length of the history state that
+            // follows "word" is 0, as for any OOV.
+            bool GetOOVProbabilityBound(const context_t *context, const wid_t word, float *outBound) const;
+
             /* Incremental Model */
 
             virtual void
@@ -52,23 +87,52 @@ namespace mmt {
 
             virtual void NormalizeContext(context_t *context);
 
+            // Fills "outVersion" with the word count of every domain of the context: since these
+            // values grow with every update, they identify the state of the model seen by the context.
+            void GetContextVersion(const context_t *context, vector <count_t> &outVersion) const;
+
         private:
             const uint8_t order;
+            const bool batchLookups;
 
             NGramStorage storage;
             BufferedUpdateManager updateManager;
 
             // Returns the probability (not in log space) of the ngram identified by the words
-            // in the range [start, end] stored in vector<wid_t>.
+            // in the range [start, end) of the history followed by "word".
             // "start" is the position of the least recent word to be considered;
-            // it must be larger than or equal to 0 and strictly lower than ngram.size().
-            // "end" is the position of the most recent word to be considered;
-            // it must be larger than or equal to 0 and strictly lower than ngram.size().
-            cachevalue_t ComputeProbability(const context_t *context, const vector <wid_t> &history, const wid_t word,
+            // it must be larger than or equal to 0 and lower than or equal to "end".
+            // "end" is the position following the most recent word to be considered.
+            cachevalue_t ComputeProbability(const context_t *context, const wid_t *history, const wid_t word,
                                             const size_t start, const size_t end, AdaptiveLMCache *cache) const;
 
+            // Same as the above method, but all the counts required by the interpolation
+            // are fetched from the storage with a single batch read.
+            cachevalue_t BatchComputeProbability(const context_t *context, const wid_t *history,
+                                                 const wid_t word, const size_t start, const size_t end,
+                                                 AdaptiveLMCache *cache) const;
+
+            // Interpolates the levels in the range [first, levels) on top of "result", the probability of
+            // the level "first - 1". Level "i" is the n-gram made of the i most recent words of the history
+            // followed by the word; "counts" holds one entry per domain of the context for each key, in
+            // the order: unigram (only if "first" is 0), then history and n-gram of every following level.
+            cachevalue_t InterpolateProbability(const context_t *context, const dbkey_t *ngramKeys,
+                                                const counts_t *counts, const size_t first, const size_t levels,
+                                                cachevalue_t result, AdaptiveLMCache *cache) const;
+
+            inline cachevalue_t ComputeProbability(const context_t *context, const wid_t *history, size_t length,
+                                                   const wid_t word, AdaptiveLMCache *cache) const {
+                return batchLookups ? BatchComputeProbability(context, history, word, 0, length, cache) :
+                       ComputeProbability(context, history, word, 0, length, cache);
+            }
+
             cachevalue_t ComputeUnigramProbability(const context_t *context, dbkey_t wordKey) const;
 
+            // "unigramCounts" contains one entry for each domain of the context
+            cachevalue_t ComputeUnigramProbability(const context_t *context, const counts_t *unigramCounts) const;
+
+            inline float UnigramProbability(count_t wordCount, count_t uniqueWordCount, count_t unigramCount) const;
+
             inline count_t OOVClassFrequency(const count_t dictionarySize) const;
 
             inline count_t OOVClassSize(const count_t dictionarySize) const;
@@ -0,0 +1,220 @@
+//
+// Created by Roldano Cattoni on 14/09/16.
+//
+
+#include "AdaptiveLMCache.h"
+#include <cstdlib>
+#include <cstring>
+#include <new>
+
+using namespace std;
+using namespace mmt;
+using namespace mmt::ilm;
+
+static const uint64_t kReferencedBit = 1ULL << 40;
+static const size_t kCacheLineSize = 64;
+
+static inline uint64_t PackValue(const cachevalue_t &value) {
+    uint32_t bits;
+    memcpy(&bits, &value.probability, sizeof(float));
+
+    return bits | (((uint64_t) value.length) << 32);
+}
+
+static inline void UnpackValue(uint64_t packed, cachevalue_t *outValue) {
+    uint32_t bits = (uint32_t) (packed & 0xFFFFFFFFULL);
+    memcpy(&outValue->probability, &bits, sizeof(float));
+
+    outValue->length = (uint8_t) ((packed >> 32) & 0xFF);
+}
+
+static inline void *AllocateAligned(size_t size) {
+    void *ptr = NULL;
+    if (posix_memalign(&ptr, kCacheLineSize, size) != 0)
+        throw bad_alloc();
+
+    memset(ptr, 0, size);
+    return ptr;
+}
+
+AdaptiveLMCache::AdaptiveLMCache(uint8_t order, size_t capacity) : order(order), hits(0), misses(0) {
+    bucketsBits = 1;
+    while ((((size_t) 1) << bucketsBits) * kBucketSize < capacity)
+        bucketsBits++;
+
+    bucketsCount = ((size_t) 1) << bucketsBits;
+
+    keys = (uint64_t *) AllocateAligned(bucketsCount * kBucketSize * sizeof(uint64_t));
+    values = (uint64_t *) AllocateAligned(bucketsCount * kBucketSize * sizeof(uint64_t));
+    hands = (uint8_t *) AllocateAligned(bucketsCount);
+
+    for (size_t i = 0; i < kLocksCount; ++i)
+        locks[i].clear();
+}
+
+AdaptiveLMCache::~AdaptiveLMCache() {
+    free(keys);
+    free(values);
+    free(hands);
+}
+
+size_t AdaptiveLMCache::GetMemoryUsage() const {
+    return sizeof(AdaptiveLMCache) + bucketsCount * (kBucketSize * 2 * sizeof(uint64_t) + sizeof(uint8_t));
+}
+
+void AdaptiveLMCache::Put(const dbkey_t key, const cachevalue_t &value) {
+    if (key == 0)
+        return;
+
+    size_t bucket = GetBucket(key);
+    uint64_t *bucketKeys = keys + bucket * kBucketSize;
+    uint64_t *bucketValues = values + bucket * kBucketSize;
+
+    Lock(bucket);
+
+    size_t slot = kBucketSize;
+    for (size_t i = 0; i < kBucketSize; ++i) {
+        if (bucketKeys[i] == key || bucketKeys[i] == 0) {
+            slot = i;
+            break;
+        }
+    }
+
+    if (slot == kBucketSize) {
+        // CLOCK: give a second chance to the referenced entries, evict the first one that is not
+        uint8_t &hand = hands[bucket];
+
+        while (true) {
+            uint64_t &candidate = bucketValues[hand];
+            size_t current = hand;
+            hand = (uint8_t) ((hand + 1) % kBucketSize);
+
+            if (candidate & kReferencedBit) {
+                candidate &= ~kReferencedBit;
+            } else {
+                slot = current;
+                break;
+            }
+        }
+    }
+
+    bucketKeys[slot] = key;
+    bucketValues[slot] = PackValue(value);
+
+    Unlock(bucket);
+}
+
+bool AdaptiveLMCache::Get(const dbkey_t key, cachevalue_t *outValue) {
+    if (key == 0)
+        return false;
+
+    size_t bucket = GetBucket(key);
+    uint64_t *bucketKeys = keys + bucket * kBucketSize;
+    uint64_t *bucketValues = values + bucket * kBucketSize;
+
+    bool found = false;
+
+    Lock(bucket);
+
+    for (size_t i = 0; i < kBucketSize; ++i) {
+        if (bucketKeys[i] == key) {
+            bucketValues[i] |= kReferencedBit;
+            UnpackValue(bucketValues[i], outValue);
+            found = true;
+            break;
+        }
+    }
+
+    Unlock(bucket);
+
+    if (found)
+        hits.fetch_add(1, memory_order_relaxed);
+    else
+        misses.fetch_add(1, memory_order_relaxed);
+
+    return found;
+}
+
+static inline bool ContextEquals(const context_t &a, const context_t &b) {
+    if (a.size() != b.size())
+        return false;
+
+    for (size_t i = 0; i < a.size(); ++i) {
+        if (a[i].domain != b[i].domain || a[i].score != b[i].score)
+            return false;
+    }
+
+    return true;
+}
+
+AdaptiveLMCachePool::AdaptiveLMCachePool(uint8_t cacheOrder, size_t cacheCapacity, size_t maxCaches)
+        : cacheOrder(cacheOrder), cacheCapacity(cacheCapacity), maxCaches(maxCaches), accessCounter(0) {
+}
+
+shared_ptr<AdaptiveLMCache> AdaptiveLMCachePool::Get(const context_t *context, const vector<count_t> &version) {
+    lock_guard<mutex> lock(access);
+
+    accessCounter++;
+
+    for (auto entry = entries.begin(); entry != entries.end(); ++entry) {
+        if (ContextEquals(entry->context, *context)) {
+            if (entry->version != version) {
+                // Model has been updated: requests still holding the old cache can keep using it
+                entry->version = version;
+                entry->cache.reset(new AdaptiveLMCache(cacheOrder, cacheCapacity));
+            }
+
+            entry->lastAccess = accessCounter;
+            return entry->cache;
+        }
+    }
+
+    if (maxCaches == 0)
+        return shared_ptr<AdaptiveLMCache>(new AdaptiveLMCache(cacheOrder, cacheCapacity));
+
+    if (entries.size() >= maxCaches) {
+        auto lru = entries.begin();
+        for (auto entry = entries.begin(); entry != entries.end(); ++entry) {
+            if (entry->lastAccess < lru->lastAccess)
+                lru = entry;
+        }
+
+        entries.erase(lru);
+    }
+
+    entry_t entry;
+    entry.context = *context;
+    entry.version = version;
+    entry.cache.reset(new AdaptiveLMCache(cacheOrder, cacheCapacity));
+    entry.lastAccess = accessCounter;
+
+    entries.push_back(entry);
+
+    return entry.cache;
+}
+
+size_t AdaptiveLMCachePool::GetMemoryUsage() const {
+    lock_guard<mutex> lock(access);
+
+    size_t size = 0;
+    for (auto entry = entries.begin(); entry != entries.end(); ++entry)
+        size += entry->cache->GetMemoryUsage();
+
+    return size;
+}
+
+float AdaptiveLMCachePool::GetHitRate() const {
+    lock_guard<mutex> lock(access);
+
+    uint64_t hits = 0;
+    uint64_t lookups = 0;
+
+    for (auto entry = entries.begin(); entry != entries.end(); ++entry) {
+        uint64_t entryHits = entry->cache->GetHits();
+
+        hits += entryHits;
+        lookups += entryHits + entry->cache->GetMisses();
+    }
+
+    return lookups == 0 ? 0.f : (float) hits / lookups;
+}
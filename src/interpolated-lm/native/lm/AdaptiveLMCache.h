@@ -6,8 +6,12 @@
 #define ILM_ADAPTIVELMCACHE_H
 
 #include <string>
-#include <unordered_map>
+#include <atomic>
+#include <mutex>
+#include <memory>
+#include <vector>
 #include <db/dbkey.h>
+#include <db/counts.h>
 #include "LM.h"
 
 using namespace std;
@@ -24,6 +28,10 @@ namespace mmt {
             cachevalue_t() : probability(0), length(0) {};
         };
 
+        // Fixed-capacity, set-associative cache: keys and packed values are stored in two flat
+        // arrays split in buckets of kBucketSize slots (the keys of a bucket fill one cache line).
+        // When a bucket is full, the victim is chosen with the CLOCK policy.
+        // The cache can be safely shared by multiple threads.
         class AdaptiveLMCache {
         public:
 
@@ -33,37 +41,105 @@ namespace mmt {
             //  - 600.000 3-grams
             //  - 600.000 4-grams
             //  - 500.000 5-grams
-            AdaptiveLMCache(uint8_t order, size_t initialSize = 2000000) : order(order) {
-                cache.reserve(initialSize);
-            }
+            static const size_t kDefaultCapacity = 1 << 19;
+
+            AdaptiveLMCache(uint8_t order, size_t capacity = kDefaultCapacity);
 
-            inline bool IsCacheable(size_t order) {
+            ~AdaptiveLMCache();
+
+            inline bool IsCacheable(size_t order) const {
                 return order <= this->order;
             }
 
             // store in the cache the entry
             //   key(word, state) -> (probability, outStateLength)
             //   if already present, replace the old value with the new value;
-            inline void Put(const dbkey_t key, const cachevalue_t &value) {
-                cache[key] = value;
-            }
+            //   key "0" is reserved and it is never stored
+            void Put(const dbkey_t key, const cachevalue_t &value);
 
             // lookup in the cache the entry key(word, state), if found, fill the given parameters
             // and return true, else return false
-            inline bool Get(const dbkey_t key, cachevalue_t *outValue) {
-                auto it = cache.find(key);
-
-                if (it == cache.end()) {
-                    return false;
-                } else {
-                    *outValue = it->second;
-                    return true;
-                }
+            bool Get(const dbkey_t key, cachevalue_t *outValue);
+
+            inline size_t GetCapacity() const {
+                return bucketsCount * kBucketSize;
+            }
+
+            // Memory allocated by the cache, in bytes
+            size_t GetMemoryUsage() const;
+
+            inline uint64_t GetHits() const {
+                return hits.load(memory_order_relaxed);
+            }
+
+            inline uint64_t GetMisses() const {
+                return misses.load(memory_order_relaxed);
             }
 
         private:
+            static const size_t kBucketSize = 8;
+            static const size_t kLocksCount = 256;
+
             const uint8_t order;
-            unordered_map <cachekey_t, cachevalue_t> cache;
+
+            size_t bucketsCount;
+            uint8_t bucketsBits;
+
+            uint64_t *keys;
+            uint64_t *values;
+            uint8_t *hands;
+
+            atomic_flag locks[kLocksCount];
+
+            atomic<uint64_t> hits;
+            atomic<uint64_t> misses;
+
+            inline size_t GetBucket(const dbkey_t key) const {
+                return (size_t) ((key * 0x9E3779B97F4A7C15ULL) >> (64 - bucketsBits));
+            }
+
+            inline void Lock(size_t bucket) {
+                atomic_flag &lock = locks[bucket & (kLocksCount - 1)];
+                while (lock.test_and_set(memory_order_acquire));
+            }
+
+            inline void Unlock(size_t bucket) {
+                locks[bucket & (kLocksCount - 1)].clear(memory_order_release);
+            }
+        };
+
+        // Keeps the caches of the most recently used contexts, so that all the translation
+        // requests with the same (normalized) context can share the same cache.
+        class AdaptiveLMCachePool {
+        public:
+            AdaptiveLMCachePool(uint8_t cacheOrder, size_t cacheCapacity, size_t maxCaches);
+
+            // "version" identifies the state of the model as seen by the context (see
+            // AdaptiveLM::GetContextVersion()): a cache built for an older version of the
+            // model is discarded and replaced with a new one.
+            shared_ptr<AdaptiveLMCache> Get(const context_t *context, const vector<count_t> &version);
+
+            // Memory allocated by the pooled caches, in bytes
+            size_t GetMemoryUsage() const;
+
+            // Ratio of cache hits over all the lookups, computed on the pooled caches
+            float GetHitRate() const;
+
+        private:
+            struct entry_t {
+                context_t context;
+                vector<count_t> version;
+                shared_ptr<AdaptiveLMCache> cache;
+                uint64_t lastAccess;
+            };
+
+            const uint8_t cacheOrder;
+            const size_t cacheCapacity;
+            const size_t maxCaches;
+
+            mutable mutex access;
+            vector<entry_t> entries;
+            uint64_t accessCounter;
         };
 
     }
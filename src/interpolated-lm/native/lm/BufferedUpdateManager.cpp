@@ -6,11 +6,17 @@
 
 using namespace mmt::ilm;
 
-BufferedUpdateManager::BufferedUpdateManager(NGramStorage *storage, size_t bufferSize, double maxDelay) :
-        storage(storage), waitTimeout(maxDelay), stop(false) {
+BufferedUpdateManager::BufferedUpdateManager(NGramStorage *storage, size_t bufferSize, double maxDelay,
+                                             const string &logPath) :
+        storage(storage), log(NULL), waitTimeout(maxDelay), stop(false) {
     foregroundBatch = new NGramBatch(storage->GetOrder(), bufferSize, storage->GetStreamsStatus());
     backgroundBatch = new NGramBatch(storage->GetOrder(), bufferSize, storage->GetStreamsStatus());
 
+    if (!logPath.empty()) {
+        log = new WriteAheadLog(logPath);
+        ReplayLog();
+    }
+
     backgroundThread = new boost::thread(boost::bind(&BufferedUpdateManager::BackgroundThreadRun, this));
 }
 
@@ -23,18 +29,47 @@ BufferedUpdateManager::~BufferedUpdateManager() {
     delete backgroundThread;
     delete foregroundBatch;
     delete backgroundBatch;
+
+    if (log)
+        delete log;
 }
 
-void BufferedUpdateManager::Add(const updateid_t &id, const domain_t domain, const vector<wid_t> &sentence) {
-    bool success = false;
+void BufferedUpdateManager::ReplayLog() {
+    log->Replay(storage->GetStreamsStatus(), [this](const updateid_t &id, const domain_t domain,
+                                                    const vector<wid_t> &source, const vector<wid_t> &target,
+                                                    const alignment_t &alignment) {
+        while (!foregroundBatch->Add(id, domain, target)) {
+            storage->PutBatch(*foregroundBatch);
+            foregroundBatch->Reset(foregroundBatch->GetStreams());
+        }
+    });
+
+    if (foregroundBatch->GetSize() > 0) {
+        storage->PutBatch(*foregroundBatch);
+        foregroundBatch->Reset(foregroundBatch->GetStreams());
+    }
+
+    // All the updates of the previous segments are now in the storage
+    log->Release(log->Rotate());
+}
 
-    while (!success) {
-        batchAccess.lock();
-        success = foregroundBatch->Add(id, domain, sentence);
-        batchAccess.unlock();
+void BufferedUpdateManager::Add(const updateid_t &id, const domain_t domain, const vector<wid_t> &sentence) {
+    while (true) {
+        {
+            lock_guard<mutex> lock(batchAccess);
+
+            if (foregroundBatch->GetSize() < foregroundBatch->GetMaxSize()) {
+                // Logged before the batch is changed, so that a failed append leaves no trace, and with
+                // the batch lock held, so that the entry is in the same segment of the batch
+                if (log)
+                    log->Append(id, domain, vector<wid_t>(), sentence, alignment_t());
+
+                foregroundBatch->Add(id, domain, sentence);
+                return;
+            }
+        }
 
-        if (!success)
-            AwakeBackgroundThread(true);
+        AwakeBackgroundThread(true);
     }
 }
 
@@ -55,19 +90,27 @@ void BufferedUpdateManager::BackgroundThreadRun() {
         awakeCondition.wait_for(lock, timeout);
 
         if (!stop) {
-            batchAccess.lock();
+            WriteAheadLog::segment_t segment = 0;
+
             {
+                lock_guard<mutex> batchLock(batchAccess);
+
                 NGramBatch *tmp = backgroundBatch;
                 backgroundBatch = foregroundBatch;
                 foregroundBatch = tmp;
 
                 foregroundBatch->Reset(backgroundBatch->GetStreams());
+
+                if (log && backgroundBatch->GetSize() > 0)
+                    segment = log->Rotate();
             }
-            batchAccess.unlock();
 
             if (backgroundBatch->GetSize() > 0) {
                 storage->PutBatch(*backgroundBatch);
                 backgroundBatch->Clear();
+
+                if (log)
+                    log->Release(segment);
             }
         }
 
@@ -8,6 +8,7 @@
 #include <cstddef>
 #include <db/NGramStorage.h>
 #include <mmt/IncrementalModel.h>
+#include <mmt/WriteAheadLog.h>
 #include <mutex>
 #include <condition_variable>
 #include <boost/thread.hpp>
@@ -17,7 +18,10 @@ namespace mmt {
 
         class BufferedUpdateManager {
         public:
-            BufferedUpdateManager(NGramStorage *storage, size_t bufferSize, double maxDelay);
+            // If "logPath" is not empty, every update is recorded in a write-ahead log before Add() returns,
+            // and the updates left in the log by a previous instance are written to the storage
+            BufferedUpdateManager(NGramStorage *storage, size_t bufferSize, double maxDelay,
+                                  const string &logPath = "");
 
             ~BufferedUpdateManager();
 
@@ -25,6 +29,7 @@ namespace mmt {
 
         private:
             NGramStorage *storage;
+            WriteAheadLog *log;
 
             NGramBatch *foregroundBatch;
             NGramBatch *backgroundBatch;
@@ -37,6 +42,8 @@ namespace mmt {
             double waitTimeout;
             bool stop;
 
+            void ReplayLog();
+
             void AwakeBackgroundThread(bool wait);
 
             void BackgroundThreadRun();
@@ -9,11 +9,14 @@ using namespace std;
 using namespace mmt::ilm;
 
 CachedLM::CachedLM(const InterpolatedLM *lm, uint8_t cacheOrder) : lm((InterpolatedLM *) lm) {
-    cache = new AdaptiveLMCache(cacheOrder);
+    cache.reset(new AdaptiveLMCache(cacheOrder));
+}
+
+CachedLM::CachedLM(const InterpolatedLM *lm, const context_t *context) : lm((InterpolatedLM *) lm) {
+    cache = lm->GetSharedCache(context);
 }
 
 CachedLM::~CachedLM() {
-    delete (AdaptiveLMCache *) cache;
 }
 
 HistoryKey *CachedLM::MakeHistoryKey(const vector<wid_t> &phrase) const {
@@ -24,13 +27,31 @@ HistoryKey *CachedLM::MakeEmptyHistoryKey() const {
     return lm->MakeEmptyHistoryKey();
 }
 
+void CachedLM::MakeHistoryState(const vector<wid_t> &phrase, HistoryState *outHistoryState) const {
+    lm->MakeHistoryState(phrase, outHistoryState);
+}
+
+void CachedLM::MakeEmptyHistoryState(HistoryState *outHistoryState) const {
+    lm->MakeEmptyHistoryState(outHistoryState);
+}
+
 bool CachedLM::IsOOV(const context_t *context, const wid_t word) const {
     return lm->IsOOV(context, word);
 }
 
 float CachedLM::ComputeProbability(const wid_t word, const HistoryKey *historyKey, const context_t *context,
                                         HistoryKey **outHistoryKey) const {
-    return lm->ComputeProbability(word, historyKey, context, outHistoryKey, cache);
+    return lm->ComputeProbability(word, historyKey, context, outHistoryKey, cache.get());
 }
 
+float CachedLM::ComputeProbability(const wid_t word, const HistoryState &historyState, const context_t *context,
+                                   HistoryState *outHistoryState) const {
+    return lm->ComputeProbability(word, historyState, context, outHistoryState, cache.get());
+}
 
+float CachedLM::ComputePhraseProbability(const wid_t *phrase, size_t length, const HistoryState &historyState,
+                                         const context_t *context, HistoryState *outHistoryState,
+                                         float *outProbabilities) const {
+    return lm->ComputePhraseProbability(phrase, length, historyState, context, outHistoryState, outProbabilities,
+                                        cache.get());
+}
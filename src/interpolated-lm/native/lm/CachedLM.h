@@ -11,6 +11,7 @@
 #include <cstdint>
 #include <vector>
 #include <string>
+#include <memory>
 
 using namespace std;
 
@@ -19,8 +20,12 @@ namespace mmt {
 
         class CachedLM : public LM {
         public:
+            // Creates a private cache, discarded together with this object
             CachedLM(const InterpolatedLM *lm, uint8_t cacheOrder = 3);
 
+            // Uses the cache shared by all the requests with the same (normalized) context
+            CachedLM(const InterpolatedLM *lm, const context_t *context);
+
             ~CachedLM();
 
             virtual float ComputeProbability(const wid_t word, const HistoryKey *historyKey,
@@ -30,11 +35,23 @@ namespace mmt {
 
             virtual HistoryKey *MakeEmptyHistoryKey() const override;
 
+            virtual float ComputeProbability(const wid_t word, const HistoryState &historyState,
+                                             const context_t *context, HistoryState *outHistoryState) const override;
+
+            virtual void MakeHistoryState(const vector <wid_t> &phrase, HistoryState *outHistoryState) const override;
+
+            virtual float ComputePhraseProbability(const wid_t *phrase, size_t length,
+                                                   const HistoryState &historyState, const context_t *context,
+                                                   HistoryState *outHistoryState,
+                                                   float *outProbabilities = NULL) const override;
+
+            virtual void MakeEmptyHistoryState(HistoryState *outHistoryState) const override;
+
             virtual bool IsOOV(const context_t *context, const wid_t word) const override;
 
         private:
             InterpolatedLM *lm;
-            void *cache;
+            shared_ptr<void> cache;
         };
 
     }
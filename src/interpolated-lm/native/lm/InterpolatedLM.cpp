@@ -6,6 +6,8 @@
 #include "InterpolatedLM.h"
 #include "AdaptiveLM.h"
 #include "StaticLM.h"
+#include <atomic>
+#include <cmath>
 #include <boost/filesystem.hpp>
 
 namespace fs = boost::filesystem;
@@ -14,6 +16,24 @@ using namespace std;
 using namespace mmt;
 using namespace mmt::ilm;
 
+static const size_t kLazyCountersStripes = 64;
+
+// The lazy lookups of every thread are counted on a stripe of its own, so that the threads
+// scoring concurrently never write the same cache line
+struct lazy_counters_t {
+    atomic<uint64_t> lookups;
+    atomic<uint64_t> skips;
+    char padding[128 - 2 * sizeof(atomic<uint64_t>)];
+
+    lazy_counters_t() : lookups(0), skips(0) {}
+};
+
+static inline size_t GetThreadStripe() {
+    static atomic<size_t> threads(0);
+    thread_local size_t stripe = threads.fetch_add(1, memory_order_relaxed) % kLazyCountersStripes;
+    return stripe;
+}
+
 namespace mmt {
     namespace ilm {
 
@@ -75,16 +95,51 @@ namespace mmt {
 struct InterpolatedLM::ilm_private {
     AdaptiveLM *alm = nullptr;
     StaticLM *slm = nullptr;
+    AdaptiveLMCachePool *cachePool = nullptr;
 
     bool is_alm_active = false;
     double log_alm_weight = 0.0;
     bool is_slm_active = false;
     double log_slm_weight = 0.0;
+
+    bool is_lazy_alm = false;
+    double log_lazy_threshold = 0.0;
+    lazy_counters_t lazy_counters[kLazyCountersStripes];
+
+    // The interpolated probability is log(ws * Ps + wa * Pa): if Pa <= B, replacing Pa with B
+    // overestimates it by at most log(1 + wa * B / (ws * Ps)), that is at most epsilon if
+    // log(wa * B) - log(ws * Ps) <= log(exp(epsilon) - 1).
+    // Returns true and sets "outProbability" to log(B) if the adaptive lm can be skipped for "word".
+    bool IsAdaptiveNegligible(const wid_t word, const context_t *context, float slm_probability,
+                              float *outProbability) const {
+        float bound;
+        if (!alm->GetOOVProbabilityBound(context, word, &bound) || !(bound > 0.f))
+            return false;
+
+        double log_bound = log(bound);
+        if (log_alm_weight + log_bound - (log_slm_weight + slm_probability) > log_lazy_threshold)
+            return false;
+
+        *outProbability = (float) log_bound;
+        return true;
+    }
+
+    void CountLazyLookups(uint64_t lookups, bool skipped) {
+        lazy_counters_t &counters = lazy_counters[GetThreadStripe()];
+
+        counters.lookups.fetch_add(lookups, memory_order_relaxed);
+        if (skipped)
+            counters.skips.fetch_add(lookups, memory_order_relaxed);
+    }
 };
 
 InterpolatedLM::InterpolatedLM(const string &modelPath, const Options &options) {
     if (options.adaptivity_ratio < 0 || options.adaptivity_ratio > 1.)
         throw invalid_argument("Invalid adaptivity_ratio");
+    if (options.order == 0 || options.order > kMaxOrder)
+        throw invalid_argument("Invalid order");
+    if (options.lazy_alm_epsilon < 0)
+        throw invalid_argument("Invalid lazy_alm_epsilon");
 
     fs::path modelDir(modelPath);
 
@@ -114,17 +169,33 @@ InterpolatedLM::InterpolatedLM(const string &modelPath, const Options &options)
 
         self->log_alm_weight = log(options.adaptivity_ratio);
         self->log_slm_weight = log(1.f - options.adaptivity_ratio);
+
+        // The bound is available only for the words rejected by the novelty filters
+        if (options.lazy_alm_epsilon > 0 && options.update_novelty_filters) {
+            self->is_lazy_alm = true;
+            self->log_lazy_threshold = log(expm1((double) options.lazy_alm_epsilon));
+        }
     }
 
-    if (self->is_alm_active)
+    if (self->is_alm_active) {
         self->alm = new AdaptiveLM(almDir.string(), options.order, options.update_buffer_size,
-                                   options.update_max_delay);
+                                   options.update_max_delay, options.batch_lookups,
+                                   options.inverted_storage ? kInvertedLayout : kDomainLayout,
+                                   options.update_novelty_filters,
+                                   storage_format_t(options.compact_counts ? kVarintEncoding : kFixedEncoding,
+                                                    options.compressed_storage ? kBlockTable : kPlainTable),
+                                   options.update_log);
+        self->cachePool = new AdaptiveLMCachePool(options.cache_order, options.cache_capacity,
+                                                  options.cache_pool_size);
+    }
 
     if (self->is_slm_active)
-        self->slm = new StaticLM(slmFile.string());
+        self->slm = new StaticLM(slmFile.string(), options.slm_load_method, options.slm_warmup);
 }
 
 InterpolatedLM::~InterpolatedLM() {
+    if (self->cachePool)
+        delete self->cachePool;
     if (self->alm)
         delete self->alm;
     if (self->slm)
@@ -142,6 +213,25 @@ HistoryKey *InterpolatedLM::MakeEmptyHistoryKey() const {
                                  self->slm ? self->slm->MakeEmptyHistoryKey() : NULL);
 }
 
+void InterpolatedLM::MakeHistoryState(const vector<wid_t> &phrase, HistoryState *outHistoryState) const {
+    MakeEmptyHistoryState(outHistoryState);
+
+    if (self->alm)
+        self->alm->MakeHistoryState(phrase, outHistoryState);
+    if (self->slm)
+        self->slm->MakeHistoryState(phrase, outHistoryState);
+}
+
+void InterpolatedLM::MakeEmptyHistoryState(HistoryState *outHistoryState) const {
+    outHistoryState->alm_length = 0;
+    outHistoryState->slm_length = 0;
+
+    if (self->alm)
+        self->alm->MakeEmptyHistoryState(outHistoryState);
+    if (self->slm)
+        self->slm->MakeEmptyHistoryState(outHistoryState);
+}
+
 bool InterpolatedLM::IsOOV(const context_t *context, const wid_t word) const {
     bool use_slm = self->is_slm_active;
     bool use_alm = self->is_alm_active && context != NULL && !context->empty();
@@ -180,9 +270,21 @@ float InterpolatedLM::ComputeProbability(const wid_t word, const HistoryKey *his
 
     if (use_slm)
         slm_probability = self->slm->ComputeProbability(word, inKey->slm_key, context, outHistoryKey ? &slm_key : NULL);
-    if (use_alm)
+
+    bool skip_alm = false;
+    if (use_slm && use_alm && self->is_lazy_alm) {
+        skip_alm = self->IsAdaptiveNegligible(word, context, slm_probability, &alm_probability);
+        self->CountLazyLookups(1, skip_alm);
+    }
+
+    if (skip_alm) {
+        // The word is missing from the adaptive lm, thus its history is empty
+        if (outHistoryKey)
+            alm_key = self->alm->MakeEmptyHistoryKey();
+    } else if (use_alm) {
         alm_probability = self->alm->ComputeProbability(word, inKey->alm_key, context, outHistoryKey ? &alm_key : NULL,
                                                         (AdaptiveLMCache *) cache);
+    }
 
     if (use_slm && use_alm) // we defined slm_weight == 1.0 - alm_weight
         result = log_sum(self->log_slm_weight + slm_probability, self->log_alm_weight + alm_probability);
@@ -197,6 +299,133 @@ float InterpolatedLM::ComputeProbability(const wid_t word, const HistoryKey *his
     return (float) result;
 }
 
+float InterpolatedLM::ComputeProbability(const wid_t word, const HistoryState &historyState,
+                                         const context_t *context, HistoryState *outHistoryState, void *cache) const {
+    double result = kNaturalLogZeroProbability;
+    float slm_probability = kNaturalLogZeroProbability;
+    float alm_probability = kNaturalLogZeroProbability;
+
+    bool use_slm = self->is_slm_active;
+    bool use_alm = self->is_alm_active && context != NULL && !context->empty();
+
+    // Every LM updates its own part of the state only, thus "outHistoryState" can alias "historyState"
+    if (use_slm)
+        slm_probability = self->slm->ComputeProbability(word, historyState, context, outHistoryState);
+    else if (outHistoryState)
+        outHistoryState->slm_length = 0;
+
+    bool skip_alm = false;
+    if (use_slm && use_alm && self->is_lazy_alm) {
+        skip_alm = self->IsAdaptiveNegligible(word, context, slm_probability, &alm_probability);
+        self->CountLazyLookups(1, skip_alm);
+    }
+
+    if (skip_alm) {
+        // The word is missing from the adaptive lm, thus its history is empty
+        if (outHistoryState)
+            outHistoryState->alm_length = 0;
+    } else if (use_alm) {
+        alm_probability = self->alm->ComputeProbability(word, historyState, context, outHistoryState,
+                                                        (AdaptiveLMCache *) cache);
+    } else if (outHistoryState) {
+        outHistoryState->alm_length = 0;
+    }
+
+    if (use_slm && use_alm) // we defined slm_weight == 1.0 - alm_weight
+        result = log_sum(self->log_slm_weight + slm_probability, self->log_alm_weight + alm_probability);
+    else if (use_slm) // we force slm_weight = 1.0
+        result = slm_probability;
+    else if (use_alm) // we force alm_weight = 1.0
+        result = alm_probability;
+
+    return (float) result;
+}
+
+float InterpolatedLM::ComputePhraseProbability(const wid_t *phrase, size_t length, const HistoryState &historyState,
+                                               const context_t *context, HistoryState *outHistoryState,
+                                               float *outProbabilities, void *cache) const {
+    if (length == 0) {
+        if (outHistoryState)
+            *outHistoryState = historyState;
+        return 0.f;
+    }
+
+    bool use_slm = self->is_slm_active;
+    bool use_alm = self->is_alm_active && context != NULL && !context->empty();
+
+    if (!use_slm || !use_alm) {
+        float result = 0.f;
+
+        if (use_slm) {
+            result = self->slm->ComputePhraseProbability(phrase, length, historyState, context, outHistoryState,
+                                                         outProbabilities);
+        } else if (outHistoryState) {
+            outHistoryState->slm_length = 0;
+        }
+
+        if (use_alm) {
+            result = self->alm->ComputePhraseProbability(phrase, length, historyState, context, outHistoryState,
+                                                         outProbabilities, (AdaptiveLMCache *) cache);
+        } else if (outHistoryState) {
+            outHistoryState->alm_length = 0;
+        }
+
+        if (!use_slm && !use_alm) {
+            if (outProbabilities)
+                std::fill(outProbabilities, outProbabilities + length, kNaturalLogZeroProbability);
+            result = length * kNaturalLogZeroProbability;
+        }
+
+        return result;
+    }
+
+    // Per-word probabilities of both the LMs, on the stack for the common phrase lengths
+    static const size_t kStackPhraseLength = 32;
+
+    float stackBuffer[2 * kStackPhraseLength];
+    vector<float> heapBuffer;
+
+    float *slm_probabilities = stackBuffer;
+    if (length > kStackPhraseLength) {
+        heapBuffer.resize(2 * length);
+        slm_probabilities = heapBuffer.data();
+    }
+    float *alm_probabilities = slm_probabilities + length;
+
+    // Every LM updates its own part of the state only, thus "outHistoryState" can alias "historyState"
+    self->slm->ComputePhraseProbability(phrase, length, historyState, context, outHistoryState, slm_probabilities);
+
+    // The adaptive lm is skipped only if it is negligible for all the words: since the last word
+    // is missing from the adaptive lm, its history is empty
+    bool skip_alm = self->is_lazy_alm;
+    for (size_t i = 0; skip_alm && i < length; ++i)
+        skip_alm = self->IsAdaptiveNegligible(phrase[i], context, slm_probabilities[i], &alm_probabilities[i]);
+
+    if (self->is_lazy_alm)
+        self->CountLazyLookups(length, skip_alm);
+
+    if (skip_alm) {
+        if (outHistoryState)
+            outHistoryState->alm_length = 0;
+    } else {
+        self->alm->ComputePhraseProbability(phrase, length, historyState, context, outHistoryState,
+                                            alm_probabilities, (AdaptiveLMCache *) cache);
+    }
+
+    double result = 0.;
+
+    for (size_t i = 0; i < length; ++i) {
+        float probability = (float) log_sum(self->log_slm_weight + slm_probabilities[i],
+                                            self->log_alm_weight + alm_probabilities[i]);
+
+        if (outProbabilities)
+            outProbabilities[i] = probability;
+        result += probability;
+    }
+
+    return (float) result;
+}
+
 void InterpolatedLM::Add(const updateid_t &id, const domain_t domain, const vector<wid_t> &source, const vector<wid_t> &target,
                   const alignment_t &alignment) {
     if (self->is_alm_active)
@@ -211,3 +440,33 @@ void InterpolatedLM::NormalizeContext(context_t *context) {
     if (self->is_alm_active)
         self->alm->NormalizeContext(context);
 }
+
+shared_ptr<void> InterpolatedLM::GetSharedCache(const context_t *context) const {
+    if (!self->is_alm_active || context == NULL || context->empty())
+        return shared_ptr<void>();
+
+    vector<count_t> version;
+    self->alm->GetContextVersion(context, version);
+
+    return self->cachePool->Get(context, version);
+}
+
+size_t InterpolatedLM::GetCacheMemoryUsage() const {
+    return self->cachePool ? self->cachePool->GetMemoryUsage() : 0;
+}
+
+float InterpolatedLM::GetCacheHitRate() const {
+    return self->cachePool ? self->cachePool->GetHitRate() : 0.f;
+}
+
+float InterpolatedLM::GetLazySkipRate() const {
+    uint64_t lookups = 0;
+    uint64_t skips = 0;
+
+    for (size_t i = 0; i < kLazyCountersStripes; ++i) {
+        lookups += self->lazy_counters[i].lookups.load(memory_order_relaxed);
+        skips += self->lazy_counters[i].skips.load(memory_order_relaxed);
+    }
+
+    return lookups == 0 ? 0.f : (float) ((double) skips / lookups);
+}
@@ -11,6 +11,7 @@
 #include <cstdint>
 #include <vector>
 #include <string>
+#include <memory>
 
 using namespace std;
 
@@ -37,6 +38,24 @@ namespace mmt {
 
             virtual HistoryKey *MakeEmptyHistoryKey() const override;
 
+            inline virtual float ComputeProbability(const wid_t word, const HistoryState &historyState,
+                                                    const context_t *context,
+                                                    HistoryState *outHistoryState) const override {
+                return ComputeProbability(word, historyState, context, outHistoryState, NULL);
+            }
+
+            virtual void MakeHistoryState(const vector <wid_t> &phrase, HistoryState *outHistoryState) const override;
+
+            inline virtual float ComputePhraseProbability(const wid_t *phrase, size_t length,
+                                                          const HistoryState &historyState,
+                                                          const context_t *context, HistoryState *outHistoryState,
+                                                          float *outProbabilities = NULL) const override {
+                return ComputePhraseProbability(phrase, length, historyState, context, outHistoryState,
+                                                outProbabilities, NULL);
+            }
+
+            virtual void MakeEmptyHistoryState(HistoryState *outHistoryState) const override;
+
             virtual bool IsOOV(const context_t *context, const wid_t word) const override;
 
             /* Incremental Model */
@@ -49,12 +68,36 @@ namespace mmt {
 
             virtual void NormalizeContext(context_t *context);
 
+            /* Cache */
+
+            // Memory allocated by the shared caches, in bytes
+            size_t GetCacheMemoryUsage() const;
+
+            // Ratio of cache hits over all the lookups made on the shared caches
+            float GetCacheHitRate() const;
+
+            /* Lazy evaluation */
+
+            // Ratio of words scored without querying the adaptive lm (see Options::lazy_alm_epsilon)
+            // over all the words scored by both the LMs
+            float GetLazySkipRate() const;
+
         private:
             struct ilm_private;
             ilm_private *self;
 
             float ComputeProbability(const wid_t word, const HistoryKey *historyKey,
                                      const context_t *context, HistoryKey **outHistoryKey, void *cache) const;
+
+            float ComputeProbability(const wid_t word, const HistoryState &historyState,
+                                     const context_t *context, HistoryState *outHistoryState, void *cache) const;
+
+            float ComputePhraseProbability(const wid_t *phrase, size_t length, const HistoryState &historyState,
+                                           const context_t *context, HistoryState *outHistoryState,
+                                           float *outProbabilities, void *cache) const;
+
+            // Returns the cache shared by all the requests with the given (normalized) context
+            shared_ptr<void> GetSharedCache(const context_t *context) const;
         };
 
     }
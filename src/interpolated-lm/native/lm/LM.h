@@ -6,8 +6,10 @@
 #define ILM_LM_H
 
 #include <cstdint>
+#include <cstddef>
 #include <vector>
 #include <map>
+#include <algorithm>
 #include <mmt/sentence.h>
 
 using namespace std;
@@ -25,6 +27,85 @@ namespace mmt {
             virtual ~HistoryKey() {};
         };
 
+        // Maximum n-gram order supported by HistoryState
+        const uint8_t kMaxOrder = 6;
+
+        // Value-type alternative to HistoryKey: it has a fixed size and it can be copied,
+        // hashed and compared without virtual calls or heap allocations.
+        // It holds both the adaptive lm and the static lm state: every LM reads and
+        // writes its own part only.
+        struct HistoryState {
+            // AdaptiveLM: the most recent words of the history, the latest one is the last
+            wid_t alm_words[kMaxOrder];
+            uint8_t alm_length;
+
+            // StaticLM: a copy of the KenLM state
+            uint32_t slm_words[kMaxOrder - 1];
+            float slm_backoff[kMaxOrder - 1];
+            uint8_t slm_length;
+
+            HistoryState() : alm_length(0), slm_length(0) {};
+
+            inline size_t hash() const {
+                uint64_t key = alm_length;
+
+                for (uint8_t i = 0; i < alm_length; ++i)
+                    key = (key * 8978948897894561157ULL) ^ ((1ULL + alm_words[i]) * 17894857484156487943ULL);
+                for (uint8_t i = 0; i < slm_length; ++i)
+                    key = (key * 8978948897894561157ULL) ^ ((1ULL + slm_words[i]) * 17894857484156487943ULL);
+
+                return (size_t) key;
+            }
+
+            inline bool operator==(const HistoryState &other) const {
+                if (alm_length != other.alm_length || slm_length != other.slm_length)
+                    return false;
+
+                return std::equal(alm_words, alm_words + alm_length, other.alm_words) &&
+                       std::equal(slm_words, slm_words + slm_length, other.slm_words);
+            }
+
+            inline size_t length() const {
+                return std::max(alm_length, slm_length);
+            }
+        };
+
+        // Allocates HistoryState objects in blocks, all of them are released together by Clear()
+        // (i.e. at the end of a sentence): this avoids one heap allocation per state when the
+        // caller needs stable pointers.
+        class HistoryStateArena {
+        public:
+            HistoryStateArena(size_t blockSize = 4096) : blockSize(blockSize), block(0), used(0) {};
+
+            ~HistoryStateArena() {
+                for (auto it = blocks.begin(); it != blocks.end(); ++it)
+                    delete[] *it;
+            }
+
+            inline HistoryState *New() {
+                if (used == blockSize) {
+                    block++;
+                    used = 0;
+                }
+
+                if (block == blocks.size())
+                    blocks.push_back(new HistoryState[blockSize]);
+
+                return &blocks[block][used++];
+            }
+
+            inline void Clear() {
+                block = 0;
+                used = 0;
+            }
+
+        private:
+            const size_t blockSize;
+            vector<HistoryState *> blocks;
+            size_t block;
+            size_t used;
+        };
+
         const wid_t kVocabularyStartSymbol = 1;
         const wid_t kVocabularyEndSymbol = 2;
 
@@ -39,6 +120,25 @@ namespace mmt {
 
             virtual HistoryKey *MakeEmptyHistoryKey() const = 0;
 
+            // Same as the HistoryKey based methods, without heap allocations;
+            // "outHistoryState" can point to "historyState" in order to update it in place.
+            virtual float ComputeProbability(const wid_t word, const HistoryState &historyState,
+                                             const context_t *context, HistoryState *outHistoryState) const = 0;
+
+            virtual void MakeHistoryState(const vector <wid_t> &phrase, HistoryState *outHistoryState) const = 0;
+
+            // Scores the "length" words of "phrase" in sequence, starting from "historyState":
+            // the result is the same as calling ComputeProbability() for each word, but the LM
+            // is free to share the work across the whole phrase.
+            // Returns the sum of the log probabilities; if not NULL, "outProbabilities" is filled
+            // with the log probability of every word. "outHistoryState" can point to "historyState".
+            virtual float ComputePhraseProbability(const wid_t *phrase, size_t length,
+                                                   const HistoryState &historyState, const context_t *context,
+                                                   HistoryState *outHistoryState,
+                                                   float *outProbabilities = NULL) const = 0;
+
+            virtual void MakeEmptyHistoryState(HistoryState *outHistoryState) const = 0;
+
             virtual bool IsOOV(const context_t *context, const wid_t word) const = 0;
         };
 
@@ -12,6 +12,18 @@
 namespace mmt {
     namespace ilm {
 
+        // How the static lm binary file is loaded in memory
+        enum slm_load_method_t {
+            // Memory mapped, pages are read on first access: fastest startup, slow first queries
+            kLazyLoad,
+            // Memory mapped and prefaulted while loading
+            kPopulateLoad,
+            // Read into private memory, backed by huge pages when available
+            kReadLoad,
+            // As kReadLoad, with multiple threads (recommended for network file systems)
+            kParallelReadLoad
+        };
+
         struct Options {
 
             // N-Gram order of the Language Model
@@ -23,6 +35,61 @@ namespace mmt {
             // the same of the static lm.
             float adaptivity_ratio = .5f;
 
+            // If true, the adaptive lm fetches all the counts needed to score
+            // a word (every order and every context domain) with a single
+            // batch read, instead of issuing one read per order and domain.
+            bool batch_lookups = true;
+
+            // If true, a new adaptive lm stores every n-gram in a single record holding
+            // the counts of all the domains, so that a whole context is answered with one
+            // read per n-gram. Existing models keep the layout they have been created with
+            // (see convert_alm).
+            bool inverted_storage = false;
+
+            // If true, a new adaptive lm stores the counts as variable-length integers, and
+            // the n-grams seen only once take no value bytes at all.
+            bool compact_counts = false;
+
+            // If true, a new adaptive lm stores its tables as compressed blocks with bloom
+            // filters instead of memory-mapped plain tables: the footprint is much smaller,
+            // lookups are slightly slower. As for the layout, existing models keep their
+            // format (see convert_alm).
+            bool compressed_storage = false;
+
+            // If greater than 0, the adaptive lm is not queried for the words that are surely
+            // missing from the context domains (see update_novelty_filters) whenever an upper
+            // bound of its probability cannot change the interpolated log-probability by
+            // more than this value; the bound is used instead. A value of 0 always
+            // computes the exact probability.
+            float lazy_alm_epsilon = 0.f;
+
+            /* Static LM */
+
+            // How the static lm is loaded (ignored if the file is in ARPA format).
+            // The same file is loaded only once per process, whatever the number of
+            // models using it. With kLazyLoad and kPopulateLoad the file is mapped
+            // read-only, thus multiple processes on the same host share its pages.
+            slm_load_method_t slm_load_method = kPopulateLoad;
+
+            // If true and the static lm is loaded with kLazyLoad, a background thread
+            // prefaults its most used tables (unigrams and bigrams following the
+            // sentence start) right after loading.
+            bool slm_warmup = true;
+
+            /* Cache */
+
+            // Maximum number of n-grams stored in a single adaptive lm cache;
+            // every entry takes 16 bytes.
+            size_t cache_capacity = 500000;
+
+            // N-Gram order of the longest n-grams stored in the cache.
+            uint8_t cache_order = 3;
+
+            // Maximum number of caches kept in memory for reuse, one for
+            // every distinct context. Translation requests with the same
+            // context share the same cache.
+            size_t cache_pool_size = 64;
+
             /* Updates */
 
             // Updates are flushed to disk when one of the following
@@ -40,6 +107,16 @@ namespace mmt {
             // to the user.
             double update_max_delay = 2.; // seconds
 
+            // If true, every update is recorded in a write-ahead log before being
+            // acknowledged, and the updates still in the buffer after a crash are
+            // recovered the next time the model is opened.
+            bool update_log = true;
+
+            // If true, the n-grams of every domain are also kept in memory in a compact,
+            // approximate form (2-3 bytes per n-gram) that lets the updates skip the
+            // database reads for the n-grams that are new for sure.
+            bool update_novelty_filters = true;
+
             Options() {};
         };
 
@@ -3,11 +3,67 @@
 //
 
 #include "StaticLM.h"
+#include <atomic>
+#include <fstream>
+#include <mutex>
+#include <stdexcept>
+#include <thread>
+#include <unordered_map>
+#include <lm/binary_format.hh>
+#include <lm/enumerate_vocab.hh>
+#include <boost/filesystem.hpp>
+
+namespace fs = boost::filesystem;
 
 using namespace mmt::ilm;
 
+static_assert(KENLM_MAX_ORDER <= kMaxOrder, "KenLM max order exceeds the HistoryState capacity");
+static_assert(sizeof(lm::WordIndex) == sizeof(uint32_t), "HistoryState requires 32-bit KenLM word indexes");
+
+static inline void ToKenLMState(const HistoryState &historyState, lm::ngram::State &outState) {
+    outState.length = historyState.slm_length;
+    std::copy(historyState.slm_words, historyState.slm_words + historyState.slm_length, outState.words);
+    std::copy(historyState.slm_backoff, historyState.slm_backoff + historyState.slm_length, outState.backoff);
+}
+
+static inline void FromKenLMState(const lm::ngram::State &state, HistoryState *outHistoryState) {
+    outHistoryState->slm_length = state.length;
+    std::copy(state.words, state.words + state.length, outHistoryState->slm_words);
+    std::copy(state.backoff, state.backoff + state.length, outHistoryState->slm_backoff);
+}
+
 namespace mmt {
     namespace ilm {
+        /* Collects the KenLM index of every word while the model is loading. The words of the
+         * background LM are the decimal representation of their wid_t, any other string
+         * (i.e. <s>, </s>, <unk>) is ignored. */
+        class WordIndexCollector : public lm::EnumerateVocab {
+        public:
+            vector<pair<wid_t, lm::WordIndex>> entries;
+            wid_t maxWord = 0;
+            lm::WordIndex bound = 0;
+
+            virtual void Add(lm::WordIndex index, const StringPiece &str) override {
+                bound = max(bound, index + 1);
+
+                if (str.empty() || str.size() > 10)
+                    return;
+
+                uint64_t word = 0;
+                for (const char *c = str.data(); c != str.data() + str.size(); ++c) {
+                    if (*c < '0' || *c > '9')
+                        return;
+                    word = word * 10 + (*c - '0');
+                }
+
+                if (word > UINT32_MAX)
+                    return;
+
+                entries.push_back(pair<wid_t, lm::WordIndex>((wid_t) word, index));
+                maxWord = max(maxWord, (wid_t) word);
+            }
+        };
+
         struct KenLMHistoryKey : public HistoryKey {
             lm::ngram::State state;
 
@@ -34,42 +90,181 @@ namespace mmt {
     }
 }
 
-StaticLM::StaticLM(const string &modelPath) {
-    const lm::ngram::Config config;
-    model = new lm::ngram::Model(modelPath.c_str(), config);
+/* A loaded KenLM model, shared by all the StaticLM instances of the same file and load method */
+struct StaticLM::kenlm_model_t {
+    lm::ngram::ModelType type;
+    lm::base::Model *model;
+    const lm::ngram::ProbingModel *probingModel;
+    vector<lm::WordIndex> wordIndexes;
+    lm::WordIndex vocabularyBound;
+
+    thread *warmupThread = NULL;
+    atomic<bool> stopWarmup;
+
+    kenlm_model_t(const string &modelPath, util::LoadMethod loadMethod) : stopWarmup(false) {
+        VerifyHeader(modelPath, &type);
+
+        WordIndexCollector collector;
+
+        lm::ngram::Config config;
+        config.enumerate_vocab = &collector;
+        config.load_method = loadMethod;
+        model = lm::ngram::LoadVirtual(modelPath.c_str(), config);
+        probingModel = dynamic_cast<const lm::ngram::ProbingModel *>(model);
+
+        // dense wid_t -> lm::WordIndex table, words not in the LM map to <unk>
+        wordIndexes.resize(collector.entries.empty() ? 0 : (size_t) collector.maxWord + 1,
+                           model->BaseVocabulary().NotFound());
+        for (auto entry = collector.entries.begin(); entry != collector.entries.end(); ++entry)
+            wordIndexes[entry->first] = entry->second;
+        vocabularyBound = collector.bound;
+    }
+
+    ~kenlm_model_t() {
+        if (warmupThread) {
+            stopWarmup = true;
+            warmupThread->join();
+            delete warmupThread;
+        }
+
+        delete model;
+    }
+
+    // Reads the binary header without mapping the model: a wrong file (i.e. a model built by a
+    // different KenLM version or for a different architecture, or a file that is neither binary
+    // nor ARPA) fails here, before the model is loaded. ARPA files are still accepted, they are
+    // loaded as probing models.
+    static void VerifyHeader(const string &modelPath, lm::ngram::ModelType *outType) {
+        bool binary;
+
+        try {
+            binary = lm::ngram::RecognizeBinary(modelPath.c_str(), *outType);
+        } catch (util::Exception &e) {
+            throw invalid_argument("Invalid static LM " + modelPath + ": " + e.what());
+        }
+
+        if (!binary) {
+            static const string kArpaHeader = "\\data\\";
+
+            string header;
+            ifstream input(modelPath.c_str());
+            while (getline(input, header) && header.empty());
+
+            if (header != kArpaHeader)
+                throw invalid_argument("Invalid static LM " + modelPath + ": neither a KenLM binary nor an ARPA model");
+
+            *outType = lm::ngram::PROBING;
+        }
+    }
+
+    void StartWarmup() {
+        warmupThread = new thread(&kenlm_model_t::Warmup, this);
+    }
+
+    // Scores every word both alone and after the sentence start, so that the pages of the unigram
+    // table and of the most frequent bigrams are mapped before the first requests need them
+    void Warmup() {
+        lm::ngram::State state;
+
+        for (lm::WordIndex word = 0; word < vocabularyBound; ++word) {
+            if ((word % 1024) == 0 && stopWarmup.load(memory_order_relaxed))
+                return;
+
+            model->BaseFullScore(model->NullContextMemory(), word, &state);
+            model->BaseFullScore(model->BeginSentenceMemory(), word, &state);
+        }
+    }
+};
+
+namespace {
+    util::LoadMethod ToKenLMLoadMethod(slm_load_method_t method) {
+        switch (method) {
+            case kLazyLoad:
+                return util::LAZY;
+            case kReadLoad:
+                return util::READ;
+            case kParallelReadLoad:
+                return util::PARALLEL_READ;
+            default:
+                return util::POPULATE_OR_READ;
+        }
+    }
+}
+
+shared_ptr<StaticLM::kenlm_model_t> StaticLM::LoadShared(const string &modelPath, slm_load_method_t loadMethod,
+                                                          bool warmup) {
+    static mutex registryAccess;
+    static unordered_map<string, weak_ptr<kenlm_model_t>> registry;
+
+    string key = fs::canonical(modelPath).string() + "#" + to_string((int) loadMethod);
+
+    lock_guard<mutex> lock(registryAccess);
+
+    shared_ptr<kenlm_model_t> result = registry[key].lock();
+
+    if (!result) {
+        result.reset(new kenlm_model_t(modelPath, ToKenLMLoadMethod(loadMethod)));
+        registry[key] = result;
+
+        if (warmup && loadMethod == kLazyLoad)
+            result->StartWarmup();
+    }
+
+    return result;
+}
+
+StaticLM::StaticLM(const string &modelPath, slm_load_method_t loadMethod, bool warmup) {
+    shared = LoadShared(modelPath, loadMethod, warmup);
+
+    model = shared->model;
+    probingModel = shared->probingModel;
+    nullContextState = *static_cast<const lm::ngram::State *>(model->NullContextMemory());
+    wordIndexes = shared->wordIndexes.data();
+    wordIndexesSize = shared->wordIndexes.size();
+    unknownWordIndex = model->BaseVocabulary().NotFound();
+    endSentenceIndex = model->BaseVocabulary().EndSentence();
+    beginSentenceIndex = model->BaseVocabulary().BeginSentence();
 }
 
 StaticLM::~StaticLM() {
-    delete model;
+}
+
+lm::ngram::ModelType StaticLM::GetModelType() const {
+    return shared->type;
 }
 
 HistoryKey *StaticLM::MakeHistoryKey(const vector<wid_t> &phrase) const {
-    lm::ngram::State state0 = model->NullContextState();
+    lm::ngram::State state;
+    MakeState(phrase, state);
+
+    return new KenLMHistoryKey(state);
+}
+
+void StaticLM::MakeState(const vector<wid_t> &phrase, lm::ngram::State &outState) const {
+    lm::ngram::State state0 = nullContextState;
     lm::ngram::State state1;
 
     for (vector<wid_t>::const_iterator it = phrase.begin(); it != phrase.end(); ++it) {
         lm::WordIndex vocab;
 
-        // convert integer wid_t code into lm::WordIndex (through a double conversion from/to std::string)
         if (*it == kVocabularyStartSymbol) {
-            vocab = model->GetVocabulary().BeginSentence();
+            vocab = beginSentenceIndex;
         } else {
-            vocab = model->GetVocabulary().Index(std::to_string(*it));
+            vocab = GetWordIndex(*it);
         }
-        model->Score(state0, vocab, state1);
+        FullScore(state0, vocab, state1);
         std::swap(state0, state1);
     }
 
-    return new KenLMHistoryKey(state0);
+    outState = state0;
 }
 
 HistoryKey *StaticLM::MakeEmptyHistoryKey() const {
-    return new KenLMHistoryKey(model->NullContextState());
+    return new KenLMHistoryKey(nullContextState);
 }
 
 bool StaticLM::IsOOV(const context_t *context, const wid_t word) const {
-    lm::WordIndex vocab = model->GetVocabulary().Index(std::to_string(word));
-    return (vocab == model->GetVocabulary().NotFound());
+    return GetWordIndex(word) == unknownWordIndex;
 }
 
 float StaticLM::ComputeProbability(const wid_t word, const HistoryKey *historyKey, const context_t *context,
@@ -79,15 +274,72 @@ float StaticLM::ComputeProbability(const wid_t word, const HistoryKey *historyKe
     assert(inKey != NULL);
 
     const lm::ngram::State &in_state = inKey->state;
-    const lm::base::Vocabulary &vocabulary = model->GetVocabulary();
-
-    const lm::WordIndex wordIndex = (word == kVocabularyEndSymbol) ? vocabulary.EndSentence() : vocabulary.Index(std::to_string(word));
+    const lm::WordIndex wordIndex = (word == kVocabularyEndSymbol) ? endSentenceIndex : GetWordIndex(word);
 
     lm::ngram::State state;
-    float prob = model->FullScore(in_state, wordIndex, state).prob;
+    float prob = FullScore(in_state, wordIndex, state);
 
     if (outHistoryKey)
-        *outHistoryKey = new KenLMHistoryKey(word == kVocabularyEndSymbol ? model->NullContextState() : state);
+        *outHistoryKey = new KenLMHistoryKey(word == kVocabularyEndSymbol ? nullContextState : state);
 
     return prob * 2.30258509299405f; // log10 to natural log
 }
+
+void StaticLM::MakeHistoryState(const vector<wid_t> &phrase, HistoryState *outHistoryState) const {
+    lm::ngram::State state;
+    MakeState(phrase, state);
+
+    FromKenLMState(state, outHistoryState);
+}
+
+void StaticLM::MakeEmptyHistoryState(HistoryState *outHistoryState) const {
+    FromKenLMState(nullContextState, outHistoryState);
+}
+
+float StaticLM::ComputeProbability(const wid_t word, const HistoryState &historyState, const context_t *context,
+                                   HistoryState *outHistoryState) const {
+    lm::ngram::State in_state;
+    ToKenLMState(historyState, in_state);
+
+    const lm::WordIndex wordIndex = (word == kVocabularyEndSymbol) ? endSentenceIndex : GetWordIndex(word);
+
+    lm::ngram::State state;
+    float prob = FullScore(in_state, wordIndex, state);
+
+    if (outHistoryState)
+        FromKenLMState(word == kVocabularyEndSymbol ? nullContextState : state, outHistoryState);
+
+    return prob * 2.30258509299405f; // log10 to natural log
+}
+
+float StaticLM::ComputePhraseProbability(const wid_t *phrase, size_t length, const HistoryState &historyState,
+                                         const context_t *context, HistoryState *outHistoryState,
+                                         float *outProbabilities) const {
+    // KenLM states are converted only once per phrase and the scoring loop works on them directly
+    lm::ngram::State states[2];
+    ToKenLMState(historyState, states[0]);
+
+    double result = 0.;
+    size_t current = 0;
+
+    for (size_t i = 0; i < length; ++i) {
+        const wid_t word = phrase[i];
+        const lm::WordIndex wordIndex = (word == kVocabularyEndSymbol) ? endSentenceIndex : GetWordIndex(word);
+
+        float prob = FullScore(states[current], wordIndex, states[1 - current]);
+        prob *= 2.30258509299405f; // log10 to natural log
+
+        if (word == kVocabularyEndSymbol)
+            states[1 - current] = nullContextState;
+        current = 1 - current;
+
+        if (outProbabilities)
+            outProbabilities[i] = prob;
+        result += prob;
+    }
+
+    if (outHistoryState)
+        FromKenLMState(states[current], outHistoryState);
+
+    return (float) result;
+}
@@ -6,7 +6,10 @@
 #define ILM_STATICLM_H
 
 #include <lm/model.hh>
+#include <lm/virtual_interface.hh>
+#include <memory>
 #include "LM.h"
+#include "Options.h"
 
 namespace mmt {
     namespace ilm {
@@ -14,7 +17,11 @@ namespace mmt {
         class StaticLM : public LM {
         public:
 
-            StaticLM(const string &modelPath);
+            // Models loaded from the same file with the same method share the same memory;
+            // "warmup" is effective only with kLazyLoad (see Options).
+            // The file must be a KenLM binary model of any type (probing, trie, quantized trie...)
+            // or an ARPA file; the binary header is verified before loading.
+            StaticLM(const string &modelPath, slm_load_method_t loadMethod = kPopulateLoad, bool warmup = false);
 
             ~StaticLM();
 
@@ -25,10 +32,55 @@ namespace mmt {
 
             virtual HistoryKey *MakeEmptyHistoryKey() const override;
 
+            virtual float ComputeProbability(const wid_t word, const HistoryState &historyState,
+                                             const context_t *context, HistoryState *outHistoryState) const override;
+
+            virtual void MakeHistoryState(const vector <wid_t> &phrase, HistoryState *outHistoryState) const override;
+
+            virtual float ComputePhraseProbability(const wid_t *phrase, size_t length,
+                                                   const HistoryState &historyState, const context_t *context,
+                                                   HistoryState *outHistoryState,
+                                                   float *outProbabilities = NULL) const override;
+
+            virtual void MakeEmptyHistoryState(HistoryState *outHistoryState) const override;
+
             virtual bool IsOOV(const context_t *context, const wid_t word) const override;
 
+            // Returns the KenLM data structure of the loaded model
+            lm::ngram::ModelType GetModelType() const;
+
         private:
-            lm::ngram::Model *model;
+            struct kenlm_model_t;
+
+            shared_ptr<kenlm_model_t> shared;
+            lm::base::Model *model;
+            const lm::ngram::ProbingModel *probingModel; // NULL if the model is not a probing model
+            lm::ngram::State nullContextState;
+            lm::WordIndex endSentenceIndex;
+            lm::WordIndex beginSentenceIndex;
+            const lm::WordIndex *wordIndexes;
+            size_t wordIndexesSize;
+            lm::WordIndex unknownWordIndex;
+
+            inline lm::WordIndex GetWordIndex(const wid_t word) const {
+                return word < wordIndexesSize ? wordIndexes[word] : unknownWordIndex;
+            }
+
+            void MakeState(const vector <wid_t> &phrase, lm::ngram::State &outState) const;
+
+            // All the KenLM n-gram models share the same state type; the probing model, the default
+            // one, is queried directly, the other types through the virtual interface
+            inline float FullScore(const lm::ngram::State &inState, const lm::WordIndex word,
+                                   lm::ngram::State &outState) const {
+                if (probingModel)
+                    return probingModel->FullScore(inState, word, outState).prob;
+
+                return model->BaseFullScore(&inState, word, &outState).prob;
+            }
+
+            // Returns the model already loaded from "modelPath" with "loadMethod" if any, otherwise loads it
+            static shared_ptr<kenlm_model_t> LoadShared(const string &modelPath, slm_load_method_t loadMethod,
+                                                        bool warmup);
         };
 
     }
@@ -0,0 +1,228 @@
+#include <iostream>
+#include <map>
+#include <random>
+#include <set>
+
+#include <mmt/sentence.h>
+#include <lm/LM.h>
+#include <db/NGramStorage.h>
+#include <db/NGramBatch.h>
+#include <db/BulkLoader.h>
+#include <boost/program_options.hpp>
+#include <boost/filesystem.hpp>
+
+using namespace std;
+using namespace mmt;
+using namespace mmt::ilm;
+
+namespace {
+    const size_t ERROR_IN_COMMAND_LINE = 1;
+    const size_t GENERIC_ERROR = 2;
+    const size_t TEST_FAILED = 3;
+    const size_t SUCCESS = 0;
+
+    struct args_t {
+        size_t sentences = 2000;
+        size_t vocabulary = 20;
+        size_t domains = 3;
+        uint8_t order = 5;
+        unsigned int seed = 1;
+    };
+} // namespace
+
+namespace po = boost::program_options;
+namespace fs = boost::filesystem;
+
+bool ParseArgs(int argc, const char *argv[], args_t *args) {
+    po::options_description desc("Compare the counts of a bulk loaded storage with the ones of the corpus");
+    desc.add_options()
+            ("help,h", "print this help message")
+            ("sentences,n", po::value<size_t>(), "number of sentences (default = 2000)")
+            ("vocabulary,v", po::value<size_t>(), "vocabulary size, small enough to repeat the n-grams (default = 20)")
+            ("domains,d", po::value<size_t>(), "number of domains (default = 3)")
+            ("seed,s", po::value<unsigned int>(), "random seed (default = 1)");
+
+    po::variables_map vm;
+    try {
+        po::store(po::parse_command_line(argc, argv, desc), vm);
+
+        if (vm.count("help")) {
+            std::cout << desc << std::endl;
+            return false;
+        }
+
+        po::notify(vm);
+
+        if (vm.count("sentences"))
+            args->sentences = vm["sentences"].as<size_t>();
+        if (vm.count("vocabulary"))
+            args->vocabulary = vm["vocabulary"].as<size_t>();
+        if (vm.count("domains"))
+            args->domains = vm["domains"].as<size_t>();
+        if (vm.count("seed"))
+            args->seed = vm["seed"].as<unsigned int>();
+    } catch (po::error &e) {
+        std::cerr << "ERROR: " << e.what() << std::endl << std::endl;
+        std::cerr << desc << std::endl;
+        return false;
+    }
+
+    return true;
+}
+
+// ------ Expected counts
+
+struct expected_ngram_t {
+    count_t count = 0;
+    set<dbkey_t> successors;
+    bool word = false;
+};
+
+typedef map<pair<domain_t, dbkey_t>, expected_ngram_t> expected_t;
+
+/*
+ * The n-grams of a sentence are the ones of NGramBatch: the sentence is enclosed by the start
+ * and end symbols, and every n-gram is a successor of the (n-1)-gram of its first words.
+ */
+void Count(domain_t domain, const vector<wid_t> &sentence, uint8_t order, expected_t &expected) {
+    vector<wid_t> words;
+    words.push_back(kVocabularyStartSymbol);
+    words.insert(words.end(), sentence.begin(), sentence.end());
+    words.push_back(kVocabularyEndSymbol);
+
+    for (size_t i = 0; i < words.size(); ++i) {
+        dbkey_t predecessor = 0;
+
+        for (size_t o = 0; o < order && i + o < words.size(); ++o) {
+            dbkey_t key = o == 0 ? make_key(words[i]) : make_key(predecessor, words[i + o]);
+
+            expected_ngram_t &ngram = expected[make_pair(domain, key)];
+            ngram.count++;
+            ngram.word = (o == 0);
+
+            if (o > 0)
+                expected[make_pair(domain, predecessor)].successors.insert(key);
+
+            predecessor = key;
+        }
+    }
+}
+
+// ------ Testing
+
+bool RunTest(const args_t &args, storage_layout_t layout, size_t memory, const string &name) {
+    mt19937 random(args.seed);
+    uniform_int_distribution<size_t> length(1, 15);
+    uniform_int_distribution<wid_t> word(3, (wid_t) (3 + args.vocabulary - 1));
+
+    fs::path path = fs::temp_directory_path() / fs::unique_path("ilm-test-%%%%-%%%%");
+    fs::path modelPath = path / "model";
+    fs::path tempPath = path / "tmp";
+    fs::create_directories(tempPath);
+
+    expected_t expected;
+    bool success = true;
+
+    {
+        NGramStorage storage(modelPath.string(), args.order, true, layout, false);
+
+        {
+            BulkLoader loader(storage, tempPath.string(), memory);
+
+            // small batches: the same n-grams are added many times by different batches
+            NGramBatch batch(args.order, 100);
+            vector<wid_t> sentence;
+
+            for (size_t i = 0; i < args.sentences; ++i) {
+                domain_t domain = (domain_t) (1 + i % args.domains);
+
+                sentence.resize(length(random));
+                for (size_t w = 0; w < sentence.size(); ++w)
+                    sentence[w] = word(random);
+
+                Count(domain, sentence, args.order, expected);
+
+                if (!batch.Add(domain, sentence)) {
+                    loader.Add(batch);
+                    batch.Clear();
+                    batch.Add(domain, sentence);
+                }
+            }
+
+            if (batch.GetSize() > 0)
+                loader.Add(batch);
+
+            loader.Load();
+        }
+
+        map<domain_t, pair<count_t, count_t>> wordCounts;
+
+        for (auto entry = expected.begin(); entry != expected.end() && success; ++entry) {
+            domain_t domain = entry->first.first;
+            const expected_ngram_t &ngram = entry->second;
+
+            counts_t counts = storage.GetCounts(domain, entry->first.second);
+            if (counts.count != ngram.count || counts.successors != ngram.successors.size()) {
+                cout << "FAILED (domain " << domain << ": expected " << ngram.count << "/" << ngram.successors.size()
+                     << " but found " << counts.count << "/" << counts.successors << ")" << endl;
+                success = false;
+            }
+
+            if (ngram.word) {
+                wordCounts[domain].first++;
+                wordCounts[domain].second += ngram.count;
+            }
+        }
+
+        for (auto entry = wordCounts.begin(); entry != wordCounts.end() && success; ++entry) {
+            count_t uniqueWordCount, wordCount;
+            storage.GetWordCounts(entry->first, &uniqueWordCount, &wordCount);
+
+            if (uniqueWordCount != entry->second.first || wordCount != entry->second.second) {
+                cout << "FAILED (domain " << entry->first << ": expected " << entry->second.first << "/"
+                     << entry->second.second << " words but found " << uniqueWordCount << "/" << wordCount << ")"
+                     << endl;
+                success = false;
+            }
+        }
+    }
+
+    fs::remove_all(path);
+
+    if (success)
+        cout << "SUCCESS (" << expected.size() << " n-grams, " << name << ")" << endl;
+
+    return success;
+}
+
+// --------------
+
+int main(int argc, const char *argv[]) {
+    args_t args;
+
+    if (!ParseArgs(argc, argv, &args))
+        return ERROR_IN_COMMAND_LINE;
+
+    storage_layout_t layouts[] = {kDomainLayout, kInvertedLayout};
+    const char *layoutNames[] = {"domain layout", "inverted layout"};
+
+    // the records fit a single sort block with the larger memory, while the smaller one spills
+    // them to many blocks that are merged
+    size_t memories[] = {512 * 1024 * 1024, 64 * 1024};
+    const char *memoryNames[] = {"single block", "merged blocks"};
+
+    try {
+        for (size_t l = 0; l < 2; ++l) {
+            for (size_t m = 0; m < 2; ++m) {
+                cout << "Testing " << layoutNames[l] << ", " << memoryNames[m] << ": " << flush;
+                if (!RunTest(args, layouts[l], memories[m], memoryNames[m]))
+                    exit(TEST_FAILED);
+            }
+        }
+    } catch (exception &e) {
+        cerr << "ERROR: " << e.what() << endl;
+        return GENERIC_ERROR;
+    }
+
+    return SUCCESS;
+}
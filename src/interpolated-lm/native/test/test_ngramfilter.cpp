@@ -0,0 +1,162 @@
+#include <atomic>
+#include <iostream>
+#include <random>
+#include <thread>
+#include <unordered_set>
+
+#include <db/NGramFilter.h>
+#include <boost/program_options.hpp>
+
+using namespace std;
+using namespace mmt;
+using namespace mmt::ilm;
+
+namespace {
+    const size_t ERROR_IN_COMMAND_LINE = 1;
+    const size_t GENERIC_ERROR = 2;
+    const size_t TEST_FAILED = 3;
+    const size_t SUCCESS = 0;
+
+    struct args_t {
+        size_t keys = 1000000;
+        size_t readers = 1;
+        unsigned int seed = 1;
+    };
+} // namespace
+
+namespace po = boost::program_options;
+
+bool ParseArgs(int argc, const char *argv[], args_t *args) {
+    po::options_description desc("Check the false negatives and the false positive rate of a growing NGramFilter");
+    desc.add_options()
+            ("help,h", "print this help message")
+            ("keys,n", po::value<size_t>(), "number of keys added to the filter (default = 1000000)")
+            ("readers,r", po::value<size_t>(), "threads reading the filter while it grows (default = 1)")
+            ("seed,s", po::value<unsigned int>(), "random seed (default = 1)");
+
+    po::variables_map vm;
+    try {
+        po::store(po::parse_command_line(argc, argv, desc), vm);
+
+        if (vm.count("help")) {
+            std::cout << desc << std::endl;
+            return false;
+        }
+
+        po::notify(vm);
+
+        if (vm.count("keys"))
+            args->keys = vm["keys"].as<size_t>();
+        if (vm.count("readers"))
+            args->readers = vm["readers"].as<size_t>();
+        if (vm.count("seed"))
+            args->seed = vm["seed"].as<unsigned int>();
+    } catch (po::error &e) {
+        std::cerr << "ERROR: " << e.what() << std::endl << std::endl;
+        std::cerr << desc << std::endl;
+        return false;
+    }
+
+    return true;
+}
+
+// ------ Testing
+
+/*
+ * A filter created with the default capacity grows through many slices, while one created with
+ * the number of keys never grows. Meanwhile the readers check that every key already added is found.
+ */
+bool RunTest(const args_t &args, size_t capacity) {
+    mt19937_64 random(args.seed);
+
+    vector<dbkey_t> keys(args.keys);
+    unordered_set<dbkey_t> added;
+    for (size_t i = 0; i < keys.size(); ++i) {
+        keys[i] = random();
+        added.insert(keys[i]);
+    }
+
+    NGramFilter filter(capacity);
+
+    atomic<size_t> published(0);
+    atomic<size_t> falseNegatives(0);
+    vector<thread> readers;
+
+    for (size_t r = 0; r < args.readers; ++r) {
+        readers.push_back(thread([&, r]() {
+            mt19937_64 sampler(args.seed + 1 + r);
+
+            size_t size;
+            while ((size = published.load(memory_order_acquire)) < keys.size()) {
+                if (size > 0 && !filter.MayContain(keys[sampler() % size]))
+                    falseNegatives++;
+            }
+        }));
+    }
+
+    for (size_t i = 0; i < keys.size(); ++i) {
+        filter.Add(keys[i]);
+        published.store(i + 1, memory_order_release);
+    }
+
+    for (auto reader = readers.begin(); reader != readers.end(); ++reader)
+        reader->join();
+
+    for (size_t i = 0; i < keys.size(); ++i) {
+        if (!filter.MayContain(keys[i]))
+            falseNegatives++;
+    }
+
+    if (falseNegatives > 0) {
+        cout << "FAILED (" << falseNegatives << " keys added but not found)" << endl;
+        return false;
+    }
+
+    size_t probes = 0;
+    size_t falsePositives = 0;
+
+    while (probes < keys.size()) {
+        dbkey_t key = random();
+        if (added.find(key) != added.end())
+            continue;
+
+        probes++;
+        if (filter.MayContain(key))
+            falsePositives++;
+    }
+
+    double rate = (double) falsePositives / probes;
+    if (rate >= 0.01) {
+        cout << "FAILED (false positive rate " << (rate * 100) << "%)" << endl;
+        return false;
+    }
+
+    cout << "SUCCESS (false positive rate " << (rate * 100) << "%, "
+         << (filter.GetMemoryUsage() * 8. / keys.size()) << " bits per key)" << endl;
+
+    return true;
+}
+
+// --------------
+
+int main(int argc, const char *argv[]) {
+    args_t args;
+
+    if (!ParseArgs(argc, argv, &args))
+        return ERROR_IN_COMMAND_LINE;
+
+    try {
+        cout << "Testing " << args.keys << " keys, growing filter: " << flush;
+        if (!RunTest(args, NGramFilter::kDefaultCapacity))
+            exit(TEST_FAILED);
+
+        cout << "Testing " << args.keys << " keys, filter sized for them: " << flush;
+        if (!RunTest(args, args.keys))
+            exit(TEST_FAILED);
+    } catch (exception &e) {
+        cerr << "ERROR: " << e.what() << endl;
+        return GENERIC_ERROR;
+    }
+
+    return SUCCESS;
+}
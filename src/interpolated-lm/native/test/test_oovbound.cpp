@@ -0,0 +1,179 @@
+#include <chrono>
+#include <cmath>
+#include <iostream>
+#include <thread>
+
+#include <mmt/sentence.h>
+#include <lm/AdaptiveLM.h>
+#include <db/NGramStorage.h>
+#include <db/NGramBatch.h>
+#include <db/BulkLoader.h>
+#include <boost/program_options.hpp>
+#include <boost/filesystem.hpp>
+
+using namespace std;
+using namespace mmt;
+using namespace mmt::ilm;
+
+namespace {
+    const size_t ERROR_IN_COMMAND_LINE = 1;
+    const size_t GENERIC_ERROR = 2;
+    const size_t TEST_FAILED = 3;
+    const size_t SUCCESS = 0;
+
+    struct args_t {
+        uint8_t order = 5;
+        double timeout = 30.;
+    };
+} // namespace
+
+namespace po = boost::program_options;
+namespace fs = boost::filesystem;
+
+bool ParseArgs(int argc, const char *argv[], args_t *args) {
+    po::options_description desc("Check when the adaptive lm bounds the probability of a word without reading it");
+    desc.add_options()
+            ("help,h", "print this help message")
+            ("timeout,t", po::value<double>(), "seconds to wait for the novelty filters (default = 30)");
+
+    po::variables_map vm;
+    try {
+        po::store(po::parse_command_line(argc, argv, desc), vm);
+
+        if (vm.count("help")) {
+            std::cout << desc << std::endl;
+            return false;
+        }
+
+        po::notify(vm);
+
+        if (vm.count("timeout"))
+            args->timeout = vm["timeout"].as<double>();
+    } catch (po::error &e) {
+        std::cerr << "ERROR: " << e.what() << std::endl << std::endl;
+        std::cerr << desc << std::endl;
+        return false;
+    }
+
+    return true;
+}
+
+// ------ Model
+
+const domain_t kFirstDomain = 1;
+const domain_t kSecondDomain = 2;
+
+// Words of the first domain only, of the second domain only, and of none
+const wid_t kFirstWords[] = {10, 11, 12};
+const wid_t kSecondWords[] = {20, 21};
+const wid_t kUnknownWord = 99;
+
+void CreateModel(const args_t &args, const string &modelPath, const string &tempPath) {
+    NGramStorage storage(modelPath, args.order, true, kDomainLayout, false);
+    BulkLoader loader(storage, tempPath, 64 * 1024 * 1024);
+
+    NGramBatch batch(args.order, 100);
+    batch.Add(kFirstDomain, vector<wid_t>(kFirstWords, kFirstWords + 3));
+    batch.Add(kFirstDomain, vector<wid_t>(kFirstWords, kFirstWords + 2));
+    batch.Add(kSecondDomain, vector<wid_t>(kSecondWords, kSecondWords + 2));
+
+    loader.Add(batch);
+    loader.Load();
+}
+
+// ------ Testing
+
+bool CheckBound(const AdaptiveLM &alm, const context_t &context, wid_t word, bool expected, const string &name) {
+    float bound = 0.f;
+    bool bounded = alm.GetOOVProbabilityBound(&context, word, &bound);
+
+    if (bounded != expected) {
+        cout << "FAILED (" << name << ": the bound is " << (bounded ? "applied" : "skipped") << ")" << endl;
+        return false;
+    }
+
+    if (bounded) {
+        HistoryState state;
+        float probability = exp(alm.ComputeProbability(word, state, &context, NULL));
+
+        if (!(bound > 0.f) || probability > bound * 1.0001f) {
+            cout << "FAILED (" << name << ": probability " << probability << " over the bound " << bound << ")"
+                 << endl;
+            return false;
+        }
+    }
+
+    return true;
+}
+
+bool RunTest(const args_t &args) {
+    fs::path path = fs::temp_directory_path() / fs::unique_path("ilm-test-%%%%-%%%%");
+    fs::path modelPath = path / "model";
+    fs::path tempPath = path / "tmp";
+    fs::create_directories(tempPath);
+
+    CreateModel(args, modelPath.string(), tempPath.string());
+
+    bool success = true;
+
+    {
+        AdaptiveLM alm(modelPath.string(), args.order, 100, 1., true, kDomainLayout, true, storage_format_t(),
+                       false);
+
+        context_t first;
+        first.push_back(cscore_t(kFirstDomain, 1.f));
+
+        context_t both;
+        both.push_back(cscore_t(kFirstDomain, .5f));
+        both.push_back(cscore_t(kSecondDomain, .5f));
+
+        // the filters are loaded in background, until then no word is bounded
+        auto begin = chrono::steady_clock::now();
+        float bound;
+
+        while (!alm.GetOOVProbabilityBound(&first, kUnknownWord, &bound)) {
+            if (chrono::duration<double>(chrono::steady_clock::now() - begin).count() > args.timeout) {
+                cout << "FAILED (the novelty filters have not been loaded)" << endl;
+                success = false;
+                break;
+            }
+
+            this_thread::sleep_for(chrono::milliseconds(10));
+        }
+
+        for (size_t i = 0; success && i < 3; ++i)
+            success = CheckBound(alm, first, kFirstWords[i], false, "word of the context");
+
+        success = success && CheckBound(alm, first, kSecondWords[0], true, "word of another domain");
+        success = success && CheckBound(alm, both, kSecondWords[0], false, "word of a domain of the context");
+        success = success && CheckBound(alm, first, kUnknownWord, true, "unknown word");
+        success = success && CheckBound(alm, both, kUnknownWord, true, "unknown word, two domains");
+    }
+
+    fs::remove_all(path);
+
+    if (success)
+        cout << "SUCCESS" << endl;
+
+    return success;
+}
+
+// --------------
+
+int main(int argc, const char *argv[]) {
+    args_t args;
+
+    if (!ParseArgs(argc, argv, &args))
+        return ERROR_IN_COMMAND_LINE;
+
+    try {
+        cout << "Testing the probability bound of the words missing from the context: " << flush;
+        if (!RunTest(args))
+            exit(TEST_FAILED);
+    } catch (exception &e) {
+        cerr << "ERROR: " << e.what() << endl;
+        return GENERIC_ERROR;
+    }
+
+    return SUCCESS;
+}
@@ -40,6 +40,11 @@ namespace mmt {
             // to the user.
             double update_max_delay = 2.; // seconds
 
+            // If true, every update is recorded in a write-ahead log before being
+            // acknowledged, and the updates still in the buffer after a crash are
+            // recovered the next time the model is opened.
+            bool update_log = true;
+
             Options() {};
         };
 
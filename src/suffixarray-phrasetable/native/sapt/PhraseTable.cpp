@@ -25,7 +25,8 @@ struct PhraseTable::pt_private {
 PhraseTable::PhraseTable(const string &modelPath, const Options &options, Aligner *aligner) {
     self = new pt_private();
     self->index = new SuffixArray(modelPath, options.prefix_length);
-    self->updates = new UpdateManager(self->index, options.update_buffer_size, options.update_max_delay);
+    self->updates = new UpdateManager(self->index, options.update_buffer_size, options.update_max_delay,
+                                      options.update_log ? modelPath + "/updates.wal" : "");
     self->aligner = aligner;
     self->numberOfSamples = options.samples;
 }
@@ -6,11 +6,16 @@
 
 using namespace mmt::sapt;
 
-UpdateManager::UpdateManager(SuffixArray *index, size_t bufferSize, double maxDelay) :
-        index(index), waitTimeout(maxDelay), stop(false) {
+UpdateManager::UpdateManager(SuffixArray *index, size_t bufferSize, double maxDelay, const string &logPath) :
+        index(index), log(NULL), waitTimeout(maxDelay), stop(false) {
     foregroundBatch = new UpdateBatch(bufferSize, index->GetStreams());
     backgroundBatch = new UpdateBatch(bufferSize, index->GetStreams());
 
+    if (!logPath.empty()) {
+        log = new WriteAheadLog(logPath);
+        ReplayLog();
+    }
+
     backgroundThread = new boost::thread(boost::bind(&UpdateManager::BackgroundThreadRun, this));
 }
 
@@ -23,19 +28,48 @@ UpdateManager::~UpdateManager() {
     delete backgroundThread;
     delete foregroundBatch;
     delete backgroundBatch;
+
+    if (log)
+        delete log;
+}
+
+void UpdateManager::ReplayLog() {
+    log->Replay(index->GetStreams(), [this](const updateid_t &id, const domain_t domain,
+                                            const vector<wid_t> &source, const vector<wid_t> &target,
+                                            const alignment_t &alignment) {
+        while (!foregroundBatch->Add(id, domain, source, target, alignment)) {
+            index->PutBatch(*foregroundBatch);
+            foregroundBatch->Reset(foregroundBatch->GetStreams());
+        }
+    });
+
+    if (foregroundBatch->GetSize() > 0) {
+        index->PutBatch(*foregroundBatch);
+        foregroundBatch->Reset(foregroundBatch->GetStreams());
+    }
+
+    // All the updates of the previous segments are now in the index
+    log->Release(log->Rotate());
 }
 
 void UpdateManager::Add(const updateid_t &id, const domain_t domain, const vector<wid_t> &source,
                         const vector<wid_t> &target, const alignment_t &alignment) {
-    bool success = false;
-
-    while (!success) {
-        batchAccess.lock();
-        success = foregroundBatch->Add(id, domain, source, target, alignment);
-        batchAccess.unlock();
+    while (true) {
+        {
+            lock_guard<mutex> lock(batchAccess);
+
+            if (foregroundBatch->GetSize() < foregroundBatch->GetMaxSize()) {
+                // Logged before the batch is changed, so that a failed append leaves no trace, and with
+                // the batch lock held, so that the entry is in the same segment of the batch
+                if (log)
+                    log->Append(id, domain, source, target, alignment);
+
+                foregroundBatch->Add(id, domain, source, target, alignment);
+                return;
+            }
+        }
 
-        if (!success)
-            AwakeBackgroundThread(true);
+        AwakeBackgroundThread(true);
     }
 }
 
@@ -56,19 +90,27 @@ void UpdateManager::BackgroundThreadRun() {
         awakeCondition.wait_for(lock, timeout);
 
         if (!stop) {
-            batchAccess.lock();
+            WriteAheadLog::segment_t segment = 0;
+
             {
+                lock_guard<mutex> batchLock(batchAccess);
+
                 UpdateBatch *tmp = backgroundBatch;
                 backgroundBatch = foregroundBatch;
                 foregroundBatch = tmp;
 
                 foregroundBatch->Reset(backgroundBatch->GetStreams());
+
+                if (log && backgroundBatch->GetSize() > 0)
+                    segment = log->Rotate();
             }
-            batchAccess.unlock();
 
             if (backgroundBatch->GetSize() > 0) {
                 index->PutBatch(*backgroundBatch);
                 backgroundBatch->Clear();
+
+                if (log)
+                    log->Release(segment);
             }
         }
 
@@ -8,6 +8,7 @@
 #include <mutex>
 #include <condition_variable>
 #include <boost/thread.hpp>
+#include <mmt/WriteAheadLog.h>
 #include <suffixarray/SuffixArray.h>
 
 namespace mmt {
@@ -15,7 +16,9 @@ namespace mmt {
 
         class UpdateManager {
         public:
-            UpdateManager(SuffixArray *index, size_t bufferSize, double maxDelay);
+            // If "logPath" is not empty, every update is recorded in a write-ahead log before Add() returns,
+            // and the updates left in the log by a previous instance are written to the index
+            UpdateManager(SuffixArray *index, size_t bufferSize, double maxDelay, const string &logPath = "");
 
             ~UpdateManager();
 
@@ -24,6 +27,7 @@ namespace mmt {
 
         private:
             SuffixArray *index;
+            WriteAheadLog *log;
 
             UpdateBatch *foregroundBatch;
             UpdateBatch *backgroundBatch;
@@ -36,6 +40,8 @@ namespace mmt {
             double waitTimeout;
             bool stop;
 
+            void ReplayLog();
+
             void AwakeBackgroundThread(bool wait);
 
             void BackgroundThreadRun();
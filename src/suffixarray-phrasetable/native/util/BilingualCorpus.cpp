@@ -2,7 +2,6 @@
 // Created by Davide  Caroselli on 29/09/16.
 //
 
-#include <sstream>
 #include "BilingualCorpus.h"
 #include <boost/filesystem.hpp>
 
@@ -18,38 +17,6 @@ BilingualCorpus::BilingualCorpus(domain_t domain, const string &sourceFile, cons
         : domain(domain), source(sourceFile), target(targetFile), alignment(alignmentFile) {
 }
 
-static inline void ParseSentenceLine(const string &line, vector<wid_t> &output) {
-    output.clear();
-
-    stringstream stream(line);
-    wid_t word;
-
-    while (stream >> word) {
-        output.push_back(word);
-    }
-
-}
-
-static inline void ParseAlignmentLine(const string &line, alignment_t &output) {
-    output.clear();
-
-    stringstream stream(line);
-    string pair;
-
-    while (stream >> pair) {
-        char dash;
-        length_t i, j;
-
-        stringstream pair_stream(pair);
-
-        pair_stream >> i;
-        pair_stream >> dash;
-        pair_stream >> j;
-
-        output.push_back(make_pair(i, j));
-    }
-}
-
 void BilingualCorpus::List(const string &path, const string &sourceLang, const string &targetLang,
                            vector<BilingualCorpus> &list) {
     fs::recursive_directory_iterator endit;
@@ -81,25 +48,24 @@ void BilingualCorpus::List(const string &path, const string &sourceLang, const s
     }
 }
 
-CorpusReader::CorpusReader(const BilingualCorpus &corpus) : drained(false), sourceStream(corpus.source),
-                                                            targetStream(corpus.target),
-                                                            alignmentStream(corpus.alignment) {
+CorpusReader::CorpusReader(const BilingualCorpus &corpus) : drained(false), sourceReader(corpus.source),
+                                                            targetReader(corpus.target),
+                                                            alignmentFile(corpus.alignment),
+                                                            alignmentReader(alignmentFile.data(), alignmentFile.size()) {
 }
 
 bool CorpusReader::Read(vector<wid_t> &outSource, vector<wid_t> &outTarget, alignment_t &outAlignment) {
     if (drained)
         return false;
 
-    string sourceLine, targetLine, alignmentLine;
-    if (!getline(sourceStream, sourceLine) || !getline(targetStream, targetLine) ||
-        !getline(alignmentStream, alignmentLine)) {
+    const char *alignmentBegin, *alignmentEnd;
+    if (!sourceReader.Read(outSource) || !targetReader.Read(outTarget) ||
+        !alignmentReader.Read(&alignmentBegin, &alignmentEnd)) {
         drained = true;
         return false;
     }
 
-    ParseSentenceLine(sourceLine, outSource);
-    ParseSentenceLine(targetLine, outTarget);
-    ParseAlignmentLine(alignmentLine, outAlignment);
+    corpus::ParseAlignment(alignmentBegin, alignmentEnd, outAlignment);
 
     return true;
-}
\ No newline at end of file
+}
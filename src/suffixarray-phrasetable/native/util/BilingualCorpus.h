@@ -6,7 +6,7 @@
 #define SAPT_BILINGUALCORPUS_H
 
 #include <mmt/sentence.h>
-#include <fstream>
+#include <mmt/corpus/SentenceReader.h>
 
 using namespace std;
 
@@ -34,6 +34,10 @@ namespace mmt {
             const string alignment;
         };
 
+        /**
+         * The source and the target are read from their binary copies if there are any (see
+         * corpus::SentenceReader), the alignment is always parsed from the text.
+         */
         class CorpusReader {
         public:
             CorpusReader(const BilingualCorpus &corpus);
@@ -42,9 +46,10 @@ namespace mmt {
 
         private:
             bool drained;
-            ifstream sourceStream;
-            ifstream targetStream;
-            ifstream alignmentStream;
+            corpus::SentenceReader sourceReader;
+            corpus::SentenceReader targetReader;
+            corpus::MappedFile alignmentFile;
+            corpus::LineReader alignmentReader;
         };
 
     }